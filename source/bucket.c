@@ -0,0 +1,174 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "bucket.h"
+
+/*
+ * Initialize a token bucket, starting full
+ *
+ * If the burst is not set, it is a tenth of a second worth of tokens
+ */
+void bucket_init(struct bucket* bucket, long rate, long burst)
+{
+  bucket->rate = (rate > 0) ? rate : 0;
+
+  if(burst > 0)
+  {
+    bucket->burst = burst;
+  }
+  else bucket->burst = (bucket->rate / 10 > 1) ? bucket->rate / 10 : 1;
+
+  bucket->tokens = bucket->burst;
+
+  clock_gettime(CLOCK_MONOTONIC, &bucket->updated);
+}
+
+/*
+ * Add the tokens that have accumulated since the last update
+ */
+static void bucket_refill(struct bucket* bucket)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  double seconds = (now.tv_sec - bucket->updated.tv_sec) + (now.tv_nsec - bucket->updated.tv_nsec) / 1e9;
+
+  bucket->updated = now;
+
+  bucket->tokens += seconds * bucket->rate;
+
+  if(bucket->tokens > bucket->burst) bucket->tokens = bucket->burst;
+}
+
+/*
+ * Get the milliseconds until a number of tokens can be taken
+ *
+ * More tokens than the burst can be taken from a full bucket,
+ * which leaves the bucket in debt
+ *
+ * RETURN (long wait)
+ * - >0 | Milliseconds to wait
+ * -  0 | The tokens can be taken now
+ */
+static long bucket_wait(struct bucket* bucket, double amount)
+{
+  if(bucket->rate == 0) return 0;
+
+  bucket_refill(bucket);
+
+  double needed = (amount < bucket->burst) ? amount : bucket->burst;
+
+  if(bucket->tokens >= needed) return 0;
+
+  return (long) ((needed - bucket->tokens) * 1000 / bucket->rate) + 1;
+}
+
+/*
+ * Take a number of tokens from a bucket
+ */
+static void bucket_take(struct bucket* bucket, double amount)
+{
+  if(bucket->rate == 0) return;
+
+  bucket->tokens -= amount;
+}
+
+/*
+ * Get the milliseconds since a point in time (of the monotonic clock)
+ */
+static long elapsed_ms(const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * Initialize the byte and line buckets of a shaper
+ */
+void shaper_init(struct shaper* shaper, long byte_rate, long byte_burst, long line_rate, long line_burst)
+{
+  bucket_init(&shaper->bytes, byte_rate, byte_burst);
+
+  bucket_init(&shaper->lines, line_rate, line_burst);
+
+  shaper->delay = 0;
+}
+
+/*
+ * Check if a shaper limits the rate at all
+ */
+bool shaper_limited(const struct shaper* shaper)
+{
+  return shaper->bytes.rate > 0 || shaper->lines.rate > 0;
+}
+
+/*
+ * Wait until a line of size bytes may pass, and take its tokens
+ *
+ * The wait sleeps (in poll) until enough tokens have accumulated,
+ * so the caller stops reading and backpressure reaches the writer
+ *
+ * PARAMS
+ * - int event    | Event to cancel the wait, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait as long as needed
+ *
+ * RETURN (int status)
+ * -  0 | The line may pass
+ * - -1 | The wait was canceled (ECANCELED) or timed out (ETIMEDOUT)
+ */
+int shaper_wait(struct shaper* shaper, size_t size, int event, long timeout)
+{
+  struct timespec deadline;
+
+  if(timeout != -1) deadline_set(&deadline, timeout);
+
+  while(true)
+  {
+    long byte_wait = bucket_wait(&shaper->bytes, size);
+    long line_wait = bucket_wait(&shaper->lines, 1);
+
+    long wait = (byte_wait > line_wait) ? byte_wait : line_wait;
+
+    if(wait == 0) break;
+
+    if(timeout != -1)
+    {
+      long left = deadline_timeout(&deadline);
+
+      if(left == 0)
+      {
+        errno = ETIMEDOUT;
+
+        return -1;
+      }
+
+      if(wait > left) wait = left;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int status = event_wait(-1, 0, event, wait);
+
+    shaper->delay += elapsed_ms(&start);
+
+    if(status == 1)
+    {
+      errno = ECANCELED;
+
+      return -1;
+    }
+
+    if(status == -1) return -1;
+  }
+
+  bucket_take(&shaper->bytes, size);
+  bucket_take(&shaper->lines, 1);
+
+  return 0;
+}
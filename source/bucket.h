@@ -0,0 +1,47 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef BUCKET_H
+#define BUCKET_H
+
+#include "event.h"
+
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * Token bucket - tokens are added at a rate, up to the burst
+ *
+ * A rate of 0 means no limit
+ */
+struct bucket
+{
+  double          rate;    // Tokens per second
+  double          burst;   // Max tokens
+  double          tokens;  // Below zero after taking more than the burst
+  struct timespec updated;
+};
+
+/*
+ * Rate limits of one direction, in bytes and in lines
+ */
+struct shaper
+{
+  struct bucket bytes;
+  struct bucket lines;
+  long          delay;   // Total milliseconds spent waiting for tokens
+};
+
+extern void bucket_init(struct bucket* bucket, long rate, long burst);
+
+extern void shaper_init(struct shaper* shaper, long byte_rate, long byte_burst, long line_rate, long line_burst);
+
+extern bool shaper_limited(const struct shaper* shaper);
+
+extern int  shaper_wait(struct shaper* shaper, size_t size, int event, long timeout);
+
+#endif // BUCKET_H
@@ -0,0 +1,275 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "codec.h"
+
+/*
+ * Initialize the compression of a connection
+ *
+ * With CODEC_NONE, nothing is allocated
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to initialize the compression
+ */
+int codec_init(struct codec* codec, int type, bool debug)
+{
+  memset(codec, 0, sizeof(struct codec));
+
+  if(type == CODEC_NONE) return 0;
+
+  if(deflateInit(&codec->deflater, Z_DEFAULT_COMPRESSION) != Z_OK)
+  {
+    if(debug) error_print("Failed to initialize compression");
+
+    return -1;
+  }
+
+  if(inflateInit(&codec->inflater) != Z_OK)
+  {
+    deflateEnd(&codec->deflater);
+
+    if(debug) error_print("Failed to initialize decompression");
+
+    return -1;
+  }
+
+  codec->type = type;
+
+  if(debug) info_print("Compressing connection (zlib)");
+
+  return 0;
+}
+
+/*
+ * Free the compression of a connection
+ */
+void codec_free(struct codec* codec)
+{
+  if(codec->type == CODEC_NONE) return;
+
+  deflateEnd(&codec->deflater);
+
+  inflateEnd(&codec->inflater);
+
+  free(codec->out);
+
+  codec->out = NULL;
+
+  codec->type = CODEC_NONE;
+}
+
+/*
+ * Make room for more compressed bytes at the end of the output
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to allocate memory
+ */
+static int codec_out_reserve(struct codec* codec, size_t size)
+{
+  if(codec->out_capacity - codec->out_end >= size) return 0;
+
+  size_t capacity = codec->out_capacity ? codec->out_capacity : CODEC_BUFFER;
+
+  while(capacity - codec->out_end < size) capacity *= 2;
+
+  char* out = realloc(codec->out, capacity);
+
+  if(!out) return -1;
+
+  codec->out = out;
+
+  codec->out_capacity = capacity;
+
+  return 0;
+}
+
+/*
+ * Compress a buffer to the end of the output
+ *
+ * The stream is flushed if asked to, or if the batch is full.
+ * Until then, the compressed bytes may stay in the deflater
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to compress
+ */
+static int codec_deflate(struct codec* codec, const char* buffer, size_t size, bool flush)
+{
+  z_stream* stream = &codec->deflater;
+
+  codec->batch += size;
+
+  int mode = (flush || codec->batch >= CODEC_BATCH) ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+
+  stream->next_in  = (Bytef*) buffer;
+  stream->avail_in = size;
+
+  do
+  {
+    if(codec_out_reserve(codec, CODEC_BUFFER) == -1) return -1;
+
+    stream->next_out  = (Bytef*) codec->out + codec->out_end;
+    stream->avail_out = CODEC_BUFFER;
+
+    if(deflate(stream, mode) == Z_STREAM_ERROR)
+    {
+      errno = EPROTO;
+
+      return -1;
+    }
+
+    codec->out_end += CODEC_BUFFER - stream->avail_out;
+  }
+  while(stream->avail_out == 0);
+
+  if(mode == Z_SYNC_FLUSH) codec->batch = 0;
+
+  return 0;
+}
+
+/*
+ * Compress a buffer and write it to a socket
+ *
+ * The buffer is either written as a whole or not at all: if the write
+ * is interrupted, the compressed bytes are kept, and the next call
+ * (with the same buffer) writes the rest of them
+ *
+ * PARAMS
+ * - bool flush   | Flush the compressed stream, because no more input is ready
+ * - int event    | Event to cancel the write, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
+ *
+ * RETURN (same as socket_write)
+ */
+ssize_t codec_write(struct codec* codec, int sockfd, const char* buffer, size_t size, bool flush, int event, long timeout)
+{
+  if(!codec->staged)
+  {
+    if(codec_deflate(codec, buffer, size, flush) == -1) return -1;
+
+    codec->staged = true;
+  }
+
+  size_t length = codec->out_end - codec->out_start;
+
+  if(length > 0)
+  {
+    ssize_t write_size = socket_write(sockfd, codec->out + codec->out_start, length, event, timeout);
+
+    if(write_size == -1) return -1;
+
+    codec->out_start += write_size;
+    codec->sent      += write_size;
+
+    if((size_t) write_size < length) return 0;
+  }
+
+  codec->out_start = codec->out_end = 0;
+
+  codec->staged = false;
+
+  return size;
+}
+
+/*
+ * Flush the compressed stream, and write what is left to a socket
+ *
+ * RETURN (int status)
+ * -  0 | Success, or nothing to flush
+ * - -1 | Failed to write, the event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ */
+int codec_flush(struct codec* codec, int sockfd, int event, long timeout)
+{
+  if(codec->type == CODEC_NONE || (codec->batch == 0 && !codec->staged)) return 0;
+
+  if(codec_write(codec, sockfd, "", 0, true, event, timeout) == -1) return -1;
+
+  return codec->staged ? -1 : 0;
+}
+
+/*
+ * Check if compressed bytes are held back, until the stream is flushed
+ */
+bool codec_pending(const struct codec* codec)
+{
+  return codec->type != CODEC_NONE && (codec->batch > 0 || codec->staged);
+}
+
+/*
+ * Read and decompress from a file descriptor, just like read
+ *
+ * Everything that is available is decompressed, as long as it fits
+ *
+ * RETURN (ssize_t size)
+ * - >0 | The number of decompressed bytes
+ * -  0 | End of File
+ * - -1 | Nothing to decompress yet (EAGAIN), corrupt stream (EPROTO) or failed to read
+ */
+ssize_t codec_read(struct codec* codec, int fd, char* buffer, size_t size)
+{
+  z_stream* stream = &codec->inflater;
+
+  stream->next_out  = (Bytef*) buffer;
+  stream->avail_out = size;
+
+  int error = EAGAIN;
+
+  while(true)
+  {
+    // Inflate even without new input, as output may be left from the last call
+    stream->next_in  = (Bytef*) codec->in + codec->in_start;
+    stream->avail_in = codec->in_end - codec->in_start;
+
+    int status = inflate(stream, Z_NO_FLUSH);
+
+    codec->in_start = codec->in_end - stream->avail_in;
+
+    if(status == Z_STREAM_ERROR || status == Z_DATA_ERROR || status == Z_NEED_DICT || status == Z_MEM_ERROR)
+    {
+      errno = EPROTO;
+
+      return -1;
+    }
+
+    // The peer never ends the stream, but if it does, nothing more follows
+    if(status == Z_STREAM_END)
+    {
+      codec->eof = true;
+
+      break;
+    }
+
+    // If there is room left, all input has been inflated
+    if(stream->avail_out == 0 || codec->eof) break;
+
+    ssize_t read_size = read(fd, codec->in, sizeof(codec->in));
+
+    if(read_size == 0) codec->eof = true;
+
+    if(read_size <= 0)
+    {
+      if(read_size == -1) error = errno;
+
+      break;
+    }
+
+    codec->in_start  = 0;
+    codec->in_end    = read_size;
+    codec->received += read_size;
+  }
+
+  size_t inflate_size = size - stream->avail_out;
+
+  if(inflate_size > 0) return inflate_size;
+
+  if(codec->eof) return 0;
+
+  errno = error;
+
+  return -1;
+}
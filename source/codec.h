@@ -0,0 +1,71 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "debug.h"
+#include "socket.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#define CODEC_NONE 0
+#define CODEC_ZLIB 1
+
+/*
+ * Max bytes compressed before the compressed stream is flushed,
+ * even though more input is ready
+ */
+#define CODEC_BATCH (64 * 1024)
+
+#define CODEC_BUFFER 16384
+
+/*
+ * Streaming compression of a socket connection
+ *
+ * The deflater compresses the sent lines as one stream, and the
+ * inflater decompresses the received stream, so repetitions between
+ * lines are compressed as well
+ */
+struct codec
+{
+  int      type;
+  z_stream deflater;
+  z_stream inflater;
+  bool     staged;       // The input of an unfinished write has been compressed
+  char*    out;          // Compressed bytes waiting to be sent
+  size_t   out_start;
+  size_t   out_end;
+  size_t   out_capacity;
+  size_t   batch;        // Bytes compressed since the last flush
+  char     in[CODEC_BUFFER]; // Received bytes waiting to be decompressed
+  size_t   in_start;
+  size_t   in_end;
+  bool     eof;
+  size_t   sent;         // Compressed bytes sent
+  size_t   received;     // Compressed bytes received
+};
+
+extern int     codec_init(struct codec* codec, int type, bool debug);
+
+extern void    codec_free(struct codec* codec);
+
+extern ssize_t codec_write(struct codec* codec, int sockfd, const char* buffer, size_t size, bool flush, int event, long timeout);
+
+extern int     codec_flush(struct codec* codec, int sockfd, int event, long timeout);
+
+extern bool    codec_pending(const struct codec* codec);
+
+extern ssize_t codec_read(struct codec* codec, int fd, char* buffer, size_t size);
+
+#endif // CODEC_H
@@ -0,0 +1,210 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "crc.h"
+
+/*
+ * The CRC32C (Castagnoli) polynomial, reversed
+ */
+#define CRC32C_POLYNOMIAL 0x82F63B78
+
+static uint32_t crc_table[256];
+
+static bool crc_hardware = false;
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Fill the table of the fallback, and check if the CPU has the crc32 instruction
+ */
+static void crc_init(void)
+{
+  for(uint32_t byte = 0; byte < 256; byte++)
+  {
+    uint32_t crc = byte;
+
+    for(int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+    }
+
+    crc_table[byte] = crc;
+  }
+
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+
+  crc_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/*
+ * Table driven CRC32C, one byte at a time
+ */
+static uint32_t crc32c_table(uint32_t crc, const uint8_t* bytes, size_t size)
+{
+  for(size_t index = 0; index < size; index++)
+  {
+    crc = crc_table[(crc ^ bytes[index]) & 0xff] ^ (crc >> 8);
+  }
+
+  return crc;
+}
+
+#if defined(__x86_64__)
+/*
+ * CRC32C using the SSE4.2 crc32 instruction, eight bytes at a time
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* bytes, size_t size)
+{
+  uint64_t crc64 = crc;
+
+  for(; size >= 8; bytes += 8, size -= 8)
+  {
+    uint64_t word;
+
+    memcpy(&word, bytes, sizeof(word));
+
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+  }
+
+  crc = crc64;
+
+  for(; size > 0; bytes++, size--)
+  {
+    crc = __builtin_ia32_crc32qi(crc, *bytes);
+  }
+
+  return crc;
+}
+#endif
+
+/*
+ * Compute the CRC32C of a buffer, continuing from a previous CRC (0 to start)
+ *
+ * The crc32 instruction is used if the CPU has it, else a table
+ */
+uint32_t crc32c(uint32_t crc, const void* buffer, size_t size)
+{
+  pthread_once(&crc_once, crc_init);
+
+  crc = ~crc;
+
+#if defined(__x86_64__)
+  if(crc_hardware) return ~crc32c_sse42(crc, buffer, size);
+#endif
+
+  return ~crc32c_table(crc, buffer, size);
+}
+
+static const char crc_digits[] = "0123456789abcdef";
+
+/*
+ * Frame a line with its checksum
+ *
+ * The checksum covers the whole line, including its newline
+ *
+ * RETURN (size_t size)
+ * - The length of the framed line, ended by a newline
+ */
+size_t crc_frame(const char* line, size_t size, char* buffer)
+{
+  bool newline = (size > 0 && line[size - 1] == '\n');
+
+  size_t body = newline ? size - 1 : size;
+
+  uint32_t crc = crc32c(0, line, size);
+
+  memcpy(buffer, line, body);
+
+  buffer[body] = newline ? CRC_MARK_LINE : CRC_MARK_CHUNK;
+
+  for(int digit = 0; digit < 8; digit++)
+  {
+    buffer[body + 1 + digit] = crc_digits[(crc >> (28 - 4 * digit)) & 0xf];
+  }
+
+  buffer[body + 9] = '\n';
+
+  return body + CRC_TRAILER_SIZE;
+}
+
+/*
+ * Parse the 8 hex digits of a checksum
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Not a checksum
+ */
+static int crc_parse(const char* digits, uint32_t* crc)
+{
+  *crc = 0;
+
+  for(int index = 0; index < 8; index++)
+  {
+    const char* digit = memchr(crc_digits, digits[index], 16);
+
+    if(!digit || digits[index] == '\0') return -1;
+
+    *crc = (*crc << 4) | (digit - crc_digits);
+  }
+
+  return 0;
+}
+
+/*
+ * Check the checksum of a framed line, and restore the line
+ *
+ * RETURN (ssize_t size)
+ * - >=0 | The length of the line
+ * -  -1 | The checksum does not match (EBADMSG),
+ *         or the frame is corrupt or does not fit (EPROTO)
+ */
+ssize_t crc_unframe(const char* buffer, size_t size, char* line, size_t line_size)
+{
+  if(size < CRC_TRAILER_SIZE || buffer[size - 1] != '\n')
+  {
+    errno = EPROTO;
+
+    return -1;
+  }
+
+  size_t body = size - CRC_TRAILER_SIZE;
+
+  char mark = buffer[body];
+
+  uint32_t crc;
+
+  if((mark != CRC_MARK_LINE && mark != CRC_MARK_CHUNK) || crc_parse(buffer + body + 1, &crc) == -1)
+  {
+    errno = EPROTO;
+
+    return -1;
+  }
+
+  size_t length = (mark == CRC_MARK_LINE) ? body + 1 : body;
+
+  if(length > line_size)
+  {
+    errno = EPROTO;
+
+    return -1;
+  }
+
+  memcpy(line, buffer, body);
+
+  if(mark == CRC_MARK_LINE) line[body] = '\n';
+
+  if(crc32c(0, line, length) != crc)
+  {
+    errno = EBADMSG;
+
+    return -1;
+  }
+
+  return length;
+}
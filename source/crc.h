@@ -0,0 +1,39 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * A framed line ends with a mark, the checksum in 8 hex digits and a newline
+ *
+ * The mark tells if the line itself ended with a newline
+ */
+#define CRC_MARK_LINE  '\x02'
+#define CRC_MARK_CHUNK '\x03'
+
+#define CRC_TRAILER_SIZE 10
+
+/*
+ * Max length of a framed line
+ */
+#define CRC_FRAMED_SIZE(size) ((size) + CRC_TRAILER_SIZE)
+
+extern uint32_t crc32c(uint32_t crc, const void* buffer, size_t size);
+
+extern size_t   crc_frame(const char* line, size_t size, char* buffer);
+
+extern ssize_t  crc_unframe(const char* buffer, size_t size, char* line, size_t line_size);
+
+#endif // CRC_H
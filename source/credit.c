@@ -0,0 +1,264 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "credit.h"
+
+/*
+ * Get the milliseconds since a point in time
+ */
+static long credit_elapsed(const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * Open the credits of an agreed connection
+ *
+ * The whole window is granted to the peer in the first grant
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to create the event
+ */
+int credit_open(struct credit* credit, long window, bool debug)
+{
+  memset(credit, 0, sizeof(struct credit));
+
+  credit->debug    = debug;
+  credit->window   = window;
+  credit->granting = window;
+
+  if((credit->wake = event_create(debug)) == -1) return -1;
+
+  pthread_mutex_init(&credit->lock, NULL);
+
+  event_cond_init(&credit->cond);
+
+  credit->open = true;
+
+  return 0;
+}
+
+/*
+ * Close the credits, after the routines have ended
+ */
+void credit_close(struct credit* credit)
+{
+  if(!credit->open) return;
+
+  event_close(&credit->wake, credit->debug);
+
+  pthread_cond_destroy(&credit->cond);
+
+  pthread_mutex_destroy(&credit->lock);
+
+  credit->open = false;
+}
+
+/*
+ * Take credits to send a line, waiting for a grant of the peer if needed
+ *
+ * PARAMS
+ * - int event    | Event to cancel the wait, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ */
+int credit_take(struct credit* credit, size_t size, int event, long timeout)
+{
+  struct timespec deadline;
+
+  if(timeout != -1) deadline_set(&deadline, timeout);
+
+  pthread_mutex_lock(&credit->lock);
+
+  while(credit->available < (long) size)
+  {
+    if(!credit->blocked)
+    {
+      credit->blocked = true;
+
+      credit->waits++;
+
+      clock_gettime(CLOCK_MONOTONIC, &credit->blocked_start);
+
+      if(credit->debug) info_print("Waiting for a grant of the peer");
+    }
+
+    int status = event_cond_wait(&credit->cond, &credit->lock, event, timeout, &deadline);
+
+    if(status != 0)
+    {
+      pthread_mutex_unlock(&credit->lock);
+
+      errno = (status == 1) ? ECANCELED : ETIMEDOUT;
+
+      return -1;
+    }
+  }
+
+  if(credit->blocked)
+  {
+    credit->blocked = false;
+
+    credit->waited += credit_elapsed(&credit->blocked_start);
+  }
+
+  credit->available -= size;
+
+  pthread_mutex_unlock(&credit->lock);
+
+  return 0;
+}
+
+/*
+ * Count the bytes of a line that has been written out,
+ * to be granted back to the peer
+ *
+ * The bytes are granted a quarter of the window at a time
+ *
+ * RETURN (bool due)
+ * - true  | A grant is due, the sender of grants should be woken
+ * - false | Not enough bytes for a grant yet
+ */
+bool credit_consumed(struct credit* credit, size_t size)
+{
+  pthread_mutex_lock(&credit->lock);
+
+  credit->consumed += size;
+
+  bool due = (credit->consumed >= credit->window / 4);
+
+  if(due)
+  {
+    credit->granting += credit->consumed;
+
+    credit->consumed = 0;
+  }
+
+  pthread_mutex_unlock(&credit->lock);
+
+  return due;
+}
+
+/*
+ * Wake the sender of grants, also while it waits for a grant itself
+ */
+void credit_wake(struct credit* credit)
+{
+  event_signal(credit->wake);
+
+  pthread_mutex_lock(&credit->lock);
+
+  pthread_cond_broadcast(&credit->cond);
+
+  pthread_mutex_unlock(&credit->lock);
+}
+
+/*
+ * Write the due grant, to be sent to the peer between two lines
+ *
+ * RETURN (size_t size)
+ * - >0 | The length of the grant
+ * -  0 | No grant is due
+ */
+size_t credit_frame(struct credit* credit, char* buffer)
+{
+  pthread_mutex_lock(&credit->lock);
+
+  long granting = credit->granting;
+
+  credit->granting = 0;
+
+  if(granting > 0) credit->grants_sent++;
+
+  pthread_mutex_unlock(&credit->lock);
+
+  if(granting == 0) return 0;
+
+  return snprintf(buffer, CREDIT_FRAME_SIZE, "%c%ld\n", CREDIT_MARK, granting);
+}
+
+/*
+ * Take a grant out of the received lines, and the escape off a line
+ *
+ * PARAMS
+ * - char* buffer  | A whole line, from its start
+ * - ssize_t* size | The length of the line, without the escape afterwards
+ *
+ * RETURN (bool grant)
+ * - true  | The line was a grant
+ * - false | The line is a line of the peer
+ */
+bool credit_line(struct credit* credit, char* buffer, ssize_t* size)
+{
+  if(*size > 0 && buffer[0] == CREDIT_MARK)
+  {
+    long granted = strtol(buffer + 1, NULL, 10);
+
+    pthread_mutex_lock(&credit->lock);
+
+    if(granted > 0) credit->available += granted;
+
+    credit->grants_received++;
+
+    pthread_cond_broadcast(&credit->cond);
+
+    pthread_mutex_unlock(&credit->lock);
+
+    return true;
+  }
+
+  if(*size > 0 && buffer[0] == CREDIT_ESC)
+  {
+    memmove(buffer, buffer + 1, *size - 1);
+
+    (*size)--;
+  }
+
+  return false;
+}
+
+/*
+ * Put the escape before a line that could be mistaken for a grant
+ *
+ * PARAMS
+ * - char* buffer | A line, with room for one more byte
+ *
+ * RETURN (size_t size)
+ * - The length of the line, with the escape
+ */
+size_t credit_escape(char* buffer, size_t size)
+{
+  if(size == 0 || (buffer[0] != CREDIT_MARK && buffer[0] != CREDIT_ESC)) return size;
+
+  memmove(buffer + 1, buffer, size);
+
+  buffer[0] = CREDIT_ESC;
+
+  return size + 1;
+}
+
+/*
+ * Get the milliseconds the sender has waited for grants, so far
+ */
+long credit_waited(struct credit* credit)
+{
+  pthread_mutex_lock(&credit->lock);
+
+  long waited = credit->waited;
+
+  if(credit->blocked) waited += credit_elapsed(&credit->blocked_start);
+
+  pthread_mutex_unlock(&credit->lock);
+
+  return waited;
+}
@@ -0,0 +1,86 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef CREDIT_H
+#define CREDIT_H
+
+#include "debug.h"
+#include "event.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * A grant is a line of the mark and the granted bytes in decimal.
+ * A line that starts with the mark or the escape is sent with
+ * the escape before it
+ */
+#define CREDIT_MARK '\x06'
+#define CREDIT_ESC  '\x10'
+
+#define CREDIT_FRAME_SIZE 24
+
+#define DEFAULT_CREDIT_WINDOW (1024 * 1024)
+
+/*
+ * The window has room for more than a line of the relay,
+ * so that a grant is always due before the sender runs dry
+ */
+#define CREDIT_WINDOW_MIN (4 * 1024)
+
+/*
+ * Credits of a connection, in bytes of lines
+ *
+ * The peer may send as many bytes as it has been granted. The receiver
+ * grants the bytes back once it has written them out, so that a peer
+ * never has more than the window in flight, and waits for a grant
+ * instead of filling the buffers of the kernel
+ */
+struct credit
+{
+  bool            open;
+  long            window;    // Bytes the peer may have in flight
+  long            available; // Bytes that may be sent
+  long            consumed;  // Bytes written out since the last grant
+  long            granting;  // Bytes to grant the peer, in the next grant
+  bool            blocked;   // The sender is waiting for a grant
+  struct timespec blocked_start;
+  size_t          waits;     // Times the sender waited for a grant
+  long            waited;    // Milliseconds the sender waited
+  size_t          grants_sent;
+  size_t          grants_received;
+  int             wake;      // Signaled when a grant is due
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  bool            debug;
+};
+
+extern int     credit_open(struct credit* credit, long window, bool debug);
+
+extern void    credit_close(struct credit* credit);
+
+extern int     credit_take(struct credit* credit, size_t size, int event, long timeout);
+
+extern bool    credit_consumed(struct credit* credit, size_t size);
+
+extern void    credit_wake(struct credit* credit);
+
+extern size_t  credit_frame(struct credit* credit, char* buffer);
+
+extern bool    credit_line(struct credit* credit, char* buffer, ssize_t* size);
+
+extern size_t  credit_escape(char* buffer, size_t size);
+
+extern long    credit_waited(struct credit* credit);
+
+#endif // CREDIT_H
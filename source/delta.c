@@ -0,0 +1,382 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "delta.h"
+
+/*
+ * An encoded line starts with its kind:
+ *
+ *   L<line>        | Literal line
+ *   D<ref><ops>    | Delta against a line in the dictionary
+ *
+ * The ops of a delta are the bytes of the line, except for copies:
+ *
+ *   ESC<offset><size> | Copy size bytes from offset in the referenced line
+ *   ESC ESC_LITERAL   | The byte ESC itself
+ *
+ * The kind is lower case if the line did not end with a newline.
+ * Every encoded line ends with a newline, so numbers are encoded
+ * in two digits of 6 bits from '0', which are never a newline
+ */
+#define DELTA_LITERAL 'L'
+#define DELTA_DELTA   'D'
+
+#define DELTA_ESC         '\x01'
+#define DELTA_ESC_LITERAL '\x7f'
+
+#define DELTA_DIGIT '0'
+
+/*
+ * Min bytes of a copy, shorter matches are cheaper as they are
+ */
+#define DELTA_COPY_MIN 6
+
+/*
+ * Max bytes of a copy, as the size is two digits
+ */
+#define DELTA_COPY_MAX 4095
+
+/*
+ * Length of the byte sequences in the index
+ */
+#define DELTA_INDEX_BYTES 4
+
+/*
+ * Initialize an empty dictionary
+ */
+void delta_init(struct delta* delta)
+{
+  memset(delta->sizes, 0, sizeof(delta->sizes));
+
+  delta->next  = 0;
+  delta->start = 0;
+  delta->end   = 0;
+}
+
+/*
+ * Hash a sequence of DELTA_INDEX_BYTES bytes to the index
+ */
+static int delta_hash(const char* bytes)
+{
+  uint32_t value;
+
+  memcpy(&value, bytes, sizeof(value));
+
+  return (value * 2654435761U) >> 24;
+}
+
+/*
+ * Store a line in the dictionary, and index its byte sequences
+ *
+ * A delta replaces its reference, so the dictionary keeps one version of
+ * every kind of line. A literal replaces the slots in turn.
+ * Lines that don't fit are not stored, by both peers
+ */
+static void delta_store(struct delta* delta, int slot, const char* line, size_t size)
+{
+  if(size > DELTA_LINE_SIZE) return;
+
+  if(slot == -1)
+  {
+    slot = delta->next;
+
+    delta->next = (delta->next + 1) % DELTA_LINES;
+  }
+
+  memcpy(delta->lines[slot], line, size);
+
+  delta->sizes[slot] = size;
+
+  uint16_t* index = delta->index[slot];
+
+  memset(index, 0, sizeof(delta->index[slot]));
+
+  // Index backwards, so that the first offset of a sequence is kept
+  for(size_t offset = size; offset-- > 0;)
+  {
+    if(offset + DELTA_INDEX_BYTES <= size) index[delta_hash(line + offset)] = offset + 1;
+  }
+}
+
+/*
+ * Count the bytes at the start of both buffers that are equal
+ */
+static size_t match_size(const char* a, size_t a_size, const char* b, size_t b_size)
+{
+  size_t max = (a_size < b_size) ? a_size : b_size;
+
+  if(max > DELTA_COPY_MAX) max = DELTA_COPY_MAX;
+
+  size_t size = 0;
+
+  while(size < max && a[size] == b[size]) size++;
+
+  return size;
+}
+
+/*
+ * Write a number as two digits
+ */
+static size_t number_write(char* buffer, size_t number)
+{
+  buffer[0] = DELTA_DIGIT + (number >> 6);
+  buffer[1] = DELTA_DIGIT + (number & 63);
+
+  return 2;
+}
+
+/*
+ * Read a number of two digits
+ *
+ * RETURN (int number)
+ * - >=0 | The number
+ * -  -1 | The digits are not digits
+ */
+static int number_read(const char* buffer)
+{
+  int high = buffer[0] - DELTA_DIGIT;
+  int low  = buffer[1] - DELTA_DIGIT;
+
+  if(high < 0 || high > 63 || low < 0 || low > 63) return -1;
+
+  return (high << 6) | low;
+}
+
+/*
+ * Encode the ops of a line against a line in the dictionary
+ *
+ * The bytes are matched where the last copy ended, and else
+ * where the next bytes of the line are indexed in the other line
+ *
+ * The buffer has to fit limit + 5 bytes
+ *
+ * RETURN (size_t length)
+ * - The length of the ops, or more than limit if they would not fit
+ */
+static size_t delta_ops(const struct delta* delta, int slot, const char* line, size_t size, char* buffer, size_t limit)
+{
+  const char* other      = delta->lines[slot];
+  size_t      other_size = delta->sizes[slot];
+
+  size_t length = 0;
+  size_t cursor = 0; // Where the last copy ended in the other line
+
+  for(size_t index = 0; index < size && length <= limit;)
+  {
+    size_t offset = cursor;
+
+    size_t match = (cursor < other_size) ? match_size(line + index, size - index, other + cursor, other_size - cursor) : 0;
+
+    if(match < DELTA_COPY_MIN && index + DELTA_INDEX_BYTES <= size)
+    {
+      int indexed = delta->index[slot][delta_hash(line + index)];
+
+      if(indexed > 0)
+      {
+        offset = indexed - 1;
+
+        match = match_size(line + index, size - index, other + offset, other_size - offset);
+      }
+    }
+
+    if(match >= DELTA_COPY_MIN)
+    {
+      buffer[length++] = DELTA_ESC;
+
+      length += number_write(buffer + length, offset);
+      length += number_write(buffer + length, match);
+
+      index += match;
+
+      cursor = offset + match;
+    }
+    else if(line[index] == DELTA_ESC)
+    {
+      buffer[length++] = DELTA_ESC;
+      buffer[length++] = DELTA_ESC_LITERAL;
+
+      index++;
+    }
+    else buffer[length++] = line[index++];
+  }
+
+  return length;
+}
+
+/*
+ * Encode a line as a delta against the line in the dictionary
+ * that gives the shortest delta, or as a literal if that is shorter
+ *
+ * The buffer has to fit DELTA_ENCODED_SIZE(size) bytes
+ *
+ * RETURN (size_t size)
+ * - The length of the encoded line, ended by a newline
+ */
+size_t delta_encode(struct delta* delta, const char* line, size_t size, char* buffer)
+{
+  bool newline = (size > 0 && line[size - 1] == '\n');
+
+  size_t body = newline ? size - 1 : size;
+
+  int    best        = -1;
+  size_t best_length = body; // The length of the ops must beat the literal line
+
+  char ops[DELTA_LINE_SIZE + 8];
+
+  for(int slot = 0; slot < DELTA_LINES && body <= DELTA_LINE_SIZE; slot++)
+  {
+    if(delta->sizes[slot] == 0) continue;
+
+    if(best_length < 2) break;
+
+    // The delta has one more byte of header than the literal
+    size_t limit = best_length - 2;
+
+    size_t length = delta_ops(delta, slot, line, body, ops, limit);
+
+    if(length > limit) continue;
+
+    memcpy(buffer + 2, ops, length);
+
+    best        = slot;
+    best_length = length;
+  }
+
+  size_t length;
+
+  if(best != -1)
+  {
+    buffer[0] = newline ? DELTA_DELTA : DELTA_DELTA + ('a' - 'A');
+    buffer[1] = DELTA_DIGIT + best;
+
+    length = 2 + best_length;
+  }
+  else
+  {
+    buffer[0] = newline ? DELTA_LITERAL : DELTA_LITERAL + ('a' - 'A');
+
+    memcpy(buffer + 1, line, body);
+
+    length = 1 + body;
+  }
+
+  buffer[length++] = '\n';
+
+  delta_store(delta, best, line, body);
+
+  return length;
+}
+
+/*
+ * Decode the ops of a delta against a line in the dictionary
+ *
+ * RETURN (ssize_t size)
+ * - >=0 | The length of the decoded line
+ * -  -1 | The ops are corrupt, or the line does not fit
+ */
+static ssize_t delta_ops_decode(const struct delta* delta, int slot, const char* ops, size_t length, char* line, size_t line_size)
+{
+  const char* other      = delta->lines[slot];
+  size_t      other_size = delta->sizes[slot];
+
+  size_t size = 0;
+
+  for(size_t index = 0; index < length;)
+  {
+    if(ops[index] != DELTA_ESC)
+    {
+      if(size == line_size) return -1;
+
+      line[size++] = ops[index++];
+
+      continue;
+    }
+
+    if(index + 1 < length && ops[index + 1] == DELTA_ESC_LITERAL)
+    {
+      if(size == line_size) return -1;
+
+      line[size++] = DELTA_ESC;
+
+      index += 2;
+
+      continue;
+    }
+
+    if(index + 5 > length) return -1;
+
+    int offset = number_read(ops + index + 1);
+    int match  = number_read(ops + index + 3);
+
+    if(offset < 0 || match < 0 || offset + match > other_size || size + match > line_size) return -1;
+
+    memcpy(line + size, other + offset, match);
+
+    size  += match;
+    index += 5;
+  }
+
+  return size;
+}
+
+/*
+ * Decode a line encoded by delta_encode
+ *
+ * RETURN (ssize_t size)
+ * - >=0 | The length of the decoded line
+ * -  -1 | The encoded line is corrupt, or too long (EPROTO)
+ */
+ssize_t delta_decode(struct delta* delta, const char* buffer, size_t size, char* line, size_t line_size)
+{
+  if(size < 2 || buffer[size - 1] != '\n' || line_size == 0)
+  {
+    errno = EPROTO;
+
+    return -1;
+  }
+
+  char kind = buffer[0];
+
+  bool newline = (kind == DELTA_LITERAL || kind == DELTA_DELTA);
+
+  if(!newline) kind -= ('a' - 'A');
+
+  // Leave room for the newline
+  size_t body_size = line_size - (newline ? 1 : 0);
+
+  ssize_t body = -1;
+
+  int slot = -1;
+
+  if(kind == DELTA_LITERAL && size - 2 <= body_size)
+  {
+    body = size - 2;
+
+    memcpy(line, buffer + 1, body);
+  }
+  else if(kind == DELTA_DELTA && size >= 3)
+  {
+    slot = buffer[1] - DELTA_DIGIT;
+
+    if(slot >= 0 && slot < DELTA_LINES)
+    {
+      body = delta_ops_decode(delta, slot, buffer + 2, size - 3, line, body_size);
+    }
+  }
+
+  if(body == -1)
+  {
+    errno = EPROTO;
+
+    return -1;
+  }
+
+  delta_store(delta, slot, line, body);
+
+  if(newline) line[body++] = '\n';
+
+  return body;
+}
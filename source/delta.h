@@ -0,0 +1,66 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+
+/*
+ * Number of recent lines in the dictionary
+ */
+#define DELTA_LINES 16
+
+/*
+ * Max length of a line in the dictionary, longer lines are sent as is
+ */
+#define DELTA_LINE_SIZE 1024
+
+/*
+ * Size of the index of the byte sequences in every line of the dictionary
+ */
+#define DELTA_INDEX_SIZE 256
+
+/*
+ * Max length of an encoded line
+ */
+#define DELTA_ENCODED_SIZE(size) ((size) + 8)
+
+/*
+ * Max length of a line to encode, with room for framing around
+ * the lines of the relay (longer than DELTA_LINE_SIZE, so sent as is)
+ */
+#define DELTA_BUFFER_SIZE (DELTA_LINE_SIZE + 64)
+
+/*
+ * Dictionary of recent lines, kept identical by the encoding
+ * and the decoding peer, as both update it with every line
+ *
+ * The buffer holds the encoded line that is being sent or received
+ */
+struct delta
+{
+  char     lines[DELTA_LINES][DELTA_LINE_SIZE];
+  size_t   sizes[DELTA_LINES];
+  uint16_t index[DELTA_LINES][DELTA_INDEX_SIZE]; // Offsets of byte sequences, plus one
+  int      next;  // Slot to replace by the next literal line
+  char     buffer[DELTA_ENCODED_SIZE(DELTA_BUFFER_SIZE)];
+  size_t   start; // Sent bytes of the encoded line
+  size_t   end;   // Length of the encoded line
+};
+
+extern void    delta_init(struct delta* delta);
+
+extern size_t  delta_encode(struct delta* delta, const char* line, size_t size, char* buffer);
+
+extern ssize_t delta_decode(struct delta* delta, const char* buffer, size_t size, char* line, size_t line_size);
+
+#endif // DELTA_H
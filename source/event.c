@@ -0,0 +1,362 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "event.h"
+
+/*
+ * Create an event, used to cancel threads waiting on file descriptors
+ *
+ * RETURN (int event)
+ * - >=0 | Success
+ * -  -1 | Failed to create event
+ */
+int event_create(bool debug)
+{
+  int event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if(event == -1)
+  {
+    if(debug) error_print("Failed to create event: %s", strerror(errno));
+
+    return -1;
+  }
+
+  return event;
+}
+
+/*
+ * close, but with pointer to event, and with debug messages
+ *
+ * RETURN (int status)
+ * - 0 | Success
+ * - 1 | Failed to close event
+ */
+int event_close(int* event, bool debug)
+{
+  if(!event || *event == -1) return 0;
+
+  if(close(*event) == -1)
+  {
+    if(debug) error_print("Failed to close event: %s", strerror(errno));
+
+    return 1;
+  }
+
+  *event = -1;
+
+  return 0;
+}
+
+/*
+ * Signal an event
+ *
+ * The event stays signaled, so every thread waiting on it,
+ * now or later, is woken up
+ *
+ * Note: This only writes to the event, and can therefore be called from a signal handler
+ */
+void event_signal(int event)
+{
+  if(event == -1) return;
+
+  int errno_saved = errno;
+
+  uint64_t value = 1;
+
+  if(write(event, &value, sizeof(value)) == -1) { }
+
+  errno = errno_saved;
+}
+
+/*
+ * Reset a signaled event, so that it can be signaled again
+ *
+ * Note: Only for an event that is not used to stop threads
+ */
+void event_reset(int event)
+{
+  if(event == -1) return;
+
+  uint64_t value;
+
+  if(read(event, &value, sizeof(value)) == -1) { }
+}
+
+/*
+ * Check if an event has been signaled, without waiting
+ */
+bool event_signaled(int event)
+{
+  if(event == -1) return false;
+
+  struct pollfd pollfd = { .fd = event, .events = POLLIN };
+
+  return poll(&pollfd, 1, 0) == 1;
+}
+
+/*
+ * Microseconds the calling thread spins before it blocks in event_wait
+ */
+static __thread long event_spin = 0;
+
+/*
+ * Let the calling thread spin before it blocks in event_wait
+ *
+ * Spinning trades a busy core for the latency of being woken up
+ *
+ * PARAMS
+ * - long spin | Microseconds to spin, 0 to block at once
+ */
+void event_spin_set(long spin)
+{
+  event_spin = (spin > 0) ? spin : 0;
+}
+
+/*
+ * Get the microseconds since a point in time (of the monotonic clock)
+ */
+static long elapsed_us(const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * poll, restarted if interrupted, with the results of event_wait
+ */
+static int event_poll(struct pollfd* pollfds, int count, long timeout)
+{
+  int status;
+
+  while((status = poll(pollfds, count, timeout)) == -1 && errno == EINTR);
+
+  if(status == -1) return -1;
+
+  if(status == 0) return 2;
+
+  if(count == 2 && pollfds[1].revents) return 1;
+
+  return 0;
+}
+
+/*
+ * Wait until a file descriptor is ready, or until an event is signaled
+ *
+ * PARAMS
+ * - short events | POLLIN or POLLOUT
+ * - int event    | Event to cancel the wait, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
+ *
+ * If the thread spins (event_spin_set), it polls without blocking first
+ *
+ * RETURN (int status)
+ * -  0 | The file descriptor is ready
+ * -  1 | The event was signaled
+ * -  2 | Timed out
+ * - -1 | Failed to wait
+ */
+int event_wait(int fd, short events, int event, long timeout)
+{
+  struct pollfd pollfds[2] =
+  {
+    { .fd = fd,    .events = events },
+    { .fd = event, .events = POLLIN }
+  };
+
+  int count = (event != -1) ? 2 : 1;
+
+  // Spin on non-blocking polls first, to not pay for the wakeup
+  if(event_spin > 0 && timeout != 0)
+  {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    long spun = 0;
+
+    while(spun < event_spin && (timeout == -1 || spun < timeout * 1000))
+    {
+      int status = event_poll(pollfds, count, 0);
+
+      if(status != 2) return status;
+
+      spun = elapsed_us(&start);
+    }
+
+    if(timeout != -1)
+    {
+      timeout = (spun < timeout * 1000) ? timeout - spun / 1000 : 0;
+    }
+  }
+
+  return event_poll(pollfds, count, timeout);
+}
+
+/*
+ * Wait until a file descriptor is ready, or until an event is signaled,
+ * for at most a number of microseconds
+ *
+ * Like event_wait, but without spinning, for timeouts below a millisecond
+ *
+ * RETURN (same as event_wait)
+ */
+int event_wait_us(int fd, short events, int event, long timeout)
+{
+  struct pollfd pollfds[2] =
+  {
+    { .fd = fd,    .events = events },
+    { .fd = event, .events = POLLIN }
+  };
+
+  int count = (event != -1) ? 2 : 1;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  long left = timeout;
+
+  int status;
+
+  // ppoll is restarted with the time that is left, if interrupted
+  while(true)
+  {
+    struct timespec wait = { .tv_sec = left / 1000000, .tv_nsec = (left % 1000000) * 1000 };
+
+    if((status = ppoll(pollfds, count, &wait, NULL)) != -1 || errno != EINTR) break;
+
+    if((left = timeout - elapsed_us(&start)) < 0) left = 0;
+  }
+
+  if(status == -1) return -1;
+
+  if(status == 0) return 2;
+
+  if(count == 2 && pollfds[1].revents) return 1;
+
+  return 0;
+}
+
+/*
+ * Interval in milliseconds between checks of the event, while waiting on a condition
+ *
+ * The event can be signaled from a signal handler, which can't wake the condition
+ */
+#define EVENT_COND_INTERVAL 10
+
+/*
+ * Initialize a condition that measures deadlines with the monotonic clock,
+ * like the deadlines of deadline_set
+ *
+ * RETURN (same as pthread_cond_init)
+ * - 0 | Success
+ */
+int event_cond_init(pthread_cond_t* cond)
+{
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+  int status = pthread_cond_init(cond, &attr);
+
+  pthread_condattr_destroy(&attr);
+
+  return status;
+}
+
+/*
+ * Wait on a condition (using the monotonic clock), or until an event is signaled
+ *
+ * PARAMS
+ * - int event                 | Event to cancel the wait, -1 to not be cancelable
+ * - long timeout              | -1 to wait forever, else wait until the deadline
+ * - struct timespec* deadline | The deadline, if there is a timeout
+ *
+ * Note: The lock must be held
+ *
+ * RETURN (int status)
+ * - 0 | Woken up
+ * - 1 | The event was signaled
+ * - 2 | Timed out
+ */
+int event_cond_wait(pthread_cond_t* cond, pthread_mutex_t* lock, int event, long timeout, const struct timespec* deadline)
+{
+  if(event_signaled(event)) return 1;
+
+  if(timeout != -1 && deadline_timeout(deadline) == 0) return 2;
+
+  if(event == -1 && timeout == -1)
+  {
+    pthread_cond_wait(cond, lock);
+
+    return 0;
+  }
+
+  struct timespec wakeup;
+
+  deadline_set(&wakeup, EVENT_COND_INTERVAL);
+
+  if(timeout != -1 && (deadline->tv_sec < wakeup.tv_sec || (deadline->tv_sec == wakeup.tv_sec && deadline->tv_nsec < wakeup.tv_nsec)))
+  {
+    wakeup = *deadline;
+  }
+
+  pthread_cond_timedwait(cond, lock, &wakeup);
+
+  return 0;
+}
+
+/*
+ * Make a file descriptor non-blocking
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to make file descriptor non-blocking
+ */
+int nonblock_set(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+
+  if(flags == -1) return -1;
+
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/*
+ * Set a deadline a number of milliseconds from now
+ */
+void deadline_set(struct timespec* deadline, long timeout)
+{
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+
+  deadline->tv_sec  += timeout / 1000;
+  deadline->tv_nsec += (timeout % 1000) * 1000000;
+
+  if(deadline->tv_nsec >= 1000000000)
+  {
+    deadline->tv_sec  += 1;
+    deadline->tv_nsec -= 1000000000;
+  }
+}
+
+/*
+ * Get the milliseconds left until a deadline
+ *
+ * RETURN (long timeout)
+ * - >0 | Milliseconds left
+ * -  0 | The deadline has passed
+ */
+long deadline_timeout(const struct timespec* deadline)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long timeout = (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+  return (timeout > 0) ? timeout : 0;
+}
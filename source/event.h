@@ -0,0 +1,50 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include "debug.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+extern int  event_create(bool debug);
+
+extern int  event_close(int* event, bool debug);
+
+extern void event_signal(int event);
+
+extern void event_reset(int event);
+
+extern bool event_signaled(int event);
+
+
+extern void event_spin_set(long spin);
+
+extern int  event_wait(int fd, short events, int event, long timeout);
+
+extern int  event_wait_us(int fd, short events, int event, long timeout);
+
+extern int  event_cond_init(pthread_cond_t* cond);
+
+extern int  event_cond_wait(pthread_cond_t* cond, pthread_mutex_t* lock, int event, long timeout, const struct timespec* deadline);
+
+extern int  nonblock_set(int fd);
+
+
+extern void deadline_set(struct timespec* deadline, long timeout);
+
+extern long deadline_timeout(const struct timespec* deadline);
+
+#endif // EVENT_H
@@ -0,0 +1,506 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "failover.h"
+
+/*
+ * Header of a line in the replay buffer, followed by the bytes of the line
+ */
+struct replay_record
+{
+  uint64_t end;  // End of the line in the connection, or REPLAY_UNSENT
+  uint32_t size;
+  uint32_t padding;
+};
+
+/*
+ * Get the bytes of a record, with its header, aligned for the next header
+ */
+static size_t replay_record_size(size_t size)
+{
+  return (sizeof(struct replay_record) + size + 7) & ~((size_t) 7);
+}
+
+static struct replay_record* replay_record(struct replay* replay, size_t offset)
+{
+  return (struct replay_record*) (replay->data + offset);
+}
+
+/*
+ * Forget the oldest line, whether or not the peer has acknowledged it
+ */
+static void replay_drop(struct replay* replay)
+{
+  replay->start += replay_record_size(replay_record(replay, replay->start)->size);
+
+  if(replay->unsent < replay->start) replay->unsent = replay->start;
+
+  if(replay->resend < replay->start) replay->resend = replay->start;
+}
+
+/*
+ * Move the lines to the front of the buffer
+ */
+static void replay_compact(struct replay* replay)
+{
+  size_t shift = replay->start;
+
+  if(shift == 0) return;
+
+  memmove(replay->data, replay->data + shift, replay->end - shift);
+
+  replay->start   = 0;
+  replay->end    -= shift;
+  replay->unsent -= shift;
+  replay->resend -= shift;
+}
+
+/*
+ * Keep a line that has been written to the connection
+ *
+ * If the buffer is full, the oldest lines are forgotten
+ *
+ * PARAMS
+ * - uint64_t end | End of the line in the connection,
+ *                  or REPLAY_UNSENT if it is held by the compressor
+ */
+void replay_add(struct replay* replay, const char* buffer, size_t size, uint64_t end)
+{
+  size_t record_size = replay_record_size(size);
+
+  if(!replay->data || record_size > replay->capacity)
+  {
+    replay->dropped++;
+
+    return;
+  }
+
+  if(replay->end + record_size > replay->capacity) replay_compact(replay);
+
+  while(replay->end + record_size > replay->capacity)
+  {
+    replay_drop(replay);
+
+    replay->dropped++;
+
+    replay_compact(replay);
+  }
+
+  struct replay_record* record = replay_record(replay, replay->end);
+
+  record->end  = end;
+  record->size = size;
+
+  memcpy(record + 1, buffer, size);
+
+  // The lines before are known to have ended, if this line has
+  if(end != REPLAY_UNSENT && replay->unsent == replay->end) replay->unsent += record_size;
+
+  // Nothing is waiting to be sent again, so neither is this line
+  if(replay->resend == replay->end) replay->resend += record_size;
+
+  replay->end += record_size;
+
+  replay->sampled += size;
+}
+
+/*
+ * The compressor has been flushed, so the lines held by it have ended
+ *
+ * PARAMS
+ * - uint64_t end | End of the flushed bytes in the connection
+ */
+void replay_sent(struct replay* replay, uint64_t end)
+{
+  for(; replay->unsent < replay->resend; replay->unsent += replay_record_size(replay_record(replay, replay->unsent)->size))
+  {
+    replay_record(replay, replay->unsent)->end = end;
+  }
+}
+
+/*
+ * Forget the lines that the peer has acknowledged
+ *
+ * PARAMS
+ * - uint64_t acked | Bytes of the connection acknowledged by the peer
+ */
+void replay_acked(struct replay* replay, uint64_t acked)
+{
+  while(replay->start < replay->unsent && replay_record(replay, replay->start)->end <= acked)
+  {
+    replay->start += replay_record_size(replay_record(replay, replay->start)->size);
+  }
+
+  if(replay->start == replay->end)
+  {
+    replay->start = replay->end = replay->unsent = replay->resend = 0;
+  }
+
+  replay->sampled = 0;
+}
+
+/*
+ * The connection was lost, so every kept line is to be sent again
+ */
+void replay_restart(struct replay* replay)
+{
+  replay->unsent = replay->start;
+  replay->resend = replay->start;
+
+  replay->sampled = 0;
+}
+
+/*
+ * Get the next line to send again
+ *
+ * RETURN (ssize_t size)
+ * - >0 | The size of the line
+ * -  0 | No line is waiting to be sent again
+ */
+ssize_t replay_next(struct replay* replay, const char** buffer)
+{
+  if(replay->resend == replay->end) return 0;
+
+  struct replay_record* record = replay_record(replay, replay->resend);
+
+  *buffer = (const char*) (record + 1);
+
+  return record->size;
+}
+
+/*
+ * The line from replay_next has been sent again
+ *
+ * PARAMS
+ * - uint64_t end | End of the line in the new connection, or REPLAY_UNSENT
+ */
+void replay_resent(struct replay* replay, uint64_t end)
+{
+  replay->resend += replay_record_size(replay_record(replay, replay->resend)->size);
+
+  replay->replayed++;
+
+  if(end != REPLAY_UNSENT) replay_sent(replay, end);
+}
+
+/*
+ * Parse an endpoint, as ADDRESS or ADDRESS:PORT
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Invalid endpoint
+ */
+static int failover_peer_parse(struct failover_peer* peer, const char* arg, int port)
+{
+  const char* colon = strrchr(arg, ':');
+
+  size_t length = colon ? (size_t) (colon - arg) : strlen(arg);
+
+  if(length == 0 || length >= sizeof(peer->address)) return -1;
+
+  memcpy(peer->address, arg, length);
+  peer->address[length] = '\0';
+
+  peer->port = colon ? atoi(colon + 1) : port;
+
+  return (peer->port > 0 && peer->port <= 65535) ? 0 : -1;
+}
+
+/*
+ * Open the endpoints of the peer, in the order they are tried
+ *
+ * PARAMS
+ * - char** addresses | Endpoints, as ADDRESS or ADDRESS:PORT
+ * - int    port      | Port of the endpoints without one
+ * - int    features  | Features offered to the peers
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Invalid endpoint, or failed to allocate
+ */
+int failover_open(struct failover* failover, char** addresses, int count, int port, int features, bool debug)
+{
+  memset(failover, 0, sizeof(struct failover));
+
+  failover->standby = -1;
+  failover->wake    = -1;
+  failover->offered = features;
+  failover->debug   = debug;
+
+  for(int index = 0; index < count && index < FAILOVER_PEERS_MAX; index++)
+  {
+    if(failover_peer_parse(&failover->peers[index], addresses[index], port) != 0)
+    {
+      if(debug) error_print("Invalid address: %s", addresses[index]);
+
+      return -1;
+    }
+
+    failover->count++;
+  }
+
+  if(failover->count == 0) return -1;
+
+  if((failover->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+  {
+    if(debug) error_print("Failed to create failover event: %s", strerror(errno));
+
+    return -1;
+  }
+
+  if(!(failover->replay.data = malloc(FAILOVER_REPLAY_SIZE)))
+  {
+    close(failover->wake);
+
+    return -1;
+  }
+
+  failover->replay.capacity = FAILOVER_REPLAY_SIZE;
+
+  pthread_mutex_init(&failover->lock, NULL);
+
+  failover->open = true;
+
+  return 0;
+}
+
+/*
+ * Close the standby, after the routine has ended
+ */
+void failover_close(struct failover* failover)
+{
+  if(!failover->open) return;
+
+  socket_close(&failover->standby, failover->debug);
+
+  close(failover->wake);
+
+  free(failover->replay.data);
+
+  pthread_mutex_destroy(&failover->lock);
+
+  failover->open = false;
+}
+
+/*
+ * Keep a standby connected to the peer after the current one,
+ * until the event is signaled
+ *
+ * Only this routine closes the standby, as it may be waiting on it
+ *
+ * RETURN (int status)
+ * -  0 | The event was signaled
+ * - -1 | Failed to wait
+ */
+int failover_run(struct failover* failover, int event)
+{
+  long backoff = FAILOVER_BACKOFF_MIN;
+
+  bool retry = false;
+
+  while(true)
+  {
+    pthread_mutex_lock(&failover->lock);
+
+    size_t target = (failover->current + 1) % failover->count;
+
+    // 1. If the current peer has changed, the standby is to the wrong peer
+    if(failover->standby != -1 && failover->standby_peer != target)
+    {
+      socket_close(&failover->standby, failover->debug);
+    }
+
+    int polled = failover->standby;
+
+    pthread_mutex_unlock(&failover->lock);
+
+    // 2. If there is no standby, and another peer to connect to, connect it
+    if(polled == -1 && failover->count > 1)
+    {
+      if(retry)
+      {
+        if(event_wait(-1, 0, event, backoff) == 1) break;
+
+        backoff = (backoff * 2 < FAILOVER_BACKOFF_MAX) ? backoff * 2 : FAILOVER_BACKOFF_MAX;
+      }
+
+      struct failover_peer* peer = &failover->peers[target];
+
+      int sockfd, features = failover->offered;
+
+      retry = true;
+
+      if(client_socket_open(&sockfd, peer->address, peer->port, &features, failover->debug) != 0) continue;
+
+      pthread_mutex_lock(&failover->lock);
+
+      bool wanted = (failover->standby == -1 && target == (failover->current + 1) % failover->count);
+
+      if(wanted)
+      {
+        failover->standby          = sockfd;
+        failover->standby_peer     = target;
+        failover->standby_features = features;
+      }
+
+      pthread_mutex_unlock(&failover->lock);
+
+      if(!wanted)
+      {
+        socket_close(&sockfd, failover->debug);
+
+        continue;
+      }
+
+      if(failover->debug) info_print("Standby connected (%s:%d)", peer->address, peer->port);
+
+      polled = sockfd;
+    }
+
+    // 3. Wait for the standby to be taken, or to be closed by the peer
+    struct pollfd pollfds[3] =
+    {
+      { .fd = event,          .events = POLLIN },
+      { .fd = failover->wake, .events = POLLIN },
+      { .fd = polled,         .events = POLLRDHUP }
+    };
+
+    if(poll(pollfds, 3, -1) == -1)
+    {
+      if(errno == EINTR) continue;
+
+      if(failover->debug) error_print("Failed to poll standby: %s", strerror(errno));
+
+      return -1;
+    }
+
+    if(pollfds[0].revents) break;
+
+    if(pollfds[1].revents & POLLIN)
+    {
+      uint64_t value;
+
+      if(read(failover->wake, &value, sizeof(value)) == -1 && errno != EAGAIN) return -1;
+    }
+
+    pthread_mutex_lock(&failover->lock);
+
+    // The standby was taken, so the next one is connected at once
+    if(failover->standby != polled)
+    {
+      backoff = FAILOVER_BACKOFF_MIN;
+
+      retry = false;
+    }
+    else if(pollfds[2].revents)
+    {
+      if(failover->debug) info_print("Standby closed by peer");
+
+      socket_close(&failover->standby, failover->debug);
+    }
+
+    pthread_mutex_unlock(&failover->lock);
+  }
+
+  return 0;
+}
+
+/*
+ * Wake the routine, to connect the standby to the next peer
+ */
+static void failover_wake(struct failover* failover)
+{
+  uint64_t value = 1;
+
+  if(write(failover->wake, &value, sizeof(value)) == -1 && failover->debug)
+  {
+    error_print("Failed to wake failover routine: %s", strerror(errno));
+  }
+}
+
+/*
+ * Take the standby, to replace a lost connection
+ *
+ * PARAMS
+ * - int* features | The agreed features of the standby
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | No standby is connected
+ */
+int failover_standby_take(struct failover* failover, int* sockfd, int* features)
+{
+  pthread_mutex_lock(&failover->lock);
+
+  if(failover->standby == -1)
+  {
+    pthread_mutex_unlock(&failover->lock);
+
+    return -1;
+  }
+
+  *sockfd   = failover->standby;
+  *features = failover->standby_features;
+
+  failover->current = failover->standby_peer;
+
+  failover->standby = -1;
+
+  failover->failovers++;
+
+  pthread_mutex_unlock(&failover->lock);
+
+  if(failover->debug) info_print("Failed over (%s:%d)", failover->peers[failover->current].address, failover->peers[failover->current].port);
+
+  failover_wake(failover);
+
+  return 0;
+}
+
+/*
+ * Connect to the first reachable peer, from the one after the current one
+ * if the current connection was lost, and otherwise from the current one
+ *
+ * PARAMS
+ * - int* features | The agreed features of the connection
+ * - bool lost     | The connection to the current peer was lost
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | No peer was reachable
+ */
+int failover_connect(struct failover* failover, int* sockfd, int* features, bool lost)
+{
+  pthread_mutex_lock(&failover->lock);
+
+  size_t first = (failover->current + (lost ? 1 : 0)) % failover->count;
+
+  pthread_mutex_unlock(&failover->lock);
+
+  for(size_t index = 0; index < failover->count; index++)
+  {
+    size_t number = (first + index) % failover->count;
+
+    struct failover_peer* peer = &failover->peers[number];
+
+    *features = failover->offered;
+
+    if(client_socket_open(sockfd, peer->address, peer->port, features, failover->debug) != 0) continue;
+
+    pthread_mutex_lock(&failover->lock);
+
+    failover->current = number;
+
+    pthread_mutex_unlock(&failover->lock);
+
+    // The standby may be to this peer, or not be connected yet
+    failover_wake(failover);
+
+    return 0;
+  }
+
+  return -1;
+}
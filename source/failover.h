@@ -0,0 +1,128 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef FAILOVER_H
+#define FAILOVER_H
+
+#include "debug.h"
+#include "socket.h"
+#include "event.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define FAILOVER_PEERS_MAX 16
+
+/*
+ * Max bytes of lines kept to be sent again, beyond it the oldest lines
+ * are forgotten. The unacknowledged bytes are at most the send buffer
+ * of the socket, and the bytes held by the compressor
+ */
+#define FAILOVER_REPLAY_SIZE (8 * 1024 * 1024)
+
+/*
+ * Bytes sent between the checks of what the peer has acknowledged
+ */
+#define FAILOVER_SAMPLE_SIZE (64 * 1024)
+
+/*
+ * Milliseconds between the attempts to connect the standby
+ */
+#define FAILOVER_BACKOFF_MIN 10
+#define FAILOVER_BACKOFF_MAX 1000
+
+/*
+ * End of a line that is still held by the compressor
+ */
+#define REPLAY_UNSENT UINT64_MAX
+
+/*
+ * An endpoint of the peer
+ */
+struct failover_peer
+{
+  char address[64];
+  int  port;
+};
+
+/*
+ * The lines sent on a connection that the peer has not acknowledged yet
+ *
+ * Every line is kept with the end of its bytes in the connection,
+ * and is forgotten when the peer has acknowledged the end.
+ * When the connection is lost, the lines are sent again on the next
+ * connection, from resend, before any new line
+ */
+struct replay
+{
+  char*  data;     // Records of a header and the bytes of a line
+  size_t capacity;
+  size_t start;    // The oldest line
+  size_t end;
+  size_t unsent;   // The first line with an unknown end
+  size_t resend;   // The next line to send again, end when all are sent
+  size_t sampled;  // Bytes of lines added since the last check
+  size_t dropped;  // Lines forgotten before they were acknowledged
+  size_t replayed; // Lines sent again
+};
+
+/*
+ * Endpoints of the peer, and a warm standby connection to the next one
+ *
+ * The standby is connected, and has agreed on its features, by a routine
+ * of its own (failover_run), so that a lost connection is replaced at once.
+ * A standby that the peer closes is connected again
+ */
+struct failover
+{
+  bool                 open;
+  struct failover_peer peers[FAILOVER_PEERS_MAX];
+  size_t               count;
+  size_t               current;  // The peer of the connection in use
+  int                  offered;  // Features offered to the peers
+  int                  standby;  // Connected socket, -1 if none
+  size_t               standby_peer;
+  int                  standby_features;
+  int                  wake;     // Signaled when the standby is taken
+  pthread_mutex_t      lock;
+  struct replay        replay;
+  bool                 debug;
+  size_t               failovers; // Connections replaced by the standby
+};
+
+extern int  failover_open(struct failover* failover, char** addresses, int count, int port, int features, bool debug);
+
+extern void failover_close(struct failover* failover);
+
+extern int  failover_run(struct failover* failover, int event);
+
+extern int  failover_standby_take(struct failover* failover, int* sockfd, int* features);
+
+extern int  failover_connect(struct failover* failover, int* sockfd, int* features, bool lost);
+
+
+extern void    replay_add(struct replay* replay, const char* buffer, size_t size, uint64_t end);
+
+extern void    replay_sent(struct replay* replay, uint64_t end);
+
+extern void    replay_acked(struct replay* replay, uint64_t acked);
+
+extern void    replay_restart(struct replay* replay);
+
+extern ssize_t replay_next(struct replay* replay, const char** buffer);
+
+extern void    replay_resent(struct replay* replay, uint64_t end);
+
+#endif // FAILOVER_H
@@ -0,0 +1,399 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "fanout.h"
+
+/*
+ * Hash a key (FNV-1a, with a final mix to spread the ring points)
+ */
+static uint32_t fanout_hash(const char* key, size_t size)
+{
+  uint32_t hash = 2166136261u;
+
+  for(size_t index = 0; index < size; index++)
+  {
+    hash ^= (uint8_t) key[index];
+    hash *= 16777619u;
+  }
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+
+  return hash;
+}
+
+/*
+ * Initialize a fan-out without consumers
+ *
+ * PARAMS
+ * - int policy | FANOUT_ROUND_ROBIN, FANOUT_LEAST_QUEUED or FANOUT_HASH
+ * - int field  | Key field of FANOUT_HASH, from 1
+ */
+void fanout_init(struct fanout* fanout, int policy, int field, bool debug)
+{
+  memset(fanout, 0, sizeof(struct fanout));
+
+  fanout->policy  = policy;
+  fanout->field   = (field > 0) ? field : 1;
+  fanout->current = -1;
+  fanout->debug   = debug;
+}
+
+/*
+ * Add a consumer to a fan-out, and its points to the hash ring
+ *
+ * The file descriptor is still owned by the caller
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Too many consumers
+ */
+int fanout_add(struct fanout* fanout, int fd)
+{
+  if(fanout->count >= FANOUT_MAX) return -1;
+
+  int index = fanout->count;
+
+  struct fanout_consumer* consumer = &fanout->consumers[index];
+
+  consumer->fd       = fd;
+  consumer->capacity = fifo_pipe_size_get(fd);
+  consumer->closed   = false;
+  consumer->lines    = 0;
+
+  // Insert the points of the consumer, keeping the ring sorted
+  int length = fanout->count * FANOUT_RING_POINTS;
+
+  for(int point = 0; point < FANOUT_RING_POINTS; point++)
+  {
+    char name[32];
+
+    int name_size = snprintf(name, sizeof(name), "%d:%d", index, point);
+
+    uint32_t hash = fanout_hash(name, name_size);
+
+    int position = length++;
+
+    for(; position > 0 && fanout->ring[position - 1].hash > hash; position--)
+    {
+      fanout->ring[position] = fanout->ring[position - 1];
+    }
+
+    fanout->ring[position] = (struct fanout_point) { .hash = hash, .consumer = index };
+  }
+
+  fanout->count++;
+
+  return 0;
+}
+
+/*
+ * Find the consumer of a line on the hash ring, by its key field
+ *
+ * The key is the field-th space separated field of the line,
+ * and a line with fewer fields has an empty key
+ */
+static int fanout_ring_find(const struct fanout* fanout, const char* line, size_t size)
+{
+  const char* start = line;
+  const char* end   = line + size;
+
+  if(end > start && end[-1] == '\n') end--;
+
+  for(int field = 1; field < fanout->field && start < end; field++)
+  {
+    const char* space = memchr(start, ' ', end - start);
+
+    start = space ? space + 1 : end;
+  }
+
+  const char* space = memchr(start, ' ', end - start);
+
+  uint32_t hash = fanout_hash(start, (space ? space : end) - start);
+
+  // The first point at or after the hash, around the ring
+  int low = 0, high = fanout->count * FANOUT_RING_POINTS;
+
+  while(low < high)
+  {
+    int middle = (low + high) / 2;
+
+    if(fanout->ring[middle].hash < hash)
+    {
+      low = middle + 1;
+    }
+    else high = middle;
+  }
+
+  if(low == fanout->count * FANOUT_RING_POINTS) low = 0;
+
+  return fanout->ring[low].consumer;
+}
+
+/*
+ * Get the unread bytes of a consumer, 0 if it is not a fifo
+ */
+static int fanout_queued(const struct fanout_consumer* consumer)
+{
+  int queued = 0;
+
+  if(consumer->capacity <= 0 || ioctl(consumer->fd, FIONREAD, &queued) == -1) return 0;
+
+  return queued;
+}
+
+/*
+ * Check if a line fits in a consumer without waiting
+ *
+ * The fifo keeps its bytes in pages, which are seldom filled to the brim,
+ * so a page of the capacity is left as a margin
+ */
+static bool fanout_room(const struct fanout_consumer* consumer, size_t size)
+{
+  if(consumer->capacity <= 0) return true;
+
+  return (size_t) (consumer->capacity - fanout_queued(consumer)) >= size + PIPE_BUF;
+}
+
+/*
+ * Get the consumer of the key of a line, on the hash ring
+ *
+ * If that consumer has gone away, the key moves on to the next one
+ *
+ * RETURN (int index)
+ * - >=0 | The index of the consumer
+ * -  -1 | Every consumer has gone away
+ */
+static int fanout_hashed(struct fanout* fanout, const char* buffer, size_t size)
+{
+  int first = fanout_ring_find(fanout, buffer, size);
+
+  for(int tried = 0; tried < fanout->count; tried++)
+  {
+    int index = (first + tried) % fanout->count;
+
+    if(!fanout->consumers[index].closed) return index;
+  }
+
+  return -1;
+}
+
+/*
+ * Choose the consumer of a line, according to the policy
+ *
+ * The consumers are tried in turn from the preferred consumer,
+ * and a consumer is skipped if it is not ready.
+ * A key of FANOUT_HASH is never skipped, but waits for its consumer
+ *
+ * PARAMS
+ * - const struct pollfd* pollfds | The consumers that can be written to,
+ *                                  or NULL for the consumers with room for the line
+ *
+ * RETURN (int index)
+ * - >=0 | The index of the consumer
+ * -  -1 | No consumer is ready
+ */
+static int fanout_choose(struct fanout* fanout, const char* buffer, size_t size, const struct pollfd* pollfds)
+{
+  if(fanout->policy == FANOUT_HASH)
+  {
+    int index = fanout_hashed(fanout, buffer, size);
+
+    if(index == -1) return -1;
+
+    bool ready = pollfds ? (pollfds[index].revents & POLLOUT) : fanout_room(&fanout->consumers[index], size);
+
+    return ready ? index : -1;
+  }
+
+  int first = fanout->next;
+
+  int chosen = -1, least = -1;
+
+  for(int tried = 0; tried < fanout->count; tried++)
+  {
+    int index = (first + tried) % fanout->count;
+
+    struct fanout_consumer* consumer = &fanout->consumers[index];
+
+    if(consumer->closed) continue;
+
+    bool ready = pollfds ? (pollfds[index].revents & POLLOUT) : fanout_room(consumer, size);
+
+    if(!ready) continue;
+
+    if(fanout->policy != FANOUT_LEAST_QUEUED)
+    {
+      chosen = index;
+
+      break;
+    }
+
+    int queued = fanout_queued(consumer);
+
+    if(least == -1 || queued < least)
+    {
+      least  = queued;
+      chosen = index;
+    }
+  }
+
+  if(chosen == -1) return -1;
+
+  if(fanout->policy != FANOUT_LEAST_QUEUED && chosen != first && !fanout->consumers[first].closed) fanout->skipped++;
+
+  fanout->next = (chosen + 1) % fanout->count;
+
+  return chosen;
+}
+
+/*
+ * Wait until any consumer, or only the given one, can be written to
+ *
+ * A consumer whose reader has gone away is closed
+ *
+ * PARAMS
+ * - int only | The consumer to wait for, -1 for any consumer
+ *
+ * RETURN (int status)
+ * -  0 | A consumer can be written to
+ * -  1 | The event was signaled
+ * -  2 | Timed out
+ * - -1 | Failed to wait
+ */
+static int fanout_wait(struct fanout* fanout, struct pollfd* pollfds, int only, int event, long timeout)
+{
+  for(int index = 0; index < fanout->count; index++)
+  {
+    struct fanout_consumer* consumer = &fanout->consumers[index];
+
+    bool waited = !consumer->closed && (only == -1 || index == only);
+
+    pollfds[index] = (struct pollfd) { .fd = waited ? consumer->fd : -1, .events = POLLOUT };
+  }
+
+  pollfds[fanout->count] = (struct pollfd) { .fd = event, .events = POLLIN };
+
+  int status;
+
+  while((status = poll(pollfds, fanout->count + 1, timeout)) == -1 && errno == EINTR);
+
+  if(status == -1) return -1;
+
+  if(status == 0) return 2;
+
+  if(pollfds[fanout->count].revents) return 1;
+
+  for(int index = 0; index < fanout->count; index++)
+  {
+    if(pollfds[index].revents & (POLLERR | POLLHUP)) fanout->consumers[index].closed = true;
+  }
+
+  return 0;
+}
+
+/*
+ * Check if every consumer has gone away
+ */
+static bool fanout_closed(const struct fanout* fanout)
+{
+  for(int index = 0; index < fanout->count; index++)
+  {
+    if(!fanout->consumers[index].closed) return false;
+  }
+
+  return true;
+}
+
+/*
+ * Write a line (or a piece of a line) to one of the consumers
+ *
+ * The rest of an unfinished line goes to the same consumer.
+ * If that consumer goes away, the rest of the line is dropped
+ *
+ * PARAMS
+ * - int event    | Event to cancel the write, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
+ *
+ * RETURN (ssize_t size)
+ * - >=0 | The number of written bytes. If not the whole buffer,
+ *         the event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ * -  -1 | Every consumer has gone away (EPIPE), or failed to write
+ */
+ssize_t fanout_write(struct fanout* fanout, const char* buffer, size_t size, int event, long timeout)
+{
+  struct pollfd pollfds[FANOUT_MAX + 1];
+
+  bool ended = (size > 0 && buffer[size - 1] == '\n');
+
+  int index = fanout->current;
+
+  while(index == -1)
+  {
+    if(fanout_closed(fanout))
+    {
+      errno = EPIPE;
+
+      return -1;
+    }
+
+    if((index = fanout_choose(fanout, buffer, size, NULL)) != -1) break;
+
+    // Every consumer is full, so the line waits for the first with room,
+    // or a key waits for its own consumer
+    int only = (fanout->policy == FANOUT_HASH) ? fanout_hashed(fanout, buffer, size) : -1;
+
+    int status = fanout_wait(fanout, pollfds, only, event, timeout);
+
+    if(status == 1 || status == 2)
+    {
+      errno = (status == 1) ? ECANCELED : ETIMEDOUT;
+
+      return 0;
+    }
+
+    if(status == -1) return -1;
+
+    index = fanout_choose(fanout, buffer, size, pollfds);
+  }
+
+  struct fanout_consumer* consumer = &fanout->consumers[index];
+
+  if(consumer->closed)
+  {
+    fanout->current = ended ? -1 : index;
+
+    return size;
+  }
+
+  ssize_t write_size = buffer_write(consumer->fd, buffer, size, event, timeout);
+
+  if(write_size == -1 && errno == EPIPE)
+  {
+    if(fanout->debug) error_print("Consumer (%d) has gone away", consumer->fd);
+
+    consumer->closed = true;
+
+    // A new line is written to another consumer, the rest of an unfinished line is dropped
+    if(fanout->current == -1) return fanout_write(fanout, buffer, size, event, timeout);
+
+    fanout->current = ended ? -1 : index;
+
+    return size;
+  }
+
+  if(write_size == (ssize_t) size)
+  {
+    if(ended) consumer->lines++;
+
+    fanout->current = ended ? -1 : index;
+  }
+
+  return write_size;
+}
@@ -0,0 +1,88 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "debug.h"
+#include "event.h"
+#include "fifo.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define FANOUT_MAX 16
+
+/*
+ * How the lines are distributed among the consumers
+ */
+#define FANOUT_ROUND_ROBIN  0 // The consumers take turns
+#define FANOUT_LEAST_QUEUED 1 // The consumer with the fewest unread bytes
+#define FANOUT_HASH         2 // The consumer of the key field, on a hash ring
+
+/*
+ * Points of every consumer on the hash ring
+ */
+#define FANOUT_RING_POINTS 64
+
+/*
+ * A consumer of the distributed lines
+ */
+struct fanout_consumer
+{
+  int    fd;
+  int    capacity; // Capacity of the fifo, or 0 if it is not a fifo
+  bool   closed;   // The reader has gone away
+  size_t lines;
+};
+
+/*
+ * A point of a consumer on the hash ring
+ */
+struct fanout_point
+{
+  uint32_t hash;
+  int      consumer;
+};
+
+/*
+ * Distribution of lines among a pool of consumers
+ *
+ * A consumer without room for a line is skipped, in favour of the next
+ * consumer, so that a full or slow consumer does not stall the stream.
+ * Only when every consumer is full, the line waits for room.
+ * A key of FANOUT_HASH always waits for its own consumer, unless it has gone away.
+ * A long line, relayed in many pieces, stays with one consumer
+ */
+struct fanout
+{
+  struct fanout_consumer consumers[FANOUT_MAX];
+  int                    count;
+  int                    policy;
+  int                    field;   // Key field of FANOUT_HASH, from 1
+  struct fanout_point    ring[FANOUT_MAX * FANOUT_RING_POINTS];
+  int                    next;    // Consumer to try first, in turn
+  int                    current; // Consumer of the unfinished line, or -1
+  size_t                 skipped; // Lines that skipped a full consumer
+  bool                   debug;
+};
+
+extern void    fanout_init(struct fanout* fanout, int policy, int field, bool debug);
+
+extern int     fanout_add(struct fanout* fanout, int fd);
+
+extern ssize_t fanout_write(struct fanout* fanout, const char* buffer, size_t size, int event, long timeout);
+
+#endif // FANOUT_H
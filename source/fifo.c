@@ -1,23 +1,62 @@
 /*
  * Written by Hampus Fridholm
  *
- * Last updated: 2024-09-08
+ * Last updated: 2026-10-18
  */
 
 #include "fifo.h"
 
+/*
+ * Prepare a persistent fifo, by creating it if it is missing
+ *
+ * A persistent fifo is opened for both reading and writing, so that
+ * the relay is itself a reader and a writer of the fifo. Then, the open
+ * does not wait for the other end, the stdin fifo never reaches End of File
+ * when its writer closes it, and the stdout fifo is never broken when its
+ * reader closes it. The lines wait in the fifo for the next writer or reader
+ *
+ * RETURN (bool persist)
+ * - true  | The path is a fifo, to be opened for reading and writing
+ * - false | The path is not a fifo, to be opened as usual
+ */
+static bool fifo_persist_prepare(const char* path, bool debug)
+{
+  struct stat status;
+
+  if(stat(path, &status) == -1)
+  {
+    if(errno != ENOENT) return false;
+
+    if(mkfifo(path, 0666) == -1 && errno != EEXIST)
+    {
+      if(debug) error_print("Failed to create fifo (%s): %s", path, strerror(errno));
+
+      return false;
+    }
+
+    if(debug) info_print("Created fifo (%s)", path);
+
+    return true;
+  }
+
+  return S_ISFIFO(status.st_mode);
+}
+
 /*
  * Open fifo for reading (input/stdin fifo)
  * 
  * Optionally print debug messages
  *
+ * PARAMS
+ * - bool persist | Keep the fifo open when its writer closes it (see fifo_persist_prepare)
+ *
  * RETURN (int status)
  * - 0 | Success
  * - 1 | Missing address for stdin fifo
  * - 2 | Missing path to stdin fifo
  * - 3 | Failed to open stdin fifo
  */
-static int stdin_fifo_open(int* fifo, const char* path, bool debug)
+int stdin_fifo_open(int* fifo, const char* path, bool persist, bool debug)
 {
   if(!fifo)
   {
@@ -35,30 +74,94 @@ static int stdin_fifo_open(int* fifo, const char* path, bool debug)
 
   if(debug) info_print("Opening stdin fifo (%s)", path);
 
-  if((*fifo = open(path, O_RDONLY)) == -1)
+  int flags = (persist && fifo_persist_prepare(path, debug)) ? O_RDWR : O_RDONLY;
+
+  if((*fifo = open(path, flags)) == -1)
   {
     if(debug) error_print("Failed to open stdin fifo (%s)", path);
     
     return 3;
   }
 
+  // The fifo is waited on with poll, to be able to cancel the read
+  nonblock_set(*fifo);
+
   if(debug) info_print("Opened stdin fifo (%s): (%d)", path, *fifo);
 
   return 0;
 }
 
+/*
+ * Start a worker command, with a pipe as its stdin
+ *
+ * The worker is started by an intermediate process that exits at once,
+ * so that nobody has to wait for the worker
+ *
+ * RETURN (int fd)
+ * - >=0 | The write end of the pipe to the worker
+ * -  -1 | Failed to start the worker
+ */
+static int worker_spawn(const char* command, bool debug)
+{
+  int pipefd[2];
+
+  if(pipe2(pipefd, O_CLOEXEC) == -1)
+  {
+    if(debug) error_print("Failed to create worker pipe: %s", strerror(errno));
+
+    return -1;
+  }
+
+  pid_t pid = fork();
+
+  if(pid == 0)
+  {
+    if(fork() == 0)
+    {
+      dup2(pipefd[0], 0);
+
+      // The worker should not keep the fifos and sockets of the relay open
+      close_range(3, ~0U, 0);
+
+      execl("/bin/sh", "sh", "-c", command, (char*) NULL);
+
+      _exit(127);
+    }
+
+    _exit(0);
+  }
+
+  close(pipefd[0]);
+
+  if(pid == -1)
+  {
+    if(debug) error_print("Failed to start worker: %s", strerror(errno));
+
+    close(pipefd[1]);
+
+    return -1;
+  }
+
+  waitpid(pid, NULL, 0);
+
+  return pipefd[1];
+}
+
 /*
  * Open fifo for writing (output/stdout fifo)
  * 
  * Optionally print debug messages
  *
+ * PARAMS
+ * - bool persist | Keep the fifo open when its reader closes it (see fifo_persist_prepare)
+ *
  * RETURN (int status)
  * - 0 | Success
  * - 1 | Missing address for stdout fifo
  * - 2 | Missing path to stdout fifo
  * - 3 | Failed to open stdout fifo
  */
-static int stdout_fifo_open(int* fifo, const char* path, bool debug)
+int stdout_fifo_open(int* fifo, const char* path, bool persist, bool debug)
 {
   if(!fifo)
   {
@@ -76,13 +179,31 @@ static int stdout_fifo_open(int* fifo, const char* path, bool debug)
 
   if(debug) info_print("Opening stdout fifo (%s)", path);
 
-  if((*fifo = open(path, O_WRONLY)) == -1)
+  // A path starting with a pipe is a worker command, fed with the lines
+  if(path[0] == '|')
+  {
+    if((*fifo = worker_spawn(path + 1, debug)) == -1) return 3;
+  }
+  else
   {
-    if(debug) error_print("Failed to open stdout fifo (%s)", path);
+    struct stat status;
 
-    return 3;
+    // A regular file is overwritten
+    int flags = (stat(path, &status) == 0 && S_ISREG(status.st_mode)) ? O_WRONLY | O_TRUNC : O_WRONLY;
+
+    if(persist && fifo_persist_prepare(path, debug)) flags = O_RDWR;
+
+    if((*fifo = open(path, flags)) == -1)
+    {
+      if(debug) error_print("Failed to open stdout fifo (%s)", path);
+
+      return 3;
+    }
   }
-  
+
+  // The fifo is waited on with poll, to be able to cancel the write
+  nonblock_set(*fifo);
+
   if(debug) info_print("Opened stdout fifo (%s): (%d)", path, *fifo);
 
   return 0;
@@ -124,6 +245,7 @@ int fifo_close(int* fifo, bool debug)
  * - bool reverse
  *   - true  | First open stdin then stdout
  *   - false | First open stdout then stdin
+ * - bool persist | Keep the fifos open (see fifo_persist_prepare)
  *
  * RETURN (int status)
  * [IMPORTANT] Same as stdin_stdout_fifo_open
@@ -131,18 +253,18 @@ int fifo_close(int* fifo, bool debug)
  * Note: This is a very nice programming concept
  *       I have never seen it being used before
  */
-int stdout_stdin_fifo_open(int* stdout_fifo, const char* stdout_path, int* stdin_fifo, const char* stdin_path, bool reverse, bool debug)
+int stdout_stdin_fifo_open(int* stdout_fifo, const char* stdout_path, int* stdin_fifo, const char* stdin_path, bool reverse, bool persist, bool debug)
 {
-  if(reverse) return stdin_stdout_fifo_open(stdin_fifo, stdin_path, stdout_fifo, stdout_path, !reverse, debug);
+  if(reverse) return stdin_stdout_fifo_open(stdin_fifo, stdin_path, stdout_fifo, stdout_path, !reverse, persist, debug);
 
   int status = 0b00;
 
-  if(stdout_path && stdout_fifo_open(stdout_fifo, stdout_path, debug) != 0)
+  if(stdout_path && stdout_fifo_open(stdout_fifo, stdout_path, persist, debug) != 0)
   {
     status |= (0b01 << 1);
   }
 
-  if(stdin_path && stdin_fifo_open(stdin_fifo, stdin_path, debug) != 0)
+  if(stdin_path && stdin_fifo_open(stdin_fifo, stdin_path, persist, debug) != 0)
   {
     status |= (0b01 << 0);
   }
@@ -158,23 +280,24 @@ int stdout_stdin_fifo_open(int* stdout_fifo, const char* stdout_path, int* stdin
  * - bool reverse
  *   - true  | First open stdout then stdin
  *   - false | First open stdin then stdout
+ * - bool persist | Keep the fifos open (see fifo_persist_prepare)
  *
  * RETURN (int status)
  * - 01 | Failed to open stdin fifo
  * - 10 | Failed to open stdout fifo
  */
-int stdin_stdout_fifo_open(int* stdin_fifo, const char* stdin_path, int* stdout_fifo, const char* stdout_path, bool reverse, bool debug)
+int stdin_stdout_fifo_open(int* stdin_fifo, const char* stdin_path, int* stdout_fifo, const char* stdout_path, bool reverse, bool persist, bool debug)
 {
-  if(reverse) return stdout_stdin_fifo_open(stdout_fifo, stdout_path, stdin_fifo, stdin_path, !reverse, debug);
+  if(reverse) return stdout_stdin_fifo_open(stdout_fifo, stdout_path, stdin_fifo, stdin_path, !reverse, persist, debug);
 
   int status = 0b00;
 
-  if(stdin_path && stdin_fifo_open(stdin_fifo, stdin_path, debug) != 0)
+  if(stdin_path && stdin_fifo_open(stdin_fifo, stdin_path, persist, debug) != 0)
   {
     status |= (0b01 << 0);
   }
 
-  if(stdout_path && stdout_fifo_open(stdout_fifo, stdout_path, debug) != 0)
+  if(stdout_path && stdout_fifo_open(stdout_fifo, stdout_path, persist, debug) != 0)
   {
     status |= (0b01 << 1);
   }
@@ -183,61 +306,141 @@ int stdin_stdout_fifo_open(int* stdin_fifo, const char* stdin_path, int* stdout_
 }
 
 /*
+ * Write a buffer to a file descriptor
+ *
+ * If the file descriptor is full, wait until it can be written to
+ *
+ * PARAMS
+ * - int event    | Event to cancel the write, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
+ *
  * RETURN (ssize_t size)
- * - >0 | Success! The length of the read buffer
- * -  0 | End of File
- * - -1 | Failed to read buffer
+ * - >=0 | The number of written bytes. If not the whole buffer,
+ *         the event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ * -  -1 | Failed to write to file descriptor
  */
-ssize_t buffer_read(int fd, char* buffer, size_t size)
+ssize_t buffer_write(int fd, const char* buffer, size_t size, int event, long timeout)
 {
-  if(errno != 0) return -1;
-
   if(!buffer) return 0;
 
-  char symbol = '\0';
-  ssize_t index;
+  size_t index = 0;
 
-  for(index = 0; index < size && symbol != '\n'; index++)
+  while(index < size)
   {
-    ssize_t status = read(fd, &symbol, 1);
+    ssize_t status = write(fd, buffer + index, size - index);
+
+    if(status > 0)
+    {
+      index += status;
 
-    if(status == -1 || errno != 0) return -1; // ERROR
+      continue;
+    }
 
-    buffer[index] = symbol;
+    if(status == -1 && errno != EAGAIN && errno != EINTR) return -1;
 
-    if(status == 0) return 0; // End Of File
+    if(status == -1 && errno == EAGAIN) PROBE2(fifo_full, fd, size - index);
+
+    int wait_status = event_wait(fd, POLLOUT, event, timeout);
+
+    if(wait_status == 1)
+    {
+      errno = ECANCELED;
+
+      break;
+    }
+    else if(wait_status == 2)
+    {
+      errno = ETIMEDOUT;
+
+      break;
+    }
+    else if(wait_status == -1) return -1;
   }
 
+  if(index < size) PROBE3(fifo_partial, fd, size, index);
+
   return index;
 }
 
 /*
- * RETURN (ssize_t size)
- * - >0 | Success! The length of the written buffer
- * -  0 | End of File? (I think)
- * - -1 | Failed to write to buffer
+ * Read the system wide maximum pipe size
+ *
+ * RETURN (int size)
+ * - >0 | The maximum pipe size
+ * - -1 | Failed to read the maximum pipe size
  */
-ssize_t buffer_write(int fd, const char* buffer, size_t size)
+static int pipe_max_size_get(void)
 {
-  if(errno != 0) return -1;
+  FILE* file = fopen("/proc/sys/fs/pipe-max-size", "r");
 
-  if(!buffer) return 0;
+  if(!file) return -1;
 
-  ssize_t index;
-  char symbol = '\0';
+  int size = -1;
 
-  for(index = 0; index < size && symbol != '\n'; index++)
-  {
-    symbol = buffer[index];
+  if(fscanf(file, "%d", &size) != 1) size = -1;
 
-    ssize_t status = write(fd, &symbol, 1);
+  fclose(file);
 
-    if(status == -1 || errno != 0) return -1;
+  return size;
+}
 
-    if(status == 0) return 0; // End Of File
-    
-    if(symbol == '\0') break;
+/*
+ * Get the capacity of a fifo
+ *
+ * RETURN (int size)
+ * - >0 | The capacity of the fifo
+ * - -1 | Not a fifo, or failed to get the capacity
+ */
+int fifo_pipe_size_get(int fifo)
+{
+  if(fifo == -1) return -1;
+
+  return fcntl(fifo, F_GETPIPE_SZ);
+}
+
+/*
+ * Set the capacity of a fifo, to let bursty producers write
+ * more than the default 64 KiB before they block
+ *
+ * PARAMS
+ * - int size
+ *   - PIPE_SIZE_AUTO | Raise the capacity as high as the system allows
+ *   - >0             | Requested capacity, rounded up by the kernel
+ *
+ * If the system refuses the requested size (per-user pipe limits),
+ * the size is halved until the kernel accepts it
+ *
+ * Note: Anything else than a fifo is left untouched
+ *
+ * RETURN (int size)
+ * - >0 | The resulting capacity of the fifo
+ * - -1 | Not a fifo, or failed to set the capacity
+ */
+int fifo_pipe_size_set(int fifo, int size, bool debug)
+{
+  struct stat fifo_stat;
+
+  if(fifo == -1 || fstat(fifo, &fifo_stat) == -1 || !S_ISFIFO(fifo_stat.st_mode)) return -1;
+
+  int current = fifo_pipe_size_get(fifo);
+
+  if(size == PIPE_SIZE_AUTO) size = pipe_max_size_get();
+
+  for(; size > current; size /= 2)
+  {
+    if(fcntl(fifo, F_SETPIPE_SZ, size) != -1) break;
+
+    if(errno != EPERM && errno != EBUSY)
+    {
+      if(debug) error_print("Failed to set fifo (%d) size: %s", fifo, strerror(errno));
+
+      break;
+    }
   }
 
-  return index;
+  int result = fifo_pipe_size_get(fifo);
+
+  if(debug) info_print("Fifo (%d) size: %d bytes", fifo, result);
+
+  return result;
 }
@@ -1,13 +1,15 @@
 /*
  * Written by Hampus Fridholm
  *
- * Last updated: 2024-09-08
+ * Last updated: 2026-10-18
  */
 
 #ifndef FIFO_H
 #define FIFO_H
 
 #include "debug.h"
+#include "event.h"
+#include "probe.h"
 
 #include <stddef.h>
 #include <stdbool.h>
@@ -15,14 +17,26 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
-extern int stdin_stdout_fifo_open(int* stdin_fifo, const char* stdin_path, int* stdout_fifo, const char* stdout_path, bool reverse, bool debug);
+#define PIPE_SIZE_AUTO -1
+
+extern int stdin_stdout_fifo_open(int* stdin_fifo, const char* stdin_path, int* stdout_fifo, const char* stdout_path, bool reverse, bool persist, bool debug);
+
+extern int stdin_fifo_open(int* fifo, const char* path, bool persist, bool debug);
+
+extern int stdout_fifo_open(int* fifo, const char* path, bool persist, bool debug);
 
 extern int fifo_close(int* fifo, bool debug);
 
+extern int fifo_pipe_size_set(int fifo, int size, bool debug);
+
+extern int fifo_pipe_size_get(int fifo);
 
-extern ssize_t buffer_read(int fd, char* buffer, size_t size);
 
-extern ssize_t buffer_write(int fd, const char* buffer, size_t size);
+extern ssize_t buffer_write(int fd, const char* buffer, size_t size, int event, long timeout);
 
 #endif // FIFO_H
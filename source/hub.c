@@ -0,0 +1,514 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "hub.h"
+
+/*
+ * Open the server socket of the hub
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to open the hub
+ */
+int hub_open(struct hub* hub, const char* address, int port, bool debug)
+{
+  memset(hub, 0, sizeof(struct hub));
+
+  hub->servfd = -1;
+
+  hub->debug = debug;
+
+  hub->clients = calloc(HUB_CLIENTS_MAX, sizeof(struct hub_client));
+
+  hub->pollfds = calloc(HUB_CLIENTS_MAX + 2, sizeof(struct pollfd));
+
+  hub->polled = calloc(HUB_CLIENTS_MAX + 2, sizeof(int));
+
+  if(!hub->clients || !hub->pollfds || !hub->polled || trie_init(&hub->trie) == -1)
+  {
+    if(debug) error_print("Failed to allocate hub");
+
+    free(hub->clients);
+
+    free(hub->pollfds);
+
+    free(hub->polled);
+
+    return -1;
+  }
+
+  if(server_socket_open(&hub->servfd, address, port, SOMAXCONN, debug) != 0)
+  {
+    trie_free(&hub->trie);
+
+    free(hub->clients);
+
+    free(hub->pollfds);
+
+    free(hub->polled);
+
+    return -1;
+  }
+
+  hub->open = true;
+
+  if(debug) info_print("Opened hub (%s:%d)", address, port);
+
+  return 0;
+}
+
+/*
+ * Disconnect a client, and remove its subscriptions
+ */
+static void hub_client_close(struct hub* hub, int index)
+{
+  struct hub_client* client = &hub->clients[index];
+
+  socket_close(&client->fd, hub->debug);
+
+  free(client->out);
+
+  memset(client, 0, sizeof(struct hub_client));
+
+  client->fd = -1;
+
+  trie_remove_all(&hub->trie, index);
+
+  while(hub->count > 0 && hub->clients[hub->count - 1].fd == -1) hub->count--;
+}
+
+/*
+ * Close the hub, and disconnect all clients
+ */
+void hub_close(struct hub* hub)
+{
+  if(!hub->open) return;
+
+  for(size_t index = 0; index < hub->count; index++)
+  {
+    if(hub->clients[index].fd != -1) hub_client_close(hub, index);
+  }
+
+  socket_close(&hub->servfd, hub->debug);
+
+  trie_free(&hub->trie);
+
+  free(hub->clients);
+
+  free(hub->pollfds);
+
+  free(hub->polled);
+
+  if(hub->debug) info_print("Closed hub");
+
+  hub->open = false;
+}
+
+/*
+ * Queue a line to be sent to a client
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The client does not keep up, or failed to allocate memory
+ */
+static int hub_client_queue(struct hub_client* client, const char* line, size_t size)
+{
+  if(client->out_end - client->out_start + size > HUB_BUFFER_MAX) return -1;
+
+  if(client->out_start > 0 && client->out_capacity - client->out_end < size)
+  {
+    memmove(client->out, client->out + client->out_start, client->out_end - client->out_start);
+
+    client->out_end -= client->out_start;
+
+    client->out_start = 0;
+  }
+
+  if(client->out_capacity - client->out_end < size)
+  {
+    size_t capacity = client->out_capacity ? client->out_capacity : HUB_LINE_MAX;
+
+    while(capacity - client->out_end < size) capacity *= 2;
+
+    char* out = realloc(client->out, capacity);
+
+    if(!out) return -1;
+
+    client->out = out;
+
+    client->out_capacity = capacity;
+  }
+
+  memcpy(client->out + client->out_end, line, size);
+
+  client->out_end += size;
+
+  return 0;
+}
+
+/*
+ * Send the queued lines of a client, as far as the socket takes them
+ *
+ * RETURN (int status)
+ * -  0 | Success, the rest waits until the socket is writable
+ * - -1 | Failed to write, the client has to be disconnected
+ */
+static int hub_client_flush(struct hub_client* client)
+{
+  while(client->out_start < client->out_end)
+  {
+    ssize_t write_size = write(client->fd, client->out + client->out_start, client->out_end - client->out_start);
+
+    if(write_size == -1)
+    {
+      if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+
+      if(errno == EINTR) continue;
+
+      return -1;
+    }
+
+    client->out_start += write_size;
+  }
+
+  client->out_start = client->out_end = 0;
+
+  return 0;
+}
+
+/*
+ * The line being published, for hub_deliver
+ */
+struct hub_line
+{
+  struct hub* hub;
+  const char* line;
+  size_t      size;
+};
+
+/*
+ * Deliver a published line to a matched subscriber, once per line
+ */
+static void hub_deliver(int index, void* arg)
+{
+  struct hub_line* line = arg;
+
+  struct hub* hub = line->hub;
+
+  struct hub_client* client = &hub->clients[index];
+
+  if(client->mark == hub->mark) return;
+
+  client->mark = hub->mark;
+
+  if(hub_client_queue(client, line->line, line->size) == -1)
+  {
+    hub->dropped++;
+  }
+  else hub->delivered++;
+}
+
+/*
+ * Get the argument of a command line, if the line is the command
+ *
+ * RETURN (const char* argument)
+ * - The argument after the command and a space (empty if there is none)
+ * - NULL | The line is not the command
+ */
+static const char* command_argument(const char* line, size_t size, const char* command)
+{
+  size_t length = strlen(command);
+
+  if(size < length || strncmp(line, command, length) != 0) return NULL;
+
+  if(size == length) return line + length;
+
+  if(line[length] == ' ') return line + length + 1;
+
+  return NULL;
+}
+
+/*
+ * Handle a line from a client: a subscription, or a line to publish
+ *
+ * PARAMS
+ * - size_t size | The size of the line, with the newline
+ */
+static void hub_line(struct hub* hub, int index, const char* line, size_t size)
+{
+  struct hub_client* client = &hub->clients[index];
+
+  // The text of the line, without the newline
+  size_t length = size - 1;
+
+  // 1. If the client starts with a hello, answer that no features are agreed
+  if(!client->greeted && length >= strlen(SOCKET_HELLO) && strncmp(line, SOCKET_HELLO, strlen(SOCKET_HELLO)) == 0)
+  {
+    client->greeted = true;
+
+    hub_client_queue(client, SOCKET_HELLO "\n", strlen(SOCKET_HELLO) + 1);
+
+    return;
+  }
+
+  client->greeted = true;
+
+  const char* prefix;
+
+  // 2. If the line is a subscription, add the prefix to the trie
+  if((prefix = command_argument(line, length, HUB_SUBSCRIBE)))
+  {
+    size_t prefix_size = length - (prefix - line);
+
+    if(trie_insert(&hub->trie, prefix, prefix_size, index) == -1)
+    {
+      if(hub->debug) error_print("Failed to subscribe client (%d)", client->fd);
+    }
+    else if(hub->debug) info_print("Client (%d) subscribed", client->fd);
+  }
+  // 3. If the line cancels a subscription, remove the prefix from the trie
+  else if((prefix = command_argument(line, length, HUB_UNSUBSCRIBE)))
+  {
+    size_t prefix_size = length - (prefix - line);
+
+    trie_remove(&hub->trie, prefix, prefix_size, index);
+
+    if(hub->debug) info_print("Client (%d) unsubscribed", client->fd);
+  }
+  // 4. Else, publish the line to the subscribers of its topic
+  else
+  {
+    const char* space = memchr(line, ' ', length);
+
+    size_t topic_size = space ? (size_t) (space - line) : length;
+
+    struct hub_line arg = { hub, line, size };
+
+    hub->mark++;
+
+    hub->published++;
+
+    trie_match(&hub->trie, line, topic_size, hub_deliver, &arg);
+  }
+}
+
+/*
+ * Read what a client has sent, and handle the complete lines
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The client disconnected, or failed to read
+ */
+static int hub_client_read(struct hub* hub, int index)
+{
+  struct hub_client* client = &hub->clients[index];
+
+  ssize_t read_size = read(client->fd, client->in + client->in_size, HUB_LINE_MAX - client->in_size);
+
+  if(read_size == -1)
+  {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+  }
+
+  if(read_size == 0) return -1;
+
+  client->in_size += read_size;
+
+  size_t start = 0;
+
+  char* newline;
+
+  while((newline = memchr(client->in + start, '\n', client->in_size - start)))
+  {
+    size_t size = newline - (client->in + start) + 1;
+
+    if(!client->discard) hub_line(hub, index, client->in + start, size);
+
+    client->discard = false;
+
+    start += size;
+  }
+
+  memmove(client->in, client->in + start, client->in_size - start);
+
+  client->in_size -= start;
+
+  // A line that does not fit is dropped, up to its newline
+  if(client->in_size == HUB_LINE_MAX)
+  {
+    if(hub->debug && !client->discard) error_print("Dropped too long line from client (%d)", client->fd);
+
+    client->discard = true;
+
+    client->in_size = 0;
+  }
+
+  return 0;
+}
+
+/*
+ * Accept the waiting clients
+ */
+static void hub_accept(struct hub* hub)
+{
+  int sockfd;
+
+  while((sockfd = server_socket_accept(hub->servfd, hub->debug)) != -1)
+  {
+    size_t index = 0;
+
+    while(index < hub->count && hub->clients[index].fd != -1) index++;
+
+    if(index == HUB_CLIENTS_MAX)
+    {
+      if(hub->debug) error_print("Too many clients, closing socket (%d)", sockfd);
+
+      socket_close(&sockfd, hub->debug);
+
+      continue;
+    }
+
+    memset(&hub->clients[index], 0, sizeof(struct hub_client));
+
+    hub->clients[index].fd = sockfd;
+
+    if(index == hub->count) hub->count++;
+
+    hub->accepted++;
+  }
+}
+
+/*
+ * Send the queued lines of all clients, without waiting
+ */
+static void hub_flush(struct hub* hub)
+{
+  for(size_t index = 0; index < hub->count; index++)
+  {
+    struct hub_client* client = &hub->clients[index];
+
+    if(client->fd == -1 || client->out_start == client->out_end) continue;
+
+    if(hub_client_flush(client) == -1) hub_client_close(hub, index);
+  }
+}
+
+/*
+ * Collect the file descriptors to poll: the event, the server socket
+ * and every client. Clients with queued lines are polled for writing
+ *
+ * RETURN (nfds_t count)
+ * - The number of file descriptors to poll
+ */
+static nfds_t hub_pollfds(struct hub* hub, int event, bool accepting)
+{
+  nfds_t count = 0;
+
+  hub->pollfds[count++] = (struct pollfd) { .fd = event, .events = POLLIN };
+
+  hub->pollfds[count++] = (struct pollfd) { .fd = accepting ? hub->servfd : -1, .events = POLLIN };
+
+  for(size_t index = 0; index < hub->count; index++)
+  {
+    struct hub_client* client = &hub->clients[index];
+
+    if(client->fd == -1) continue;
+
+    short events = accepting ? POLLIN : 0;
+
+    if(client->out_start < client->out_end) events |= POLLOUT;
+
+    hub->polled[count] = index;
+
+    hub->pollfds[count++] = (struct pollfd) { .fd = client->fd, .events = events };
+  }
+
+  return count;
+}
+
+/*
+ * Send what is queued for the clients, before the drain deadline
+ */
+static void hub_drain(struct hub* hub, long drain_timeout)
+{
+  struct timespec deadline;
+
+  deadline_set(&deadline, drain_timeout);
+
+  hub_flush(hub);
+
+  long timeout;
+
+  while((timeout = deadline_timeout(&deadline)) > 0)
+  {
+    nfds_t count = hub_pollfds(hub, -1, false);
+
+    bool pending = false;
+
+    for(nfds_t position = 2; position < count; position++)
+    {
+      if(hub->pollfds[position].events) pending = true;
+    }
+
+    if(!pending) break;
+
+    if(poll(hub->pollfds, count, timeout) == -1 && errno != EINTR) break;
+
+    hub_flush(hub);
+  }
+}
+
+/*
+ * Route the lines of the clients, until the event is signaled
+ *
+ * Then, what is queued for the clients is sent before the drain deadline
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to poll
+ */
+int hub_run(struct hub* hub, int event, long drain_timeout)
+{
+  int status = 0;
+
+  while(true)
+  {
+    nfds_t count = hub_pollfds(hub, event, true);
+
+    if(poll(hub->pollfds, count, -1) == -1)
+    {
+      if(errno == EINTR) continue;
+
+      if(hub->debug) error_print("Failed to poll hub: %s", strerror(errno));
+
+      status = -1;
+
+      break;
+    }
+
+    if(hub->pollfds[0].revents) break;
+
+    if(hub->pollfds[1].revents & POLLIN) hub_accept(hub);
+
+    for(nfds_t position = 2; position < count; position++)
+    {
+      int index = hub->polled[position];
+
+      if(hub->clients[index].fd != hub->pollfds[position].fd) continue;
+
+      if(hub->pollfds[position].revents & (POLLIN | POLLHUP | POLLERR))
+      {
+        if(hub_client_read(hub, index) == -1) hub_client_close(hub, index);
+      }
+    }
+
+    hub_flush(hub);
+  }
+
+  hub_drain(hub, drain_timeout);
+
+  return status;
+}
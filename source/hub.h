@@ -0,0 +1,88 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef HUB_H
+#define HUB_H
+
+#include "debug.h"
+#include "socket.h"
+#include "event.h"
+#include "trie.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define HUB_CLIENTS_MAX 1024
+
+/*
+ * Max length of a line from a client, longer lines are dropped
+ */
+#define HUB_LINE_MAX 4096
+
+/*
+ * Max bytes waiting to be sent to a client,
+ * lines to a client that does not keep up are dropped
+ */
+#define HUB_BUFFER_MAX (1024 * 1024)
+
+#define HUB_SUBSCRIBE   ":sub"
+#define HUB_UNSUBSCRIBE ":unsub"
+
+/*
+ * A client connected to the hub
+ */
+struct hub_client
+{
+  int    fd;            // -1 for a free slot
+  char   in[HUB_LINE_MAX];
+  size_t in_size;
+  bool   discard;       // Dropping the rest of a line that is too long
+  bool   greeted;       // The first line has been read
+  char*  out;           // Lines waiting to be sent
+  size_t out_start;
+  size_t out_end;
+  size_t out_capacity;
+  size_t mark;          // The last line delivered to the client
+};
+
+/*
+ * A router of published lines to the subscribed clients
+ *
+ * A client subscribes with a line ":sub PREFIX", and unsubscribes
+ * with ":unsub PREFIX". Every other line is published: the topic is
+ * the line up to the first space, and the whole line is sent to every
+ * client subscribed to a prefix of the topic (an empty prefix is all)
+ */
+struct hub
+{
+  bool               open;
+  int                servfd;
+  struct hub_client* clients;
+  size_t             count;     // Slots in use, including free slots in between
+  struct pollfd*     pollfds;
+  int*               polled;    // Client of every polled file descriptor
+  struct trie        trie;
+  size_t             mark;      // Number of the line being published
+  bool               debug;
+  size_t             accepted;  // Clients accepted
+  size_t             published; // Lines published
+  size_t             delivered; // Lines sent to subscribers
+  size_t             dropped;   // Lines dropped for slow clients
+};
+
+extern int  hub_open(struct hub* hub, const char* address, int port, bool debug);
+
+extern void hub_close(struct hub* hub);
+
+extern int  hub_run(struct hub* hub, int event, long drain_timeout);
+
+#endif // HUB_H
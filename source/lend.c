@@ -0,0 +1,498 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "lend.h"
+
+/*
+ * Open the lend of an embedded relay, without a source
+ *
+ * RETURN (int status)
+ * - 0 | Success
+ */
+int lend_open(struct lend* lend, bool debug)
+{
+  memset(lend, 0, sizeof(struct lend));
+
+  lend->fd    = -1;
+  lend->debug = debug;
+
+  pthread_mutex_init(&lend->lock, NULL);
+
+  event_cond_init(&lend->cond);
+
+  lend->open = true;
+
+  return 0;
+}
+
+/*
+ * Let go of a buffer, which is recycled when nothing refers to it
+ *
+ * Note: The lock must be held
+ */
+static void lend_block_put(struct lend* lend, struct lend_block* block)
+{
+  if(--block->refs > 0) return;
+
+  block->next = lend->free;
+
+  lend->free = block;
+}
+
+/*
+ * Free the buffers, after the routines have ended
+ *
+ * Note: Every borrowed line has to be released before
+ */
+void lend_free(struct lend* lend)
+{
+  if(!lend->open) return;
+
+  // The lines that were never borrowed
+  for(; lend->count > 0; lend->count--)
+  {
+    lend_block_put(lend, lend->loans[lend->head].block);
+
+    lend->head = (lend->head + 1) % LEND_LOANS_MAX;
+  }
+
+  if(lend->block) lend_block_put(lend, lend->block);
+
+  if(lend->released < lend->lent)
+  {
+    if(lend->debug) error_print("%ld lent lines were never released", (long) (lend->lent - lend->released));
+  }
+
+  while(lend->free)
+  {
+    struct lend_block* block = lend->free;
+
+    lend->free = block->next;
+
+    free(block);
+  }
+
+  pthread_cond_destroy(&lend->cond);
+
+  pthread_mutex_destroy(&lend->lock);
+
+  lend->open = false;
+}
+
+/*
+ * Read the lines straight from a file descriptor, instead of being given them
+ */
+void lend_source(struct lend* lend, int fd, struct codec* codec)
+{
+  int flags = fcntl(fd, F_GETFL);
+
+  lend->fd       = fd;
+  lend->blocking = (flags == -1 || !(flags & O_NONBLOCK));
+  lend->codec    = codec;
+}
+
+/*
+ * No more lines are given, the borrowers get End of File
+ * when the lent lines have been borrowed
+ */
+void lend_close(struct lend* lend)
+{
+  if(!lend->open) return;
+
+  pthread_mutex_lock(&lend->lock);
+
+  lend->closed = true;
+
+  pthread_cond_broadcast(&lend->cond);
+
+  pthread_mutex_unlock(&lend->lock);
+}
+
+/*
+ * Wake the threads waiting on the lend, to check their events
+ */
+void lend_wake(struct lend* lend)
+{
+  if(!lend->open) return;
+
+  pthread_mutex_lock(&lend->lock);
+
+  pthread_cond_broadcast(&lend->cond);
+
+  pthread_mutex_unlock(&lend->lock);
+}
+
+/*
+ * Wait on the lend until it is woken, or the event or timeout
+ *
+ * Note: The lock must be held, and is released if the wait has to end
+ *
+ * RETURN (int status)
+ * -  0 | Woken up
+ * - -1 | The event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ */
+static int lend_wait(struct lend* lend, int event, long timeout, const struct timespec* deadline)
+{
+  int status = event_cond_wait(&lend->cond, &lend->lock, event, timeout, deadline);
+
+  if(status == 0) return 0;
+
+  pthread_mutex_unlock(&lend->lock);
+
+  errno = (status == 1) ? ECANCELED : ETIMEDOUT;
+
+  return -1;
+}
+
+/*
+ * Move the start of a line to the next buffer, as the rest does not fit
+ *
+ * If every buffer is lent, wait until the application releases a line
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The event was signaled (ECANCELED), timed out (ETIMEDOUT) or out of memory
+ */
+static int lend_block_next(struct lend* lend, int event, long timeout)
+{
+  struct timespec deadline;
+
+  if(timeout != -1) deadline_set(&deadline, timeout);
+
+  pthread_mutex_lock(&lend->lock);
+
+  while(!lend->free && lend->blocks >= LEND_BLOCKS_MAX)
+  {
+    if(lend_wait(lend, event, timeout, &deadline) == -1) return -1;
+  }
+
+  struct lend_block* block = lend->free;
+
+  if(block)
+  {
+    lend->free = block->next;
+  }
+  else if((block = malloc(sizeof(struct lend_block))))
+  {
+    lend->blocks++;
+  }
+  else
+  {
+    pthread_mutex_unlock(&lend->lock);
+
+    if(lend->debug) error_print("Failed to allocate lend buffer");
+
+    return -1;
+  }
+
+  block->refs = 1;
+
+  pthread_mutex_unlock(&lend->lock);
+
+  size_t length = lend->end - lend->start;
+
+  if(lend->block)
+  {
+    memcpy(block->data, lend->block->data + lend->start, length);
+
+    lend->copied += length;
+
+    pthread_mutex_lock(&lend->lock);
+
+    lend_block_put(lend, lend->block);
+
+    pthread_mutex_unlock(&lend->lock);
+  }
+
+  lend->block = block;
+  lend->start = 0;
+  lend->end   = length;
+
+  return 0;
+}
+
+/*
+ * Read as much as is available from the source to the buffer
+ *
+ * RETURN (int status)
+ * -  0 | Success, or nothing available yet
+ * - -1 | Failed to read
+ */
+static int lend_fill(struct lend* lend)
+{
+  ssize_t status;
+
+  if(lend->codec)
+  {
+    status = codec_read(lend->codec, lend->fd, lend->block->data + lend->end, LEND_BLOCK_SIZE - lend->end);
+  }
+  else status = read(lend->fd, lend->block->data + lend->end, LEND_BLOCK_SIZE - lend->end);
+
+  if(status > 0) lend->end += status;
+
+  else if(status == 0) lend->eof = true;
+
+  else if(errno != EAGAIN && errno != EINTR) return -1;
+
+  return 0;
+}
+
+/*
+ * Read the next line of the source into the buffers, just like reader_line
+ *
+ * The line is not copied, but pointed to in the buffer, to be lent by lend_give
+ *
+ * RETURN (same as reader_line)
+ */
+ssize_t lend_line(struct lend* lend, const char** line, int event, long timeout)
+{
+  while(true)
+  {
+    size_t length = lend->end - lend->start;
+
+    if(lend->block)
+    {
+      const char* first = lend->block->data + lend->start;
+
+      const char* newline = memchr(first, '\n', length);
+
+      *line = first;
+
+      if(newline) return newline - first + 1;
+
+      if(length == LEND_BLOCK_SIZE || (lend->eof && length > 0)) return length;
+    }
+
+    if(lend->eof) return 0;
+
+    // The buffer is full, the start of the line moves to the next one
+    if(!lend->block || lend->end == LEND_BLOCK_SIZE)
+    {
+      if(lend_block_next(lend, event, timeout) == -1) return -1;
+
+      continue;
+    }
+
+    // A non-blocking source is read directly, and only waited on when it is empty
+    if(!lend->blocking)
+    {
+      size_t end = lend->end;
+
+      if(lend_fill(lend) == -1) return -1;
+
+      if(lend->end != end || lend->eof) continue;
+    }
+
+    int status = event_wait(lend->fd, POLLIN, event, timeout);
+
+    if(status == 1)
+    {
+      errno = ECANCELED;
+
+      return -1;
+    }
+    else if(status == 2)
+    {
+      if(length > 0) return length;
+
+      errno = ETIMEDOUT;
+
+      return -1;
+    }
+    else if(status == -1) return -1;
+
+    if(lend->blocking && lend_fill(lend) == -1) return -1;
+  }
+}
+
+/*
+ * Skip a line read by lend_line, that is not to be lent
+ */
+void lend_skip(struct lend* lend, size_t size)
+{
+  lend->start += size;
+}
+
+/*
+ * Lend the bytes at the start of the buffer, to be borrowed
+ *
+ * Note: There has to be room for the line, see lend_give
+ */
+static void lend_publish(struct lend* lend, size_t size)
+{
+  pthread_mutex_lock(&lend->lock);
+
+  struct loan* loan = &lend->loans[(lend->head + lend->count) % LEND_LOANS_MAX];
+
+  loan->data  = lend->block->data + lend->start;
+  loan->size  = size;
+  loan->block = lend->block;
+
+  lend->block->refs++;
+
+  lend->count++;
+
+  pthread_cond_broadcast(&lend->cond);
+
+  pthread_mutex_unlock(&lend->lock);
+
+  lend->start += size;
+}
+
+/*
+ * Wait until a given line can be lent, with room for a cut line before it
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ */
+static int lend_room_wait(struct lend* lend, int event, long timeout)
+{
+  struct timespec deadline;
+
+  if(timeout != -1) deadline_set(&deadline, timeout);
+
+  pthread_mutex_lock(&lend->lock);
+
+  while(lend->count + 2 > LEND_LOANS_MAX)
+  {
+    if(lend_wait(lend, event, timeout, &deadline) == -1) return -1;
+  }
+
+  pthread_mutex_unlock(&lend->lock);
+
+  return 0;
+}
+
+/*
+ * Give a line to be lent, just like buffer_write
+ *
+ * A line read by lend_line is lent where it is. Any other line is copied
+ * to the buffer, and is lent when it has been given up to its newline
+ *
+ * PARAMS
+ * - int event    | Event to cancel the wait, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
+ *
+ * RETURN (ssize_t size)
+ * - >=0 | The number of given bytes. If not the whole line,
+ *         the event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ * -  -1 | The line does not fit in a buffer (EMSGSIZE), or out of memory
+ */
+ssize_t lend_give(struct lend* lend, const char* buffer, size_t size, int event, long timeout)
+{
+  if(!buffer || size == 0) return 0;
+
+  if(size > LEND_BLOCK_SIZE)
+  {
+    errno = EMSGSIZE;
+
+    return -1;
+  }
+
+  if(lend_room_wait(lend, event, timeout) == -1) return 0;
+
+  // 1. If the line was read by lend_line, lend it where it is
+  if(lend->block && buffer == lend->block->data + lend->start)
+  {
+    lend_publish(lend, size);
+
+    return size;
+  }
+
+  // 2. Else, copy the line to the buffer
+  if(!lend->block || lend->end + size > LEND_BLOCK_SIZE)
+  {
+    // The start of a line that can't be continued is lent as it is
+    if(lend->end - lend->start + size > LEND_BLOCK_SIZE) lend_publish(lend, lend->end - lend->start);
+
+    if(lend_block_next(lend, event, timeout) == -1)
+    {
+      return (errno == ECANCELED || errno == ETIMEDOUT) ? 0 : -1;
+    }
+  }
+
+  memcpy(lend->block->data + lend->end, buffer, size);
+
+  lend->end += size;
+
+  lend->copied += size;
+
+  if(buffer[size - 1] == '\n') lend_publish(lend, lend->end - lend->start);
+
+  return size;
+}
+
+/*
+ * Borrow the next line, which stays valid until it is released
+ *
+ * PARAMS
+ * - int event    | Event to cancel the wait, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
+ *
+ * RETURN (ssize_t size)
+ * - >0 | Success! The length of the borrowed line
+ * -  0 | No more lines are lent, End of File
+ * - -1 | The event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ */
+ssize_t lend_borrow(struct lend* lend, struct loan* loan, int event, long timeout)
+{
+  struct timespec deadline;
+
+  if(timeout != -1) deadline_set(&deadline, timeout);
+
+  pthread_mutex_lock(&lend->lock);
+
+  while(!lend->closed && lend->count == 0)
+  {
+    if(lend_wait(lend, event, timeout, &deadline) == -1) return -1;
+  }
+
+  if(lend->count == 0)
+  {
+    pthread_mutex_unlock(&lend->lock);
+
+    return 0;
+  }
+
+  *loan = lend->loans[lend->head];
+
+  lend->head = (lend->head + 1) % LEND_LOANS_MAX;
+
+  lend->count--;
+
+  lend->lent++;
+
+  pthread_cond_broadcast(&lend->cond);
+
+  pthread_mutex_unlock(&lend->lock);
+
+  return loan->size;
+}
+
+/*
+ * Release a borrowed line, in any order
+ *
+ * The buffer of the line is recycled when all of its lines are released
+ */
+void lend_release(struct lend* lend, struct loan* loan)
+{
+  if(!loan->block) return;
+
+  pthread_mutex_lock(&lend->lock);
+
+  lend_block_put(lend, loan->block);
+
+  lend->released++;
+
+  pthread_cond_broadcast(&lend->cond);
+
+  pthread_mutex_unlock(&lend->lock);
+
+  loan->data  = NULL;
+  loan->size  = 0;
+  loan->block = NULL;
+}
@@ -0,0 +1,120 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef LEND_H
+#define LEND_H
+
+#include "debug.h"
+#include "event.h"
+#include "codec.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * Bytes of a receive buffer, a longer line is cut
+ */
+#define LEND_BLOCK_SIZE (256 * 1024)
+
+/*
+ * Max receive buffers, beyond it the relay waits for the application
+ * to release its lines, and the peer is held back by the socket
+ */
+#define LEND_BLOCKS_MAX 64
+
+/*
+ * Max lines waiting to be borrowed
+ */
+#define LEND_LOANS_MAX 4096
+
+/*
+ * A receive buffer, shared by the lines lent out of it
+ *
+ * The buffer is recycled when the last of its lines has been released,
+ * and the relay no longer reads into it
+ */
+struct lend_block
+{
+  struct lend_block* next; // Next recycled buffer
+  size_t             refs; // Lent lines, and the relay while it reads into it
+  char               data[LEND_BLOCK_SIZE];
+};
+
+/*
+ * A line lent to the application, to be released when it is done with it
+ */
+struct loan
+{
+  const char*        data;
+  size_t             size;
+  struct lend_block* block;
+};
+
+/*
+ * Lines of an embedded relay, lent to the application
+ * straight out of the receive buffers
+ *
+ * With a source, the socket is read (and decompressed) into the buffers,
+ * and every line is lent where it was received. Else, the lines are
+ * copied to the buffers as they are given. Only the start of a line
+ * that does not fit in a buffer is moved to the next one.
+ *
+ * The lines can be released in any order
+ */
+struct lend
+{
+  bool               open;
+  bool               closed;   // No more lines are given
+  int                fd;       // Source to read into the buffers, -1 if lines are given
+  bool               blocking; // The source is blocking, so always wait before reading
+  struct codec*      codec;    // NULL to not decompress
+  bool               eof;
+  struct lend_block* block;    // The buffer being read into
+  size_t             start;    // The next line in the buffer
+  size_t             end;      // End of the bytes in the buffer
+  struct loan        loans[LEND_LOANS_MAX]; // Lines waiting to be borrowed
+  size_t             head;
+  size_t             count;
+  struct lend_block* free;     // Recycled buffers
+  size_t             blocks;   // Buffers in use or recycled
+  size_t             lent;     // Lines borrowed by the application
+  size_t             released; // Lines released by the application
+  size_t             copied;   // Bytes copied to the buffers
+  pthread_mutex_t    lock;
+  pthread_cond_t     cond;
+  bool               debug;
+};
+
+extern int     lend_open(struct lend* lend, bool debug);
+
+extern void    lend_free(struct lend* lend);
+
+extern void    lend_source(struct lend* lend, int fd, struct codec* codec);
+
+extern void    lend_close(struct lend* lend);
+
+extern void    lend_wake(struct lend* lend);
+
+
+extern ssize_t lend_line(struct lend* lend, const char** line, int event, long timeout);
+
+extern void    lend_skip(struct lend* lend, size_t size);
+
+extern ssize_t lend_give(struct lend* lend, const char* buffer, size_t size, int event, long timeout);
+
+extern ssize_t lend_borrow(struct lend* lend, struct loan* loan, int event, long timeout);
+
+extern void    lend_release(struct lend* lend, struct loan* loan);
+
+#endif // LEND_H
@@ -0,0 +1,391 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "metrics.h"
+
+/*
+ * Get the latency bucket of a number of microseconds
+ */
+static int metrics_latency_bucket(long usec)
+{
+  if(usec < METRICS_LATENCY_SUBBUCKETS) return (usec > 0) ? usec : 0;
+
+  int msb = 63 - __builtin_clzl(usec);
+
+  int bucket = (msb - 2) * METRICS_LATENCY_SUBBUCKETS + ((usec >> (msb - 3)) & (METRICS_LATENCY_SUBBUCKETS - 1));
+
+  return (bucket < METRICS_LATENCY_BUCKETS) ? bucket : METRICS_LATENCY_BUCKETS - 1;
+}
+
+/*
+ * Get the highest number of microseconds of a latency bucket
+ */
+static long metrics_latency_bound(int bucket)
+{
+  if(bucket < METRICS_LATENCY_SUBBUCKETS) return bucket;
+
+  int shift = bucket / METRICS_LATENCY_SUBBUCKETS - 1;
+
+  long lower = (long) (METRICS_LATENCY_SUBBUCKETS + bucket % METRICS_LATENCY_SUBBUCKETS) << shift;
+
+  return lower + (1L << shift) - 1;
+}
+
+/*
+ * Add a latency to a histogram
+ */
+void histogram_add(struct histogram* histogram, long usec)
+{
+  histogram->buckets[metrics_latency_bucket(usec)]++;
+
+  histogram->count++;
+
+  histogram->sum += (usec > 0) ? usec : 0;
+}
+
+/*
+ * printf to the end of the text, growing it if needed
+ *
+ * If the text can not grow, the rest of the scrape is left out
+ */
+static void metrics_printf(struct metrics_text* text, const char* format, ...)
+{
+  while(true)
+  {
+    va_list args;
+
+    va_start(args, format);
+
+    size_t room = text->capacity - text->size;
+
+    int length = vsnprintf(text->data ? text->data + text->size : NULL, room, format, args);
+
+    va_end(args);
+
+    if(length < 0) return;
+
+    if((size_t) length < room)
+    {
+      text->size += length;
+
+      return;
+    }
+
+    size_t capacity = text->capacity ? text->capacity * 2 : 4096;
+
+    while(capacity - text->size <= (size_t) length) capacity *= 2;
+
+    char* data = realloc(text->data, capacity);
+
+    if(!data) return;
+
+    text->data     = data;
+    text->capacity = capacity;
+  }
+}
+
+/*
+ * Write the help and type of a metric family, before its samples
+ *
+ * PARAMS
+ * - const char* type | counter, gauge or histogram
+ */
+void metrics_family(struct metrics_text* text, const char* name, const char* type, const char* help)
+{
+  metrics_printf(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/*
+ * Write a sample of a metric
+ *
+ * PARAMS
+ * - const char* labels | The labels without braces, such as channel="stdin"
+ */
+void metrics_sample(struct metrics_text* text, const char* name, const char* labels, double value)
+{
+  metrics_printf(text, "%s{%s} %.15g\n", name, labels, value);
+}
+
+/*
+ * Write the samples of a latency histogram, in seconds
+ *
+ * The buckets are latency buckets of METRICS_LATENCY_BUCKETS, and they are
+ * exposed as cumulative buckets at every power of two microseconds
+ *
+ * PARAMS
+ * - size_t count | The number of latencies
+ * - long sum     | The sum of the latencies, in microseconds
+ */
+void metrics_histogram(struct metrics_text* text, const char* name, const char* labels, const size_t* buckets, size_t count, long sum)
+{
+  size_t cumulative = 0;
+
+  int bucket = 0;
+
+  for(int power = 0; power < METRICS_EXPOSED_POWERS; power++)
+  {
+    long bound = 1L << power;
+
+    for(; bucket < METRICS_LATENCY_BUCKETS && metrics_latency_bound(bucket) < bound; bucket++)
+    {
+      cumulative += buckets[bucket];
+    }
+
+    metrics_printf(text, "%s_bucket{%s,le=\"%.6f\"} %lu\n", name, labels, bound / 1e6, (unsigned long) cumulative);
+  }
+
+  metrics_printf(text, "%s_bucket{%s,le=\"+Inf\"} %lu\n", name, labels, (unsigned long) count);
+
+  metrics_printf(text, "%s_sum{%s} %.6f\n", name, labels, sum / 1e6);
+
+  metrics_printf(text, "%s_count{%s} %lu\n", name, labels, (unsigned long) count);
+}
+
+/*
+ * Create a listening Unix socket, replacing a stale socket at the path
+ *
+ * RETURN (int servfd)
+ * - >=0 | Success
+ * -  -1 | Failed to create the socket
+ */
+static int metrics_unix_listen(const char* path, bool debug)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+  if(strlen(path) >= sizeof(addr.sun_path))
+  {
+    if(debug) error_print("Too long metrics socket path: %s", path);
+
+    return -1;
+  }
+
+  strcpy(addr.sun_path, path);
+
+  struct stat status;
+
+  if(lstat(path, &status) == 0 && S_ISSOCK(status.st_mode)) unlink(path);
+
+  int servfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  if(servfd == -1)
+  {
+    if(debug) error_print("Failed to create metrics socket: %s", strerror(errno));
+
+    return -1;
+  }
+
+  if(bind(servfd, (struct sockaddr*) &addr, sizeof(addr)) == -1 || listen(servfd, SOMAXCONN) == -1)
+  {
+    if(debug) error_print("Failed to listen on metrics socket (%s): %s", path, strerror(errno));
+
+    close(servfd);
+
+    return -1;
+  }
+
+  return servfd;
+}
+
+/*
+ * Open the metrics listener
+ *
+ * PARAMS
+ * - const char* target | A path of a Unix socket (with a slash),
+ *                        or a port, as PORT or ADDRESS:PORT
+ *
+ * A port without an address is only listened on by localhost
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to open the listener
+ */
+int metrics_open(struct metrics* metrics, const char* target, bool debug)
+{
+  memset(metrics, 0, sizeof(struct metrics));
+
+  metrics->servfd = -1;
+  metrics->debug  = debug;
+
+  // 1. If the target is a path, listen on a Unix socket
+  if(strchr(target, '/'))
+  {
+    if(!(metrics->path = strdup(target))) return -1;
+
+    if((metrics->servfd = metrics_unix_listen(target, debug)) == -1)
+    {
+      free(metrics->path);
+
+      metrics->path = NULL;
+
+      return -1;
+    }
+  }
+  // 2. Else, listen on a TCP port
+  else
+  {
+    char address[64] = "127.0.0.1";
+
+    const char* colon = strrchr(target, ':');
+
+    if(colon)
+    {
+      size_t length = colon - target;
+
+      if(length == 0 || length >= sizeof(address)) return -1;
+
+      memcpy(address, target, length);
+      address[length] = '\0';
+    }
+
+    int port = atoi(colon ? colon + 1 : target);
+
+    if(port <= 0 || port > 65535)
+    {
+      if(debug) error_print("Invalid metrics port: %s", target);
+
+      return -1;
+    }
+
+    if(server_socket_open(&metrics->servfd, address, port, SOMAXCONN, debug) != 0) return -1;
+  }
+
+  if(debug) info_print("Serving metrics on %s", target);
+
+  metrics->open = true;
+
+  return 0;
+}
+
+/*
+ * Close the metrics listener, and remove its Unix socket
+ */
+void metrics_close(struct metrics* metrics)
+{
+  if(!metrics->open) return;
+
+  socket_close(&metrics->servfd, metrics->debug);
+
+  if(metrics->path)
+  {
+    unlink(metrics->path);
+
+    free(metrics->path);
+
+    metrics->path = NULL;
+  }
+
+  metrics->open = false;
+}
+
+/*
+ * Read the request of a scraper, until its empty line, End of File,
+ * or METRICS_READ_TIMEOUT, as a scraper may send nothing at all
+ *
+ * RETURN (bool http)
+ * - true  | The scraper sent an HTTP request
+ * - false | The scraper wants the bare metrics
+ */
+static bool metrics_request_read(int sockfd, int event)
+{
+  char request[METRICS_REQUEST_MAX + 1];
+
+  size_t size = 0;
+
+  while(size < METRICS_REQUEST_MAX)
+  {
+    if(event_wait(sockfd, POLLIN, event, METRICS_READ_TIMEOUT) != 0) break;
+
+    ssize_t read_size = read(sockfd, request + size, METRICS_REQUEST_MAX - size);
+
+    if(read_size == -1 && (errno == EAGAIN || errno == EINTR)) continue;
+
+    if(read_size <= 0) break;
+
+    size += read_size;
+
+    request[size] = '\0';
+
+    if(strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+  }
+
+  return (size >= 4 && !strncmp(request, "GET ", 4));
+}
+
+/*
+ * Serve the metrics to a waiting scraper
+ */
+static void metrics_serve(struct metrics* metrics, int event, struct metrics_text* text, metrics_render_t render, void* arg)
+{
+  int sockfd = server_socket_accept(metrics->servfd, false);
+
+  if(sockfd == -1) return;
+
+  bool http = metrics_request_read(sockfd, event);
+
+  text->size = 0;
+
+  render(text, arg);
+
+  if(http)
+  {
+    char header[256];
+
+    int length = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n", (unsigned long) text->size);
+
+    socket_write(sockfd, header, length, event, METRICS_WRITE_TIMEOUT);
+  }
+
+  socket_write(sockfd, text->data, text->size, event, METRICS_WRITE_TIMEOUT);
+
+  close(sockfd);
+
+  metrics->scrapes++;
+}
+
+/*
+ * Serve the metrics until the event is signaled
+ *
+ * PARAMS
+ * - metrics_render_t render | Writes the metrics of a scrape
+ *
+ * RETURN (int status)
+ * -  0 | The event was signaled
+ * - -1 | Failed to wait for a scraper
+ */
+int metrics_run(struct metrics* metrics, int event, metrics_render_t render, void* arg)
+{
+  struct metrics_text text = { 0 };
+
+  int status = 0;
+
+  while(true)
+  {
+    struct pollfd pollfds[2] =
+    {
+      { .fd = event,           .events = POLLIN },
+      { .fd = metrics->servfd, .events = POLLIN }
+    };
+
+    if(poll(pollfds, 2, -1) == -1)
+    {
+      if(errno == EINTR) continue;
+
+      if(metrics->debug) error_print("Failed to poll metrics: %s", strerror(errno));
+
+      status = -1;
+
+      break;
+    }
+
+    if(pollfds[0].revents) break;
+
+    if(pollfds[1].revents & POLLIN) metrics_serve(metrics, event, &text, render, arg);
+  }
+
+  free(text.data);
+
+  return status;
+}
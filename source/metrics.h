@@ -0,0 +1,106 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "debug.h"
+#include "socket.h"
+#include "event.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/*
+ * Buckets of a latency histogram, with 8 buckets for every power of two
+ * microseconds, the same as the latency histogram of the RPC server
+ */
+#define METRICS_LATENCY_SUBBUCKETS 8
+#define METRICS_LATENCY_BUCKETS    (40 * METRICS_LATENCY_SUBBUCKETS)
+
+/*
+ * The buckets of an exposed histogram are the powers of two microseconds,
+ * from 1 us up to about a minute
+ */
+#define METRICS_EXPOSED_POWERS 27
+
+/*
+ * Max milliseconds to wait for the request of a scraper,
+ * and to send the metrics to it
+ */
+#define METRICS_READ_TIMEOUT  100
+#define METRICS_WRITE_TIMEOUT 1000
+
+#define METRICS_REQUEST_MAX 4096
+
+/*
+ * A latency histogram, written by a single thread and read by the metrics thread
+ */
+struct histogram
+{
+  size_t buckets[METRICS_LATENCY_BUCKETS];
+  size_t count;
+  long   sum; // Microseconds
+};
+
+/*
+ * The text of the metrics, that grows as it is written
+ */
+struct metrics_text
+{
+  char*  data;
+  size_t size;
+  size_t capacity;
+};
+
+/*
+ * Write the metrics of a scrape to the text
+ */
+typedef void (*metrics_render_t)(struct metrics_text* text, void* arg);
+
+/*
+ * A listener that serves metrics in the Prometheus text format
+ *
+ * The metrics are served from a thread of their own, one scraper at a time,
+ * and are read from the counters without locks, so that a scrape never
+ * stalls the relay. A scraper either sends an HTTP GET request and gets
+ * an HTTP response, or sends nothing and gets the bare metrics
+ */
+struct metrics
+{
+  bool   open;
+  int    servfd;
+  char*  path;    // The Unix socket, NULL for a TCP port
+  bool   debug;
+  size_t scrapes;
+};
+
+extern void histogram_add(struct histogram* histogram, long usec);
+
+
+extern void metrics_family(struct metrics_text* text, const char* name, const char* type, const char* help);
+
+extern void metrics_sample(struct metrics_text* text, const char* name, const char* labels, double value);
+
+extern void metrics_histogram(struct metrics_text* text, const char* name, const char* labels, const size_t* buckets, size_t count, long sum);
+
+
+extern int  metrics_open(struct metrics* metrics, const char* target, bool debug);
+
+extern void metrics_close(struct metrics* metrics);
+
+extern int  metrics_run(struct metrics* metrics, int event, metrics_render_t render, void* arg);
+
+#endif // METRICS_H
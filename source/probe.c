@@ -0,0 +1,18 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "probe.h"
+
+#ifdef PROBE_ENABLED
+
+/*
+ * The semaphores of the probes, that a tracer counts up while it is attached
+ */
+#define PROBE_SEMAPHORE_DEFINE(name) unsigned short PROBE_SEMAPHORE(name) __attribute__((section(".probes"))) = 0;
+
+PROBE_NAMES(PROBE_SEMAPHORE_DEFINE)
+
+#endif // PROBE_ENABLED
@@ -0,0 +1,98 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <time.h>
+
+/*
+ * Static probes (USDT) on the hot paths, for perf, bpftrace and SystemTap
+ *
+ * With <sys/sdt.h>, a probe is a nop in the code and a note in the binary,
+ * that the tracer turns into a breakpoint when it attaches. The arguments
+ * of a probe are only computed while a tracer is attached, as told by the
+ * semaphore of the probe. Without <sys/sdt.h>, or with PROBE_DISABLE,
+ * the probes are left out
+ *
+ * The first argument of every probe is the time in nanoseconds (CLOCK_MONOTONIC)
+ *
+ *   bpftrace -e 'usdt:./procom:procom:fifo_full { @[arg1] = count(); }'
+ */
+#if defined(__has_include) && !defined(PROBE_DISABLE)
+#if __has_include(<sys/sdt.h>)
+#define PROBE_ENABLED 1
+#endif
+#endif
+
+/*
+ * The probes, with their arguments after the time
+ *
+ * - stdin_read     | fd, size        | A line is read by the stdin routine
+ * - stdin_write    | size, lines     | A line is written by the stdin routine
+ * - stdout_read    | fd, size        | A line is read by the stdout routine
+ * - stdout_write   | size, lines     | A line is written by the stdout routine
+ * - routine_end    | routine, error  | The stdin (0) or stdout (1) routine ends
+ * - fifo_full      | fd, left        | A fifo write waits for room
+ * - fifo_partial   | fd, size, done  | A fifo write is canceled or timed out
+ * - socket_full    | fd, left        | A socket write waits for room
+ * - socket_partial | fd, size, done  | A socket write is canceled or timed out
+ * - connect        | fd, port        | A socket is connected
+ * - accept         | fd, servfd      | A socket is accepted
+ */
+#define PROBE_NAMES(X) \
+  X(stdin_read)        \
+  X(stdin_write)       \
+  X(stdout_read)       \
+  X(stdout_write)      \
+  X(routine_end)       \
+  X(fifo_full)         \
+  X(fifo_partial)      \
+  X(socket_full)       \
+  X(socket_partial)    \
+  X(connect)           \
+  X(accept)
+
+#ifdef PROBE_ENABLED
+
+#define _SDT_HAS_SEMAPHORES 1
+
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name) procom_##name##_semaphore
+
+#define PROBE_SEMAPHORE_DECLARE(name) extern unsigned short PROBE_SEMAPHORE(name);
+
+PROBE_NAMES(PROBE_SEMAPHORE_DECLARE)
+
+/*
+ * Get the time of a probe, in nanoseconds
+ */
+static inline long probe_time(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+#define PROBE2(name, a, b) \
+  do { if(__builtin_expect(PROBE_SEMAPHORE(name), 0)) DTRACE_PROBE3(procom, name, probe_time(), a, b); } while(0)
+
+#define PROBE3(name, a, b, c) \
+  do { if(__builtin_expect(PROBE_SEMAPHORE(name), 0)) DTRACE_PROBE4(procom, name, probe_time(), a, b, c); } while(0)
+
+#else // PROBE_ENABLED
+
+// The arguments are not evaluated, but still count as used
+#define PROBE2(name, a, b)    do { (void) sizeof(a); (void) sizeof(b); } while(0)
+
+#define PROBE3(name, a, b, c) do { (void) sizeof(a); (void) sizeof(b); (void) sizeof(c); } while(0)
+
+#endif // PROBE_ENABLED
+
+#endif // PROBE_H
@@ -1,34 +1,17 @@
 /*
  * Written by Hampus Fridholm
  *
- * Last updated: 2024-09-08
+ * Last updated: 2026-10-18
  */
 
-#define DEFAULT_ADDRESS "127.0.0.1"
-#define DEFAULT_PORT    5555
-
 #include <stdlib.h>
 #include <stdbool.h>
 #include <argp.h>
+#include <signal.h>
 
-#include "debug.h"
-#include "fifo.h"
-#include "socket.h"
-#include "thread.h"
-
-pthread_t stdin_thread;
-bool      stdin_running = false;
-
-pthread_t stdout_thread;
-bool      stdout_running = false;
-
-int sockfd = -1;
-int servfd = -1;
+#include "relay.h"
 
-bool fifo_reverse = false;
-
-int stdin_fifo  = -1;
-int stdout_fifo = -1;
+struct relay* relay = NULL;
 
 static char doc[] = "procom - process communication";
 
@@ -36,270 +19,499 @@ static char args_doc[] = "";
 
 static struct argp_option options[] =
 {
-  { "stdin",   'i', "FIFO",    0, "Stdin fifo" },
-  { "stdout",  'o', "FIFO",    0, "Stdout fifo" },
-  { "address", 'a', "ADDRESS", 0, "Network address" },
+  { "stdin",   'i', "FIFO",    0, "Stdin fifo, repeat to merge more fifos" },
+  { "weight",  'w', "WEIGHT",  0, "Fair share of the last stdin fifo" },
+  { "tag",     't', 0,         0, "Tag merged lines with their fifo" },
+  { "control", 'c', 0,         0, "Put the last stdin fifo in the control lane" },
+  { "control-prefix", 'C', "PREFIX", 0, "Put lines starting with prefix in the control lane" },
+  { "stdout",  'o', "FIFO",    0, "Stdout fifo, repeat to share the lines among more fifos (|COMMAND for a worker)" },
+  { "fanout",  'm', "POLICY",  0, "Share the lines by round-robin, least-queued or hash[:FIELD]" },
+  { "persist", 'K', 0,         0, "Create the fifos, and keep them open when their other end restarts" },
+  { "idle-flush", 'I', "USEC", 0, "Relay the start of a line after USEC microseconds without the rest" },
+  { "raw",     'F', 0,         0, "Relay the bytes as they come, instead of lines" },
+  { "address", 'a', "ADDRESS", 0, "Network address, or ADDRESS[:PORT] repeated with a spool to fail over" },
   { "port",    'p', "PORT",    0, "Network port" },
   { "debug",   'd', 0,         0, "Print debug messages" },
+  { "stats",   's', 0,         0, "Print statistics on exit" },
+  { "pipe-size",   'P', "SIZE", 0, "Fifo capacity in bytes, or auto" },
+  { "sock-buffer", 'B', "SIZE", 0, "Socket buffer size in bytes, or auto" },
+  { "drain-timeout", 'T', "MS", 0, "Max milliseconds to drain on shutdown" },
+  { "stdin-rate",   'r', "BYTES[/BURST]", 0, "Max stdin bytes per second" },
+  { "stdin-lines",  'l', "LINES[/BURST]", 0, "Max stdin lines per second" },
+  { "stdout-rate",  'R', "BYTES[/BURST]", 0, "Max stdout bytes per second" },
+  { "stdout-lines", 'L', "LINES[/BURST]", 0, "Max stdout lines per second" },
+  { "compress",     'z', 0,               0, "Compress the connection (zlib), if the peer agrees" },
+  { "delta",        'D', 0,               0, "Send lines as deltas to recent lines, if the peer agrees" },
+  { "checksum",     'k', 0,               0, "Check every line with a CRC32C, if the peer agrees" },
+  { "credit",       'W', "SIZE",          0, "Limit the bytes in flight, granted by the peer as it drains them" },
+  { "progress",     'g', 0,               0, "Report the progress of file transfers" },
+  { "stripes",      'n', "COUNT",         0, "Stripe the connection over COUNT connections, if the peer agrees" },
+  { "cpus",         'x', "LIST",          0, "Pin the threads to the CPUs (comma separated)" },
+  { "rt-priority",  'X', "PRIORITY",      0, "Run the threads under SCHED_FIFO" },
+  { "busy-poll",    'b', "USEC",          0, "Spin before blocking, in microseconds" },
+  { "spool",        'S', "DIR",           0, "Store lines on disk until the peer receives them" },
+  { "spool-size",   'Z', "SIZE",          0, "Max bytes in the spool" },
+  { "hub",          'H', 0,               0, "Route lines between clients, by topic" },
+  { "subscribe",    'u', "PREFIX",        0, "Subscribe to a topic prefix of the hub, repeatable" },
+  { "rpc",          'q', 0,               0, "Serve requests of clients by a worker, on the fifos" },
+  { "rpc-timeout",  'Q', "MS",            0, "Max milliseconds to wait for a reply" },
+  { "metrics",      'M', "TARGET",        0, "Serve metrics on a Unix socket (a path) or a localhost port" },
   { 0 }
 };
 
 struct args
 {
-  char*  stdin_path;
-  char*  stdout_path;
-  char*  address;
-  int    port;
-  bool   debug;
+  struct relay_config config;
+  bool   stats;
 };
 
 struct args args =
 {
-  .stdin_path  = NULL,
-  .stdout_path = NULL,
-  .address     = NULL,
-  .port        = -1,
-  .debug       = false
+  .config =
+  {
+    .stdin_path   = NULL,
+    .stdin_weight = 1,
+    .stdin_lane   = SCHED_LANE_BULK,
+    .stdout_path  = NULL,
+    .fifo_reverse = false,
+    .address      = NULL,
+    .port         = -1,
+    .debug        = false,
+    .embedded     = false,
+    .pipe_size    = 0,
+    .sock_buffer  = 0,
+    .drain_timeout = DEFAULT_DRAIN_TIMEOUT
+  },
+  .stats = false
 };
 
 /*
- * This is the option parsing function used by argp
+ * Parse a buffer size, either in bytes (with optional K or M suffix)
+ * or as the word auto
+ *
+ * RETURN (int size)
+ * - >0 | The parsed size
+ * -  0 | Invalid size, with trailing characters or out of range (max 1G)
+ * - -1 | Automatic size (PIPE_SIZE_AUTO and SOCKET_BUFFER_AUTO)
  */
-static error_t opt_parse(int key, char* arg, struct argp_state* state)
+static int size_parse(const char* arg)
 {
-  struct args* args = state->input;
+  if(!strcmp(arg, "auto")) return -1;
 
-  switch(key)
+  char* end = NULL;
+
+  errno = 0;
+
+  long size = strtol(arg, &end, 10);
+
+  if(end == arg || errno == ERANGE || size <= 0 || size > (1 << 30)) return 0;
+
+  if(*end == 'K' || *end == 'k')
   {
-    case 'i':
-      // If the output fifo has already been inputted,
-      // open the output fifo before the input fifo
-      if(args->stdout_path) fifo_reverse = true;
+    size *= 1024;
+    end++;
+  }
+  else if(*end == 'M' || *end == 'm')
+  {
+    size *= 1024 * 1024;
+    end++;
+  }
 
-      args->stdin_path = arg;
-      break;
+  // Anything after the size and its suffix makes it invalid
+  if(*end != '\0') return 0;
 
-    case 'o':
-      args->stdout_path = arg;
-      break;
+  return (size > 0 && size <= (1 << 30)) ? (int) size : 0;
+}
 
-    case 'a':
-      args->address = arg;
-      break;
+/*
+ * Parse a rate limit, as a rate with an optional burst after a slash
+ * (both with optional K or M suffix)
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Invalid rate or burst
+ */
+static int rate_parse(const char* arg, long* rate, long* burst)
+{
+  const char* slash = strchr(arg, '/');
 
-    case 'p':
-      int port = atoi(arg);
+  char rate_arg[32];
 
-      if(port != 0) args->port = port;
-      break;
+  size_t length = slash ? (size_t) (slash - arg) : strlen(arg);
 
-    case 'd':
-      args->debug = true;
-      break;
+  if(length == 0 || length >= sizeof(rate_arg)) return -1;
 
-    case ARGP_KEY_ARG:
-      break;
+  memcpy(rate_arg, arg, length);
+  rate_arg[length] = '\0';
 
-    case ARGP_KEY_END:
-      break;
+  int rate_size  = size_parse(rate_arg);
+  int burst_size = slash ? size_parse(slash + 1) : 0;
 
-    default:
-      return ARGP_ERR_UNKNOWN;
-  }
+  if(rate_size <= 0 || burst_size < 0 || (slash && burst_size == 0)) return -1;
+
+  *rate  = rate_size;
+  *burst = burst_size;
 
   return 0;
 }
 
 /*
- * The stdin thread reads from either [stdin] or [stdin fifo]
+ * Parse a fan-out policy: round-robin, least-queued or hash,
+ * optionally followed by the key field of hash after a colon
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Invalid policy or field
  */
-static ssize_t stdin_thread_read(char* buffer, size_t size)
+static int fanout_parse(const char* arg, int* policy, int* field)
 {
-  // 1. If both [stdin fifo] AND [socket] are connected, read from [stdin fifo]
-  if(stdin_fifo != -1 && sockfd != -1)
+  if(!strcmp(arg, "round-robin"))
   {
-    return buffer_read(stdin_fifo, buffer, size);
+    *policy = FANOUT_ROUND_ROBIN;
   }
-  // 2. If not both [stdin fifo] AND [socket] are connected, read from [stdin]
-  else
+  else if(!strcmp(arg, "least-queued"))
   {
-    return buffer_read(0, buffer, size);
+    *policy = FANOUT_LEAST_QUEUED;
   }
-}
-
-/*
- * The stdin thread writes to either [stdout fifo], [socket] or [stdout]
- */
-static ssize_t stdin_thread_write(const char* buffer, size_t size)
-{
-  // 1. If both [stdin fifo] and [socket] are connected, write to [socket]
-  if(stdin_fifo != -1 && sockfd != -1)
+  else if(!strncmp(arg, "hash", 4) && (arg[4] == '\0' || arg[4] == ':'))
   {
-    if(args.debug) debug_print(stdout, "FIFO => SOCKET", "%s\033[F", buffer);
+    *policy = FANOUT_HASH;
 
-    return socket_write(sockfd, buffer, size);
-  }
-  // 2. If both [stdout fifo] and [socket], but not [stdin fifo], are connected, write to [socket]
-  else if(stdout_fifo != -1 && sockfd != -1)
-  {
-    return socket_write(sockfd, buffer, size);
-  }
-  // 3. If [stdout fifo], but not [socket], is connected, write to [stdout fifo]
-  else if(stdout_fifo != -1)
-  {
-    return buffer_write(stdout_fifo, buffer, size);
-  }
-  // 4. If [socket], but not [stdout fifo], is connected, write to [socket]
-  else if(sockfd != -1)
-  {
-    return socket_write(sockfd, buffer, size);
-  }
-  // 5. If neither [stdout fifo] nor [socket] are connected, write to [stdout]
-  else
-  {
-    return buffer_write(1, buffer, size);
+    *field = (arg[4] == ':') ? atoi(arg + 5) : 1;
+
+    if(*field <= 0) return -1;
   }
-} 
+  else return -1;
+
+  return 0;
+}
 
 /*
- * The stdout thread reads from either [stdin fifo] or [socket]
+ * Parse a comma separated list of CPUs
  *
- * If neither [stdin fifo] nor [socket] are connected, nothing is done
+ * RETURN (int count)
+ * - >0 | The number of parsed CPUs
+ * -  0 | Invalid list
  */
-static ssize_t stdout_thread_read(char* buffer, size_t size)
+static int cpus_parse(const char* arg, int* cpus, int max)
 {
-  // 1. If both [stdin fifo] and [socket] are connected, read from [socket]
-  if(stdin_fifo != -1 && sockfd != -1)
-  {
-    return socket_read(sockfd, buffer, size);
-  }
-  // 2. If [socket], but not [stdin fifo], is connected, read from [socket]
-  else if(sockfd != -1)
-  {
-    return socket_read(sockfd, buffer, size);
-  }
-  // 3. If [stdin fifo], but not [socket], is connected, read from [stdin fifo]
-  else if(stdin_fifo != -1)
+  int count = 0;
+
+  const char* start = arg;
+
+  while(*start)
   {
-    return buffer_read(stdin_fifo, buffer, size);
+    char* end = NULL;
+
+    long cpu = strtol(start, &end, 10);
+
+    if(end == start || cpu < 0 || cpu >= CPU_SETSIZE || count == max) return 0;
+
+    cpus[count++] = cpu;
+
+    if(*end == ',') end++;
+
+    else if(*end != '\0') return 0;
+
+    start = end;
   }
-  // 4. If neither [stdin fifo] nor [socket] are connected, stdout thread should not be running
-  else return -1;
+
+  return count;
 }
 
 /*
- * The stdout thread writes to either [stdout fifo] or [stdout]
+ * This is the option parsing function used by argp
  */
-static ssize_t stdout_thread_write(const char* buffer, size_t size)
+static error_t opt_parse(int key, char* arg, struct argp_state* state)
 {
-  // 1. If both [stdout fifo] and [socket] are connected, write to [stdout fifo]
-  if(stdout_fifo != -1 && sockfd != -1)
-  {
-    if(args.debug) debug_print(stdout, "SOCKET => FIFO", "%s\033[F", buffer);
+  struct args* args = state->input;
 
-    return buffer_write(stdout_fifo, buffer, size);
-  }
-  // 2. Else, write to [stdout]
-  else
+  switch(key)
   {
-    return buffer_write(1, buffer, size);
-  }
-} 
+    case 'i':
+      // Every stdin fifo after the first is merged into the stream (fan-in)
+      if(args->config.stdin_path)
+      {
+        if(args->config.fanin_count >= RELAY_FANIN_MAX)
+        {
+          argp_error(state, "Too many stdin fifos (max %d)", RELAY_FANIN_MAX + 1);
+        }
+
+        args->config.fanin[args->config.fanin_count++] = (struct relay_input) { .path = arg, .weight = 1, .lane = SCHED_LANE_BULK };
+        break;
+      }
 
-/*
- * stdout routine - process that handles one way communication (usually output)
- *
- * This thread will read from somewhere and write to somewhere else,
- * depending on configuration of communication
- *
- * No need for a recieving routine if neither [stdin fifo] nor [socket] are connected
- */
-void* stdout_routine(void* arg)
-{
-  if(stdin_fifo == -1 && sockfd == -1) return NULL;
+      // If the output fifo has already been inputted,
+      // open the output fifo before the input fifo
+      if(args->config.stdout_path) args->config.fifo_reverse = true;
 
+      args->config.stdin_path = arg;
+      break;
 
-  if(args.debug) info_print("Start of stdout routine");
+    case 'w':
+      int weight = atoi(arg);
 
-  stdout_running = true;
+      if(weight <= 0) break;
 
-  char buffer[1024];
+      if(args->config.fanin_count > 0)
+      {
+        args->config.fanin[args->config.fanin_count - 1].weight = weight;
+      }
+      else args->config.stdin_weight = weight;
+      break;
 
-  int read_size = -1, write_size = -1;
+    case 't':
+      args->config.fanin_tag = true;
+      break;
 
-  while((read_size = stdout_thread_read(buffer, sizeof(buffer) - 1)) > 0)
-  {
-    // IMPORTANT: Terminate string after reading bytes
-    buffer[read_size] = '\0';
+    case 'c':
+      if(args->config.fanin_count > 0)
+      {
+        args->config.fanin[args->config.fanin_count - 1].lane = SCHED_LANE_CONTROL;
+      }
+      else args->config.stdin_lane = SCHED_LANE_CONTROL;
+      break;
 
-    if((write_size = stdout_thread_write(buffer, sizeof(buffer))) <= 0) break;
-  }
+    case 'C':
+      args->config.control_prefix = arg;
+      break;
 
-  if(errno != 0)
-  {
-    if(args.debug) error_print("%s", strerror(errno));
-  }
+    case 'o':
+      if(args->config.stdout_path)
+      {
+        if(args->config.fanout_count >= RELAY_FANOUT_MAX)
+        {
+          argp_error(state, "Too many stdout fifos (max %d)", RELAY_FANOUT_MAX + 1);
+        }
+
+        args->config.fanout[args->config.fanout_count++] = arg;
+        break;
+      }
+
+      args->config.stdout_path = arg;
+      break;
 
-  if(stdin_running)
-  {
-    if(args.debug) info_print("Interrupting stdin routine");
+    case 'm':
+      if(fanout_parse(arg, &args->config.fanout_policy, &args->config.fanout_field) != 0)
+      {
+        argp_error(state, "Invalid fan-out policy: %s", arg);
+      }
+      break;
 
-    pthread_kill(stdin_thread, SIGUSR1);
-  }
+    case 'K':
+      args->config.persist = true;
+      break;
 
-  stdout_running = false;
+    case 'I':
+      long idle_flush = atol(arg);
 
-  if(args.debug) info_print("End of stdout routine");
+      if(idle_flush <= 0) argp_error(state, "Invalid idle flush: %s", arg);
 
-  return NULL;
-}
+      args->config.idle_flush = idle_flush;
+      break;
 
-/*
- * stdin routine - process that handles one way communication (usually input)
- *
- * This thread will read from somewhere and write to somewhere else,
- * depending on configuration of communication
- *
- * No need for an inputting end, if ONLY [stdin fifo] is connected
- */
-void* stdin_routine(void* arg)
-{
-  if(stdin_fifo != -1 && sockfd == -1 && stdout_fifo == -1) return NULL;
+    case 'F':
+      args->config.raw = true;
+      break;
 
+    case 'a':
+      if(args->config.address_count >= RELAY_ADDRESS_MAX)
+      {
+        argp_error(state, "Too many addresses (max %d)", RELAY_ADDRESS_MAX);
+      }
 
-  if(args.debug) info_print("Start of stdin routine");
+      args->config.addresses[args->config.address_count++] = arg;
 
-  stdin_running = true;
+      args->config.address = args->config.addresses[0];
+      break;
 
-  char buffer[1024];
+    case 'p':
+      int port = atoi(arg);
 
-  int read_size = -1, write_size = -1;
+      if(port != 0) args->config.port = port;
+      break;
 
-  while((read_size = stdin_thread_read(buffer, sizeof(buffer) - 1)) > 0)
-  {
-    // IMPORTANT: Terminate string after reading bytes
-    buffer[read_size] = '\0';
+    case 'd':
+      args->config.debug = true;
+      break;
 
-    if((write_size = stdin_thread_write(buffer, sizeof(buffer))) <= 0) break;
-  }
+    case 's':
+      args->stats = true;
+      break;
 
-  if(errno != 0)
-  {
-    if(args.debug) error_print("%s", strerror(errno));
-  }
+    case 'P':
+      int pipe_size = size_parse(arg);
 
-  if(stdout_running)
-  {
-    if(args.debug) info_print("Interrupting stdout routine");
+      if(pipe_size == 0) argp_error(state, "Invalid pipe size: %s", arg);
 
-    pthread_kill(stdout_thread, SIGUSR1);
-  }
+      args->config.pipe_size = pipe_size;
+      break;
+
+    case 'B':
+      int sock_buffer = size_parse(arg);
 
-  stdin_running = false;
+      if(sock_buffer == 0) argp_error(state, "Invalid socket buffer size: %s", arg);
+
+      args->config.sock_buffer = sock_buffer;
+      break;
+
+    case 'T':
+      long drain_timeout = atol(arg);
+
+      if(drain_timeout > 0) args->config.drain_timeout = drain_timeout;
+      break;
+
+    case 'r':
+      if(rate_parse(arg, &args->config.stdin_limit.bytes, &args->config.stdin_limit.bytes_burst) != 0)
+      {
+        argp_error(state, "Invalid rate: %s", arg);
+      }
+      break;
 
-  if(args.debug) info_print("End of stdin routine");
+    case 'l':
+      if(rate_parse(arg, &args->config.stdin_limit.lines, &args->config.stdin_limit.lines_burst) != 0)
+      {
+        argp_error(state, "Invalid rate: %s", arg);
+      }
+      break;
+
+    case 'R':
+      if(rate_parse(arg, &args->config.stdout_limit.bytes, &args->config.stdout_limit.bytes_burst) != 0)
+      {
+        argp_error(state, "Invalid rate: %s", arg);
+      }
+      break;
+
+    case 'L':
+      if(rate_parse(arg, &args->config.stdout_limit.lines, &args->config.stdout_limit.lines_burst) != 0)
+      {
+        argp_error(state, "Invalid rate: %s", arg);
+      }
+      break;
+
+    case 'z':
+      args->config.compress = CODEC_ZLIB;
+      break;
+
+    case 'D':
+      args->config.delta = true;
+      break;
+
+    case 'k':
+      args->config.checksum = true;
+      break;
+
+    case 'W':
+      int credit_window = size_parse(arg);
+
+      if(credit_window < CREDIT_WINDOW_MIN)
+      {
+        argp_error(state, "Invalid credit window (min %d): %s", CREDIT_WINDOW_MIN, arg);
+      }
+
+      args->config.credit_window = credit_window;
+      break;
+
+    case 'g':
+      args->config.progress = true;
+      break;
+
+    case 'n':
+      int stripes = atoi(arg);
+
+      if(stripes < 1 || stripes > STRIPES_MAX)
+      {
+        argp_error(state, "Invalid number of stripes (1 - %d): %s", STRIPES_MAX, arg);
+      }
+
+      args->config.stripes = stripes;
+      break;
+
+    case 'x':
+      if((args->config.cpu_count = cpus_parse(arg, args->config.cpus, RELAY_CPUS_MAX)) == 0)
+      {
+        argp_error(state, "Invalid CPU list: %s", arg);
+      }
+      break;
+
+    case 'X':
+      int priority = atoi(arg);
+
+      if(priority < sched_get_priority_min(SCHED_FIFO) || priority > sched_get_priority_max(SCHED_FIFO))
+      {
+        argp_error(state, "Invalid SCHED_FIFO priority: %s", arg);
+      }
+
+      args->config.rt_priority = priority;
+      break;
 
-  return NULL;
+    case 'b':
+      long busy_poll = atol(arg);
+
+      if(busy_poll > 0) args->config.busy_poll = busy_poll;
+      break;
+
+    case 'S':
+      args->config.spool_path = arg;
+      break;
+
+    case 'Z':
+      int spool_size = size_parse(arg);
+
+      if(spool_size <= 0) argp_error(state, "Invalid spool size: %s", arg);
+
+      args->config.spool_size = spool_size;
+      break;
+
+    case 'H':
+      args->config.hub = true;
+      break;
+
+    case 'u':
+      if(args->config.subscribe_count >= RELAY_SUBSCRIBE_MAX)
+      {
+        argp_error(state, "Too many subscriptions (max %d)", RELAY_SUBSCRIBE_MAX);
+      }
+
+      args->config.subscribe[args->config.subscribe_count++] = arg;
+      break;
+
+    case 'q':
+      args->config.rpc = true;
+      break;
+
+    case 'Q':
+      long rpc_timeout = atol(arg);
+
+      if(rpc_timeout <= 0) argp_error(state, "Invalid RPC timeout: %s", arg);
+
+      args->config.rpc_timeout = rpc_timeout;
+      break;
+
+    case 'M':
+      args->config.metrics = arg;
+      break;
+
+    case ARGP_KEY_ARG:
+      break;
+
+    case ARGP_KEY_END:
+      if(args->config.address_count > 1 && !args->config.spool_path)
+      {
+        argp_error(state, "More addresses are only used with a spool");
+      }
+
+      if(args->config.address && strchr(args->config.address, ':') && !args->config.spool_path)
+      {
+        argp_error(state, "A port in the address is only used with a spool, use --port");
+      }
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+
+  return 0;
 }
 
 /*
@@ -307,11 +519,9 @@ void* stdin_routine(void* arg)
  */
 static void sigint_handler(int signum)
 {
-  if(args.debug) info_print("Keyboard interrupt");
-
-  if(stdin_running)  pthread_kill(stdin_thread, SIGUSR1);
+  if(args.config.debug) info_print("Keyboard interrupt");
 
-  if(stdout_running) pthread_kill(stdout_thread, SIGUSR1);
+  relay_interrupt(relay);
 }
 
 /*
@@ -319,20 +529,11 @@ static void sigint_handler(int signum)
  */
 static void sigpipe_handler(int signum)
 {
-  if(args.debug) error_print("Pipe has been broken");
+  if(args.config.debug) error_print("Pipe has been broken");
 
-  if(stdin_running)  pthread_kill(stdin_thread, SIGUSR1);
-
-  if(stdout_running) pthread_kill(stdout_thread, SIGUSR1);
+  relay_interrupt(relay);
 }
 
-/*
- * SIGUSR1 is the signal used to interrupt stdin and stdout routine
- *
- * The signal doesn't need to be processed, just interrupt
- */
-static void sigusr1_handler(int signum) { }
-
 /*
  * Setup handler for specified signal
  *
@@ -357,29 +558,6 @@ static void signals_handler_setup(void)
   signal_handler_setup(SIGPIPE, sigpipe_handler);
 
   signal_handler_setup(SIGINT,  sigint_handler);
-
-  signal_handler_setup(SIGUSR1, sigusr1_handler);
-}
-
-/*
- * If either an address or a port has been inputted,
- * the program should connect to a socket
- *
- * RETURN (same as client_or_server_socket_create)
- * - 0 | Success
- * - 1 | Failed to create socket
- *
- * Note: Success can be omitted, without a socket being created
- */
-static int args_socket_create(void)
-{
-  if(!args.address && args.port == -1) return 0;
-
-  if(!args.address)   args.address = DEFAULT_ADDRESS;
-
-  if(args.port == -1) args.port    = DEFAULT_PORT;
-
-  return client_or_server_socket_create(&sockfd, &servfd, args.address, args.port, args.debug);
 }
 
 static struct argp argp = { options, opt_parse, args_doc, doc };
@@ -394,25 +572,29 @@ int main(int argc, char* argv[])
   signals_handler_setup();
 
 
-  if(args_socket_create() == 0)
+  if(!(relay = relay_create(&args.config)))
+  {
+    if(args.config.debug) error_print("Failed to create relay");
+
+    return 1;
+  }
+
+  if(relay_start(relay) == 0)
   {
-    if(stdin_stdout_fifo_open(&stdin_fifo, args.stdin_path, &stdout_fifo, args.stdout_path, fifo_reverse, args.debug) == 0)
-    {
-      stdin_stdout_thread_start(&stdin_thread, &stdin_routine, &stdout_thread, &stdout_routine, args.debug);
-    }
+    relay_wait(relay);
   }
 
+  if(args.stats) stats_print(&relay->stats);
 
-  fifo_close(&stdin_fifo, args.debug);
 
-  fifo_close(&stdout_fifo, args.debug);
+  struct relay* ended_relay = relay;
 
-  socket_close(&sockfd, args.debug);
+  relay = NULL;
 
-  socket_close(&servfd, args.debug);
+  relay_destroy(ended_relay);
 
 
-  if(args.debug) info_print("End of main");
+  if(args.config.debug) info_print("End of main");
 
   return 0;
 }
@@ -0,0 +1,250 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "queue.h"
+
+/*
+ * Initialize an empty queue
+ *
+ * PARAMS
+ * - size_t capacity | Max bytes in the queue, 0 is unbounded
+ *
+ * RETURN (int status)
+ * - 0 | Success
+ * - 1 | Failed to initialize lock or condition
+ */
+int queue_init(struct queue* queue, size_t capacity)
+{
+  memset(queue, 0, sizeof(struct queue));
+
+  queue->capacity = capacity;
+
+  if(pthread_mutex_init(&queue->lock, NULL) != 0) return 1;
+
+  if(event_cond_init(&queue->cond) != 0)
+  {
+    pthread_mutex_destroy(&queue->lock);
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Free the queued messages and the lock of the queue
+ *
+ * Note: No thread may be using the queue anymore
+ */
+void queue_free(struct queue* queue)
+{
+  struct message* message = queue->head;
+
+  while(message)
+  {
+    struct message* next = message->next;
+
+    free(message);
+
+    message = next;
+  }
+
+  queue->head = queue->tail = NULL;
+
+  pthread_cond_destroy(&queue->cond);
+
+  pthread_mutex_destroy(&queue->lock);
+}
+
+/*
+ * Close the queue, so that nothing more can be written
+ *
+ * Threads waiting on the queue are woken up.
+ * The bytes left in the queue can still be read
+ */
+void queue_close(struct queue* queue)
+{
+  pthread_mutex_lock(&queue->lock);
+
+  queue->closed = true;
+
+  pthread_cond_broadcast(&queue->cond);
+
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Wake up the threads waiting on the queue,
+ * so that they can check if their event has been signaled
+ */
+void queue_wake(struct queue* queue)
+{
+  pthread_mutex_lock(&queue->lock);
+
+  pthread_cond_broadcast(&queue->cond);
+
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Check if there are bytes in the queue to read
+ */
+bool queue_pending(struct queue* queue)
+{
+  pthread_mutex_lock(&queue->lock);
+
+  bool pending = (queue->size > 0);
+
+  pthread_mutex_unlock(&queue->lock);
+
+  return pending;
+}
+
+/*
+ * Read a single line from the queue, just like reader_line
+ *
+ * If the queue is empty, wait until bytes have been written
+ *
+ * PARAMS
+ * - int event    | Event to cancel the read, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
+ *
+ * RETURN (ssize_t size)
+ * - >0 | Success! The length of the read line
+ * -  0 | The queue is closed and empty, End of File
+ * - -1 | The event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ */
+ssize_t queue_read(struct queue* queue, char* buffer, size_t size, int event, long timeout)
+{
+  if(!buffer) return 0;
+
+  struct timespec deadline;
+
+  if(timeout != -1) deadline_set(&deadline, timeout);
+
+  pthread_mutex_lock(&queue->lock);
+
+  while(!queue->closed && queue->size == 0)
+  {
+    int status = event_cond_wait(&queue->cond, &queue->lock, event, timeout, &deadline);
+
+    if(status != 0)
+    {
+      pthread_mutex_unlock(&queue->lock);
+
+      errno = (status == 1) ? ECANCELED : ETIMEDOUT;
+
+      return -1;
+    }
+  }
+
+  char symbol = '\0';
+  ssize_t index;
+
+  for(index = 0; index < size && symbol != '\n' && queue->head; index++)
+  {
+    struct message* message = queue->head;
+
+    symbol = message->data[queue->offset++];
+
+    buffer[index] = symbol;
+
+    if(queue->offset == message->size)
+    {
+      queue->head = message->next;
+
+      if(!queue->head) queue->tail = NULL;
+
+      queue->offset = 0;
+
+      free(message);
+    }
+  }
+
+  queue->size -= index;
+
+  pthread_cond_broadcast(&queue->cond);
+
+  pthread_mutex_unlock(&queue->lock);
+
+  return index;
+}
+
+/*
+ * Write a chunk of bytes to the end of the queue, just like buffer_write
+ *
+ * If the queue is full, wait until bytes have been read
+ *
+ * PARAMS
+ * - int event    | Event to cancel the write, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
+ *
+ * RETURN (ssize_t size)
+ * - >=0 | The number of written bytes. If not the whole buffer,
+ *         the event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ * -  -1 | The queue is closed (EPIPE), or failed to allocate memory
+ */
+ssize_t queue_write(struct queue* queue, const char* buffer, size_t size, int event, long timeout)
+{
+  if(!buffer || size == 0) return 0;
+
+  struct message* message = malloc(sizeof(struct message) + size);
+
+  if(!message) return -1;
+
+  message->next = NULL;
+  message->size = size;
+
+  memcpy(message->data, buffer, size);
+
+  struct timespec deadline;
+
+  if(timeout != -1) deadline_set(&deadline, timeout);
+
+  pthread_mutex_lock(&queue->lock);
+
+  // A chunk larger than the capacity is let through when the queue is empty
+  while(!queue->closed && queue->capacity > 0 && queue->size > 0 && queue->size + size > queue->capacity)
+  {
+    int status = event_cond_wait(&queue->cond, &queue->lock, event, timeout, &deadline);
+
+    if(status != 0)
+    {
+      pthread_mutex_unlock(&queue->lock);
+
+      free(message);
+
+      errno = (status == 1) ? ECANCELED : ETIMEDOUT;
+
+      return 0;
+    }
+  }
+
+  if(queue->closed)
+  {
+    pthread_mutex_unlock(&queue->lock);
+
+    free(message);
+
+    errno = EPIPE;
+
+    return -1;
+  }
+
+  if(queue->tail) queue->tail->next = message;
+
+  else queue->head = message;
+
+  queue->tail = message;
+
+  queue->size += size;
+
+  pthread_cond_broadcast(&queue->cond);
+
+  pthread_mutex_unlock(&queue->lock);
+
+  return size;
+}
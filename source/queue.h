@@ -0,0 +1,63 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "event.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/*
+ * A chunk of bytes in a queue
+ */
+struct message
+{
+  struct message* next;
+  size_t          size;
+  char            data[];
+};
+
+/*
+ * Thread safe byte queue, used to hand data between
+ * the relay threads and an application embedding the relay
+ *
+ * Bytes are written in chunks and read line by line,
+ * just like a fifo
+ */
+struct queue
+{
+  struct message* head;
+  struct message* tail;
+  size_t          offset;   // Bytes already read from head
+  size_t          size;     // Bytes in the queue
+  size_t          capacity; // Max bytes in the queue, 0 is unbounded
+  bool            closed;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+};
+
+extern int  queue_init(struct queue* queue, size_t capacity);
+
+extern void queue_free(struct queue* queue);
+
+extern void queue_close(struct queue* queue);
+
+extern void queue_wake(struct queue* queue);
+
+extern bool queue_pending(struct queue* queue);
+
+
+extern ssize_t queue_read(struct queue* queue, char* buffer, size_t size, int event, long timeout);
+
+extern ssize_t queue_write(struct queue* queue, const char* buffer, size_t size, int event, long timeout);
+
+#endif // QUEUE_H
@@ -0,0 +1,332 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "reader.h"
+
+/*
+ * Initialize a reader of a file descriptor
+ */
+void reader_init(struct reader* reader, int fd)
+{
+  reader->fd    = fd;
+  reader->eof   = false;
+  reader->start = 0;
+  reader->end   = 0;
+  reader->codec = NULL;
+
+  reader->idle_flush = 0;
+  reader->raw        = false;
+
+  int flags = fcntl(fd, F_GETFL);
+
+  reader->blocking = (flags == -1 || !(flags & O_NONBLOCK));
+
+  reader->mapped   = false;
+  reader->map      = NULL;
+  reader->map_size = 0;
+  reader->map_pos  = 0;
+
+  struct stat status;
+
+  // A regular file is mapped from its current offset, the first time it is read
+  if(fstat(fd, &status) == 0 && S_ISREG(status.st_mode))
+  {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+
+    if(offset != -1)
+    {
+      reader->mapped     = true;
+      reader->map_offset = offset;
+      reader->file_size  = status.st_size;
+    }
+  }
+}
+
+/*
+ * Unmap the window of a mapped reader
+ */
+void reader_free(struct reader* reader)
+{
+  if(reader->map) munmap(reader->map, reader->map_size);
+
+  reader->map = NULL;
+
+  reader->map_size = 0;
+}
+
+/*
+ * Map the next window of a regular file, starting at the next line
+ *
+ * The handed out part of the last window is dropped from the page cache,
+ * so that relaying a large file does not push out everything else
+ *
+ * RETURN (int status)
+ * -  1 | Success
+ * -  0 | End of File
+ * - -1 | Failed to map the file
+ */
+static int reader_map(struct reader* reader)
+{
+  off_t position = reader->map_offset + reader->map_pos;
+
+  if(reader->map)
+  {
+    munmap(reader->map, reader->map_size);
+
+    posix_fadvise(reader->fd, reader->map_offset, reader->map_pos, POSIX_FADV_DONTNEED);
+
+    reader->map = NULL;
+  }
+
+  // The file may have grown since it was last looked at
+  if(position >= reader->file_size)
+  {
+    struct stat status;
+
+    if(fstat(reader->fd, &status) == -1) return -1;
+
+    reader->file_size = status.st_size;
+
+    if(position >= reader->file_size)
+    {
+      reader->map_offset = position;
+      reader->map_size   = 0;
+      reader->map_pos    = 0;
+
+      return 0;
+    }
+  }
+
+  // A mapping starts at a page boundary
+  off_t offset = position - (position % sysconf(_SC_PAGESIZE));
+
+  size_t size = reader->file_size - offset;
+
+  if(size > READER_MAP_WINDOW) size = READER_MAP_WINDOW;
+
+  char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, reader->fd, offset);
+
+  if(map == MAP_FAILED) return -1;
+
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  reader->map        = map;
+  reader->map_size   = size;
+  reader->map_offset = offset;
+  reader->map_pos    = position - offset;
+
+  return 1;
+}
+
+/*
+ * Borrow a single line from the mapping of a regular file
+ *
+ * A line is ended by '\n', or cut at size. The line stays
+ * valid until the next line is read from the reader
+ *
+ * RETURN (ssize_t size)
+ * - >0 | Success! The length of the line
+ * -  0 | End of File
+ * - -1 | Failed to map the file, or the reader is not mapped (EINVAL)
+ */
+ssize_t reader_borrow(struct reader* reader, const char** line, size_t size)
+{
+  if(!reader->mapped)
+  {
+    errno = EINVAL;
+
+    return -1;
+  }
+
+  while(true)
+  {
+    size_t length = reader->map_size - reader->map_pos;
+
+    size_t search = (length < size) ? length : size;
+
+    const char* start = reader->map + reader->map_pos;
+
+    const char* newline = (length && !reader->raw) ? memchr(start, '\n', search) : NULL;
+
+    bool last = (reader->map_offset + (off_t) reader->map_size >= reader->file_size);
+
+    // 1. If the line is whole in the window, or has to be cut, hand it out
+    if(newline || length >= size || (length > 0 && (last || reader->raw)))
+    {
+      size_t line_size = newline ? (size_t) (newline - start + 1) : search;
+
+      *line = start;
+
+      reader->map_pos += line_size;
+
+      return line_size;
+    }
+
+    // 2. Else, the line goes on in the next window
+    int status = reader_map(reader);
+
+    if(status == 0) reader->eof = true;
+
+    if(status != 1) return status;
+  }
+}
+
+/*
+ * Hand out the first bytes of the buffer
+ *
+ * RETURN (ssize_t size)
+ * - The number of copied bytes
+ */
+static ssize_t reader_take(struct reader* reader, char* buffer, size_t size)
+{
+  memcpy(buffer, reader->buffer + reader->start, size);
+
+  reader->start += size;
+
+  if(reader->start == reader->end) reader->start = reader->end = 0;
+
+  return size;
+}
+
+/*
+ * Read as much as is available from the file descriptor to the buffer
+ *
+ * RETURN (int status)
+ * -  0 | Success, or nothing available yet
+ * - -1 | Failed to read
+ */
+static int reader_fill(struct reader* reader)
+{
+  // Move the buffered bytes to the front, to make room for more
+  if(reader->start > 0)
+  {
+    memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+
+    reader->end  -= reader->start;
+    reader->start = 0;
+  }
+
+  ssize_t status;
+
+  if(reader->codec)
+  {
+    status = codec_read(reader->codec, reader->fd, reader->buffer + reader->end, READER_SIZE - reader->end);
+  }
+  else status = read(reader->fd, reader->buffer + reader->end, READER_SIZE - reader->end);
+
+  if(status > 0) reader->end += status;
+
+  else if(status == 0) reader->eof = true;
+
+  else if(errno != EAGAIN && errno != EINTR) return -1;
+
+  return 0;
+}
+
+/*
+ * Check if a line can be read right away
+ *
+ * RETURN (bool pending)
+ * - true  | A whole line is buffered, or the file descriptor is readable
+ * - false | Reading a line would have to wait
+ */
+bool reader_pending(struct reader* reader)
+{
+  if(reader->mapped && !reader->codec) return !reader->eof;
+
+  if(memchr(reader->buffer + reader->start, '\n', reader->end - reader->start)) return true;
+
+  if(reader->eof) return false;
+
+  return event_wait(reader->fd, POLLIN, -1, 0) == 0;
+}
+
+/*
+ * Read a single line to a buffer
+ *
+ * A line is ended by '\n', or cut at the size of the buffer
+ *
+ * PARAMS
+ * - int event    | Event to cancel the read, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait for more bytes, -1 to wait forever
+ *
+ * If the wait times out, the bytes of an incomplete line are handed out,
+ * as they are if the rest of the line is idle for longer than the idle flush
+ *
+ * RETURN (ssize_t size)
+ * - >0 | Success! The length of the read line
+ * -  0 | End of File
+ * - -1 | Failed to read, the event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ */
+ssize_t reader_line(struct reader* reader, char* buffer, size_t size, int event, long timeout)
+{
+  if(!buffer || size == 0) return 0;
+
+  if(reader->mapped && !reader->codec)
+  {
+    const char* line;
+
+    ssize_t line_size = reader_borrow(reader, &line, size);
+
+    if(line_size > 0) memcpy(buffer, line, line_size);
+
+    return line_size;
+  }
+
+  while(true)
+  {
+    size_t length = reader->end - reader->start;
+
+    size_t search = (length < size) ? length : size;
+
+    char* newline = memchr(reader->buffer + reader->start, '\n', search);
+
+    if(newline) return reader_take(reader, buffer, newline - (reader->buffer + reader->start) + 1);
+
+    if(length >= size) return reader_take(reader, buffer, size);
+
+    if(reader->eof) return reader_take(reader, buffer, length);
+
+    if(reader->raw && length > 0) return reader_take(reader, buffer, length);
+
+    // A non-blocking fd is read directly, and only waited on when it is empty
+    if(!reader->blocking)
+    {
+      size_t end = reader->end;
+
+      if(reader_fill(reader) == -1) return -1;
+
+      if(reader->end != end || reader->eof) continue;
+    }
+
+    int status;
+
+    // An incomplete line waits for its rest for at most the idle flush
+    if(length > 0 && reader->idle_flush > 0 && (timeout == -1 || reader->idle_flush < timeout * 1000))
+    {
+      status = event_wait_us(reader->fd, POLLIN, event, reader->idle_flush);
+    }
+    else status = event_wait(reader->fd, POLLIN, event, timeout);
+
+    if(status == 1)
+    {
+      errno = ECANCELED;
+
+      return -1;
+    }
+    else if(status == 2)
+    {
+      if(length > 0) return reader_take(reader, buffer, length);
+
+      errno = ETIMEDOUT;
+
+      return -1;
+    }
+    else if(status == -1) return -1;
+
+    if(reader->blocking && reader_fill(reader) == -1) return -1;
+  }
+}
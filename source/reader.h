@@ -0,0 +1,74 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef READER_H
+#define READER_H
+
+#include "event.h"
+#include "codec.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define READER_SIZE 65536
+
+/*
+ * Bytes of a regular file mapped at a time
+ */
+#define READER_MAP_WINDOW (64 * 1024 * 1024)
+
+/*
+ * Buffered line reader of a fifo, a socket or stdin
+ *
+ * The file descriptor is read in large chunks,
+ * and the lines are handed out from the buffer
+ *
+ * If the reader has a codec, the read bytes are decompressed
+ *
+ * With an idle flush, the start of a line is handed out if the rest of
+ * the line does not come in time, such as a prompt. In raw mode, the bytes
+ * are handed out as soon as they come, whether they end a line or not
+ *
+ * A regular file is instead mapped, a window at a time, and the lines
+ * are handed out from the mapping without any system calls. The windows
+ * that have been handed out are unmapped, and dropped from the page cache
+ */
+struct reader
+{
+  int    fd;
+  bool   blocking; // The fd is blocking, so always wait before reading
+  bool   eof;
+  size_t start;
+  size_t end;
+  struct codec* codec; // NULL to not decompress
+  long   idle_flush; // Microseconds to wait for the rest of a line, 0 to wait for a whole line
+  bool   raw;        // Hand out the bytes as they come, instead of lines
+  bool   mapped;     // The fd is a regular file, read through mappings
+  char*  map;        // The mapped window, or NULL
+  size_t map_size;
+  size_t map_pos;    // Position of the next line in the window
+  off_t  map_offset; // Offset of the window in the file
+  off_t  file_size;
+  char   buffer[READER_SIZE];
+};
+
+extern void    reader_init(struct reader* reader, int fd);
+
+extern void    reader_free(struct reader* reader);
+
+extern bool    reader_pending(struct reader* reader);
+
+extern ssize_t reader_line(struct reader* reader, char* buffer, size_t size, int event, long timeout);
+
+extern ssize_t reader_borrow(struct reader* reader, const char** line, size_t size);
+
+#endif // READER_H
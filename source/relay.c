@@ -0,0 +1,2973 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "relay.h"
+
+/*
+ * Max bytes in the feed and drain queues of an embedded relay
+ */
+#define QUEUE_CAPACITY (1 << 20)
+
+/*
+ * Max unsent bytes in the socket when priority lanes are used
+ *
+ * Keeping the kernel queue short lets control lines
+ * overtake bulk lines in the relay, instead of behind the socket
+ */
+#define NOTSENT_LOWAT (64 * 1024)
+
+/*
+ * Milliseconds between the attempts to reach the peer in spool mode
+ */
+#define SPOOL_BACKOFF_MIN 100
+#define SPOOL_BACKOFF_MAX 5000
+
+/*
+ * State of a routine
+ *
+ * A routine relays until the relay is stopped, and then drains:
+ * what is already readable is written, until the drain deadline
+ */
+struct routine
+{
+  int             event;    // Event that stops the relay, -1 when draining
+  struct timespec deadline; // End of the drain phase
+};
+
+/*
+ * Start the drain phase of a routine
+ */
+static void routine_drain(struct relay* relay, struct routine* routine, const char* name)
+{
+  if(routine->event == -1) return;
+
+  // A due grant wakes the stdin routine, without stopping it
+  if(relay->credit.open && routine->event == relay->credit.wake)
+  {
+    event_reset(routine->event);
+
+    if(!event_signaled(relay->event)) return;
+  }
+
+  if(relay->config.debug) info_print("Draining %s routine", name);
+
+  routine->event = -1;
+
+  deadline_set(&routine->deadline, relay->config.drain_timeout);
+}
+
+/*
+ * Milliseconds a routine may wait to read
+ *
+ * While draining, only what is already readable is read
+ */
+static long routine_read_timeout(const struct routine* routine)
+{
+  return (routine->event == -1) ? 0 : -1;
+}
+
+/*
+ * Milliseconds a routine may wait to write
+ *
+ * While draining, the routine may wait until the drain deadline
+ */
+static long routine_write_timeout(const struct routine* routine)
+{
+  return (routine->event == -1) ? deadline_timeout(&routine->deadline) : -1;
+}
+
+/*
+ * Check if a routine should keep on relaying
+ *
+ * RETURN (bool running)
+ * - true  | Relaying, or draining before the deadline
+ * - false | The drain deadline has passed
+ */
+static bool routine_running(const struct routine* routine)
+{
+  return routine->event != -1 || deadline_timeout(&routine->deadline) > 0;
+}
+
+/*
+ * Write a whole buffer using one of the thread write functions
+ *
+ * If the relay is stopped in the middle of the write,
+ * the rest of the buffer is written before the drain deadline
+ *
+ * RETURN (ssize_t size)
+ * - >=0 | The number of written bytes. If not the whole buffer,
+ *         the drain deadline has passed (ETIMEDOUT)
+ * -  -1 | Failed to write
+ */
+static ssize_t routine_write(struct relay* relay, struct routine* routine, const char* name, ssize_t (*thread_write) (struct relay*, const char*, size_t, int, long), const char* buffer, size_t size)
+{
+  size_t index = 0;
+
+  while(index < size)
+  {
+    ssize_t write_size = thread_write(relay, buffer + index, size - index, routine->event, routine_write_timeout(routine));
+
+    if(write_size == -1) return -1;
+
+    index += write_size;
+
+    if(index == size) break;
+
+    if(errno != ECANCELED) break;
+
+    routine_drain(relay, routine, name);
+  }
+
+  return index;
+}
+
+/*
+ * Wait until a line may pass the rate limit of a routine
+ *
+ * If the relay is stopped while waiting,
+ * the line may still pass before the drain deadline
+ *
+ * RETURN (int status)
+ * -  0 | The line may pass
+ * - -1 | The drain deadline has passed (ETIMEDOUT), or error
+ */
+static int routine_shape(struct relay* relay, struct routine* routine, const char* name, struct shaper* shaper, size_t size)
+{
+  if(!shaper_limited(shaper)) return 0;
+
+  while(shaper_wait(shaper, size, routine->event, routine_write_timeout(routine)) == -1)
+  {
+    if(errno != ECANCELED) return -1;
+
+    routine_drain(relay, routine, name);
+  }
+
+  return 0;
+}
+
+/*
+ * Tune the thread of a routine for latency, as configured
+ *
+ * PARAMS
+ * - int thread | 0 for stdin, 1 for stdout, 2 and up for the fan-in sources
+ */
+static void routine_tune(struct relay* relay, int thread)
+{
+  struct relay_config* config = &relay->config;
+
+  int cpu = (config->cpu_count > 0) ? config->cpus[thread % config->cpu_count] : -1;
+
+  thread_tune(cpu, config->rt_priority, config->debug);
+
+  event_spin_set(config->busy_poll);
+}
+
+/*
+ * Block SIGPIPE in the thread of a routine that writes to the fan-out fifos,
+ * like rpc_run does, so that a consumer that goes away fails the write
+ * with EPIPE and is dropped from the pool, instead of stopping the relay
+ */
+static void routine_sigpipe_block(struct relay* relay)
+{
+  if(relay->fanout.count == 0) return;
+
+  sigset_t sigset;
+  sigemptyset(&sigset);
+  sigaddset(&sigset, SIGPIPE);
+
+  pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+}
+
+/*
+ * Stop the relay from one of its routines
+ *
+ * The other routine drains, and then ends
+ */
+static void relay_cancel(struct relay* relay)
+{
+  event_signal(relay->event);
+
+  queue_wake(&relay->feed_queue);
+
+  queue_wake(&relay->drain_queue);
+
+  lend_wake(&relay->lend);
+
+  sched_wake(&relay->sched);
+
+  if(relay->spool.open) spool_wake(&relay->spool);
+
+  // The stdin routine waits on the wake of the credits
+  if(relay->credit.open) event_signal(relay->credit.wake);
+}
+
+/*
+ * Wake the stdin routine to send the grant that is due,
+ * as it is the only writer of [socket]
+ */
+static void relay_credit_wake(struct relay* relay)
+{
+  credit_wake(&relay->credit);
+
+  queue_wake(&relay->feed_queue);
+
+  sched_wake(&relay->sched);
+}
+
+/*
+ * Read from [stdin fifo], or from the merged stream if more stdin fifos are connected
+ */
+static ssize_t stdin_fifo_read(struct relay* relay, struct reader* reader, char* buffer, size_t size, int event, long timeout)
+{
+  if(relay->source_count > 0)
+  {
+    return sched_pop(&relay->sched, buffer, size, event);
+  }
+  else return reader_line(reader, buffer, size, event, timeout);
+}
+
+/*
+ * Check if the relay sends to a peer, either through [socket] or [spool]
+ */
+static bool relay_sends(struct relay* relay)
+{
+  return relay->spool.open || relay->sockfd != -1;
+}
+
+/*
+ * Read a line of the stdin reader
+ *
+ * The line of a regular file is borrowed from its mapping, instead of
+ * being copied to the buffer, unless debug messages print the line
+ */
+static ssize_t stdin_reader_line(struct relay* relay, const char** line, char* buffer, size_t size, int event, long timeout)
+{
+  if(relay->stdin_reader.mapped && !relay->config.debug)
+  {
+    return reader_borrow(&relay->stdin_reader, line, size);
+  }
+  else return reader_line(&relay->stdin_reader, buffer, size, event, timeout);
+}
+
+/*
+ * The stdin thread reads from either [stdin], [feed queue] or [stdin fifo]
+ *
+ * PARAMS
+ * - const char** line | The read line, either the buffer or a borrowed line
+ */
+static ssize_t stdin_thread_read(struct relay* relay, const char** line, char* buffer, size_t size, int event, long timeout)
+{
+  *line = buffer;
+
+  // 1. If both [stdin fifo] AND [socket] (or [spool]) are connected, read from [stdin fifo]
+  if(relay->stdin_fifo != -1 && relay_sends(relay))
+  {
+    if(relay->source_count > 0)
+    {
+      return stdin_fifo_read(relay, &relay->stdin_reader, buffer, size, event, timeout);
+    }
+    else return stdin_reader_line(relay, line, buffer, size, event, timeout);
+  }
+  // 2. If the relay is embedded, read from [feed queue]
+  else if(relay->config.embedded)
+  {
+    return queue_read(&relay->feed_queue, buffer, size, event, timeout);
+  }
+  // 3. If not both [stdin fifo] AND [socket] (or [spool]) are connected, read from [stdin]
+  else
+  {
+    return stdin_reader_line(relay, line, buffer, size, event, timeout);
+  }
+}
+
+/*
+ * Check if the stdin thread can read another line right away
+ *
+ * The compressed stream is flushed when no more input is ready,
+ * so that lines are batched under load but never held back
+ */
+static bool stdin_thread_pending(struct relay* relay)
+{
+  // 1. If [spool] is open, the spool routine writes to [socket], check [spool]
+  if(relay->spool.open)
+  {
+    return spool_pending(&relay->spool);
+  }
+  // 2. If both [stdin fifo] AND [socket] are connected, check [stdin fifo]
+  else if(relay->stdin_fifo != -1 && relay->sockfd != -1)
+  {
+    if(relay->source_count > 0)
+    {
+      return sched_pending(&relay->sched);
+    }
+    else return reader_pending(&relay->stdin_reader);
+  }
+  // 3. If the relay is embedded, check [feed queue]
+  else if(relay->config.embedded)
+  {
+    return queue_pending(&relay->feed_queue);
+  }
+  // 4. If not both [stdin fifo] AND [socket] are connected, check [stdin]
+  else
+  {
+    return reader_pending(&relay->stdin_reader);
+  }
+}
+
+/*
+ * Write to [socket], compressed if agreed
+ */
+static ssize_t stdin_socket_send(struct relay* relay, const char* buffer, size_t size, int event, long timeout)
+{
+  ssize_t write_size;
+
+  if(relay->codec.type != CODEC_NONE)
+  {
+    write_size = codec_write(&relay->codec, relay->sockfd, buffer, size, !stdin_thread_pending(relay), event, timeout);
+
+    relay->stats.socket_sent = relay->codec.sent;
+  }
+  else
+  {
+    write_size = socket_write(relay->sockfd, buffer, size, event, timeout);
+
+    if(write_size > 0) relay->socket_written += write_size;
+  }
+
+  return write_size;
+}
+
+/*
+ * Encode a line to be sent, framed with its checksum and delta encoded, as agreed
+ *
+ * The encoded line is staged in the buffer of the sent dictionary
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The line is too long to encode (EMSGSIZE)
+ */
+static int stdin_line_encode(struct relay* relay, const char* buffer, size_t size)
+{
+  struct delta* delta = &relay->delta_out;
+
+  char framed[CRC_FRAMED_SIZE(DELTA_BUFFER_SIZE)];
+
+  if(relay->features & SOCKET_FEATURE_CRC)
+  {
+    if(CRC_FRAMED_SIZE(size) > DELTA_BUFFER_SIZE)
+    {
+      errno = EMSGSIZE;
+
+      return -1;
+    }
+
+    size = crc_frame(buffer, size, framed);
+
+    buffer = framed;
+  }
+
+  if(relay->features & SOCKET_FEATURE_DELTA)
+  {
+    if(size > DELTA_BUFFER_SIZE)
+    {
+      errno = EMSGSIZE;
+
+      return -1;
+    }
+
+    delta->end = delta_encode(delta, buffer, size, delta->buffer);
+
+    relay->stats.delta_sent += delta->end;
+  }
+  else
+  {
+    if(size > sizeof(delta->buffer))
+    {
+      errno = EMSGSIZE;
+
+      return -1;
+    }
+
+    memcpy(delta->buffer, buffer, size);
+
+    delta->end = size;
+  }
+
+  // A line that could be taken for a grant is escaped
+  if((relay->features & SOCKET_FEATURE_CREDIT) && relay->sent_line_end)
+  {
+    if(delta->end >= sizeof(delta->buffer))
+    {
+      errno = EMSGSIZE;
+
+      return -1;
+    }
+
+    delta->end = credit_escape(delta->buffer, delta->end);
+  }
+
+  return 0;
+}
+
+/*
+ * Write a line to [socket], framed with its checksum and delta encoded, as agreed
+ *
+ * The encoded line is either written as a whole or not at all:
+ * if the write is interrupted, the next call (with the same line)
+ * writes the rest of it, without encoding the line again
+ *
+ * RETURN (same as socket_write)
+ */
+static ssize_t stdin_socket_write(struct relay* relay, const char* buffer, size_t size, int event, long timeout)
+{
+  if(!(relay->features & (SOCKET_FEATURE_DELTA | SOCKET_FEATURE_CRC | SOCKET_FEATURE_CREDIT)))
+  {
+    return stdin_socket_send(relay, buffer, size, event, timeout);
+  }
+
+  struct delta* delta = &relay->delta_out;
+
+  if(delta->end == 0 && stdin_line_encode(relay, buffer, size) == -1) return -1;
+
+  ssize_t write_size = stdin_socket_send(relay, delta->buffer + delta->start, delta->end - delta->start, event, timeout);
+
+  if(write_size == -1) return -1;
+
+  delta->start += write_size;
+
+  if(delta->start < delta->end) return 0;
+
+  relay->sent_line_end = (delta->buffer[delta->end - 1] == '\n');
+
+  delta->start = delta->end = 0;
+
+  return size;
+}
+
+/*
+ * Flush the compressed stream to [socket], as the last lines may still be
+ * held by the compressor: at the end of the stdin routine, after a grant,
+ * and before waiting for a grant of the peer
+ */
+static void stdin_socket_flush(struct relay* relay, struct routine* routine)
+{
+  if(relay->sockfd == -1) return;
+
+  while(codec_flush(&relay->codec, relay->sockfd, routine->event, routine_write_timeout(routine)) == -1)
+  {
+    if(errno != ECANCELED) break;
+
+    routine_drain(relay, routine, "stdin");
+  }
+
+  relay->stats.socket_sent = relay->codec.sent;
+}
+
+/*
+ * Send the grant that is due to the peer, between two sent lines
+ *
+ * RETURN (int status)
+ * -  0 | Success, or no grant is due yet
+ * - -1 | Failed to send the grant
+ */
+static int stdin_grant_send(struct relay* relay, struct routine* routine)
+{
+  if(!relay->credit.open || !relay->sent_line_end) return 0;
+
+  char frame[CREDIT_FRAME_SIZE];
+
+  size_t size = credit_frame(&relay->credit, frame);
+
+  if(size == 0) return 0;
+
+  if(relay->config.debug) info_print("Granting %ld bytes to the peer", strtol(frame + 1, NULL, 10));
+
+  if(routine_write(relay, routine, "stdin", stdin_socket_send, frame, size) < (ssize_t) size) return -1;
+
+  stdin_socket_flush(relay, routine);
+
+  return 0;
+}
+
+/*
+ * Wait until the peer has granted the credits to send a line
+ *
+ * The grants that are due are sent while waiting,
+ * so that two peers waiting on each other are never stuck
+ *
+ * RETURN (int status)
+ * -  0 | The line may be sent
+ * - -1 | The drain deadline has passed (ETIMEDOUT), or error
+ */
+static int routine_credit(struct relay* relay, struct routine* routine, size_t size)
+{
+  if(!relay->credit.open) return 0;
+
+  if(credit_take(&relay->credit, size, -1, 0) == 0) return 0;
+
+  // The peer can only grant what it has received
+  stdin_socket_flush(relay, routine);
+
+  while(credit_take(&relay->credit, size, routine->event, routine_write_timeout(routine)) == -1)
+  {
+    if(errno != ECANCELED) return -1;
+
+    routine_drain(relay, routine, "stdin");
+
+    if(stdin_grant_send(relay, routine) == -1) return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Append to [spool], which never waits for the peer
+ *
+ * RETURN (same as buffer_write)
+ */
+static ssize_t stdin_spool_write(struct relay* relay, const char* buffer, size_t size)
+{
+  if(spool_append(&relay->spool, buffer, size, relay->config.debug) == -1) return -1;
+
+  relay->stats.spool_dropped = relay->spool.dropped;
+
+  return size;
+}
+
+/*
+ * Write to [stdout fifo], or to one of the fan-out fifos
+ */
+static ssize_t stdout_fifo_write(struct relay* relay, const char* buffer, size_t size, int event, long timeout)
+{
+  if(relay->fanout.count > 0)
+  {
+    return fanout_write(&relay->fanout, buffer, size, event, timeout);
+  }
+  else return buffer_write(relay->stdout_fifo, buffer, size, event, timeout);
+}
+
+/*
+ * Write to [drain queue], or lend the line to the application
+ */
+static ssize_t stdout_drain_write(struct relay* relay, const char* buffer, size_t size, int event, long timeout)
+{
+  if(relay->lend.open)
+  {
+    return lend_give(&relay->lend, buffer, size, event, timeout);
+  }
+  else return queue_write(&relay->drain_queue, buffer, size, event, timeout);
+}
+
+/*
+ * The stdin thread writes to either [spool], [stdout fifo], [socket], [drain queue] or [stdout]
+ */
+static ssize_t stdin_thread_write(struct relay* relay, const char* buffer, size_t size, int event, long timeout)
+{
+  // 1. If [spool] is open, write to [spool], and the spool routine writes to [socket]
+  if(relay->spool.open)
+  {
+    if(relay->config.debug) debug_print(stdout, "FIFO => SPOOL", "%s\033[F", buffer);
+
+    return stdin_spool_write(relay, buffer, size);
+  }
+  // 2. If both [stdin fifo] and [socket] are connected, write to [socket]
+  else if(relay->stdin_fifo != -1 && relay->sockfd != -1)
+  {
+    if(relay->config.debug) debug_print(stdout, "FIFO => SOCKET", "%s\033[F", buffer);
+
+    return stdin_socket_write(relay, buffer, size, event, timeout);
+  }
+  // 3. If both [stdout fifo] and [socket], but not [stdin fifo], are connected, write to [socket]
+  else if(relay->stdout_fifo != -1 && relay->sockfd != -1)
+  {
+    return stdin_socket_write(relay, buffer, size, event, timeout);
+  }
+  // 4. If [stdout fifo], but not [socket], is connected, write to [stdout fifo]
+  else if(relay->stdout_fifo != -1)
+  {
+    return stdout_fifo_write(relay, buffer, size, event, timeout);
+  }
+  // 5. If [socket], but not [stdout fifo], is connected, write to [socket]
+  else if(relay->sockfd != -1)
+  {
+    return stdin_socket_write(relay, buffer, size, event, timeout);
+  }
+  // 6. If the relay is embedded, write to [drain queue], or lend the line
+  else if(relay->config.embedded)
+  {
+    return stdout_drain_write(relay, buffer, size, event, timeout);
+  }
+  // 7. If neither [stdout fifo] nor [socket] are connected, write to [stdout]
+  else
+  {
+    return buffer_write(1, buffer, size, event, timeout);
+  }
+}
+
+/*
+ * Read a line from [socket], taking the grants of the peer out of the stream
+ *
+ * RETURN (same as reader_line)
+ */
+static ssize_t stdout_line_read(struct relay* relay, char* buffer, size_t size, int event, long timeout)
+{
+  if(!relay->credit.open) return reader_line(&relay->stdout_reader, buffer, size, event, timeout);
+
+  while(true)
+  {
+    ssize_t read_size = reader_line(&relay->stdout_reader, buffer, size, event, timeout);
+
+    if(read_size <= 0) return read_size;
+
+    bool line_start = relay->received_line_end;
+
+    relay->received_line_end = (buffer[read_size - 1] == '\n');
+
+    if(line_start && credit_line(&relay->credit, buffer, &read_size)) continue;
+
+    // A lone escape leaves nothing of the line yet
+    if(read_size > 0) return read_size;
+  }
+}
+
+/*
+ * Read a delta encoded line from [socket] and decode it
+ *
+ * The encoded line is read until its newline, as a part of it can't be decoded.
+ * If the read is interrupted, the read part is kept for the next call
+ *
+ * RETURN (same as reader_line)
+ */
+static ssize_t stdout_delta_read(struct relay* relay, char* buffer, size_t size, int event, long timeout)
+{
+  struct delta* delta = &relay->delta_in;
+
+  while(delta->end == 0 || delta->buffer[delta->end - 1] != '\n')
+  {
+    if(delta->end == sizeof(delta->buffer))
+    {
+      errno = EPROTO;
+
+      return -1;
+    }
+
+    ssize_t read_size = stdout_line_read(relay, delta->buffer + delta->end, sizeof(delta->buffer) - delta->end, event, timeout);
+
+    if(read_size <= 0) return read_size;
+
+    delta->end += read_size;
+  }
+
+  size_t length = delta->end;
+
+  delta->end = 0;
+
+  return delta_decode(delta, delta->buffer, length, buffer, size);
+}
+
+/*
+ * Read a line framed with its checksum from [socket], delta encoded if agreed
+ *
+ * Lines with a bad checksum are dropped, and the next line is read
+ *
+ * RETURN (same as reader_line)
+ */
+static ssize_t stdout_crc_read(struct relay* relay, char* buffer, size_t size, int event, long timeout)
+{
+  while(true)
+  {
+    while(relay->crc_end == 0 || relay->crc_in[relay->crc_end - 1] != '\n')
+    {
+      if(relay->crc_end == sizeof(relay->crc_in))
+      {
+        errno = EPROTO;
+
+        return -1;
+      }
+
+      char*  frame      = relay->crc_in + relay->crc_end;
+      size_t frame_size = sizeof(relay->crc_in) - relay->crc_end;
+
+      ssize_t read_size;
+
+      if(relay->features & SOCKET_FEATURE_DELTA)
+      {
+        read_size = stdout_delta_read(relay, frame, frame_size, event, timeout);
+      }
+      else read_size = stdout_line_read(relay, frame, frame_size, event, timeout);
+
+      if(read_size <= 0) return read_size;
+
+      relay->crc_end += read_size;
+    }
+
+    size_t length = relay->crc_end;
+
+    relay->crc_end = 0;
+
+    ssize_t line_size = crc_unframe(relay->crc_in, length, buffer, size);
+
+    if(line_size >= 0) return line_size;
+
+    relay->stats.crc_errors++;
+
+    if(relay->config.debug) error_print("Dropped line with bad checksum: %s", strerror(errno));
+  }
+}
+
+/*
+ * Send a hello without features, as the answer to the hello of the peer
+ */
+static void stdout_hello_send(struct relay* relay, int event)
+{
+  if(relay->config.debug) info_print("Answering hello without features");
+
+  ssize_t length = strlen(SOCKET_HELLO) + 1;
+
+  if(socket_write(relay->sockfd, SOCKET_HELLO "\n", length, event, SOCKET_HELLO_TIMEOUT) != length)
+  {
+    if(relay->config.debug) error_print("Failed to answer hello");
+  }
+}
+
+/*
+ * Answer the hello of a peer that offers features, if it is the first line
+ * of a plain [socket], with a hello without any features (like hub_line)
+ *
+ * RETURN (bool answered)
+ * - true  | The line was a hello, and is not relayed
+ * - false | The line is relayed
+ */
+static bool stdout_hello_answer(struct relay* relay, const char* line, size_t size, int event)
+{
+  if(relay->greeted) return false;
+
+  relay->greeted = true;
+
+  if(size < strlen(SOCKET_HELLO) || strncmp(line, SOCKET_HELLO, strlen(SOCKET_HELLO)) != 0) return false;
+
+  stdout_hello_send(relay, event);
+
+  return true;
+}
+
+/*
+ * Answer the hello of a peer that offers features at once, if it arrives
+ * right after connecting, before the fifos are opened and lines are sent
+ *
+ * A hello that arrives later is answered by stdout_hello_answer
+ */
+static void relay_hello_early(struct relay* relay)
+{
+  if(event_wait(relay->sockfd, POLLIN, relay->event, SOCKET_HELLO_GRACE) != 0) return;
+
+  char peek[256];
+
+  ssize_t size = recv(relay->sockfd, peek, sizeof(peek), MSG_PEEK);
+
+  if(size <= 0) return;
+
+  size_t length = strlen(SOCKET_HELLO);
+
+  // The first line is not a hello, and is relayed
+  if(memcmp(peek, SOCKET_HELLO, ((size_t) size < length) ? (size_t) size : length) != 0)
+  {
+    relay->greeted = true;
+
+    return;
+  }
+
+  char* newline = memchr(peek, '\n', size);
+
+  // The rest of the hello has not arrived yet
+  if(!newline) return;
+
+  // The hello is taken out of the socket, and not relayed
+  if(recv(relay->sockfd, peek, newline - peek + 1, 0) != newline - peek + 1) return;
+
+  relay->greeted = true;
+
+  stdout_hello_send(relay, relay->event);
+}
+
+/*
+ * Read from [socket], decoded as agreed
+ *
+ * PARAMS
+ * - const char** line | The read line, either the buffer or a line to be lent
+ */
+static ssize_t stdout_socket_read(struct relay* relay, const char** line, char* buffer, size_t size, int event, long timeout)
+{
+  ssize_t read_size;
+
+  while(true)
+  {
+    // A line to be lent is read straight into the buffers of the lend
+    if(relay->lend.open && relay->lend.fd != -1)
+    {
+      read_size = lend_line(&relay->lend, line, event, timeout);
+    }
+    else if(relay->features & SOCKET_FEATURE_CRC)
+    {
+      read_size = stdout_crc_read(relay, buffer, size, event, timeout);
+    }
+    else if(relay->features & SOCKET_FEATURE_DELTA)
+    {
+      read_size = stdout_delta_read(relay, buffer, size, event, timeout);
+    }
+    else read_size = stdout_line_read(relay, buffer, size, event, timeout);
+
+    if(read_size <= 0 || !stdout_hello_answer(relay, *line, read_size, event)) break;
+
+    if(relay->lend.open && relay->lend.fd != -1) lend_skip(&relay->lend, read_size);
+  }
+
+  relay->stats.socket_received = relay->codec.received;
+
+  return read_size;
+}
+
+/*
+ * The stdout thread reads from either [stdin fifo] or [socket]
+ *
+ * If neither [stdin fifo] nor [socket] are connected, nothing is done
+ *
+ * PARAMS
+ * - const char** line | The read line, either the buffer or a line to be lent
+ */
+static ssize_t stdout_thread_read(struct relay* relay, const char** line, char* buffer, size_t size, int event, long timeout)
+{
+  *line = buffer;
+
+  // 1. If both [stdin fifo] and [socket] are connected, read from [socket]
+  if(relay->stdin_fifo != -1 && relay->sockfd != -1)
+  {
+    return stdout_socket_read(relay, line, buffer, size, event, timeout);
+  }
+  // 2. If [socket], but not [stdin fifo], is connected, read from [socket]
+  else if(relay->sockfd != -1)
+  {
+    return stdout_socket_read(relay, line, buffer, size, event, timeout);
+  }
+  // 3. If [stdin fifo], but not [socket], is connected, read from [stdin fifo]
+  else if(relay->stdin_fifo != -1)
+  {
+    return stdin_fifo_read(relay, &relay->stdout_reader, buffer, size, event, timeout);
+  }
+  // 4. If neither [stdin fifo] nor [socket] are connected, stdout thread should not be running
+  else return -1;
+}
+
+/*
+ * The stdout thread writes to either [stdout fifo], [drain queue] or [stdout]
+ */
+static ssize_t stdout_thread_write(struct relay* relay, const char* buffer, size_t size, int event, long timeout)
+{
+  // 1. If both [stdout fifo] and [socket] are connected, write to [stdout fifo]
+  if(relay->stdout_fifo != -1 && relay->sockfd != -1)
+  {
+    if(relay->config.debug) debug_print(stdout, "SOCKET => FIFO", "%s\033[F", buffer);
+
+    return stdout_fifo_write(relay, buffer, size, event, timeout);
+  }
+  // 2. If the relay is embedded, write to [drain queue], or lend the line
+  else if(relay->config.embedded)
+  {
+    return stdout_drain_write(relay, buffer, size, event, timeout);
+  }
+  // 3. Else, write to [stdout]
+  else
+  {
+    return buffer_write(1, buffer, size, event, timeout);
+  }
+}
+
+/*
+ * Print why a routine ended, unless it ended as expected
+ * (End of File, or nothing more to drain)
+ */
+static void routine_error_print(struct relay* relay, ssize_t size, int error)
+{
+  if(!relay->config.debug || size == 0) return;
+
+  if(error == ETIMEDOUT) return;
+
+  error_print("%s", strerror(error));
+}
+
+/*
+ * Relay a regular file as a whole, instead of line by line,
+ * if either end of a routine is a regular file
+ *
+ * When the relay is stopped, the transfer ends at once
+ *
+ * RETURN (int status)
+ * -  0 | Success, the file has been transferred or the relay was stopped
+ * -  1 | Neither end is a regular file, relay line by line
+ * - -1 | Failed to transfer
+ */
+static int routine_transfer(struct relay* relay, const char* name, int infd, int outfd, size_t* bytes, long* elapsed)
+{
+  struct transfer transfer;
+
+  // The bytes are counted as they move, to be seen by the metrics during the transfer
+  if(transfer_open(&transfer, name, infd, outfd, bytes, relay->config.progress, relay->config.debug) != 0) return 1;
+
+  int status = transfer_run(&transfer, infd, outfd, relay->event);
+
+  int error = errno;
+
+  *elapsed = transfer_elapsed(&transfer);
+
+  transfer_close(&transfer);
+
+  if(status == -1 && error == ECANCELED) return 0;
+
+  errno = error;
+
+  return status;
+}
+
+/*
+ * Add the time since a line was read to the latency of a channel
+ */
+static void routine_latency_add(struct histogram* latency, const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  histogram_add(latency, (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000);
+}
+
+/*
+ * Get the ends of the stdout thread, if it can relay them as bytes,
+ * following the same rules as stdout_thread_read and stdout_thread_write
+ *
+ * RETURN (bool stream)
+ * - true  | The bytes can be relayed from infd to outfd
+ * - false | Every line has to be handled
+ */
+static bool stdout_thread_stream(struct relay* relay, int* infd, int* outfd)
+{
+  if(relay->config.embedded || relay->source_count > 0 || relay->fanout.count > 0) return false;
+
+  if(shaper_limited(&relay->stdout_shaper)) return false;
+
+  // Encoded lines have to be decoded one by one
+  if(relay->sockfd != -1 && (relay->features & ~SOCKET_FEATURE_STRIPE)) return false;
+
+  *infd = relay->stdout_reader.fd;
+
+  *outfd = (relay->stdout_fifo != -1 && relay->sockfd != -1) ? relay->stdout_fifo : 1;
+
+  return true;
+}
+
+/*
+ * stdout routine - process that handles one way communication (usually output)
+ *
+ * This thread will read from somewhere and write to somewhere else,
+ * depending on configuration of communication
+ *
+ * No need for a recieving routine if neither [stdin fifo] nor [socket] are connected,
+ * or if [spool] is open, as the spool routine only sends to the peer,
+ * or if the relay is a hub, that routes the lines of its clients,
+ * or an RPC server, that serves the requests of its clients
+ */
+static void* stdout_routine(void* arg)
+{
+  struct relay* relay = arg;
+
+  if(relay->stdin_fifo == -1 && relay->sockfd == -1) return NULL;
+
+  if(relay->spool.open) return NULL;
+
+  if(relay->hub.open || relay->rpc.open) return NULL;
+
+
+  if(relay->config.debug) info_print("Start of stdout routine");
+
+  routine_tune(relay, 1);
+
+  routine_sigpipe_block(relay);
+
+  struct routine routine = { .event = relay->event };
+
+  char buffer[1024];
+
+  const char* line = buffer;
+
+  struct timespec start;
+
+  ssize_t read_size = -1, write_size = -1;
+
+  int error = 0, infd, outfd;
+
+  // 1. If either end is a regular file, relay the file as a whole
+  if(stdout_thread_stream(relay, &infd, &outfd) && (read_size = routine_transfer(relay, "stdout", infd, outfd, &relay->stats.stdout_bytes, &relay->stats.stdout_transfer)) != 1)
+  {
+    error = errno;
+  }
+  // 2. Else, relay line by line
+  else while(routine_running(&routine))
+  {
+    read_size = stdout_thread_read(relay, &line, buffer, sizeof(buffer) - 1, routine.event, routine_read_timeout(&routine));
+
+    if(read_size == -1 && errno == ECANCELED)
+    {
+      routine_drain(relay, &routine, "stdout");
+
+      continue;
+    }
+
+    if(read_size <= 0)
+    {
+      error = errno;
+
+      break;
+    }
+
+    // IMPORTANT: Terminate string after reading bytes (a lent line is never printed)
+    if(line == buffer) buffer[read_size] = '\0';
+
+    PROBE2(stdout_read, relay->stdout_reader.fd, read_size);
+
+    if(relay->metrics.open) clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if(routine_shape(relay, &routine, "stdout", &relay->stdout_shaper, read_size) == -1)
+    {
+      error = errno;
+
+      if(relay->config.debug) error_print("Dropped %ld bytes at the drain deadline", (long) read_size);
+
+      break;
+    }
+
+    relay->stats.stdout_delay = relay->stdout_shaper.delay;
+
+    if((write_size = routine_write(relay, &routine, "stdout", stdout_thread_write, line, read_size)) < read_size)
+    {
+      error = errno;
+
+      if(write_size >= 0 && relay->config.debug) error_print("Dropped %ld bytes at the drain deadline", (long) (read_size - write_size));
+
+      break;
+    }
+
+    relay->stats.stdout_bytes += write_size;
+    relay->stats.stdout_lines++;
+
+    if(relay->credit.open && credit_consumed(&relay->credit, write_size)) relay_credit_wake(relay);
+
+    PROBE2(stdout_write, write_size, relay->stats.stdout_lines);
+
+    if(relay->metrics.open) routine_latency_add(&relay->stdout_latency, &start);
+  }
+
+  routine_error_print(relay, read_size, error);
+
+  PROBE2(routine_end, 1, error);
+
+  relay_cancel(relay);
+
+  queue_close(&relay->drain_queue);
+
+  lend_close(&relay->lend);
+
+  if(relay->config.debug) info_print("End of stdout routine");
+
+  return NULL;
+}
+
+/*
+ * Get the ends of the stdin thread, if it can relay them as bytes,
+ * following the same rules as stdin_thread_read and stdin_thread_write
+ *
+ * RETURN (bool stream)
+ * - true  | The bytes can be relayed from infd to outfd
+ * - false | Every line has to be handled
+ */
+static bool stdin_thread_stream(struct relay* relay, int* infd, int* outfd)
+{
+  if(relay->config.embedded || relay->spool.open || relay->source_count > 0) return false;
+
+  if(shaper_limited(&relay->stdin_shaper) || relay->fanout.count > 0) return false;
+
+  // Lines have to be encoded one by one
+  if(relay->sockfd != -1 && (relay->features & ~SOCKET_FEATURE_STRIPE)) return false;
+
+  *infd = relay->stdin_reader.fd;
+
+  if(relay->sockfd != -1)
+  {
+    *outfd = relay->sockfd;
+  }
+  else *outfd = (relay->stdout_fifo != -1) ? relay->stdout_fifo : 1;
+
+  return true;
+}
+
+/*
+ * stdin routine - process that handles one way communication (usually input)
+ *
+ * This thread will read from somewhere and write to somewhere else,
+ * depending on configuration of communication
+ *
+ * No need for an inputting end, if ONLY [stdin fifo] is connected,
+ * or if the relay is a hub or an RPC server
+ */
+static void* stdin_routine(void* arg)
+{
+  struct relay* relay = arg;
+
+  if(relay->stdin_fifo != -1 && !relay_sends(relay) && relay->stdout_fifo == -1) return NULL;
+
+  if(relay->hub.open || relay->rpc.open) return NULL;
+
+
+  if(relay->config.debug) info_print("Start of stdin routine");
+
+  routine_tune(relay, 0);
+
+  routine_sigpipe_block(relay);
+
+  struct routine routine = { .event = relay->event };
+
+  // With credits, the routine is also woken to send a grant (see routine_drain)
+  if(relay->credit.open) routine.event = relay->credit.wake;
+
+  char buffer[1024];
+
+  const char* line = buffer;
+
+  struct timespec start;
+
+  ssize_t read_size = -1, write_size = -1;
+
+  int error = 0, infd, outfd;
+
+  // 1. If either end is a regular file, relay the file as a whole
+  if(stdin_thread_stream(relay, &infd, &outfd) && (read_size = routine_transfer(relay, "stdin", infd, outfd, &relay->stats.stdin_bytes, &relay->stats.stdin_transfer)) != 1)
+  {
+    error = errno;
+  }
+  // 2. Else, relay line by line
+  else while(routine_running(&routine))
+  {
+    if(stdin_grant_send(relay, &routine) == -1)
+    {
+      error = errno;
+
+      break;
+    }
+
+    read_size = stdin_thread_read(relay, &line, buffer, sizeof(buffer) - 1, routine.event, routine_read_timeout(&routine));
+
+    if(read_size == -1 && errno == ECANCELED)
+    {
+      routine_drain(relay, &routine, "stdin");
+
+      continue;
+    }
+
+    if(read_size <= 0)
+    {
+      error = errno;
+
+      break;
+    }
+
+    // IMPORTANT: Terminate string after reading bytes (a borrowed line is never printed)
+    if(line == buffer) buffer[read_size] = '\0';
+
+    PROBE2(stdin_read, relay->stdin_reader.fd, read_size);
+
+    if(relay->metrics.open) clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if(routine_shape(relay, &routine, "stdin", &relay->stdin_shaper, read_size) == -1 || routine_credit(relay, &routine, read_size) == -1)
+    {
+      error = errno;
+
+      if(relay->config.debug) error_print("Dropped %ld bytes at the drain deadline", (long) read_size);
+
+      break;
+    }
+
+    relay->stats.stdin_delay = relay->stdin_shaper.delay;
+
+    if((write_size = routine_write(relay, &routine, "stdin", stdin_thread_write, line, read_size)) < read_size)
+    {
+      error = errno;
+
+      if(write_size >= 0 && relay->config.debug) error_print("Dropped %ld bytes at the drain deadline", (long) (read_size - write_size));
+
+      break;
+    }
+
+    relay->stats.stdin_bytes += write_size;
+    relay->stats.stdin_lines++;
+
+    PROBE2(stdin_write, write_size, relay->stats.stdin_lines);
+
+    if(relay->metrics.open) routine_latency_add(&relay->stdin_latency, &start);
+  }
+
+  // In spool mode, [socket] belongs to the spool routine
+  if(!relay->spool.open) stdin_socket_flush(relay, &routine);
+
+  // The stripe send routine sends what is left, until End of File
+  if(relay->stripe.open) shutdown(relay->sockfd, SHUT_WR);
+
+  routine_error_print(relay, read_size, error);
+
+  PROBE2(routine_end, 0, error);
+
+  // The spool routine forwards the spooled lines, before it ends
+  if(relay->spool.open)
+  {
+    spool_end(&relay->spool);
+  }
+  else relay_cancel(relay);
+
+  queue_close(&relay->feed_queue);
+
+  if(relay->config.debug) info_print("End of stdin routine");
+
+  return NULL;
+}
+
+/*
+ * Write the tag of a source to the start of a buffer
+ *
+ * The tag is the name of the fifo, followed by a space
+ *
+ * RETURN (size_t size)
+ * - The length of the tag, 0 if lines are not tagged
+ */
+static size_t source_tag_write(struct relay_source* source, char* buffer, size_t size)
+{
+  if(!source->relay->config.fanin_tag) return 0;
+
+  const char* name = strrchr(source->path, '/');
+
+  name = name ? name + 1 : source->path;
+
+  size_t length = strlen(name);
+
+  // Leave room for at least half a line after the tag
+  if(length + 1 > size / 2) length = size / 2 - 1;
+
+  memcpy(buffer, name, length);
+
+  buffer[length] = ' ';
+
+  return length + 1;
+}
+
+/*
+ * Get the priority lane of a line from a source
+ *
+ * A line starting with the control prefix is always a control line
+ */
+static int source_line_lane(struct relay_source* source, const char* line, size_t size)
+{
+  const char* prefix = source->relay->config.control_prefix;
+
+  if(prefix)
+  {
+    size_t length = strlen(prefix);
+
+    if(size >= length && !strncmp(line, prefix, length)) return SCHED_LANE_CONTROL;
+  }
+
+  return source->lane;
+}
+
+/*
+ * Push a whole line to the queue of a source
+ *
+ * If the relay is stopped in the middle of the push,
+ * the line is pushed before the drain deadline
+ *
+ * RETURN (same as routine_write)
+ */
+static ssize_t source_push(struct relay_source* source, struct routine* routine, int lane, const char* buffer, size_t size)
+{
+  struct relay* relay = source->relay;
+
+  while(true)
+  {
+    ssize_t push_size = sched_push(&relay->sched, source->index, lane, buffer, size, routine->event, routine_write_timeout(routine));
+
+    if(push_size != 0 || errno != ECANCELED) return push_size;
+
+    routine_drain(relay, routine, source->path);
+  }
+}
+
+/*
+ * source routine - process that reads one of the stdin fifos in fan-in mode
+ *
+ * The lines are pushed to the scheduler, that merges them
+ * with the lines of the other stdin fifos
+ */
+static void* source_routine(void* arg)
+{
+  struct relay_source* source = arg;
+
+  struct relay* relay = source->relay;
+
+  if(relay->config.debug) info_print("Start of source routine (%s)", source->path);
+
+  routine_tune(relay, 2 + source->index);
+
+  struct routine routine = { .event = relay->event };
+
+  char buffer[1024];
+
+  size_t tag_size = source_tag_write(source, buffer, sizeof(buffer));
+
+  ssize_t read_size = -1, push_size = -1;
+
+  int error = 0;
+
+  while(routine_running(&routine))
+  {
+    read_size = reader_line(&source->reader, buffer + tag_size, sizeof(buffer) - tag_size - 1, routine.event, routine_read_timeout(&routine));
+
+    if(read_size == -1 && errno == ECANCELED)
+    {
+      routine_drain(relay, &routine, source->path);
+
+      continue;
+    }
+
+    if(read_size <= 0)
+    {
+      error = errno;
+
+      break;
+    }
+
+    int lane = source_line_lane(source, buffer + tag_size, read_size);
+
+    if((push_size = source_push(source, &routine, lane, buffer, tag_size + read_size)) < (ssize_t) (tag_size + read_size))
+    {
+      error = errno;
+
+      break;
+    }
+  }
+
+  routine_error_print(relay, read_size, error);
+
+  sched_source_end(&relay->sched, source->index);
+
+  if(relay->config.debug) info_print("End of source routine (%s)", source->path);
+
+  return NULL;
+}
+
+/*
+ * Open the fan-in fifos and start a source routine for every stdin fifo
+ *
+ * Nothing is done, if there are neither fan-in fifos nor priority lanes
+ *
+ * RETURN (int status)
+ * - 0 | Success
+ * - 1 | Failed to open a fan-in fifo
+ * - 2 | Failed to start a source routine
+ */
+static int relay_sources_start(struct relay* relay)
+{
+  struct relay_config* config = &relay->config;
+
+  if((config->fanin_count == 0 && !config->control_prefix) || relay->stdin_fifo == -1) return 0;
+
+  // The stdin fifo is the first source
+  struct relay_source* source = &relay->sources[0];
+
+  source->path = config->stdin_path;
+  source->fifo = relay->stdin_fifo;
+  source->lane = config->stdin_lane;
+  source->index = sched_source_add(&relay->sched, config->stdin_weight, QUEUE_CAPACITY);
+
+  relay->source_count = 1;
+
+  for(int index = 0; index < config->fanin_count; index++)
+  {
+    source = &relay->sources[relay->source_count];
+
+    source->path = config->fanin[index].path;
+    source->fifo = -1;
+    source->lane = config->fanin[index].lane;
+
+    if(stdin_fifo_open(&source->fifo, source->path, config->persist, config->debug) != 0) return 1;
+
+    source->index = sched_source_add(&relay->sched, config->fanin[index].weight, QUEUE_CAPACITY);
+
+    relay->source_count++;
+  }
+
+  for(int index = 0; index < relay->source_count; index++)
+  {
+    source = &relay->sources[index];
+
+    source->relay = relay;
+
+    reader_init(&source->reader, source->fifo);
+
+    if(pthread_create(&source->thread, NULL, source_routine, source) != 0)
+    {
+      if(config->debug) error_print("Failed to create source thread (%s)", source->path);
+
+      return 2;
+    }
+
+    source->started = true;
+  }
+
+  return 0;
+}
+
+/*
+ * Wait for the source routines to end
+ */
+static void relay_sources_wait(struct relay* relay)
+{
+  for(int index = 0; index < relay->source_count; index++)
+  {
+    struct relay_source* source = &relay->sources[index];
+
+    if(!source->started) continue;
+
+    if(pthread_join(source->thread, NULL) != 0)
+    {
+      if(relay->config.debug) error_print("Failed to join source thread (%s)", source->path);
+    }
+
+    source->started = false;
+  }
+}
+
+/*
+ * Check if the relay has lines in the control lane
+ */
+static bool relay_lanes_used(struct relay* relay)
+{
+  struct relay_config* config = &relay->config;
+
+  if(config->control_prefix || config->stdin_lane == SCHED_LANE_CONTROL) return true;
+
+  for(int index = 0; index < config->fanin_count; index++)
+  {
+    if(config->fanin[index].lane == SCHED_LANE_CONTROL) return true;
+  }
+
+  return false;
+}
+
+/*
+ * Get the features to offer the peer, as configured
+ */
+static int relay_features_offered(struct relay* relay)
+{
+  struct relay_config* config = &relay->config;
+
+  int features = (config->compress == CODEC_ZLIB) ? SOCKET_FEATURE_ZLIB : 0;
+
+  if(config->delta) features |= SOCKET_FEATURE_DELTA;
+
+  if(config->checksum) features |= SOCKET_FEATURE_CRC;
+
+  // The spool routine writes to [socket] itself
+  if(config->stripes > 1 && !config->spool_path) features |= SOCKET_FEATURE_STRIPE;
+
+  // The grants are sent by the stdin routine, between its lines
+  if(config->credit_window > 0 && config->stripes <= 1 && !config->spool_path) features |= SOCKET_FEATURE_CREDIT;
+
+  return features;
+}
+
+/*
+ * Subscribe to the configured topic prefixes of a hub
+ *
+ * A hub agrees to no features, so the lines are sent as they are
+ */
+static void relay_subscribe(struct relay* relay)
+{
+  struct relay_config* config = &relay->config;
+
+  if(config->subscribe_count == 0) return;
+
+  if(relay->features != 0)
+  {
+    if(config->debug) error_print("Peer is not a hub, not subscribing");
+
+    return;
+  }
+
+  for(int index = 0; index < config->subscribe_count; index++)
+  {
+    char line[HUB_LINE_MAX];
+
+    int length = snprintf(line, sizeof(line), "%s %s\n", HUB_SUBSCRIBE, config->subscribe[index]);
+
+    if(length < 0 || length >= (int) sizeof(line)) continue;
+
+    if(socket_write(relay->sockfd, line, length, relay->event, SOCKET_HELLO_TIMEOUT) != length)
+    {
+      if(config->debug) error_print("Failed to subscribe: %s", config->subscribe[index]);
+    }
+  }
+}
+
+/*
+ * Set up a new connection: the agreed encodings and the socket options
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to set up compression
+ */
+static int relay_socket_setup(struct relay* relay)
+{
+  struct relay_config* config = &relay->config;
+
+  if(config->compress != CODEC_NONE && !(relay->features & SOCKET_FEATURE_ZLIB))
+  {
+    if(config->debug) error_print("Peer did not agree to compression");
+  }
+
+  if(config->delta && !(relay->features & SOCKET_FEATURE_DELTA))
+  {
+    if(config->debug) error_print("Peer did not agree to delta encoding");
+  }
+
+  if(config->checksum && !(relay->features & SOCKET_FEATURE_CRC))
+  {
+    if(config->debug) error_print("Peer did not agree to checksums");
+  }
+
+  if(config->stripes > 1 && !config->spool_path && !(relay->features & SOCKET_FEATURE_STRIPE))
+  {
+    if(config->debug) error_print("Peer did not agree to striping");
+  }
+
+  if(config->credit_window > 0 && config->stripes <= 1 && !config->spool_path && !(relay->features & SOCKET_FEATURE_CREDIT))
+  {
+    if(config->debug) error_print("Peer did not agree to credits");
+  }
+
+  delta_init(&relay->delta_out);
+
+  relay->crc_end = 0;
+
+  relay->socket_written = 0;
+
+  relay->sent_line_end = relay->received_line_end = true;
+
+  relay->greeted = (relay->features != 0);
+
+  if(!relay->greeted) relay_hello_early(relay);
+
+  delta_init(&relay->delta_in);
+
+  codec_free(&relay->codec);
+
+  int codec = (relay->features & SOCKET_FEATURE_ZLIB) ? CODEC_ZLIB : CODEC_NONE;
+
+  if(codec_init(&relay->codec, codec, config->debug) != 0) return -1;
+
+  // The credits are only agreed on the single connection of a relay
+  if((relay->features & SOCKET_FEATURE_CREDIT) && !relay->credit.open)
+  {
+    if(credit_open(&relay->credit, config->credit_window, config->debug) != 0) return -1;
+  }
+
+  if(config->sock_buffer != 0)
+  {
+    socket_buffer_size_set(relay->sockfd, SO_SNDBUF, config->sock_buffer, config->debug);
+
+    socket_buffer_size_set(relay->sockfd, SO_RCVBUF, config->sock_buffer, config->debug);
+  }
+
+  relay->stats.sndbuf_size = socket_buffer_size_get(relay->sockfd, SO_SNDBUF);
+  relay->stats.rcvbuf_size = socket_buffer_size_get(relay->sockfd, SO_RCVBUF);
+
+  if(config->busy_poll > 0)
+  {
+    socket_busy_poll_set(relay->sockfd, config->busy_poll, config->debug);
+  }
+
+  if(relay_lanes_used(relay))
+  {
+    socket_notsent_lowat_set(relay->sockfd, NOTSENT_LOWAT, config->debug);
+  }
+
+  relay_subscribe(relay);
+
+  return 0;
+}
+
+/*
+ * Stripe the connection over more connections, if agreed with the peer
+ *
+ * [socket] is then the end of the relay of a local socket pair
+ *
+ * RETURN (int status)
+ * -  0 | Success, or not striped
+ * - -1 | Failed to add the connections
+ */
+static int relay_stripe_open(struct relay* relay)
+{
+  struct relay_config* config = &relay->config;
+
+  if(!(relay->features & SOCKET_FEATURE_STRIPE)) return 0;
+
+  if(stripe_open(&relay->stripe, &relay->sockfd, relay->servfd, config->address, config->port, config->stripes, config->sock_buffer, config->debug) != 0) return -1;
+
+  relay->stats.stripes = relay->stripe.count;
+
+  return 0;
+}
+
+/*
+ * Use the default address and port, if only one of them is configured
+ *
+ * RETURN (bool configured)
+ * - true  | The relay should connect to a socket
+ * - false | Neither an address nor a port is configured
+ */
+static bool relay_address_default(struct relay_config* config)
+{
+  if(!config->address && config->port == -1) return false;
+
+  if(!config->address)   config->address = DEFAULT_ADDRESS;
+
+  if(config->port == -1) config->port    = DEFAULT_PORT;
+
+  return true;
+}
+
+/*
+ * If either an address or a port has been configured,
+ * the relay should connect to a socket
+ *
+ * The connection is compressed and delta encoded, if configured and agreed with the peer
+ *
+ * RETURN (int status)
+ * - 0 | Success
+ * - 1 | Failed to create socket, or to set up compression
+ *
+ * Note: Success can be omitted, without a socket being created
+ */
+static int relay_socket_create(struct relay* relay)
+{
+  struct relay_config* config = &relay->config;
+
+  if(!relay_address_default(config)) return 0;
+
+  relay->features = relay_features_offered(relay);
+
+  if(client_or_server_socket_create(&relay->sockfd, &relay->servfd, config->address, config->port, &relay->features, config->debug) != 0) return 1;
+
+  if(relay_socket_setup(relay) != 0 || relay_stripe_open(relay) != 0)
+  {
+    socket_close(&relay->sockfd, config->debug);
+
+    socket_close(&relay->servfd, config->debug);
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Size the kernel buffers of the fifos, as configured
+ *
+ * The resulting sizes are stored in the statistics
+ */
+static void relay_buffers_size(struct relay* relay)
+{
+  struct relay_config* config = &relay->config;
+
+  if(config->pipe_size != 0)
+  {
+    fifo_pipe_size_set(relay->stdin_fifo,  config->pipe_size, config->debug);
+
+    fifo_pipe_size_set(relay->stdout_fifo, config->pipe_size, config->debug);
+  }
+
+  relay->stats.stdin_pipe_size  = fifo_pipe_size_get(relay->stdin_fifo);
+  relay->stats.stdout_pipe_size = fifo_pipe_size_get(relay->stdout_fifo);
+}
+
+/*
+ * Open the fan-out fifos, to share the lines of the stdout fifo
+ *
+ * RETURN (int status)
+ * -  0 | Success, or no fan-out
+ * - -1 | Failed to open a fan-out fifo
+ */
+static int relay_fanout_open(struct relay* relay)
+{
+  struct relay_config* config = &relay->config;
+
+  if(config->fanout_count == 0 || relay->stdout_fifo == -1) return 0;
+
+  fanout_init(&relay->fanout, config->fanout_policy, config->fanout_field, config->debug);
+
+  fanout_add(&relay->fanout, relay->stdout_fifo);
+
+  for(int index = 0; index < config->fanout_count; index++)
+  {
+    int fifo = -1;
+
+    if(stdout_fifo_open(&fifo, config->fanout[index], config->persist, config->debug) != 0) return -1;
+
+    if(config->pipe_size != 0) fifo_pipe_size_set(fifo, config->pipe_size, config->debug);
+
+    fanout_add(&relay->fanout, fifo);
+  }
+
+  return 0;
+}
+
+/*
+ * Connect [socket] for the spool routine, retrying until a peer is reachable
+ *
+ * A lost connection is replaced by the standby, if one is connected.
+ * Otherwise, the peers are tried in turn, and the retries back off
+ * from SPOOL_BACKOFF_MIN to SPOOL_BACKOFF_MAX milliseconds
+ *
+ * PARAMS
+ * - bool lost | The last connection was lost
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The relay was stopped before a peer was reachable
+ */
+static int spool_socket_connect(struct relay* relay, struct routine* routine, bool lost)
+{
+  struct relay_config* config = &relay->config;
+
+  if(lost && failover_standby_take(&relay->failover, &relay->sockfd, &relay->features) == 0)
+  {
+    relay->stats.failovers = relay->failover.failovers;
+
+    if(relay_socket_setup(relay) == 0) return 0;
+
+    socket_close(&relay->sockfd, config->debug);
+  }
+
+  long backoff = SPOOL_BACKOFF_MIN;
+
+  while(true)
+  {
+    if(failover_connect(&relay->failover, &relay->sockfd, &relay->features, lost) == 0)
+    {
+      if(relay_socket_setup(relay) == 0) return 0;
+
+      socket_close(&relay->sockfd, config->debug);
+    }
+
+    // While draining, there is no time left to wait for the peer
+    if(routine->event == -1) return -1;
+
+    if(config->debug) info_print("Reconnecting in %ld ms", backoff);
+
+    if(event_wait(-1, 0, routine->event, backoff) == 1) return -1;
+
+    backoff = (backoff * 2 < SPOOL_BACKOFF_MAX) ? backoff * 2 : SPOOL_BACKOFF_MAX;
+  }
+}
+
+/*
+ * Get the bytes written to [socket] since it was connected
+ */
+static uint64_t spool_socket_sent(struct relay* relay)
+{
+  return (relay->codec.type != CODEC_NONE) ? relay->codec.sent : relay->socket_written;
+}
+
+/*
+ * Get the end of the last line written to [socket],
+ * or REPLAY_UNSENT if the compressor holds a part of it back
+ */
+static uint64_t spool_socket_end(struct relay* relay)
+{
+  return codec_pending(&relay->codec) ? REPLAY_UNSENT : spool_socket_sent(relay);
+}
+
+/*
+ * Forget the lines that the peer has acknowledged, if the connection is up
+ */
+static void spool_replay_acked(struct relay* relay)
+{
+  int unacked = socket_unacked(relay->sockfd);
+
+  if(unacked != -1) replay_acked(&relay->failover.replay, spool_socket_sent(relay) - unacked);
+}
+
+/*
+ * Close a lost [socket], and send the unacknowledged lines again on the next
+ */
+static void spool_socket_lost(struct relay* relay)
+{
+  if(relay->config.debug) error_print("Lost connection: %s", strerror(errno));
+
+  spool_replay_acked(relay);
+
+  socket_close(&relay->sockfd, relay->config.debug);
+
+  replay_restart(&relay->failover.replay);
+
+  relay->stats.reconnects++;
+}
+
+/*
+ * spool routine - process that forwards the spooled lines to [socket]
+ *
+ * A line is removed from [spool] once it has been written to [socket],
+ * and is kept in memory until the peer has acknowledged it.
+ * If the connection is lost, the routine reconnects (or takes the standby)
+ * and writes the unacknowledged lines again, before the next line
+ *
+ * What is left in [spool] when the relay stops, is forwarded the next time
+ */
+static void* spool_routine(void* arg)
+{
+  struct relay* relay = arg;
+
+  if(relay->config.debug) info_print("Start of spool routine");
+
+  routine_tune(relay, 2 + relay->source_count);
+
+  struct routine routine = { .event = relay->event };
+
+  struct replay* replay = &relay->failover.replay;
+
+  char buffer[1024];
+
+  ssize_t read_size = -1, write_size = -1;
+
+  int error = 0;
+
+  bool lost = false;
+
+  while(routine_running(&routine))
+  {
+    if(relay->sockfd == -1 && spool_socket_connect(relay, &routine, lost) == -1)
+    {
+      if(relay->config.debug) info_print("Stopped before the peer was reachable");
+
+      read_size = 0;
+
+      break;
+    }
+
+    lost = false;
+
+    const char* line;
+
+    ssize_t line_size = replay_next(replay, &line);
+
+    // The unacknowledged lines of a lost connection are sent first
+    if(line_size > 0)
+    {
+      memcpy(buffer, line, line_size);
+
+      // IMPORTANT: Terminate string after copying bytes
+      buffer[line_size] = '\0';
+
+      if(relay->config.debug) debug_print(stdout, "REPLAY => SOCKET", "%s\033[F", buffer);
+
+      if((write_size = routine_write(relay, &routine, "spool", stdin_socket_write, buffer, line_size)) < line_size)
+      {
+        if(write_size >= 0)
+        {
+          error = errno;
+
+          break;
+        }
+
+        spool_socket_lost(relay);
+
+        lost = true;
+
+        continue;
+      }
+
+      replay_resent(replay, spool_socket_end(relay));
+
+      relay->stats.replayed = replay->replayed;
+
+      continue;
+    }
+
+    read_size = spool_peek(&relay->spool, buffer, sizeof(buffer) - 1, routine.event, routine_read_timeout(&routine));
+
+    if(read_size == -1 && errno == ECANCELED)
+    {
+      routine_drain(relay, &routine, "spool");
+
+      continue;
+    }
+
+    // A line that does not fit the buffer is skipped
+    if(read_size == -1 && errno == EMSGSIZE)
+    {
+      if(relay->config.debug) error_print("Skipped spooled line, too long");
+
+      spool_commit(&relay->spool);
+
+      continue;
+    }
+
+    if(read_size <= 0)
+    {
+      error = errno;
+
+      break;
+    }
+
+    // IMPORTANT: Terminate string after reading bytes
+    buffer[read_size] = '\0';
+
+    if(relay->config.debug) debug_print(stdout, "SPOOL => SOCKET", "%s\033[F", buffer);
+
+    if((write_size = routine_write(relay, &routine, "spool", stdin_socket_write, buffer, read_size)) < read_size)
+    {
+      // The drain deadline has passed, the line stays in [spool]
+      if(write_size >= 0)
+      {
+        error = errno;
+
+        break;
+      }
+
+      spool_socket_lost(relay);
+
+      lost = true;
+
+      continue;
+    }
+
+    uint64_t end = spool_socket_end(relay);
+
+    if(end != REPLAY_UNSENT) replay_sent(replay, end);
+
+    replay_add(replay, buffer, read_size, end);
+
+    spool_commit(&relay->spool);
+
+    // The acknowledged lines are checked now and then, and when the spool has caught up
+    if(replay->sampled >= FAILOVER_SAMPLE_SIZE || !spool_pending(&relay->spool)) spool_replay_acked(relay);
+
+    relay->stats.spool_lines++;
+  }
+
+  if(relay->sockfd != -1) stdin_socket_flush(relay, &routine);
+
+  routine_error_print(relay, read_size, error);
+
+  relay_cancel(relay);
+
+  if(relay->config.debug) info_print("End of spool routine");
+
+  return NULL;
+}
+
+/*
+ * standby routine - process that keeps a standby connection to the next peer
+ */
+static void* standby_routine(void* arg)
+{
+  struct relay* relay = arg;
+
+  if(relay->config.debug) info_print("Start of standby routine");
+
+  routine_tune(relay, 2);
+
+  if(failover_run(&relay->failover, relay->event) == -1)
+  {
+    if(relay->config.debug) error_print("Stopped keeping a standby");
+  }
+
+  if(relay->config.debug) info_print("End of standby routine");
+
+  return NULL;
+}
+
+/*
+ * hub routine - process that routes the lines of the clients of the hub
+ */
+static void* hub_routine(void* arg)
+{
+  struct relay* relay = arg;
+
+  if(relay->config.debug) info_print("Start of hub routine");
+
+  routine_tune(relay, 2);
+
+  if(hub_run(&relay->hub, relay->event, relay->config.drain_timeout) == -1)
+  {
+    relay_cancel(relay);
+  }
+
+  relay->stats.hub_clients   = relay->hub.accepted;
+  relay->stats.hub_published = relay->hub.published;
+  relay->stats.hub_delivered = relay->hub.delivered;
+  relay->stats.hub_dropped   = relay->hub.dropped;
+
+  if(relay->config.debug) info_print("End of hub routine");
+
+  return NULL;
+}
+
+/*
+ * rpc routine - process that serves the requests of the clients of the RPC server
+ *
+ * The worker reads the requests from [stdout fifo] and writes the replies
+ * to [stdin fifo], or to stdout and from stdin if they are not connected.
+ * When the worker ends, the relay ends
+ */
+static void* rpc_routine(void* arg)
+{
+  struct relay* relay = arg;
+
+  if(relay->config.debug) info_print("Start of rpc routine");
+
+  routine_tune(relay, 2);
+
+  int requestfd = (relay->stdout_fifo != -1) ? relay->stdout_fifo : STDOUT_FILENO;
+
+  int replyfd   = (relay->stdin_fifo  != -1) ? relay->stdin_fifo  : STDIN_FILENO;
+
+  if(rpc_run(&relay->rpc, requestfd, replyfd, relay->event, relay->config.drain_timeout) != 0)
+  {
+    relay_cancel(relay);
+  }
+
+  struct rpc* rpc = &relay->rpc;
+
+  relay->stats.rpc_clients     = rpc->accepted;
+  relay->stats.rpc_sent        = rpc->sent;
+  relay->stats.rpc_replied     = rpc->replied;
+  relay->stats.rpc_timeouts    = rpc->timeouts;
+  relay->stats.rpc_unmatched   = rpc->unmatched;
+  relay->stats.rpc_undelivered = rpc->undelivered;
+  relay->stats.rpc_p50         = rpc_latency_percentile(rpc, 50);
+  relay->stats.rpc_p90         = rpc_latency_percentile(rpc, 90);
+  relay->stats.rpc_p99         = rpc_latency_percentile(rpc, 99);
+  relay->stats.rpc_max         = rpc_latency_percentile(rpc, 100);
+
+  if(relay->config.debug) info_print("End of rpc routine");
+
+  return NULL;
+}
+
+/*
+ * Get the bytes waiting in a fifo, or not yet sent by a socket, 0 if unknown
+ *
+ * PARAMS
+ * - int request | FIONREAD for a fifo, or SIOCOUTQ for a socket
+ */
+static int relay_fd_queued(int fd, int request)
+{
+  int queued = 0;
+
+  if(fd == -1 || ioctl(fd, request, &queued) == -1) return 0;
+
+  return queued;
+}
+
+/*
+ * Write the samples of a metric for both channels
+ */
+static void relay_metrics_channels(struct metrics_text* text, const char* name, const char* relay_label, double stdin_value, double stdout_value)
+{
+  char labels[256];
+
+  snprintf(labels, sizeof(labels), "%s,channel=\"stdin\"", relay_label);
+
+  metrics_sample(text, name, labels, stdin_value);
+
+  snprintf(labels, sizeof(labels), "%s,channel=\"stdout\"", relay_label);
+
+  metrics_sample(text, name, labels, stdout_value);
+}
+
+/*
+ * Write the metrics of the relay
+ *
+ * The counters are read while the routines write them,
+ * so a scrape may be a line behind, but never waits for the relay
+ */
+static void relay_metrics_render(struct metrics_text* text, void* arg)
+{
+  struct relay* relay = arg;
+
+  struct relay_config* config = &relay->config;
+
+  struct stats* stats = &relay->stats;
+
+  char relay_label[128];
+
+  if(config->port != -1)
+  {
+    snprintf(relay_label, sizeof(relay_label), "relay=\"%s:%d\"", config->address ? config->address : DEFAULT_ADDRESS, config->port);
+  }
+  else snprintf(relay_label, sizeof(relay_label), "relay=\"local\"");
+
+  char labels[256];
+
+  metrics_family(text, "procom_lines_total", "counter", "Lines relayed, not counted when relayed as a whole");
+  relay_metrics_channels(text, "procom_lines_total", relay_label, stats->stdin_lines, stats->stdout_lines);
+
+  metrics_family(text, "procom_bytes_total", "counter", "Bytes relayed");
+  relay_metrics_channels(text, "procom_bytes_total", relay_label, stats->stdin_bytes, stats->stdout_bytes);
+
+  metrics_family(text, "procom_rate_limit_wait_seconds_total", "counter", "Seconds waited by the rate limits");
+  relay_metrics_channels(text, "procom_rate_limit_wait_seconds_total", relay_label, relay->stdin_shaper.delay / 1000.0, relay->stdout_shaper.delay / 1000.0);
+
+  metrics_family(text, "procom_line_latency_seconds", "histogram", "Seconds from when a line is read until it has been written");
+
+  snprintf(labels, sizeof(labels), "%s,channel=\"stdin\"", relay_label);
+  metrics_histogram(text, "procom_line_latency_seconds", labels, relay->stdin_latency.buckets, relay->stdin_latency.count, relay->stdin_latency.sum);
+
+  snprintf(labels, sizeof(labels), "%s,channel=\"stdout\"", relay_label);
+  metrics_histogram(text, "procom_line_latency_seconds", labels, relay->stdout_latency.buckets, relay->stdout_latency.count, relay->stdout_latency.sum);
+
+  // The queue depths, in bytes
+  metrics_family(text, "procom_queued_bytes", "gauge", "Bytes waiting in a queue, fifo or socket");
+
+  const struct
+  {
+    const char* name;
+    double      value;
+  } queues[] =
+  {
+    { "feed",        relay->feed_queue.size },
+    { "drain",       relay->drain_queue.size },
+    { "stdin_fifo",  relay_fd_queued(relay->stdin_fifo,  FIONREAD) },
+    { "stdout_fifo", relay_fd_queued(relay->stdout_fifo, FIONREAD) },
+    { "socket",      relay_fd_queued(relay->sockfd,      SIOCOUTQ) }
+  };
+
+  for(size_t index = 0; index < sizeof(queues) / sizeof(*queues); index++)
+  {
+    snprintf(labels, sizeof(labels), "%s,queue=\"%s\"", relay_label, queues[index].name);
+
+    metrics_sample(text, "procom_queued_bytes", labels, queues[index].value);
+  }
+
+  // The connection
+  metrics_family(text, "procom_socket_bytes_total", "counter", "Compressed bytes sent and received on the socket");
+
+  snprintf(labels, sizeof(labels), "%s,direction=\"sent\"", relay_label);
+  metrics_sample(text, "procom_socket_bytes_total", labels, stats->socket_sent);
+
+  snprintf(labels, sizeof(labels), "%s,direction=\"received\"", relay_label);
+  metrics_sample(text, "procom_socket_bytes_total", labels, stats->socket_received);
+
+  metrics_family(text, "procom_reconnects_total", "counter", "Lost connections in spool mode");
+  metrics_sample(text, "procom_reconnects_total", relay_label, stats->reconnects);
+
+  metrics_family(text, "procom_failovers_total", "counter", "Lost connections replaced by the standby");
+  metrics_sample(text, "procom_failovers_total", relay_label, stats->failovers);
+
+  metrics_family(text, "procom_replayed_lines_total", "counter", "Lines sent again after a lost connection");
+  metrics_sample(text, "procom_replayed_lines_total", relay_label, stats->replayed);
+
+  metrics_family(text, "procom_crc_errors_total", "counter", "Received lines with a bad checksum");
+  metrics_sample(text, "procom_crc_errors_total", relay_label, stats->crc_errors);
+
+  // The drops
+  metrics_family(text, "procom_dropped_bytes_total", "counter", "Bytes dropped, by reason");
+
+  snprintf(labels, sizeof(labels), "%s,reason=\"spool_full\"", relay_label);
+  metrics_sample(text, "procom_dropped_bytes_total", labels, relay->spool.dropped);
+
+  metrics_family(text, "procom_dropped_lines_total", "counter", "Lines dropped, by reason");
+
+  snprintf(labels, sizeof(labels), "%s,reason=\"slow_subscriber\"", relay_label);
+  metrics_sample(text, "procom_dropped_lines_total", labels, relay->hub.dropped);
+
+  snprintf(labels, sizeof(labels), "%s,reason=\"rpc_undelivered\"", relay_label);
+  metrics_sample(text, "procom_dropped_lines_total", labels, relay->rpc.undelivered);
+
+  if(relay->spool.open)
+  {
+    metrics_family(text, "procom_spool_segments", "gauge", "Segment files in the spool");
+    metrics_sample(text, "procom_spool_segments", relay_label, relay->spool.count);
+  }
+
+  if(relay->fanout.count > 0)
+  {
+    metrics_family(text, "procom_fanout_skipped_total", "counter", "Lines that skipped a full consumer of the fan-out");
+    metrics_sample(text, "procom_fanout_skipped_total", relay_label, relay->fanout.skipped);
+  }
+
+  if(relay->lend.open)
+  {
+    struct lend* lend = &relay->lend;
+
+    metrics_family(text, "procom_lent_lines_total", "counter", "Lines lent to the application");
+    metrics_sample(text, "procom_lent_lines_total", relay_label, lend->lent);
+
+    metrics_family(text, "procom_lent_outstanding_lines", "gauge", "Lent lines not released by the application");
+    metrics_sample(text, "procom_lent_outstanding_lines", relay_label, lend->lent - lend->released);
+
+    metrics_family(text, "procom_lend_copied_bytes_total", "counter", "Bytes copied to the buffers of the lent lines");
+    metrics_sample(text, "procom_lend_copied_bytes_total", relay_label, lend->copied);
+  }
+
+  if(relay->credit.open)
+  {
+    struct credit* credit = &relay->credit;
+
+    metrics_family(text, "procom_credit_available_bytes", "gauge", "Bytes the peer has granted and that are not sent yet");
+    metrics_sample(text, "procom_credit_available_bytes", relay_label, credit->available);
+
+    metrics_family(text, "procom_backpressure", "gauge", "1 while the sender waits for a grant of the peer");
+    metrics_sample(text, "procom_backpressure", relay_label, credit->blocked ? 1 : 0);
+
+    metrics_family(text, "procom_credit_waits_total", "counter", "Times the sender waited for a grant of the peer");
+    metrics_sample(text, "procom_credit_waits_total", relay_label, credit->waits);
+
+    metrics_family(text, "procom_credit_wait_seconds_total", "counter", "Seconds the sender waited for grants of the peer");
+    metrics_sample(text, "procom_credit_wait_seconds_total", relay_label, credit_waited(credit) / 1000.0);
+
+    metrics_family(text, "procom_credit_grants_total", "counter", "Grants of credits sent to and received from the peer");
+
+    snprintf(labels, sizeof(labels), "%s,direction=\"sent\"", relay_label);
+    metrics_sample(text, "procom_credit_grants_total", labels, credit->grants_sent);
+
+    snprintf(labels, sizeof(labels), "%s,direction=\"received\"", relay_label);
+    metrics_sample(text, "procom_credit_grants_total", labels, credit->grants_received);
+  }
+
+  if(relay->hub.open)
+  {
+    metrics_family(text, "procom_hub_lines_total", "counter", "Lines published to and delivered by the hub");
+
+    snprintf(labels, sizeof(labels), "%s,direction=\"published\"", relay_label);
+    metrics_sample(text, "procom_hub_lines_total", labels, relay->hub.published);
+
+    snprintf(labels, sizeof(labels), "%s,direction=\"delivered\"", relay_label);
+    metrics_sample(text, "procom_hub_lines_total", labels, relay->hub.delivered);
+  }
+
+  if(relay->rpc.open)
+  {
+    struct rpc* rpc = &relay->rpc;
+
+    metrics_family(text, "procom_rpc_requests_total", "counter", "Requests sent to the worker");
+    metrics_sample(text, "procom_rpc_requests_total", relay_label, rpc->sent);
+
+    metrics_family(text, "procom_rpc_timeouts_total", "counter", "Requests that timed out");
+    metrics_sample(text, "procom_rpc_timeouts_total", relay_label, rpc->timeouts);
+
+    metrics_family(text, "procom_rpc_latency_seconds", "histogram", "Seconds from when a request is sent until it is replied to");
+    metrics_histogram(text, "procom_rpc_latency_seconds", relay_label, rpc->latency, rpc->replied, rpc->latency_sum);
+  }
+}
+
+/*
+ * metrics routine - process that serves the metrics of the relay
+ */
+static void* metrics_routine(void* arg)
+{
+  struct relay* relay = arg;
+
+  if(relay->config.debug) info_print("Start of metrics routine");
+
+  metrics_run(&relay->metrics, relay->event, relay_metrics_render, relay);
+
+  if(relay->config.debug) info_print("End of metrics routine");
+
+  return NULL;
+}
+
+/*
+ * stripe send routine - process that stripes the sent stream over the connections
+ */
+static void* stripe_send_routine(void* arg)
+{
+  struct relay* relay = arg;
+
+  if(relay->config.debug) info_print("Start of stripe send routine");
+
+  routine_tune(relay, 2 + relay->source_count);
+
+  if(stripe_send(&relay->stripe, relay->event, relay->config.drain_timeout) == -1)
+  {
+    if(relay->config.debug) error_print("Failed to send stripe: %s", strerror(errno));
+
+    relay_cancel(relay);
+  }
+
+  relay->stats.stripe_chunks = relay->stripe.chunks;
+
+  if(relay->config.debug) info_print("End of stripe send routine");
+
+  return NULL;
+}
+
+/*
+ * stripe receive routine - process that puts the received chunks back in order
+ */
+static void* stripe_receive_routine(void* arg)
+{
+  struct relay* relay = arg;
+
+  if(relay->config.debug) info_print("Start of stripe receive routine");
+
+  routine_tune(relay, 3 + relay->source_count);
+
+  if(stripe_receive(&relay->stripe, relay->event) == -1)
+  {
+    if(relay->config.debug) error_print("Failed to receive stripe: %s", strerror(errno));
+  }
+
+  relay->stats.reordered = relay->stripe.reordered;
+
+  if(relay->config.debug) info_print("End of stripe receive routine");
+
+  return NULL;
+}
+
+/*
+ * Start the stripe send and receive routines
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to create the send thread
+ * - -2 | Failed to create the receive thread (all threads have been joined)
+ */
+static int relay_stripe_start(struct relay* relay)
+{
+  if(pthread_create(&relay->stripe_send_thread, NULL, stripe_send_routine, relay) != 0)
+  {
+    if(relay->config.debug) error_print("Failed to create stripe send thread");
+
+    return -1;
+  }
+
+  if(pthread_create(&relay->stripe_receive_thread, NULL, stripe_receive_routine, relay) != 0)
+  {
+    if(relay->config.debug) error_print("Failed to create stripe receive thread");
+
+    // The send routine ends once the stdin routine has ended
+    relay_cancel(relay);
+
+    stdin_stdout_thread_join(relay->stdin_thread, relay->stdout_thread, relay->config.debug);
+
+    pthread_join(relay->stripe_send_thread, NULL);
+
+    return -2;
+  }
+
+  relay->stripe_started = true;
+
+  return 0;
+}
+
+/*
+ * Create a relay from a configuration
+ *
+ * Nothing is opened or connected until the relay is started
+ *
+ * RETURN (struct relay* relay)
+ * - NULL | Failed to allocate relay
+ */
+struct relay* relay_create(const struct relay_config* config)
+{
+  struct relay* relay = malloc(sizeof(struct relay));
+
+  if(!relay) return NULL;
+
+  memset(relay, 0, sizeof(struct relay));
+
+  relay->config = *config;
+
+  relay->sockfd = -1;
+  relay->servfd = -1;
+
+  relay->stdin_fifo  = -1;
+  relay->stdout_fifo = -1;
+
+  if(relay->config.drain_timeout == 0) relay->config.drain_timeout = DEFAULT_DRAIN_TIMEOUT;
+
+  const struct relay_limit* limit = &config->stdin_limit;
+
+  shaper_init(&relay->stdin_shaper, limit->bytes, limit->bytes_burst, limit->lines, limit->lines_burst);
+
+  limit = &config->stdout_limit;
+
+  shaper_init(&relay->stdout_shaper, limit->bytes, limit->bytes_burst, limit->lines, limit->lines_burst);
+
+  if((relay->event = event_create(config->debug)) == -1)
+  {
+    free(relay);
+
+    return NULL;
+  }
+
+  if(pthread_mutex_init(&relay->lock, NULL) != 0)
+  {
+    event_close(&relay->event, config->debug);
+
+    free(relay);
+
+    return NULL;
+  }
+
+  if(queue_init(&relay->feed_queue, QUEUE_CAPACITY) != 0)
+  {
+    pthread_mutex_destroy(&relay->lock);
+
+    event_close(&relay->event, config->debug);
+
+    free(relay);
+
+    return NULL;
+  }
+
+  if(queue_init(&relay->drain_queue, QUEUE_CAPACITY) != 0)
+  {
+    queue_free(&relay->feed_queue);
+
+    pthread_mutex_destroy(&relay->lock);
+
+    event_close(&relay->event, config->debug);
+
+    free(relay);
+
+    return NULL;
+  }
+
+  if(sched_init(&relay->sched) != 0)
+  {
+    queue_free(&relay->drain_queue);
+
+    queue_free(&relay->feed_queue);
+
+    pthread_mutex_destroy(&relay->lock);
+
+    event_close(&relay->event, config->debug);
+
+    free(relay);
+
+    return NULL;
+  }
+
+  if(config->embedded && config->lend) lend_open(&relay->lend, config->debug);
+
+  return relay;
+}
+
+/*
+ * Initialize the readers of the stdin and stdout threads,
+ * following the same rules as stdin_thread_read and stdout_thread_read
+ */
+static void relay_readers_init(struct relay* relay)
+{
+  // The stdin thread reads [stdin fifo] if also [socket] (or [spool]) is connected, else [stdin]
+  if(relay->stdin_fifo != -1 && relay_sends(relay))
+  {
+    reader_init(&relay->stdin_reader, relay->stdin_fifo);
+  }
+  else reader_init(&relay->stdin_reader, 0);
+
+  relay->stdin_reader.idle_flush = relay->config.idle_flush;
+  relay->stdin_reader.raw        = relay->config.raw;
+
+  // The stdout thread reads [socket] if it is connected, else [stdin fifo]
+  if(relay->sockfd != -1)
+  {
+    reader_init(&relay->stdout_reader, relay->sockfd);
+
+    if(relay->codec.type != CODEC_NONE) relay->stdout_reader.codec = &relay->codec;
+  }
+  else reader_init(&relay->stdout_reader, relay->stdin_fifo);
+
+  // A plain stream is lent out of the buffers it is read into (a lent line is never printed)
+  if(relay->lend.open && relay->sockfd != -1 && relay->stdout_fifo == -1 && !relay->config.debug && !relay->config.raw && relay->config.idle_flush == 0 && !(relay->features & (SOCKET_FEATURE_DELTA | SOCKET_FEATURE_CRC | SOCKET_FEATURE_CREDIT)))
+  {
+    lend_source(&relay->lend, relay->stdout_reader.fd, relay->stdout_reader.codec);
+  }
+
+  // Delta encoded and checksummed lines, and grants, are framed by their newlines
+  if(relay->sockfd == -1 || !(relay->features & (SOCKET_FEATURE_DELTA | SOCKET_FEATURE_CRC | SOCKET_FEATURE_CREDIT)))
+  {
+    relay->stdout_reader.idle_flush = relay->config.idle_flush;
+    relay->stdout_reader.raw        = relay->config.raw;
+  }
+}
+
+/*
+ * Start the relay - connect the socket, open the fifos and start the threads
+ *
+ * The function returns directly, use relay_wait to wait for the relay to end
+ *
+ * RETURN (int status)
+ * - 0 | Success
+ * - 1 | Failed to create socket, or to open the spool
+ * - 2 | Failed to open fifos, or to start the fan-in
+ * - 3 | Failed to create threads
+ */
+int relay_start(struct relay* relay)
+{
+  struct relay_config* config = &relay->config;
+
+  if(config->metrics && metrics_open(&relay->metrics, config->metrics, config->debug) != 0) return 1;
+
+  // As a hub, the clients connect to the hub
+  if(config->hub)
+  {
+    if(config->port == -1) config->port = DEFAULT_PORT;
+
+    relay_address_default(config);
+
+    if(hub_open(&relay->hub, config->address, config->port, config->debug) != 0) return 1;
+  }
+  // As an RPC server, the clients connect to the server
+  else if(config->rpc)
+  {
+    if(config->port == -1) config->port = DEFAULT_PORT;
+
+    relay_address_default(config);
+
+    if(rpc_open(&relay->rpc, config->address, config->port, config->rpc_timeout, config->debug) != 0) return 1;
+  }
+  // In spool mode, the spool routine connects [socket] when the peer is reachable
+  else if(config->spool_path)
+  {
+    relay_address_default(config);
+
+    if(spool_open(&relay->spool, config->spool_path, config->spool_size, config->debug) != 0) return 1;
+
+    char** addresses = (config->address_count > 0) ? config->addresses : &config->address;
+
+    int count = (config->address_count > 0) ? config->address_count : 1;
+
+    if(failover_open(&relay->failover, addresses, count, config->port, relay_features_offered(relay), config->debug) != 0) return 1;
+  }
+  else if(relay_socket_create(relay) != 0) return 1;
+
+  if(stdin_stdout_fifo_open(&relay->stdin_fifo, config->stdin_path, &relay->stdout_fifo, config->stdout_path, config->fifo_reverse, config->persist, config->debug) != 0) return 2;
+
+  relay_buffers_size(relay);
+
+  if(relay_fanout_open(relay) != 0) return 2;
+
+  relay_readers_init(relay);
+
+  if(relay_sources_start(relay) != 0)
+  {
+    relay_cancel(relay);
+
+    relay_sources_wait(relay);
+
+    return 2;
+  }
+
+  pthread_mutex_lock(&relay->lock);
+
+  int status = stdin_stdout_thread_create(&relay->stdin_thread, &stdin_routine, &relay->stdout_thread, &stdout_routine, relay, config->debug);
+
+  // If only the stdout thread failed, the stdin thread has to be stopped
+  if(status == 2)
+  {
+    relay_cancel(relay);
+
+    pthread_join(relay->stdin_thread, NULL);
+  }
+
+  if(status == 0 && relay->spool.open)
+  {
+    if(pthread_create(&relay->spool_thread, NULL, spool_routine, relay) != 0)
+    {
+      if(config->debug) error_print("Failed to create spool thread");
+
+      relay_cancel(relay);
+
+      stdin_stdout_thread_join(relay->stdin_thread, relay->stdout_thread, config->debug);
+
+      status = 3;
+    }
+    else relay->spool_started = true;
+  }
+
+  // The standby is only a head start, so a failure to keep one does not stop the relay
+  if(status == 0 && relay->failover.open && relay->failover.count > 1)
+  {
+    if(pthread_create(&relay->standby_thread, NULL, standby_routine, relay) != 0)
+    {
+      if(config->debug) error_print("Failed to create standby thread");
+    }
+    else relay->standby_started = true;
+  }
+
+  if(status == 0 && relay->stripe.open)
+  {
+    int stripe_status = relay_stripe_start(relay);
+
+    // If the send routine was started, the threads have been joined already
+    if(stripe_status == -1)
+    {
+      relay_cancel(relay);
+
+      stdin_stdout_thread_join(relay->stdin_thread, relay->stdout_thread, config->debug);
+    }
+
+    if(stripe_status != 0) status = 3;
+  }
+
+  if(status == 0 && relay->hub.open)
+  {
+    if(pthread_create(&relay->hub_thread, NULL, hub_routine, relay) != 0)
+    {
+      if(config->debug) error_print("Failed to create hub thread");
+
+      relay_cancel(relay);
+
+      stdin_stdout_thread_join(relay->stdin_thread, relay->stdout_thread, config->debug);
+
+      status = 3;
+    }
+    else relay->hub_started = true;
+  }
+
+  if(status == 0 && relay->rpc.open)
+  {
+    if(pthread_create(&relay->rpc_thread, NULL, rpc_routine, relay) != 0)
+    {
+      if(config->debug) error_print("Failed to create rpc thread");
+
+      relay_cancel(relay);
+
+      stdin_stdout_thread_join(relay->stdin_thread, relay->stdout_thread, config->debug);
+
+      status = 3;
+    }
+    else relay->rpc_started = true;
+  }
+
+  // The metrics are served until the relay is stopped, but a failure to serve them does not stop it
+  if(status == 0 && relay->metrics.open)
+  {
+    if(pthread_create(&relay->metrics_thread, NULL, metrics_routine, relay) != 0)
+    {
+      if(config->debug) error_print("Failed to create metrics thread");
+    }
+    else relay->metrics_started = true;
+  }
+
+  if(status != 0)
+  {
+    relay_cancel(relay);
+
+    relay_sources_wait(relay);
+  }
+
+  relay->started = (status == 0);
+
+  pthread_mutex_unlock(&relay->lock);
+
+  return (status == 0) ? 0 : 3;
+}
+
+/*
+ * Stop the relay
+ *
+ * Both routines drain what they have already read, and then end.
+ * An embedded relay first relays what has already been fed
+ */
+void relay_stop(struct relay* relay)
+{
+  queue_close(&relay->feed_queue);
+
+  relay_cancel(relay);
+}
+
+/*
+ * Stop the relay, just like relay_stop
+ *
+ * Note: This only signals the event of the relay,
+ *       and can therefore be called from a signal handler
+ */
+void relay_interrupt(struct relay* relay)
+{
+  if(!relay) return;
+
+  event_signal(relay->event);
+
+  if(relay->credit.open) event_signal(relay->credit.wake);
+}
+
+/*
+ * Store how evenly the lines were shared among the fan-out fifos
+ */
+static void relay_fanout_stats(struct relay* relay)
+{
+  struct fanout* fanout = &relay->fanout;
+
+  if(fanout->count == 0) return;
+
+  relay->stats.fanout_count   = fanout->count;
+  relay->stats.fanout_skipped = fanout->skipped;
+  relay->stats.fanout_least   = fanout->consumers[0].lines;
+  relay->stats.fanout_most    = fanout->consumers[0].lines;
+
+  for(int index = 1; index < fanout->count; index++)
+  {
+    size_t lines = fanout->consumers[index].lines;
+
+    if(lines < relay->stats.fanout_least) relay->stats.fanout_least = lines;
+
+    if(lines > relay->stats.fanout_most)  relay->stats.fanout_most  = lines;
+  }
+}
+
+/*
+ * Store how long the sender waited for the grants of the peer
+ */
+static void relay_credit_stats(struct relay* relay)
+{
+  struct credit* credit = &relay->credit;
+
+  if(!credit->open) return;
+
+  relay->stats.credit_waits    = credit->waits;
+  relay->stats.credit_waited   = credit_waited(credit);
+  relay->stats.grants_sent     = credit->grants_sent;
+  relay->stats.grants_received = credit->grants_received;
+}
+
+/*
+ * Wait for the threads of the relay to end
+ */
+void relay_wait(struct relay* relay)
+{
+  if(!relay->started) return;
+
+  stdin_stdout_thread_join(relay->stdin_thread, relay->stdout_thread, relay->config.debug);
+
+  relay_sources_wait(relay);
+
+  relay_fanout_stats(relay);
+
+  relay_credit_stats(relay);
+
+  relay->stats.lent_lines  = relay->lend.lent;
+  relay->stats.lend_copied = relay->lend.copied;
+
+  if(relay->spool_started)
+  {
+    if(pthread_join(relay->spool_thread, NULL) != 0)
+    {
+      if(relay->config.debug) error_print("Failed to join spool thread");
+    }
+
+    relay->spool_started = false;
+  }
+
+  if(relay->standby_started)
+  {
+    if(pthread_join(relay->standby_thread, NULL) != 0)
+    {
+      if(relay->config.debug) error_print("Failed to join standby thread");
+    }
+
+    relay->standby_started = false;
+  }
+
+  if(relay->stripe_started)
+  {
+    if(pthread_join(relay->stripe_send_thread, NULL) != 0)
+    {
+      if(relay->config.debug) error_print("Failed to join stripe send thread");
+    }
+
+    if(pthread_join(relay->stripe_receive_thread, NULL) != 0)
+    {
+      if(relay->config.debug) error_print("Failed to join stripe receive thread");
+    }
+
+    relay->stripe_started = false;
+  }
+
+  if(relay->hub_started)
+  {
+    if(pthread_join(relay->hub_thread, NULL) != 0)
+    {
+      if(relay->config.debug) error_print("Failed to join hub thread");
+    }
+
+    relay->hub_started = false;
+  }
+
+  if(relay->rpc_started)
+  {
+    if(pthread_join(relay->rpc_thread, NULL) != 0)
+    {
+      if(relay->config.debug) error_print("Failed to join rpc thread");
+    }
+
+    relay->rpc_started = false;
+  }
+
+  if(relay->metrics_started)
+  {
+    if(pthread_join(relay->metrics_thread, NULL) != 0)
+    {
+      if(relay->config.debug) error_print("Failed to join metrics thread");
+    }
+
+    relay->metrics_started = false;
+  }
+
+  relay->started = false;
+}
+
+/*
+ * Stop the relay, close the fifos and the socket, and free the relay
+ */
+void relay_destroy(struct relay* relay)
+{
+  if(!relay) return;
+
+  relay_stop(relay);
+
+  relay_wait(relay);
+
+  bool debug = relay->config.debug;
+
+  fifo_close(&relay->stdin_fifo, debug);
+
+  fifo_close(&relay->stdout_fifo, debug);
+
+  // The first source is the stdin fifo, which is already closed
+  for(int index = 1; index < relay->source_count; index++)
+  {
+    fifo_close(&relay->sources[index].fifo, debug);
+  }
+
+  // The first consumer is the stdout fifo, which is already closed
+  for(int index = 1; index < relay->fanout.count; index++)
+  {
+    fifo_close(&relay->fanout.consumers[index].fd, debug);
+  }
+
+  socket_close(&relay->sockfd, debug);
+
+  socket_close(&relay->servfd, debug);
+
+  codec_free(&relay->codec);
+
+  spool_close(&relay->spool, debug);
+
+  failover_close(&relay->failover);
+
+  credit_close(&relay->credit);
+
+  stripe_close(&relay->stripe);
+
+  hub_close(&relay->hub);
+
+  rpc_close(&relay->rpc);
+
+  metrics_close(&relay->metrics);
+
+  queue_free(&relay->feed_queue);
+
+  queue_free(&relay->drain_queue);
+
+  lend_free(&relay->lend);
+
+  sched_free(&relay->sched);
+
+  reader_free(&relay->stdin_reader);
+
+  reader_free(&relay->stdout_reader);
+
+  for(int index = 0; index < relay->source_count; index++)
+  {
+    reader_free(&relay->sources[index].reader);
+  }
+
+  pthread_mutex_destroy(&relay->lock);
+
+  event_close(&relay->event, debug);
+
+  free(relay);
+}
+
+/*
+ * Feed bytes to an embedded relay, in place of [stdin]
+ *
+ * Blocks while the feed queue is full
+ *
+ * RETURN (ssize_t size)
+ * - >0 | Success! The number of fed bytes
+ * -  0 | Nothing to feed
+ * - -1 | The relay is stopped, or not embedded
+ */
+ssize_t relay_feed(struct relay* relay, const char* buffer, size_t size)
+{
+  if(!relay->config.embedded) return -1;
+
+  return queue_write(&relay->feed_queue, buffer, size, -1, -1);
+}
+
+/*
+ * Drain a single line from an embedded relay, in place of [stdout]
+ *
+ * Blocks until a line has been relayed
+ *
+ * RETURN (ssize_t size)
+ * - >0 | Success! The length of the drained line
+ * -  0 | The relay has ended, End of File
+ * - -1 | The relay is not embedded, or lends its lines
+ */
+ssize_t relay_drain(struct relay* relay, char* buffer, size_t size)
+{
+  if(!relay->config.embedded || relay->lend.open) return -1;
+
+  return queue_read(&relay->drain_queue, buffer, size, -1, -1);
+}
+
+/*
+ * Borrow a single line from an embedded relay that lends its lines,
+ * in place of relay_drain
+ *
+ * The line is not copied, and stays valid until it is released
+ * (relay_release). Lines may be released in any order, but all of them
+ * before the relay is destroyed. Blocks until a line has been relayed
+ *
+ * RETURN (ssize_t size)
+ * - >0 | Success! The length of the borrowed line
+ * -  0 | The relay has ended, End of File
+ * - -1 | The relay does not lend its lines
+ */
+ssize_t relay_borrow(struct relay* relay, struct loan* loan)
+{
+  if(!relay->lend.open) return -1;
+
+  return lend_borrow(&relay->lend, loan, -1, -1);
+}
+
+/*
+ * Release a borrowed line, so that its buffer can be reused
+ */
+void relay_release(struct relay* relay, struct loan* loan)
+{
+  if(relay->lend.open) lend_release(&relay->lend, loan);
+}
@@ -0,0 +1,352 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef RELAY_H
+#define RELAY_H
+
+#include "debug.h"
+#include "fifo.h"
+#include "socket.h"
+#include "thread.h"
+#include "stats.h"
+#include "queue.h"
+#include "lend.h"
+#include "event.h"
+#include "probe.h"
+#include "reader.h"
+#include "scheduler.h"
+#include "bucket.h"
+#include "codec.h"
+#include "delta.h"
+#include "crc.h"
+#include "credit.h"
+#include "transfer.h"
+#include "stripe.h"
+#include "fanout.h"
+#include "spool.h"
+#include "failover.h"
+#include "hub.h"
+#include "rpc.h"
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_PORT    5555
+
+#define DEFAULT_DRAIN_TIMEOUT 1000
+
+#define RELAY_FANIN_MAX (SCHED_SOURCES_MAX - 1)
+
+#define RELAY_CPUS_MAX 16
+
+#define RELAY_SUBSCRIBE_MAX 16
+
+#define RELAY_FANOUT_MAX (FANOUT_MAX - 1)
+
+#define RELAY_ADDRESS_MAX FAILOVER_PEERS_MAX
+
+/*
+ * A stdin fifo merged into the stream of the stdin fifo
+ */
+struct relay_input
+{
+  char* path;
+  int   weight;
+  int   lane; // SCHED_LANE_BULK or SCHED_LANE_CONTROL
+};
+
+/*
+ * Rate limit of one direction, 0 for no limit
+ *
+ * A burst of 0 is a tenth of a second at the rate
+ */
+struct relay_limit
+{
+  long bytes;       // Bytes per second
+  long bytes_burst;
+  long lines;       // Lines per second
+  long lines_burst;
+};
+
+/*
+ * Configuration of a relay
+ *
+ * Leave a path NULL to not open that fifo,
+ * and leave both address and port unset (NULL and -1) to not use a socket
+ *
+ * An embedded relay is fed and drained by the application
+ * (relay_feed and relay_drain) instead of using stdin and stdout.
+ * With lend, the lines are instead lent to the application (relay_borrow
+ * and relay_release) out of the buffers they were received into, and
+ * the lines can be released in any order. Until then, the buffers are
+ * not reused, and the relay waits when all of them are lent
+ *
+ * When the relay is stopped, the data that has already been read
+ * is written within drain_timeout milliseconds (0 is DEFAULT_DRAIN_TIMEOUT)
+ *
+ * The fan-in fifos are read concurrently with the stdin fifo,
+ * and their lines are merged fairly according to the weights.
+ * With fanin_tag, every merged line starts with the name of its fifo
+ *
+ * Lines from a fifo in the control lane, and lines starting with
+ * the control prefix, overtake the queued lines of the bulk lane
+ *
+ * The stdin and stdout limits pace each direction: the routine
+ * stops reading while it waits, so the writer is held back by the fifo
+ *
+ * With compress, the connection is compressed if the peer agrees
+ * (the peer has to ask for compression as well)
+ *
+ * With delta, every line is sent as the difference to a similar
+ * recent line, if the peer agrees. Unlike compression, every line
+ * is sent at once, so it suits streams of small messages
+ *
+ * With checksum, every line carries its CRC32C, if the peer agrees.
+ * The checksum covers the line itself, before delta encoding and
+ * compression, and lines that do not match are dropped
+ *
+ * If either end of a thread is a regular file, the file is relayed
+ * as a whole by the kernel (sendfile, copy_file_range or splice),
+ * unless the lines have to be encoded, shaped or merged.
+ * With progress, the progress is reported every second
+ *
+ * With a credit window, the peers limit the bytes in flight, if the peer
+ * agrees. The receiver grants bytes back as its stdout drains them, and
+ * the sender waits for a grant instead of filling the buffers of the
+ * kernel, so a slow consumer holds the sender back at once, and the wait
+ * is counted as backpressure. Grants are sent between the lines
+ *
+ * With stripes, the connection is striped over that many connections,
+ * if the peer agrees, to not be held back by the window of a single
+ * connection. The stream is cut into chunks that are put back in order
+ * by the peer. Both peers have to be given the same number of stripes
+ *
+ * The lines to the stdout fifo can be distributed among more fifos
+ * (fanout, after the stdout fifo) by fanout_policy (see fanout.h),
+ * so that every line goes to one of them. A fifo path starting with
+ * a pipe (|) is a worker command instead, which reads the lines
+ *
+ * Lines are relayed when they are whole. With an idle flush, the start
+ * of a line is relayed if the rest does not come within idle_flush
+ * microseconds, so that a prompt is not held back. In raw mode, the bytes
+ * are relayed as they come. The lines of the merged stdin fifos are
+ * always kept whole, and so are delta encoded or checksummed lines
+ * on their way out of the socket
+ *
+ * With persist, the fifos are created if they are missing, and are kept
+ * open when their writer or reader closes them, so that a restarted writer
+ * or reader picks up where the last one left, and the socket stays
+ * connected in the meantime. The relay then only ends when interrupted
+ *
+ * For low latency, the threads can be pinned to the CPUs (in turn:
+ * stdin, stdout and then the fan-in threads), run under SCHED_FIFO,
+ * and spin for busy_poll microseconds before they block.
+ * A spinning SCHED_FIFO thread should have a CPU of its own
+ *
+ * With a spool directory, the lines are stored on disk and forwarded
+ * by a routine of their own, so the writer never waits for the peer.
+ * The relay connects as a client, and reconnects when the connection
+ * is lost. The lines written to the socket that the peer has not
+ * acknowledged are sent again on the next connection, so a line may
+ * arrive twice. Lines left when the relay stops are sent the next time.
+ * With more addresses (as ADDRESS or ADDRESS:PORT), the peers are tried
+ * in turn, and a standby connection is kept to the next peer, which
+ * replaces a lost connection at once.
+ * The relay only sends in spool mode, the peer is not read.
+ * When the spool is full, the oldest lines are dropped
+ *
+ * As a hub, the relay routes lines between the clients connected to
+ * the address and port, instead of relaying the fifos (see hub.h).
+ * A client subscribes to the topic prefixes in subscribe when it
+ * connects, if the peer agreed to no features (as a hub does)
+ *
+ * As an RPC server, the relay serves the requests of the clients connected
+ * to the address and port, by a worker reading the stdout fifo and
+ * replying to the stdin fifo (see rpc.h). Many requests can be outstanding,
+ * and a request not replied to within rpc_timeout gets a timeout reply
+ *
+ * With metrics, the counters, queue depths and latency histograms of the
+ * relay are served in the Prometheus text format, on a Unix socket or
+ * a localhost port (see metrics.h). The latency of a channel is the time
+ * from when a line is read until it has been written
+ */
+struct relay_config
+{
+  char* stdin_path;
+  int   stdin_weight;
+  int   stdin_lane;
+  char* stdout_path;
+  bool  fifo_reverse; // Open the stdout fifo before the stdin fifo
+  bool  persist;      // Keep the fifos open when their other end closes them
+  long  idle_flush;   // Microseconds to wait for the rest of a line, 0 to wait for a whole line
+  bool  raw;          // Relay the bytes as they come, instead of lines
+  char* address;
+  int   port;
+  char* addresses[RELAY_ADDRESS_MAX]; // More peers in spool mode, the first is address
+  int   address_count;
+  bool  debug;
+  bool  embedded;
+  bool  lend; // Lend the drained lines, instead of copying them
+  int   pipe_size;
+  int   sock_buffer;
+  long  drain_timeout;
+  struct relay_input fanin[RELAY_FANIN_MAX];
+  int   fanin_count;
+  bool  fanin_tag;
+  char* control_prefix;
+  struct relay_limit stdin_limit;
+  struct relay_limit stdout_limit;
+  int   compress; // CODEC_NONE or CODEC_ZLIB
+  bool  delta;
+  bool  checksum;
+  long  credit_window; // Bytes the peer may have in flight, 0 for no credits
+  bool  progress;
+  int   stripes; // Connections to stripe over, 0 or 1 for a single connection
+  char* fanout[RELAY_FANOUT_MAX];
+  int   fanout_count;
+  int   fanout_policy; // FANOUT_ROUND_ROBIN, FANOUT_LEAST_QUEUED or FANOUT_HASH
+  int   fanout_field;  // Key field of FANOUT_HASH, from 1
+  int   cpus[RELAY_CPUS_MAX];
+  int   cpu_count;
+  int   rt_priority; // SCHED_FIFO priority, 0 for the normal policy
+  long  busy_poll;   // Microseconds to spin before blocking
+  char* spool_path;  // Directory of the spool, NULL to not spool
+  long  spool_size;  // Max bytes in the spool, 0 for DEFAULT_SPOOL_SIZE
+  bool  hub;
+  char* subscribe[RELAY_SUBSCRIBE_MAX];
+  int   subscribe_count;
+  bool  rpc;
+  long  rpc_timeout; // Max milliseconds to wait for a reply, 0 to wait forever
+  char* metrics;     // Unix socket or port to serve metrics on, NULL to not serve them
+};
+
+/*
+ * A stdin fifo read by its own thread, in fan-in mode (or with priority lanes)
+ */
+struct relay_source
+{
+  struct relay* relay;
+  int           index; // Index of the source in the scheduler
+  const char*   path;
+  int           fifo;
+  int           lane;
+  pthread_t     thread;
+  bool          started;
+  struct reader reader;
+};
+
+/*
+ * All state of a single relay
+ */
+struct relay
+{
+  struct relay_config config;
+
+  pthread_t stdin_thread;
+  pthread_t stdout_thread;
+
+  bool      started;
+
+  pthread_mutex_t lock; // Protects started
+
+  int event; // Signaled to stop the relay
+
+  int sockfd;
+  int servfd;
+
+  int  features; // Agreed features of the connection
+  bool greeted;  // The hello was exchanged, or the first line of a plain [socket] was read
+
+  struct codec codec;
+
+  size_t socket_written; // Bytes written to [socket] since it was connected, if not compressed
+
+  struct delta delta_out; // Dictionary of the sent lines
+  struct delta delta_in;  // Dictionary of the received lines
+
+  char   crc_in[CRC_FRAMED_SIZE(DELTA_BUFFER_SIZE)]; // Framed line being received
+  size_t crc_end;
+
+  struct credit credit;
+  bool          sent_line_end;     // The last unit sent to [socket] ended a line
+  bool          received_line_end; // The last unit read from [socket] ended a line
+
+  int stdin_fifo;
+  int stdout_fifo;
+
+  struct reader stdin_reader;
+  struct reader stdout_reader;
+
+  struct fanout fanout; // The first consumer is the stdout fifo
+
+  struct queue feed_queue;
+  struct queue drain_queue;
+  struct lend  lend; // In place of the drain queue, if lines are lent
+
+  struct sched        sched;
+  struct relay_source sources[SCHED_SOURCES_MAX];
+  int                 source_count; // More than zero in fan-in mode, or with priority lanes
+
+  struct stats stats;
+
+  struct shaper stdin_shaper;
+  struct shaper stdout_shaper;
+
+  struct spool spool;
+  pthread_t    spool_thread;
+  bool         spool_started;
+
+  struct failover failover;
+  pthread_t       standby_thread;
+  bool            standby_started;
+
+  struct hub hub;
+  pthread_t  hub_thread;
+  bool       hub_started;
+
+  struct rpc rpc;
+  pthread_t  rpc_thread;
+  bool       rpc_started;
+
+  struct stripe stripe;
+  pthread_t     stripe_send_thread;
+  pthread_t     stripe_receive_thread;
+  bool          stripe_started;
+
+  struct metrics   metrics;
+  pthread_t        metrics_thread;
+  bool             metrics_started;
+  struct histogram stdin_latency;
+  struct histogram stdout_latency;
+};
+
+extern struct relay* relay_create(const struct relay_config* config);
+
+extern int  relay_start(struct relay* relay);
+
+extern void relay_stop(struct relay* relay);
+
+extern void relay_interrupt(struct relay* relay);
+
+extern void relay_wait(struct relay* relay);
+
+extern void relay_destroy(struct relay* relay);
+
+
+extern ssize_t relay_feed(struct relay* relay, const char* buffer, size_t size);
+
+extern ssize_t relay_drain(struct relay* relay, char* buffer, size_t size);
+
+extern ssize_t relay_borrow(struct relay* relay, struct loan* loan);
+
+extern void    relay_release(struct relay* relay, struct loan* loan);
+
+#endif // RELAY_H
@@ -0,0 +1,1034 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "rpc.h"
+
+/*
+ * Get the slot of a correlation ID
+ */
+static struct rpc_request* rpc_slot(struct rpc* rpc, uint32_t id)
+{
+  return &rpc->requests[id & (RPC_REQUESTS_MAX - 1)];
+}
+
+/*
+ * Get the outstanding request of a correlation ID
+ *
+ * RETURN (struct rpc_request* request)
+ * - The request
+ * - NULL | No request of the ID is outstanding
+ */
+static struct rpc_request* rpc_request_get(struct rpc* rpc, uint32_t id)
+{
+  struct rpc_request* request = rpc_slot(rpc, id);
+
+  return (request->used && request->id == id) ? request : NULL;
+}
+
+/*
+ * Free a request, and its slot
+ */
+static void rpc_request_free(struct rpc_request* request)
+{
+  free(request->path);
+
+  free(request->reply);
+
+  memset(request, 0, sizeof(struct rpc_request));
+}
+
+/*
+ * Queue bytes to be written
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to allocate memory
+ */
+static int rpc_buffer_queue(struct rpc_buffer* buffer, const char* data, size_t size)
+{
+  if(buffer->start > 0 && buffer->capacity - buffer->end < size)
+  {
+    memmove(buffer->data, buffer->data + buffer->start, buffer->end - buffer->start);
+
+    buffer->end -= buffer->start;
+
+    buffer->start = 0;
+  }
+
+  if(buffer->capacity - buffer->end < size)
+  {
+    size_t capacity = buffer->capacity ? buffer->capacity : RPC_LINE_MAX;
+
+    while(capacity - buffer->end < size) capacity *= 2;
+
+    char* data_new = realloc(buffer->data, capacity);
+
+    if(!data_new) return -1;
+
+    buffer->data = data_new;
+
+    buffer->capacity = capacity;
+  }
+
+  memcpy(buffer->data + buffer->end, data, size);
+
+  buffer->end += size;
+
+  return 0;
+}
+
+/*
+ * Write the queued bytes, as far as the file descriptor takes them
+ *
+ * RETURN (int status)
+ * -  0 | Success, the rest waits until the file descriptor is writable
+ * - -1 | Failed to write, the reader has gone away (EPIPE) or failed
+ */
+static int rpc_buffer_flush(struct rpc_buffer* buffer, int fd, bool socket)
+{
+  while(buffer->start < buffer->end)
+  {
+    const char* data = buffer->data + buffer->start;
+
+    size_t size = buffer->end - buffer->start;
+
+    ssize_t write_size = socket ? send(fd, data, size, MSG_NOSIGNAL) : write(fd, data, size);
+
+    if(write_size == -1)
+    {
+      if(errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+
+      if(errno == EINTR) continue;
+
+      return -1;
+    }
+
+    buffer->start += write_size;
+  }
+
+  buffer->start = buffer->end = 0;
+
+  return 0;
+}
+
+/*
+ * Get the bytes waiting to be written
+ */
+static size_t rpc_buffer_size(const struct rpc_buffer* buffer)
+{
+  return buffer->end - buffer->start;
+}
+
+/*
+ * Open the server socket of the RPC server
+ *
+ * PARAMS
+ * - long timeout | Max milliseconds to wait for a reply, 0 to wait forever
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to open the RPC server
+ */
+int rpc_open(struct rpc* rpc, const char* address, int port, long timeout, bool debug)
+{
+  memset(rpc, 0, sizeof(struct rpc));
+
+  rpc->servfd = -1;
+
+  rpc->timeout = timeout;
+
+  rpc->debug = debug;
+
+  rpc->clients = calloc(RPC_CLIENTS_MAX, sizeof(struct rpc_client));
+
+  rpc->pollfds = calloc(RPC_CLIENTS_MAX + 4, sizeof(struct pollfd));
+
+  rpc->polled = calloc(RPC_CLIENTS_MAX + 4, sizeof(int));
+
+  rpc->requests = calloc(RPC_REQUESTS_MAX, sizeof(struct rpc_request));
+
+  if(!rpc->clients || !rpc->pollfds || !rpc->polled || !rpc->requests)
+  {
+    if(debug) error_print("Failed to allocate RPC server");
+
+    free(rpc->clients);
+
+    free(rpc->pollfds);
+
+    free(rpc->polled);
+
+    free(rpc->requests);
+
+    return -1;
+  }
+
+  if(server_socket_open(&rpc->servfd, address, port, SOMAXCONN, debug) != 0)
+  {
+    free(rpc->clients);
+
+    free(rpc->pollfds);
+
+    free(rpc->polled);
+
+    free(rpc->requests);
+
+    return -1;
+  }
+
+  rpc->open = true;
+
+  if(debug) info_print("Opened RPC server (%s:%d)", address, port);
+
+  return 0;
+}
+
+/*
+ * Disconnect a client
+ *
+ * The replies to its outstanding requests are dropped when they arrive
+ */
+static void rpc_client_close(struct rpc* rpc, int index)
+{
+  struct rpc_client* client = &rpc->clients[index];
+
+  for(size_t position = 0; position < client->pending_count; position++)
+  {
+    uint32_t id = client->pending[(client->pending_head + position) % RPC_PIPELINE_MAX];
+
+    struct rpc_request* request = rpc_request_get(rpc, id);
+
+    if(!request) continue;
+
+    if(request->done)
+    {
+      rpc->undelivered++;
+
+      rpc_request_free(request);
+    }
+    else request->client = -1;
+  }
+
+  socket_close(&client->fd, rpc->debug);
+
+  free(client->out.data);
+
+  memset(client, 0, sizeof(struct rpc_client));
+
+  client->fd = -1;
+
+  while(rpc->count > 0 && rpc->clients[rpc->count - 1].fd == -1) rpc->count--;
+}
+
+/*
+ * Close the RPC server, disconnect all clients and drop the outstanding requests
+ */
+void rpc_close(struct rpc* rpc)
+{
+  if(!rpc->open) return;
+
+  for(size_t index = 0; index < rpc->count; index++)
+  {
+    if(rpc->clients[index].fd != -1) rpc_client_close(rpc, index);
+  }
+
+  for(size_t index = 0; index < RPC_REQUESTS_MAX; index++)
+  {
+    if(rpc->requests[index].used) rpc_request_free(&rpc->requests[index]);
+  }
+
+  socket_close(&rpc->servfd, rpc->debug);
+
+  free(rpc->worker_out.data);
+
+  free(rpc->clients);
+
+  free(rpc->pollfds);
+
+  free(rpc->polled);
+
+  free(rpc->requests);
+
+  if(rpc->debug) info_print("Closed RPC server");
+
+  rpc->open = false;
+}
+
+/*
+ * Get the latency bucket of a number of microseconds
+ */
+static int rpc_latency_bucket(long usec)
+{
+  if(usec < RPC_LATENCY_SUBBUCKETS) return (usec > 0) ? usec : 0;
+
+  int msb = 63 - __builtin_clzl(usec);
+
+  int bucket = (msb - 2) * RPC_LATENCY_SUBBUCKETS + ((usec >> (msb - 3)) & (RPC_LATENCY_SUBBUCKETS - 1));
+
+  return (bucket < RPC_LATENCY_BUCKETS) ? bucket : RPC_LATENCY_BUCKETS - 1;
+}
+
+/*
+ * Get the highest number of microseconds of a latency bucket
+ */
+static long rpc_latency_bound(int bucket)
+{
+  if(bucket < RPC_LATENCY_SUBBUCKETS) return bucket;
+
+  int shift = bucket / RPC_LATENCY_SUBBUCKETS - 1;
+
+  long lower = (long) (RPC_LATENCY_SUBBUCKETS + bucket % RPC_LATENCY_SUBBUCKETS) << shift;
+
+  return lower + (1L << shift) - 1;
+}
+
+/*
+ * Get a percentile of the latency of the replied requests
+ *
+ * PARAMS
+ * - double percentile | The percentile, from 0 to 100
+ *
+ * RETURN (long usec)
+ * - The latency in microseconds, rounded up to its bucket,
+ *   or 0 if no request has been replied to
+ */
+long rpc_latency_percentile(const struct rpc* rpc, double percentile)
+{
+  size_t total = 0;
+
+  for(int bucket = 0; bucket < RPC_LATENCY_BUCKETS; bucket++)
+  {
+    total += rpc->latency[bucket];
+  }
+
+  if(total == 0) return 0;
+
+  size_t rank = (size_t) (percentile / 100 * total);
+
+  if(rank < 1) rank = 1;
+
+  if(rank > total) rank = total;
+
+  size_t count = 0;
+
+  for(int bucket = 0; bucket < RPC_LATENCY_BUCKETS; bucket++)
+  {
+    if((count += rpc->latency[bucket]) >= rank) return rpc_latency_bound(bucket);
+  }
+
+  return rpc_latency_bound(RPC_LATENCY_BUCKETS - 1);
+}
+
+/*
+ * Add the latency of a request, from when it was sent until now
+ */
+static void rpc_latency_add(struct rpc* rpc, const struct rpc_request* request)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long usec = (now.tv_sec - request->start.tv_sec) * 1000000 + (now.tv_nsec - request->start.tv_nsec) / 1000;
+
+  rpc->latency[rpc_latency_bucket(usec)]++;
+
+  rpc->latency_sum += usec;
+}
+
+/*
+ * Get the reply of a done request, or the timeout reply
+ */
+static const char* rpc_reply(const struct rpc_request* request, size_t* size)
+{
+  if(request->reply)
+  {
+    *size = request->reply_size;
+
+    return request->reply;
+  }
+
+  *size = strlen(RPC_TIMEOUT "\n");
+
+  return RPC_TIMEOUT "\n";
+}
+
+/*
+ * Write the reply of a request to its reply fifo
+ *
+ * The fifo is not waited for, the reply is dropped if nobody reads the fifo
+ */
+static void rpc_fifo_reply(struct rpc* rpc, const struct rpc_request* request)
+{
+  int fd = open(request->path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+  if(fd == -1)
+  {
+    if(rpc->debug) error_print("Failed to open reply fifo (%s)", request->path);
+
+    rpc->undelivered++;
+
+    return;
+  }
+
+  size_t size;
+
+  const char* reply = rpc_reply(request, &size);
+
+  if(write(fd, reply, size) != (ssize_t) size) rpc->undelivered++;
+
+  close(fd);
+}
+
+/*
+ * Send the done requests of a client, in the order of its requests
+ *
+ * The replies stop at the first request that is not done
+ */
+static void rpc_client_deliver(struct rpc* rpc, int index)
+{
+  struct rpc_client* client = &rpc->clients[index];
+
+  while(client->pending_count > 0)
+  {
+    struct rpc_request* request = rpc_request_get(rpc, client->pending[client->pending_head]);
+
+    if(request && !request->done) break;
+
+    if(request)
+    {
+      size_t size;
+
+      const char* reply = rpc_reply(request, &size);
+
+      // The reply of a client that does not keep up is dropped
+      if(rpc_buffer_size(&client->out) + size > RPC_BUFFER_MAX || rpc_buffer_queue(&client->out, reply, size) == -1)
+      {
+        rpc->undelivered++;
+      }
+
+      rpc_request_free(request);
+    }
+
+    client->pending_head = (client->pending_head + 1) % RPC_PIPELINE_MAX;
+
+    client->pending_count--;
+  }
+}
+
+/*
+ * Hand a done request over to its client or reply fifo
+ */
+static void rpc_request_done(struct rpc* rpc, struct rpc_request* request)
+{
+  request->done = true;
+
+  // 1. If the reply goes to a fifo, write it at once
+  if(request->path)
+  {
+    rpc_fifo_reply(rpc, request);
+
+    rpc_request_free(request);
+  }
+  // 2. If the client has gone away, drop the reply
+  else if(request->client == -1)
+  {
+    rpc->undelivered++;
+
+    rpc_request_free(request);
+  }
+  // 3. Else, send the replies of the client that are in order
+  else rpc_client_deliver(rpc, request->client);
+}
+
+/*
+ * Handle a reply line from the worker, "ID REPLY"
+ *
+ * PARAMS
+ * - size_t size | The size of the line, with the newline
+ */
+static void rpc_worker_line(struct rpc* rpc, const char* line, size_t size)
+{
+  uint32_t id = 0;
+
+  size_t index = 0;
+
+  for(; index < size && line[index] >= '0' && line[index] <= '9'; index++)
+  {
+    id = id * 10 + (line[index] - '0');
+  }
+
+  struct rpc_request* request = NULL;
+
+  if(index > 0 && index < size && line[index] == ' ')
+  {
+    request = rpc_request_get(rpc, id);
+  }
+
+  // A reply to a request that has timed out, or a reply without an ID
+  if(!request || request->done)
+  {
+    rpc->unmatched++;
+
+    return;
+  }
+
+  size_t reply_size = size - (index + 1);
+
+  if(!(request->reply = malloc(reply_size)))
+  {
+    if(rpc->debug) error_print("Failed to allocate reply");
+
+    rpc->unmatched++;
+
+    return;
+  }
+
+  memcpy(request->reply, line + index + 1, reply_size);
+
+  request->reply_size = reply_size;
+
+  rpc_latency_add(rpc, request);
+
+  rpc->replied++;
+
+  rpc_request_done(rpc, request);
+}
+
+/*
+ * Read what the worker has replied, and handle the complete lines
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The worker has ended, or failed to read
+ */
+static int rpc_worker_read(struct rpc* rpc, int replyfd)
+{
+  ssize_t read_size = read(replyfd, rpc->worker_in + rpc->worker_in_size, RPC_LINE_MAX - rpc->worker_in_size);
+
+  if(read_size == -1)
+  {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+  }
+
+  if(read_size == 0) return -1;
+
+  rpc->worker_in_size += read_size;
+
+  size_t start = 0;
+
+  char* newline;
+
+  while((newline = memchr(rpc->worker_in + start, '\n', rpc->worker_in_size - start)))
+  {
+    size_t size = newline - (rpc->worker_in + start) + 1;
+
+    if(!rpc->worker_discard) rpc_worker_line(rpc, rpc->worker_in + start, size);
+
+    rpc->worker_discard = false;
+
+    start += size;
+  }
+
+  memmove(rpc->worker_in, rpc->worker_in + start, rpc->worker_in_size - start);
+
+  rpc->worker_in_size -= start;
+
+  // A reply that does not fit is dropped, up to its newline
+  if(rpc->worker_in_size == RPC_LINE_MAX)
+  {
+    if(rpc->debug && !rpc->worker_discard) error_print("Dropped too long reply");
+
+    rpc->worker_discard = true;
+
+    rpc->worker_in_size = 0;
+  }
+
+  return 0;
+}
+
+/*
+ * Check if a client can make another request
+ *
+ * The slot of the next ID has to be free, the client has to be below
+ * its max outstanding requests, and the worker has to keep up
+ */
+static bool rpc_ready(struct rpc* rpc, const struct rpc_client* client)
+{
+  return client->pending_count < RPC_PIPELINE_MAX && !rpc_slot(rpc, rpc->next_id)->used &&
+         rpc_buffer_size(&rpc->worker_out) < RPC_BUFFER_MAX;
+}
+
+/*
+ * Tag a request with the next ID, and queue it to be sent to the worker
+ *
+ * PARAMS
+ * - size_t size      | The size of the request, without the newline
+ * - const char* path | The reply fifo of the request, or NULL
+ */
+static void rpc_request_send(struct rpc* rpc, int index, const char* line, size_t size, const char* path, size_t path_size)
+{
+  char prefix[16];
+
+  uint32_t id = rpc->next_id;
+
+  int prefix_size = snprintf(prefix, sizeof(prefix), "%u ", id);
+
+  struct rpc_request* request = rpc_slot(rpc, id);
+
+  if(path && !(request->path = strndup(path, path_size)))
+  {
+    if(rpc->debug) error_print("Failed to allocate reply fifo path");
+
+    return;
+  }
+
+  size_t queued = rpc_buffer_size(&rpc->worker_out);
+
+  if(rpc_buffer_queue(&rpc->worker_out, prefix, prefix_size) == -1 ||
+     rpc_buffer_queue(&rpc->worker_out, line, size) == -1 ||
+     rpc_buffer_queue(&rpc->worker_out, "\n", 1) == -1)
+  {
+    if(rpc->debug) error_print("Failed to queue request");
+
+    // The part of the request that was queued is not sent
+    rpc->worker_out.end = rpc->worker_out.start + queued;
+
+    rpc_request_free(request);
+
+    return;
+  }
+
+  request->used   = true;
+  request->id     = id;
+  request->client = path ? -1 : index;
+
+  clock_gettime(CLOCK_MONOTONIC, &request->start);
+
+  if(rpc->timeout > 0) deadline_set(&request->deadline, rpc->timeout);
+
+  if(!path)
+  {
+    struct rpc_client* client = &rpc->clients[index];
+
+    client->pending[(client->pending_head + client->pending_count) % RPC_PIPELINE_MAX] = id;
+
+    client->pending_count++;
+  }
+
+  rpc->next_id++;
+
+  rpc->sent++;
+}
+
+/*
+ * Get the argument of a command line, if the line is the command
+ *
+ * RETURN (const char* argument)
+ * - The argument after the command and a space (empty if there is none)
+ * - NULL | The line is not the command
+ */
+static const char* command_argument(const char* line, size_t size, const char* command)
+{
+  size_t length = strlen(command);
+
+  if(size < length || strncmp(line, command, length) != 0) return NULL;
+
+  if(size == length) return line + length;
+
+  if(line[length] == ' ') return line + length + 1;
+
+  return NULL;
+}
+
+/*
+ * Handle a line from a client: a request, or a request with a reply fifo
+ *
+ * PARAMS
+ * - size_t size | The size of the line, with the newline
+ */
+static void rpc_line(struct rpc* rpc, int index, const char* line, size_t size)
+{
+  struct rpc_client* client = &rpc->clients[index];
+
+  // The text of the line, without the newline
+  size_t length = size - 1;
+
+  // 1. If the client starts with a hello, answer that no features are agreed
+  if(!client->greeted && length >= strlen(SOCKET_HELLO) && strncmp(line, SOCKET_HELLO, strlen(SOCKET_HELLO)) == 0)
+  {
+    client->greeted = true;
+
+    rpc_buffer_queue(&client->out, SOCKET_HELLO "\n", strlen(SOCKET_HELLO) + 1);
+
+    return;
+  }
+
+  client->greeted = true;
+
+  const char* path;
+
+  // 2. If the line names a reply fifo, the rest of the line is the request
+  if((path = command_argument(line, length, RPC_REPLY)))
+  {
+    const char* space = memchr(path, ' ', length - (path - line));
+
+    if(!space || space == path)
+    {
+      if(rpc->debug) error_print("Missing reply fifo or request from client (%d)", client->fd);
+
+      return;
+    }
+
+    rpc_request_send(rpc, index, space + 1, length - (space + 1 - line), path, space - path);
+  }
+  // 3. Else, the whole line is the request
+  else rpc_request_send(rpc, index, line, length, NULL, 0);
+}
+
+/*
+ * Handle the complete lines of a client, as long as it can make requests
+ *
+ * The rest of the lines wait until the client can make requests again
+ */
+static void rpc_client_lines(struct rpc* rpc, int index)
+{
+  struct rpc_client* client = &rpc->clients[index];
+
+  size_t start = 0;
+
+  char* newline = NULL;
+
+  while(rpc_ready(rpc, client) && (newline = memchr(client->in + start, '\n', client->in_size - start)))
+  {
+    size_t size = newline - (client->in + start) + 1;
+
+    if(!client->discard) rpc_line(rpc, index, client->in + start, size);
+
+    client->discard = false;
+
+    start += size;
+  }
+
+  memmove(client->in, client->in + start, client->in_size - start);
+
+  client->in_size -= start;
+
+  // A line that does not fit is dropped, up to its newline
+  if(client->in_size == RPC_LINE_MAX && !memchr(client->in, '\n', client->in_size))
+  {
+    if(rpc->debug && !client->discard) error_print("Dropped too long line from client (%d)", client->fd);
+
+    client->discard = true;
+
+    client->in_size = 0;
+  }
+}
+
+/*
+ * Read what a client has sent, and handle the complete lines
+ *
+ * RETURN (int status)
+ * -  0 | Success, or the client has sent everything
+ * - -1 | The client disconnected, or failed to read
+ */
+static int rpc_client_read(struct rpc* rpc, int index)
+{
+  struct rpc_client* client = &rpc->clients[index];
+
+  ssize_t read_size = read(client->fd, client->in + client->in_size, RPC_LINE_MAX - client->in_size);
+
+  if(read_size == -1)
+  {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+  }
+
+  // The client has sent all its requests, but still waits for the replies
+  if(read_size == 0)
+  {
+    client->ended = true;
+
+    return 0;
+  }
+
+  client->in_size += read_size;
+
+  rpc_client_lines(rpc, index);
+
+  return 0;
+}
+
+/*
+ * Accept the waiting clients
+ */
+static void rpc_accept(struct rpc* rpc)
+{
+  int sockfd;
+
+  while((sockfd = server_socket_accept(rpc->servfd, rpc->debug)) != -1)
+  {
+    size_t index = 0;
+
+    while(index < rpc->count && rpc->clients[index].fd != -1) index++;
+
+    if(index == RPC_CLIENTS_MAX)
+    {
+      if(rpc->debug) error_print("Too many clients, closing socket (%d)", sockfd);
+
+      socket_close(&sockfd, rpc->debug);
+
+      continue;
+    }
+
+    memset(&rpc->clients[index], 0, sizeof(struct rpc_client));
+
+    rpc->clients[index].fd = sockfd;
+
+    if(index == rpc->count) rpc->count++;
+
+    rpc->accepted++;
+  }
+}
+
+/*
+ * Time out the requests that have not been replied to in time
+ *
+ * The requests time out in the order of their IDs, as they all wait
+ * for as long
+ *
+ * RETURN (long timeout)
+ * - >0 | Milliseconds until the next request times out
+ * - -1 | No request can time out
+ */
+static long rpc_expire(struct rpc* rpc)
+{
+  while(rpc->oldest_id != rpc->next_id && !rpc_request_get(rpc, rpc->oldest_id))
+  {
+    rpc->oldest_id++;
+  }
+
+  if(rpc->timeout <= 0) return -1;
+
+  for(uint32_t id = rpc->oldest_id; id != rpc->next_id; id++)
+  {
+    struct rpc_request* request = rpc_request_get(rpc, id);
+
+    if(!request || request->done) continue;
+
+    long timeout = deadline_timeout(&request->deadline);
+
+    if(timeout > 0) return timeout;
+
+    if(rpc->debug) error_print("Request (%d) timed out", (int) id);
+
+    rpc->timeouts++;
+
+    rpc_request_done(rpc, request);
+  }
+
+  return -1;
+}
+
+/*
+ * Send the queued requests to the worker, and the queued replies
+ * to the clients, without waiting
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The worker has gone away, or failed to write to it
+ */
+static int rpc_flush(struct rpc* rpc, int requestfd)
+{
+  for(size_t index = 0; index < rpc->count; index++)
+  {
+    struct rpc_client* client = &rpc->clients[index];
+
+    if(client->fd == -1 || rpc_buffer_size(&client->out) == 0) continue;
+
+    if(rpc_buffer_flush(&client->out, client->fd, true) == -1) rpc_client_close(rpc, index);
+  }
+
+  // A client that has ended is disconnected once it has all its replies
+  for(size_t index = 0; index < rpc->count; index++)
+  {
+    struct rpc_client* client = &rpc->clients[index];
+
+    if(client->fd != -1 && client->ended && client->pending_count == 0 && rpc_buffer_size(&client->out) == 0)
+    {
+      rpc_client_close(rpc, index);
+    }
+  }
+
+  if(rpc_buffer_flush(&rpc->worker_out, requestfd, false) == -1)
+  {
+    if(rpc->debug) error_print("Failed to write to worker: %s", strerror(errno));
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Collect the file descriptors to poll: the event, the server socket,
+ * the worker and every client. Clients with queued replies are polled
+ * for writing, and clients that can make requests for reading
+ *
+ * RETURN (nfds_t count)
+ * - The number of file descriptors to poll
+ */
+static nfds_t rpc_pollfds(struct rpc* rpc, int event, int requestfd, int replyfd, bool accepting)
+{
+  nfds_t count = 0;
+
+  bool sending = (rpc_buffer_size(&rpc->worker_out) > 0);
+
+  rpc->pollfds[count++] = (struct pollfd) { .fd = event, .events = POLLIN };
+
+  rpc->pollfds[count++] = (struct pollfd) { .fd = accepting ? rpc->servfd : -1, .events = POLLIN };
+
+  rpc->pollfds[count++] = (struct pollfd) { .fd = accepting ? replyfd : -1, .events = POLLIN };
+
+  rpc->pollfds[count++] = (struct pollfd) { .fd = (accepting && sending) ? requestfd : -1, .events = POLLOUT };
+
+  for(size_t index = 0; index < rpc->count; index++)
+  {
+    struct rpc_client* client = &rpc->clients[index];
+
+    if(client->fd == -1) continue;
+
+    short events = (accepting && !client->ended && client->in_size < RPC_LINE_MAX && rpc_ready(rpc, client)) ? POLLIN : 0;
+
+    if(rpc_buffer_size(&client->out) > 0) events |= POLLOUT;
+
+    rpc->polled[count] = index;
+
+    rpc->pollfds[count++] = (struct pollfd) { .fd = client->fd, .events = events };
+  }
+
+  return count;
+}
+
+/*
+ * Send the replies queued for the clients, before the drain deadline
+ */
+static void rpc_drain(struct rpc* rpc, int requestfd, long drain_timeout)
+{
+  struct timespec deadline;
+
+  deadline_set(&deadline, drain_timeout);
+
+  rpc_flush(rpc, requestfd);
+
+  long timeout;
+
+  while((timeout = deadline_timeout(&deadline)) > 0)
+  {
+    nfds_t count = rpc_pollfds(rpc, -1, requestfd, -1, false);
+
+    bool pending = false;
+
+    for(nfds_t position = 4; position < count; position++)
+    {
+      if(rpc->pollfds[position].events) pending = true;
+    }
+
+    if(!pending) break;
+
+    if(poll(rpc->pollfds, count, timeout) == -1 && errno != EINTR) break;
+
+    rpc_flush(rpc, requestfd);
+  }
+}
+
+/*
+ * Serve the requests of the clients, until the event is signaled
+ * or the worker ends
+ *
+ * Then, the replies queued for the clients are sent before the drain deadline.
+ * SIGPIPE is blocked in the calling thread, a reply fifo or worker
+ * that has gone away is seen as a failed write
+ *
+ * PARAMS
+ * - int requestfd | The worker reads the requests from it
+ * - int replyfd   | The worker writes the replies to it
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * -  1 | The worker has ended
+ * - -1 | Failed to poll
+ */
+int rpc_run(struct rpc* rpc, int requestfd, int replyfd, int event, long drain_timeout)
+{
+  sigset_t sigset;
+  sigemptyset(&sigset);
+  sigaddset(&sigset, SIGPIPE);
+
+  pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+  nonblock_set(requestfd);
+
+  nonblock_set(replyfd);
+
+  int status = 0;
+
+  while(true)
+  {
+    long timeout = rpc_expire(rpc);
+
+    nfds_t count = rpc_pollfds(rpc, event, requestfd, replyfd, true);
+
+    if(poll(rpc->pollfds, count, timeout) == -1)
+    {
+      if(errno == EINTR) continue;
+
+      if(rpc->debug) error_print("Failed to poll RPC server: %s", strerror(errno));
+
+      status = -1;
+
+      break;
+    }
+
+    if(rpc->pollfds[0].revents) break;
+
+    if(rpc->pollfds[1].revents & POLLIN) rpc_accept(rpc);
+
+    if(rpc->pollfds[2].revents && rpc_worker_read(rpc, replyfd) == -1)
+    {
+      if(rpc->debug) info_print("Worker has ended");
+
+      status = 1;
+
+      break;
+    }
+
+    for(nfds_t position = 4; position < count; position++)
+    {
+      int index = rpc->polled[position];
+
+      if(rpc->clients[index].fd != rpc->pollfds[position].fd) continue;
+
+      if(rpc->pollfds[position].revents & (POLLIN | POLLHUP | POLLERR))
+      {
+        if(rpc_client_read(rpc, index) == -1) rpc_client_close(rpc, index);
+      }
+    }
+
+    // The lines that waited for a free slot can be requested now
+    for(size_t index = 0; index < rpc->count; index++)
+    {
+      if(rpc->clients[index].fd != -1 && rpc->clients[index].in_size > 0) rpc_client_lines(rpc, index);
+    }
+
+    if(rpc_flush(rpc, requestfd) == -1)
+    {
+      status = 1;
+
+      break;
+    }
+  }
+
+  rpc_drain(rpc, requestfd, drain_timeout);
+
+  return status;
+}
@@ -0,0 +1,149 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef RPC_H
+#define RPC_H
+
+#include "debug.h"
+#include "socket.h"
+#include "event.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define RPC_CLIENTS_MAX 1024
+
+/*
+ * Max length of a request or a reply, longer lines are dropped
+ */
+#define RPC_LINE_MAX 4096
+
+/*
+ * Max bytes waiting to be sent to a client or to the worker
+ */
+#define RPC_BUFFER_MAX (1024 * 1024)
+
+/*
+ * Max outstanding requests in all (a power of two), and of a single client.
+ * A client is not read while it, or the worker, is at its max
+ */
+#define RPC_REQUESTS_MAX 4096
+#define RPC_PIPELINE_MAX 64
+
+/*
+ * A request line ":reply FIFO REQUEST" has its reply written to the fifo,
+ * and a request that is not replied to in time gets the reply ":timeout"
+ */
+#define RPC_REPLY   ":reply"
+#define RPC_TIMEOUT ":timeout"
+
+/*
+ * Buckets of the latency histogram, with 8 buckets for every power of two
+ * microseconds, so that a percentile is within an eighth of the latency
+ */
+#define RPC_LATENCY_SUBBUCKETS 8
+#define RPC_LATENCY_BUCKETS    (40 * RPC_LATENCY_SUBBUCKETS)
+
+/*
+ * Bytes waiting to be written to a file descriptor
+ */
+struct rpc_buffer
+{
+  char*  data;
+  size_t start;
+  size_t end;
+  size_t capacity;
+};
+
+/*
+ * A client connected to the RPC server
+ */
+struct rpc_client
+{
+  int               fd;      // -1 for a free slot
+  char              in[RPC_LINE_MAX];
+  size_t            in_size;
+  bool              discard; // Dropping the rest of a line that is too long
+  bool              greeted; // The first line has been read
+  bool              ended;   // The client has sent everything
+  struct rpc_buffer out;
+  uint32_t          pending[RPC_PIPELINE_MAX]; // Outstanding requests, in order
+  size_t            pending_head;
+  size_t            pending_count;
+};
+
+/*
+ * An outstanding request, in the slot of its correlation ID
+ */
+struct rpc_request
+{
+  bool            used;
+  bool            done;   // Replied to or timed out, waiting for earlier requests
+  uint32_t        id;
+  int             client; // The client of the request, -1 for none
+  char*           path;   // The reply fifo of the request, or NULL
+  char*           reply;  // The reply with its newline, NULL if timed out
+  size_t          reply_size;
+  struct timespec start;
+  struct timespec deadline;
+};
+
+/*
+ * A request/reply server in front of a worker
+ *
+ * Every line from a client is a request. It is tagged with a correlation
+ * ID, "ID REQUEST", and written to the worker, without waiting for the
+ * replies to earlier requests. The worker replies with "ID REPLY", in any
+ * order, and the reply is sent without the ID to the client of the
+ * request. A client gets its replies in the order of its requests
+ */
+struct rpc
+{
+  bool                open;
+  int                 servfd;
+  struct rpc_client*  clients;
+  size_t              count;    // Slots in use, including free slots in between
+  struct pollfd*      pollfds;
+  int*                polled;   // Client of every polled file descriptor
+  struct rpc_request* requests; // RPC_REQUESTS_MAX slots, by ID
+  uint32_t            next_id;
+  uint32_t            oldest_id; // The oldest request that may be outstanding
+  long                timeout;   // Max milliseconds to wait for a reply, 0 to wait forever
+  struct rpc_buffer   worker_out;
+  char                worker_in[RPC_LINE_MAX];
+  size_t              worker_in_size;
+  bool                worker_discard;
+  size_t              latency[RPC_LATENCY_BUCKETS];
+  long                latency_sum; // Microseconds
+  bool                debug;
+  size_t              accepted;    // Clients accepted
+  size_t              sent;        // Requests sent to the worker
+  size_t              replied;     // Replies matched to their request
+  size_t              timeouts;    // Requests that timed out
+  size_t              unmatched;   // Replies without an outstanding request
+  size_t              undelivered; // Replies whose client or fifo has gone away
+};
+
+extern int  rpc_open(struct rpc* rpc, const char* address, int port, long timeout, bool debug);
+
+extern void rpc_close(struct rpc* rpc);
+
+extern int  rpc_run(struct rpc* rpc, int requestfd, int replyfd, int event, long drain_timeout);
+
+extern long rpc_latency_percentile(const struct rpc* rpc, double percentile);
+
+#endif // RPC_H
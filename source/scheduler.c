@@ -0,0 +1,334 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "scheduler.h"
+
+/*
+ * Initialize a scheduler without sources
+ *
+ * RETURN (int status)
+ * - 0 | Success
+ * - 1 | Failed to initialize lock or condition
+ */
+int sched_init(struct sched* sched)
+{
+  memset(sched, 0, sizeof(struct sched));
+
+  if(pthread_mutex_init(&sched->lock, NULL) != 0) return 1;
+
+  if(event_cond_init(&sched->cond) != 0)
+  {
+    pthread_mutex_destroy(&sched->lock);
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Free the queued lines and the lock of the scheduler
+ *
+ * Note: No thread may be using the scheduler anymore
+ */
+void sched_free(struct sched* sched)
+{
+  for(int index = 0; index < sched->count; index++)
+  {
+    for(int lane = 0; lane < SCHED_LANES; lane++)
+    {
+      struct message* message = sched->sources[index].queues[lane].head;
+
+      while(message)
+      {
+        struct message* next = message->next;
+
+        free(message);
+
+        message = next;
+      }
+    }
+  }
+
+  sched->count = 0;
+
+  pthread_cond_destroy(&sched->cond);
+
+  pthread_mutex_destroy(&sched->lock);
+}
+
+/*
+ * Add a source to the scheduler
+ *
+ * PARAMS
+ * - int weight      | Share of the stream, relative to the other sources
+ * - size_t capacity | Max bytes queued for the source
+ *
+ * RETURN (int source)
+ * - >=0 | The index of the source
+ * -  -1 | Too many sources
+ */
+int sched_source_add(struct sched* sched, int weight, size_t capacity)
+{
+  pthread_mutex_lock(&sched->lock);
+
+  if(sched->count >= SCHED_SOURCES_MAX)
+  {
+    pthread_mutex_unlock(&sched->lock);
+
+    return -1;
+  }
+
+  int index = sched->count++;
+
+  struct sched_source* source = &sched->sources[index];
+
+  memset(source, 0, sizeof(struct sched_source));
+
+  source->weight   = (weight > 0) ? weight : 1;
+  source->capacity = capacity;
+
+  sched->active++;
+
+  pthread_mutex_unlock(&sched->lock);
+
+  return index;
+}
+
+/*
+ * Mark a source as ended, nothing more will be pushed from it
+ *
+ * When all sources have ended and their lines have been popped,
+ * the scheduler reaches End of File
+ */
+void sched_source_end(struct sched* sched, int source)
+{
+  pthread_mutex_lock(&sched->lock);
+
+  if(!sched->sources[source].ended)
+  {
+    sched->sources[source].ended = true;
+
+    sched->active--;
+  }
+
+  pthread_cond_broadcast(&sched->cond);
+
+  pthread_mutex_unlock(&sched->lock);
+}
+
+/*
+ * Wake up the threads waiting on the scheduler,
+ * so that they can check if their event has been signaled
+ */
+void sched_wake(struct sched* sched)
+{
+  pthread_mutex_lock(&sched->lock);
+
+  pthread_cond_broadcast(&sched->cond);
+
+  pthread_mutex_unlock(&sched->lock);
+}
+
+/*
+ * Check if there are lines in the queues to pop
+ */
+bool sched_pending(struct sched* sched)
+{
+  pthread_mutex_lock(&sched->lock);
+
+  bool pending = (sched->size > 0);
+
+  pthread_mutex_unlock(&sched->lock);
+
+  return pending;
+}
+
+/*
+ * Push a line to the queue of a source, just like buffer_write
+ *
+ * PARAMS
+ * - int lane | SCHED_LANE_CONTROL or SCHED_LANE_BULK
+ *
+ * If the queues of the source are full, wait until lines have been popped.
+ * Only the producer of that source is held back
+ *
+ * RETURN (ssize_t size)
+ * - >=0 | The number of pushed bytes. If not the whole buffer,
+ *         the event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ * -  -1 | Failed to allocate memory
+ */
+ssize_t sched_push(struct sched* sched, int source, int lane, const char* buffer, size_t size, int event, long timeout)
+{
+  if(!buffer || size == 0) return 0;
+
+  struct message* message = malloc(sizeof(struct message) + size);
+
+  if(!message) return -1;
+
+  message->next = NULL;
+  message->size = size;
+
+  memcpy(message->data, buffer, size);
+
+  struct timespec deadline;
+
+  if(timeout != -1) deadline_set(&deadline, timeout);
+
+  pthread_mutex_lock(&sched->lock);
+
+  struct sched_source* owner = &sched->sources[source];
+
+  while(owner->size > 0 && owner->size + size > owner->capacity)
+  {
+    int status = event_cond_wait(&sched->cond, &sched->lock, event, timeout, &deadline);
+
+    if(status != 0)
+    {
+      pthread_mutex_unlock(&sched->lock);
+
+      free(message);
+
+      errno = (status == 1) ? ECANCELED : ETIMEDOUT;
+
+      return 0;
+    }
+  }
+
+  struct sched_queue* queue = &owner->queues[lane];
+
+  if(queue->tail) queue->tail->next = message;
+
+  else queue->head = message;
+
+  queue->tail = message;
+
+  owner->size             += size;
+  sched->lanes[lane].size += size;
+  sched->size             += size;
+
+  pthread_cond_broadcast(&sched->cond);
+
+  pthread_mutex_unlock(&sched->lock);
+
+  return size;
+}
+
+/*
+ * Pick the source to pop the next line from in a lane, with deficit round robin
+ *
+ * Note: sched->lock must be held, and at least one line must be queued in the lane
+ *
+ * RETURN (int source)
+ */
+static int sched_source_next(struct sched* sched, int lane)
+{
+  struct sched_lane* state = &sched->lanes[lane];
+
+  while(true)
+  {
+    struct sched_source* source = &sched->sources[state->current];
+
+    struct sched_queue* queue = &source->queues[lane];
+
+    if(queue->head)
+    {
+      if(!state->visited)
+      {
+        queue->deficit += source->weight * SCHED_QUANTUM;
+
+        state->visited = true;
+      }
+
+      if(queue->head->size <= queue->deficit) return state->current;
+    }
+    // An idle source doesn't save up its quantum
+    else queue->deficit = 0;
+
+    state->current = (state->current + 1) % sched->count;
+
+    state->visited = false;
+  }
+}
+
+/*
+ * Pop the next line of the merged stream, just like reader_line
+ *
+ * The control lane is served first, then the bulk lane.
+ *
+ * If no line is queued, wait until one has been pushed.
+ * Sources that are still running are always waited on,
+ * even when the event has been signaled, since they end by themselves
+ *
+ * RETURN (ssize_t size)
+ * - >0 | Success! The length of the popped line
+ * -  0 | All sources have ended, End of File
+ * - -1 | The event was signaled (ECANCELED)
+ */
+ssize_t sched_pop(struct sched* sched, char* buffer, size_t size, int event)
+{
+  if(!buffer || size == 0) return 0;
+
+  pthread_mutex_lock(&sched->lock);
+
+  while(sched->size == 0 && sched->active > 0)
+  {
+    if(event_cond_wait(&sched->cond, &sched->lock, event, -1, NULL) == 1)
+    {
+      pthread_mutex_unlock(&sched->lock);
+
+      errno = ECANCELED;
+
+      return -1;
+    }
+  }
+
+  if(sched->size == 0)
+  {
+    pthread_mutex_unlock(&sched->lock);
+
+    return 0;
+  }
+
+  int lane = (sched->lanes[SCHED_LANE_CONTROL].size > 0) ? SCHED_LANE_CONTROL : SCHED_LANE_BULK;
+
+  struct sched_source* source = &sched->sources[sched_source_next(sched, lane)];
+
+  struct sched_queue* queue = &source->queues[lane];
+
+  struct message* message = queue->head;
+
+  // A line longer than the buffer is cut, and the rest is left in the queue
+  size_t length = (message->size < size) ? message->size : size;
+
+  memcpy(buffer, message->data, length);
+
+  if(length == message->size)
+  {
+    queue->head = message->next;
+
+    if(!queue->head) queue->tail = NULL;
+
+    free(message);
+  }
+  else
+  {
+    memmove(message->data, message->data + length, message->size - length);
+
+    message->size -= length;
+  }
+
+  queue->deficit          -= length;
+  source->size            -= length;
+  sched->lanes[lane].size -= length;
+  sched->size             -= length;
+
+  pthread_cond_broadcast(&sched->cond);
+
+  pthread_mutex_unlock(&sched->lock);
+
+  return length;
+}
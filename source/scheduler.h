@@ -0,0 +1,105 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "event.h"
+#include "queue.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define SCHED_SOURCES_MAX 16
+
+/*
+ * Bytes a source of weight 1 may send per round
+ */
+#define SCHED_QUANTUM 1024
+
+/*
+ * Priority lanes - the control lane is always served before the bulk lane
+ */
+#define SCHED_LANE_CONTROL 0
+#define SCHED_LANE_BULK    1
+
+#define SCHED_LANES 2
+
+/*
+ * The queue of a source in one lane
+ */
+struct sched_queue
+{
+  struct message* head;
+  struct message* tail;
+  size_t          deficit; // Bytes the source may still send this round
+};
+
+/*
+ * A source of lines, with its own queue in every lane
+ */
+struct sched_source
+{
+  struct sched_queue queues[SCHED_LANES];
+  size_t             size;     // Bytes in the queues
+  size_t             capacity; // Max bytes in the queues
+  int                weight;
+  bool               ended;
+};
+
+/*
+ * Round robin state of a lane
+ */
+struct sched_lane
+{
+  size_t size;    // Bytes in the lane
+  int    current; // Source being served this round
+  bool   visited; // The current source has got its quantum
+};
+
+/*
+ * Fair scheduler, merging the lines of several sources into one stream
+ *
+ * Lines in the control lane are popped before any line in the bulk lane,
+ * so control lines overtake queued bulk lines at line boundaries.
+ *
+ * Within a lane, the sources are served with deficit round robin:
+ * each round, a source may send its weight times SCHED_QUANTUM bytes,
+ * so a chatty source can't starve the others
+ */
+struct sched
+{
+  struct sched_source sources[SCHED_SOURCES_MAX];
+  int                 count;
+  int                 active; // Sources that have not ended
+  struct sched_lane   lanes[SCHED_LANES];
+  size_t              size;   // Bytes in all queues
+  pthread_mutex_t     lock;
+  pthread_cond_t      cond;
+};
+
+extern int  sched_init(struct sched* sched);
+
+extern void sched_free(struct sched* sched);
+
+extern int  sched_source_add(struct sched* sched, int weight, size_t capacity);
+
+extern void sched_source_end(struct sched* sched, int source);
+
+extern void sched_wake(struct sched* sched);
+
+extern bool sched_pending(struct sched* sched);
+
+
+extern ssize_t sched_push(struct sched* sched, int source, int lane, const char* buffer, size_t size, int event, long timeout);
+
+extern ssize_t sched_pop(struct sched* sched, char* buffer, size_t size, int event);
+
+#endif // SCHEDULER_H
@@ -1,7 +1,7 @@
 /*
  * Written by Hampus Fridholm
  *
- * Last updated: 2024-09-08
+ * Last updated: 2026-10-18
  */
 
 #include "socket.h"
@@ -115,13 +115,13 @@ static int socket_create(bool debug)
  * - >=0 | Success
  * -  -1 | Failed to create server socket
  */
-static int server_socket_create(const char* address, int port, bool debug)
+static int server_socket_create(const char* address, int port, int backlog, bool debug)
 {
   int servfd = socket_create(debug);
 
   if(servfd == -1) return -1;
 
-  if(socket_bind(servfd, address, port, debug) == -1 || socket_listen(servfd, 1, debug) == -1)
+  if(socket_bind(servfd, address, port, debug) == -1 || socket_listen(servfd, backlog, debug) == -1)
   {
     socket_close(&servfd, debug);
 
@@ -153,6 +153,8 @@ static int socket_connect(int sockfd, const char* address, int port, bool debug)
 
   if(debug) info_print("Connected socket (%s:%d)", address, port);
 
+  PROBE2(connect, sockfd, port);
+
   return 0;
 }
 
@@ -205,38 +207,317 @@ static int socket_accept(int servfd, const char* address, int port, bool debug)
 
   if(debug) info_print("Accepted socket (%d)", sockfd);
 
+  PROBE2(accept, sockfd, servfd);
+
+  return sockfd;
+}
+
+/*
+ * Names of the features in the hello
+ */
+static const struct
+{
+  const char* name;
+  int         feature;
+} socket_features[] =
+{
+  { "zlib",   SOCKET_FEATURE_ZLIB   },
+  { "delta",  SOCKET_FEATURE_DELTA  },
+  { "crc32c", SOCKET_FEATURE_CRC    },
+  { "stripe", SOCKET_FEATURE_STRIPE },
+  { "credit", SOCKET_FEATURE_CREDIT }
+};
+
+#define SOCKET_FEATURE_COUNT (sizeof(socket_features) / sizeof(*socket_features))
+
+
+/*
+ * Read the hello line of the peer, one byte at a time,
+ * to not read anything that follows it
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to read the hello, or it did not arrive in time
+ */
+static int socket_hello_read(int sockfd, char* buffer, size_t size, const struct timespec* deadline)
+{
+  size_t length = 0;
+
+  while(length + 1 < size)
+  {
+    ssize_t status = recv(sockfd, buffer + length, 1, 0);
+
+    if(status == 1)
+    {
+      if(buffer[length] == '\n')
+      {
+        buffer[length] = '\0';
+
+        return 0;
+      }
+
+      length++;
+
+      continue;
+    }
+
+    if(status == 0) return -1;
+
+    if(errno != EAGAIN && errno != EINTR) return -1;
+
+    if(event_wait(sockfd, POLLIN, -1, deadline_timeout(deadline)) != 0) return -1;
+  }
+
+  return -1;
+}
+
+/*
+ * Exchange hellos with the peer, to agree on the features of the connection
+ *
+ * Both peers send their hello first, and then read the hello of the other,
+ * which lists the features it offers. The features of the connection
+ * are the features offered by both
+ *
+ * PARAMS
+ * - int* features | The offered features, and then the agreed features
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to exchange hellos
+ */
+static int socket_hello(int sockfd, int* features, bool debug)
+{
+  char hello[256] = SOCKET_HELLO;
+
+  for(size_t index = 0; index < SOCKET_FEATURE_COUNT; index++)
+  {
+    if(*features & socket_features[index].feature)
+    {
+      strcat(hello, " ");
+      strcat(hello, socket_features[index].name);
+    }
+  }
+
+  if(debug) info_print("Sending hello: %s", hello);
+
+  strcat(hello, "\n");
+
+  struct timespec deadline;
+
+  deadline_set(&deadline, SOCKET_HELLO_TIMEOUT);
+
+  size_t length = strlen(hello);
+
+  if(socket_write(sockfd, hello, length, -1, SOCKET_HELLO_TIMEOUT) != (ssize_t) length || socket_hello_read(sockfd, hello, sizeof(hello), &deadline) == -1)
+  {
+    if(debug) error_print("Failed to exchange hellos");
+
+    return -1;
+  }
+
+  if(debug) info_print("Received hello: %s", hello);
+
+  if(strncmp(hello, SOCKET_HELLO, strlen(SOCKET_HELLO)) != 0)
+  {
+    if(debug) error_print("Peer did not send a hello");
+
+    return -1;
+  }
+
+  int peer_features = 0;
+
+  char* saveptr = NULL;
+
+  for(char* token = strtok_r(hello + strlen(SOCKET_HELLO), " ", &saveptr); token; token = strtok_r(NULL, " ", &saveptr))
+  {
+    for(size_t index = 0; index < SOCKET_FEATURE_COUNT; index++)
+    {
+      if(!strcmp(token, socket_features[index].name)) peer_features |= socket_features[index].feature;
+    }
+  }
+
+  *features &= peer_features;
+
+  return 0;
+}
+
+/*
+ * Prepare a connected socket to be relayed, and negotiate its features
+ *
+ * The hello is only exchanged if any features are offered,
+ * so that a peer without features sees a plain connection.
+ * A plain relay answers the hello itself, see stdout_hello_answer
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to negotiate features
+ */
+static int socket_connected(int sockfd, int* features, bool debug)
+{
+  // The socket is waited on with poll, to be able to cancel reads and writes
+  nonblock_set(sockfd);
+
+  if(*features == 0) return 0;
+
+  return socket_hello(sockfd, features, debug);
+}
+
+/*
+ * Connect to a server, without becoming the server if there is none
+ *
+ * PARAMS
+ * - int* features | The offered features, and then the agreed features
+ *
+ * RETURN (int status)
+ * - 0 | Success!
+ * - 1 | Failed to connect
+ * - 2 | Failed to negotiate features
+ */
+int client_socket_open(int* sockfd, const char* address, int port, int* features, bool debug)
+{
+  *sockfd = client_socket_create(address, port, debug);
+
+  if(*sockfd == -1) return 1;
+
+  if(socket_connected(*sockfd, features, debug) == 0) return 0;
+
+  socket_close(sockfd, debug);
+
+  return 2;
+}
+
+/*
+ * Create a server socket for many clients, which are accepted without waiting
+ *
+ * RETURN (int status)
+ * - 0 | Success!
+ * - 1 | Failed to create server socket
+ */
+int server_socket_open(int* servfd, const char* address, int port, int backlog, bool debug)
+{
+  *servfd = server_socket_create(address, port, backlog, debug);
+
+  if(*servfd == -1) return 1;
+
+  if(nonblock_set(*servfd) == -1)
+  {
+    if(debug) error_print("Failed to set server socket non-blocking: %s", strerror(errno));
+
+    socket_close(servfd, debug);
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Accept a waiting client of a server socket from server_socket_open
+ *
+ * The client socket is non-blocking
+ *
+ * RETURN (int sockfd)
+ * - >=0 | Success
+ * -  -1 | No client is waiting (EAGAIN), or failed to accept
+ */
+int server_socket_accept(int servfd, bool debug)
+{
+  int sockfd = accept4(servfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  if(sockfd == -1)
+  {
+    if(errno != EAGAIN && errno != EWOULDBLOCK && debug) error_print("Failed to accept socket: %s", strerror(errno));
+
+    return -1;
+  }
+
+  if(debug) info_print("Accepted socket (%d)", sockfd);
+
+  PROBE2(accept, sockfd, servfd);
+
   return sockfd;
 }
 
 /*
+ * Accept another client of the server socket of a connection,
+ * and negotiate its features
+ *
+ * PARAMS
+ * - int* features | The offered features, and then the agreed features
+ * - long timeout  | Max milliseconds to wait for the client
+ *
+ * RETURN (int sockfd)
+ * - >=0 | Success
+ * -  -1 | No client in time (ETIMEDOUT), or failed to accept or negotiate
+ */
+int server_socket_join(int servfd, int* features, long timeout, bool debug)
+{
+  int status = event_wait(servfd, POLLIN, -1, timeout);
+
+  if(status != 0)
+  {
+    if(status == 2) errno = ETIMEDOUT;
+
+    if(debug) error_print("No client joined in time");
+
+    return -1;
+  }
+
+  int sockfd = server_socket_accept(servfd, debug);
+
+  if(sockfd == -1) return -1;
+
+  if(socket_connected(sockfd, features, debug) == 0) return sockfd;
+
+  socket_close(&sockfd, debug);
+
+  return -1;
+}
+
+/*
+ * PARAMS
+ * - int* features | The offered features, and then the agreed features
+ *
  * RETURN (int status)
  * - 0 | Success!
  * - 1 | Failed to create server socket
  * - 2 | Failed to create client socket
+ * - 3 | Failed to negotiate features
  *
  * This function is designed to clean up after it,
  * in case that it failed
  */
-int client_or_server_socket_create(int* sockfd, int* servfd, const char* address, int port, bool debug)
+int client_or_server_socket_create(int* sockfd, int* servfd, const char* address, int port, int* features, bool debug)
 {
   // 1. Try to connect to a server using address and port
-  *sockfd = client_socket_create(address, port, debug);
+  int status = client_socket_open(sockfd, address, port, features, debug);
+
+  if(status == 0) return 0;
 
-  if(*sockfd != -1) return 0;
+  if(status == 2) return 3;
 
   // 2. If no server was running, create a new server
-  *servfd = server_socket_create(address, port, debug);
+  *servfd = server_socket_create(address, port, 1, debug);
 
   if(*servfd == -1) return 1;
 
   // 3. Accept client connecting to server
   *sockfd = socket_accept(*servfd, address, port, debug);
 
-  if(*sockfd != -1) return 0;
+  if(*sockfd == -1)
+  {
+    socket_close(servfd, debug);
+
+    return 2;
+  }
+
+  if(socket_connected(*sockfd, features, debug) == 0) return 0;
+
+  socket_close(sockfd, debug);
 
   socket_close(servfd, debug);
 
-  return 2;
+  return 3;
 }
 
 /*
@@ -269,65 +550,193 @@ int socket_close(int* sockfd, bool debug)
 }
 
 /*
- * Read a single line to a buffer from a socket connection
+ * Write a buffer to a socket connection
+ *
+ * If the socket is full, wait until it can be written to
+ *
+ * PARAMS
+ * - int event    | Event to cancel the write, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
  *
  * RETURN (ssize_t size)
- * - >0 | The number of read characters
- * -  0 | Nothing to read, end of file
- * - -1 | Failed to read from socket
+ * - >=0 | The number of written bytes. If not the whole buffer,
+ *         the event was signaled (ECANCELED) or timed out (ETIMEDOUT)
+ * -  -1 | Failed to write to socket
  */
-ssize_t socket_read(int sockfd, char* buffer, size_t size)
+ssize_t socket_write(int sockfd, const char* buffer, size_t size, int event, long timeout)
 {
-  if(errno != 0) return -1;
-
   if(!buffer) return 0;
 
-  char symbol = '\0';
-  ssize_t index;
+  size_t index = 0;
 
-  for(index = 0; index < size && symbol != '\n'; index++)
+  while(index < size)
   {
-    ssize_t status = recv(sockfd, &symbol, 1, 0);
+    ssize_t status = send(sockfd, buffer + index, size - index, MSG_NOSIGNAL | MSG_DONTWAIT);
 
-    if(status == -1 || errno != 0) return -1; // ERROR
+    if(status > 0)
+    {
+      index += status;
+
+      continue;
+    }
+
+    if(status == -1 && errno != EAGAIN && errno != EINTR) return -1;
 
-    buffer[index] = symbol;
+    if(status == -1 && errno == EAGAIN) PROBE2(socket_full, sockfd, size - index);
 
-    if(status == 0) return 0; // End Of File
+    int wait_status = event_wait(sockfd, POLLOUT, event, timeout);
+
+    if(wait_status == 1)
+    {
+      errno = ECANCELED;
+
+      break;
+    }
+    else if(wait_status == 2)
+    {
+      errno = ETIMEDOUT;
+
+      break;
+    }
+    else if(wait_status == -1) return -1;
   }
 
+  if(index < size) PROBE3(socket_partial, sockfd, size, index);
+
   return index;
 }
 
 /*
- * Write a single line from a buffer to a socket connection
+ * Get the kernel buffer size of a socket
  *
- * RETURN (ssize_t size)
- * - >0 | The number of written characters
- * -  0 | Nothing to write to, end of file
- * - -1 | Failed to write to socket
+ * PARAMS
+ * - int optname | SO_SNDBUF or SO_RCVBUF
+ *
+ * Note: The kernel reports double the requested size,
+ *       to account for its own bookkeeping overhead
+ *
+ * RETURN (int size)
+ * - >0 | The buffer size
+ * - -1 | Failed to get the buffer size
  */
-ssize_t socket_write(int sockfd, const char* buffer, size_t size)
+int socket_buffer_size_get(int sockfd, int optname)
 {
-  if(errno != 0) return -1;
+  int size = -1;
+  socklen_t optlen = sizeof(size);
 
-  if(!buffer) return 0;
+  if(sockfd == -1 || getsockopt(sockfd, SOL_SOCKET, optname, &size, &optlen) == -1) return -1;
+
+  return size;
+}
 
-  ssize_t index;
-  char symbol = '\0';
+/*
+ * Set the kernel buffer size of a socket
+ *
+ * PARAMS
+ * - int optname | SO_SNDBUF or SO_RCVBUF
+ * - int size
+ *   - SOCKET_BUFFER_AUTO | Leave the size to the kernel autotuning
+ *   - >0                 | Requested size, capped by the system maximum
+ *
+ * RETURN (int size)
+ * - >0 | The resulting buffer size
+ * - -1 | Failed to set the buffer size
+ */
+int socket_buffer_size_set(int sockfd, int optname, int size, bool debug)
+{
+  if(sockfd == -1) return -1;
 
-  for(index = 0; index < size && symbol != '\n'; index++)
+  if(size != SOCKET_BUFFER_AUTO)
   {
-    symbol = buffer[index];
+    if(setsockopt(sockfd, SOL_SOCKET, optname, &size, sizeof(size)) == -1)
+    {
+      if(debug) error_print("Failed to set socket buffer size: %s", strerror(errno));
+    }
+  }
 
-    ssize_t status = send(sockfd, &symbol, 1, 0);
+  int result = socket_buffer_size_get(sockfd, optname);
 
-    if(status == -1 || errno != 0) return -1; // ERROR
-    
-    if(status == 0) return 0; // End Of File
+  if(debug) info_print("Socket (%d) %s buffer: %d bytes", sockfd, (optname == SO_SNDBUF) ? "send" : "receive", result);
+
+  return result;
+}
 
-    if(symbol == '\0') break;
+/*
+ * Limit the bytes that may wait unsent in the socket
+ *
+ * The socket is only writable when less than size bytes are unsent,
+ * so that queued data is held back in the relay instead of in the kernel
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to set the limit
+ */
+int socket_notsent_lowat_set(int sockfd, int size, bool debug)
+{
+  if(sockfd == -1) return -1;
+
+  if(setsockopt(sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &size, sizeof(size)) == -1)
+  {
+    if(debug) error_print("Failed to set socket (%d) unsent limit: %s", sockfd, strerror(errno));
+
+    return -1;
   }
 
-  return index;
+  if(debug) info_print("Socket (%d) unsent limit: %d bytes", sockfd, size);
+
+  return 0;
+}
+
+/*
+ * Let the kernel busy poll the device queue when the socket is read,
+ * instead of waiting for the interrupt
+ *
+ * Note: Raising the value above net.core.busy_read needs CAP_NET_ADMIN
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to enable busy polling
+ */
+int socket_busy_poll_set(int sockfd, int usec, bool debug)
+{
+  if(sockfd == -1) return -1;
+
+  if(setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1)
+  {
+    if(debug) error_print("Failed to set socket (%d) busy poll: %s", sockfd, strerror(errno));
+
+    return -1;
+  }
+
+  if(debug) info_print("Socket (%d) busy poll: %d us", sockfd, usec);
+
+  return 0;
+}
+
+/*
+ * Get the bytes written to a socket that the peer has not acknowledged
+ *
+ * The bytes are only known while the connection is up,
+ * as a reset connection discards what it has not sent
+ *
+ * RETURN (int size)
+ * - >=0 | Unacknowledged bytes
+ * -  -1 | The connection is not up
+ */
+int socket_unacked(int sockfd)
+{
+  int size;
+
+  if(ioctl(sockfd, SIOCOUTQ, &size) == -1) return -1;
+
+  struct tcp_info info;
+
+  socklen_t length = sizeof(info);
+
+  // The state is read after the bytes, so a reset in between is noticed
+  if(getsockopt(sockfd, IPPROTO_TCP, TCP_INFO, &info, &length) == -1) return -1;
+
+  if(info.tcpi_state != TCP_ESTABLISHED && info.tcpi_state != TCP_CLOSE_WAIT) return -1;
+
+  return size;
 }
@@ -1,31 +1,80 @@
 /*
  * Written by Hampus Fridholm
  *
- * Last updated: 2024-09-08
+ * Last updated: 2026-10-18
  */
 
 #ifndef SOCKET_H
 #define SOCKET_H
 
 #include "debug.h"
+#include "event.h"
+#include "probe.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
 
-extern int client_or_server_socket_create(int* sockfd, int* servfd, const char* address, int port, bool debug);
+#define SOCKET_BUFFER_AUTO -1
+
+/*
+ * Features of a connection, negotiated by the hello of both peers
+ */
+#define SOCKET_FEATURE_ZLIB   (1 << 0)
+#define SOCKET_FEATURE_DELTA  (1 << 1)
+#define SOCKET_FEATURE_CRC    (1 << 2)
+#define SOCKET_FEATURE_STRIPE (1 << 3)
+#define SOCKET_FEATURE_CREDIT (1 << 4)
+
+/*
+ * Start of the hello line, followed by the names of the offered features
+ */
+#define SOCKET_HELLO "PROCOM/1"
+
+/*
+ * Max milliseconds to wait for the hello of the peer
+ */
+#define SOCKET_HELLO_TIMEOUT 5000
+
+/*
+ * Max milliseconds that a relay without features waits for an early hello
+ */
+#define SOCKET_HELLO_GRACE 100
+
+extern int client_socket_open(int* sockfd, const char* address, int port, int* features, bool debug);
+
+extern int client_or_server_socket_create(int* sockfd, int* servfd, const char* address, int port, int* features, bool debug);
+
+extern int server_socket_open(int* servfd, const char* address, int port, int backlog, bool debug);
+
+extern int server_socket_accept(int servfd, bool debug);
+
+extern int server_socket_join(int servfd, int* features, long timeout, bool debug);
 
 extern int socket_close(int* sockfd, bool debug);
 
+extern int socket_buffer_size_set(int sockfd, int optname, int size, bool debug);
+
+extern int socket_buffer_size_get(int sockfd, int optname);
+
+extern int socket_notsent_lowat_set(int sockfd, int size, bool debug);
+
+extern int socket_busy_poll_set(int sockfd, int usec, bool debug);
+
+extern int socket_unacked(int sockfd);
 
-extern ssize_t socket_write(int sockfd, const char* buffer, size_t size);
 
-extern ssize_t socket_read(int sockfd, char* buffer, size_t size);
+extern ssize_t socket_write(int sockfd, const char* buffer, size_t size, int event, long timeout);
 
 #endif // SOCKET_H
@@ -0,0 +1,624 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "spool.h"
+
+/*
+ * Every segment starts with a header, followed by the records.
+ * A record is the size of the line (uint32_t), followed by the line
+ */
+struct spool_header
+{
+  char     magic[8];
+  uint64_t end; // Offset after the last record
+};
+
+#define SPOOL_HEADER_SIZE 64
+
+#define SPOOL_SEGMENT_MAGIC "PCSPOOL1"
+#define SPOOL_CURSOR_MAGIC  "PCCURSR1"
+
+#define SPOOL_RECORD_HEADER sizeof(uint32_t)
+
+/*
+ * Get the header of a segment
+ */
+static struct spool_header* segment_header(struct spool_segment* segment)
+{
+  return (struct spool_header*) segment->data;
+}
+
+/*
+ * Write the path of a file in the spool directory to a buffer
+ */
+static void spool_file_path(const struct spool* spool, char* buffer, size_t size, uint64_t number)
+{
+  snprintf(buffer, size, "%s/segment-%010lu", spool->path, (unsigned long) number);
+}
+
+/*
+ * Open (or create) a segment file, and map it to memory
+ *
+ * A new segment, or a segment without a valid header, starts empty
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to open or map the segment
+ */
+static int segment_open(struct spool* spool, struct spool_segment* segment, uint64_t number, bool debug)
+{
+  char path[4096];
+
+  spool_file_path(spool, path, sizeof(path), number);
+
+  segment->number = number;
+
+  if((segment->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1)
+  {
+    if(debug) error_print("Failed to open spool segment (%s): %s", path, strerror(errno));
+
+    return -1;
+  }
+
+  if(ftruncate(segment->fd, SPOOL_SEGMENT_SIZE) == -1)
+  {
+    if(debug) error_print("Failed to size spool segment (%s): %s", path, strerror(errno));
+
+    close(segment->fd);
+
+    return -1;
+  }
+
+  segment->data = mmap(NULL, SPOOL_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+
+  if(segment->data == MAP_FAILED)
+  {
+    if(debug) error_print("Failed to map spool segment (%s): %s", path, strerror(errno));
+
+    close(segment->fd);
+
+    return -1;
+  }
+
+  struct spool_header* header = segment_header(segment);
+
+  if(memcmp(header->magic, SPOOL_SEGMENT_MAGIC, sizeof(header->magic)) != 0 || header->end < SPOOL_HEADER_SIZE || header->end > SPOOL_SEGMENT_SIZE)
+  {
+    memcpy(header->magic, SPOOL_SEGMENT_MAGIC, sizeof(header->magic));
+
+    header->end = SPOOL_HEADER_SIZE;
+  }
+
+  return 0;
+}
+
+/*
+ * Unmap and close a segment, and remove its file if asked to
+ */
+static void segment_close(struct spool* spool, struct spool_segment* segment, bool remove)
+{
+  munmap(segment->data, SPOOL_SEGMENT_SIZE);
+
+  close(segment->fd);
+
+  if(remove)
+  {
+    char path[4096];
+
+    spool_file_path(spool, path, sizeof(path), segment->number);
+
+    unlink(path);
+  }
+}
+
+/*
+ * Remove the first (oldest) segment
+ *
+ * If the cursor is in the segment, it is moved to the next segment
+ */
+static void spool_first_remove(struct spool* spool)
+{
+  segment_close(spool, &spool->segments[0], true);
+
+  memmove(spool->segments, spool->segments + 1, (spool->count - 1) * sizeof(struct spool_segment));
+
+  spool->count--;
+
+  if(spool->cursor->segment < spool->segments[0].number)
+  {
+    spool->cursor->segment = spool->segments[0].number;
+    spool->cursor->offset  = SPOOL_HEADER_SIZE;
+  }
+}
+
+/*
+ * Compare segment numbers, for qsort
+ */
+static int number_compare(const void* a, const void* b)
+{
+  uint64_t first  = *(const uint64_t*) a;
+  uint64_t second = *(const uint64_t*) b;
+
+  return (first > second) - (first < second);
+}
+
+/*
+ * List the numbers of the segment files in the spool directory, in order
+ *
+ * RETURN (int count)
+ * - >=0 | The number of segments
+ * -  -1 | Failed to read the directory
+ */
+static int spool_numbers_read(struct spool* spool, uint64_t* numbers, size_t max)
+{
+  DIR* dir = opendir(spool->path);
+
+  if(!dir) return -1;
+
+  size_t count = 0;
+
+  struct dirent* entry;
+
+  while((entry = readdir(dir)) && count < max)
+  {
+    unsigned long number;
+
+    char rest;
+
+    if(sscanf(entry->d_name, "segment-%lu%c", &number, &rest) == 1)
+    {
+      numbers[count++] = number;
+    }
+  }
+
+  closedir(dir);
+
+  qsort(numbers, count, sizeof(uint64_t), number_compare);
+
+  return count;
+}
+
+/*
+ * Open (or create) and map the cursor file
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to open or map the cursor
+ */
+static int spool_cursor_open(struct spool* spool, bool debug)
+{
+  char path[4096];
+
+  snprintf(path, sizeof(path), "%s/cursor", spool->path);
+
+  if((spool->cursor_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1)
+  {
+    if(debug) error_print("Failed to open spool cursor (%s): %s", path, strerror(errno));
+
+    return -1;
+  }
+
+  if(ftruncate(spool->cursor_fd, sizeof(struct spool_cursor)) == -1)
+  {
+    close(spool->cursor_fd);
+
+    return -1;
+  }
+
+  spool->cursor = mmap(NULL, sizeof(struct spool_cursor), PROT_READ | PROT_WRITE, MAP_SHARED, spool->cursor_fd, 0);
+
+  if(spool->cursor == MAP_FAILED)
+  {
+    if(debug) error_print("Failed to map spool cursor (%s): %s", path, strerror(errno));
+
+    close(spool->cursor_fd);
+
+    return -1;
+  }
+
+  if(memcmp(spool->cursor->magic, SPOOL_CURSOR_MAGIC, sizeof(spool->cursor->magic)) != 0)
+  {
+    memcpy(spool->cursor->magic, SPOOL_CURSOR_MAGIC, sizeof(spool->cursor->magic));
+
+    spool->cursor->segment = 0;
+    spool->cursor->offset  = SPOOL_HEADER_SIZE;
+  }
+
+  return 0;
+}
+
+/*
+ * Map the segments that are left in the spool directory,
+ * and remove the segments that have already been forwarded
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to open the segments
+ */
+static int spool_segments_open(struct spool* spool, bool debug)
+{
+  uint64_t numbers[SPOOL_SEGMENTS_MAX];
+
+  int count = spool_numbers_read(spool, numbers, SPOOL_SEGMENTS_MAX);
+
+  if(count == -1)
+  {
+    if(debug) error_print("Failed to read spool (%s): %s", spool->path, strerror(errno));
+
+    return -1;
+  }
+
+  for(int index = 0; index < count; index++)
+  {
+    struct spool_segment* segment = &spool->segments[spool->count];
+
+    if(segment_open(spool, segment, numbers[index], debug) == -1) return -1;
+
+    spool->count++;
+
+    // Forwarded segments are removed
+    if(numbers[index] < spool->cursor->segment)
+    {
+      segment_close(spool, segment, true);
+
+      spool->count--;
+    }
+  }
+
+  // An empty spool starts with the segment of the cursor
+  if(spool->count == 0)
+  {
+    if(segment_open(spool, &spool->segments[0], spool->cursor->segment, debug) == -1) return -1;
+
+    spool->count = 1;
+  }
+
+  struct spool_segment* first = &spool->segments[0];
+
+  if(spool->cursor->segment != first->number || spool->cursor->offset < SPOOL_HEADER_SIZE || spool->cursor->offset > segment_header(first)->end)
+  {
+    spool->cursor->segment = first->number;
+    spool->cursor->offset  = SPOOL_HEADER_SIZE;
+  }
+
+  return 0;
+}
+
+/*
+ * Open a spool directory, creating it if needed
+ *
+ * The lines that were left in the spool, when it was closed,
+ * are forwarded first
+ *
+ * PARAMS
+ * - size_t size | Max bytes of the segment files, 0 for DEFAULT_SPOOL_SIZE
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to open the spool
+ */
+int spool_open(struct spool* spool, const char* path, size_t size, bool debug)
+{
+  memset(spool, 0, sizeof(struct spool));
+
+  spool->cursor_fd = -1;
+
+  pthread_mutex_init(&spool->lock, NULL);
+
+  event_cond_init(&spool->cond);
+
+  spool->open = true;
+
+  if(size == 0) size = DEFAULT_SPOOL_SIZE;
+
+  spool->max_segments = size / SPOOL_SEGMENT_SIZE;
+
+  if(spool->max_segments < 2) spool->max_segments = 2;
+
+  if(spool->max_segments > SPOOL_SEGMENTS_MAX) spool->max_segments = SPOOL_SEGMENTS_MAX;
+
+  if(mkdir(path, 0755) == -1 && errno != EEXIST)
+  {
+    if(debug) error_print("Failed to create spool (%s): %s", path, strerror(errno));
+
+    spool_close(spool, false);
+
+    return -1;
+  }
+
+  if(!(spool->path = strdup(path)) || spool_cursor_open(spool, debug) == -1 || spool_segments_open(spool, debug) == -1)
+  {
+    spool_close(spool, false);
+
+    return -1;
+  }
+
+  if(debug) info_print("Opened spool (%s): %ld segments", path, (long) spool->count);
+
+  return 0;
+}
+
+/*
+ * Close a spool, leaving the lines that are left in its directory
+ */
+void spool_close(struct spool* spool, bool debug)
+{
+  if(!spool->open) return;
+
+  for(size_t index = 0; index < spool->count; index++)
+  {
+    segment_close(spool, &spool->segments[index], false);
+  }
+
+  if(spool->cursor && spool->cursor != MAP_FAILED)
+  {
+    munmap(spool->cursor, sizeof(struct spool_cursor));
+
+    close(spool->cursor_fd);
+  }
+
+  pthread_mutex_destroy(&spool->lock);
+
+  pthread_cond_destroy(&spool->cond);
+
+  if(debug) info_print("Closed spool (%s)", spool->path);
+
+  free(spool->path);
+
+  spool->open = false;
+}
+
+/*
+ * Start a new segment after the last segment
+ *
+ * If the spool is full, the oldest segment is dropped first
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to create the segment
+ */
+static int spool_segment_add(struct spool* spool, bool debug)
+{
+  while(spool->count >= spool->max_segments)
+  {
+    struct spool_segment* first = &spool->segments[0];
+
+    size_t start = (spool->cursor->segment == first->number) ? spool->cursor->offset : SPOOL_HEADER_SIZE;
+
+    spool->dropped += segment_header(first)->end - start;
+
+    if(debug) error_print("Spool is full, dropping segment %ld", (long) first->number);
+
+    spool_first_remove(spool);
+  }
+
+  struct spool_segment* last = &spool->segments[spool->count - 1];
+
+  struct spool_segment* segment = &spool->segments[spool->count];
+
+  if(segment_open(spool, segment, last->number + 1, debug) == -1) return -1;
+
+  spool->count++;
+
+  return 0;
+}
+
+/*
+ * Append a line to the spool
+ *
+ * This never waits for the line to be forwarded: if the spool is full,
+ * the oldest lines are dropped instead
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The line is too long (EMSGSIZE), or failed to create a segment
+ */
+int spool_append(struct spool* spool, const char* buffer, size_t size, bool debug)
+{
+  if(size > SPOOL_SEGMENT_SIZE - SPOOL_HEADER_SIZE - SPOOL_RECORD_HEADER)
+  {
+    errno = EMSGSIZE;
+
+    return -1;
+  }
+
+  pthread_mutex_lock(&spool->lock);
+
+  struct spool_header* header = segment_header(&spool->segments[spool->count - 1]);
+
+  if(header->end + SPOOL_RECORD_HEADER + size > SPOOL_SEGMENT_SIZE)
+  {
+    if(spool_segment_add(spool, debug) == -1)
+    {
+      pthread_mutex_unlock(&spool->lock);
+
+      return -1;
+    }
+
+    header = segment_header(&spool->segments[spool->count - 1]);
+  }
+
+  char* record = (char*) header + header->end;
+
+  uint32_t record_size = size;
+
+  memcpy(record, &record_size, SPOOL_RECORD_HEADER);
+
+  memcpy(record + SPOOL_RECORD_HEADER, buffer, size);
+
+  // The end is moved last, so that a record is only seen once it is whole
+  header->end += SPOOL_RECORD_HEADER + size;
+
+  pthread_cond_broadcast(&spool->cond);
+
+  pthread_mutex_unlock(&spool->lock);
+
+  return 0;
+}
+
+/*
+ * Mark that nothing more will be appended,
+ * so that the spool reaches End of File once it is empty
+ */
+void spool_end(struct spool* spool)
+{
+  pthread_mutex_lock(&spool->lock);
+
+  spool->ended = true;
+
+  pthread_cond_broadcast(&spool->cond);
+
+  pthread_mutex_unlock(&spool->lock);
+}
+
+/*
+ * Wake up the threads waiting on the spool,
+ * so that they can check if their event has been signaled
+ */
+void spool_wake(struct spool* spool)
+{
+  pthread_mutex_lock(&spool->lock);
+
+  pthread_cond_broadcast(&spool->cond);
+
+  pthread_mutex_unlock(&spool->lock);
+}
+
+/*
+ * Find the next record to forward, and remove forwarded segments
+ *
+ * Note: The lock must be held
+ *
+ * RETURN (char* record)
+ * - The record, or NULL if the spool is empty
+ */
+static char* spool_next(struct spool* spool)
+{
+  while(true)
+  {
+    struct spool_segment* first = &spool->segments[0];
+
+    if(spool->cursor->offset < segment_header(first)->end)
+    {
+      return first->data + spool->cursor->offset;
+    }
+
+    if(spool->count == 1) return NULL;
+
+    spool_first_remove(spool);
+  }
+}
+
+/*
+ * Check if there are lines in the spool to forward,
+ * besides the peeked line that is being forwarded
+ */
+bool spool_pending(struct spool* spool)
+{
+  pthread_mutex_lock(&spool->lock);
+
+  bool pending = (spool_next(spool) != NULL);
+
+  if(pending && spool->peeking && spool->cursor->segment == spool->peek_segment && spool->cursor->offset == spool->peek_offset)
+  {
+    pending = (spool->peek_end < segment_header(&spool->segments[0])->end || spool->count > 1);
+  }
+
+  pthread_mutex_unlock(&spool->lock);
+
+  return pending;
+}
+
+/*
+ * Read the next line to forward, without removing it from the spool
+ *
+ * The line is removed by spool_commit, once it has been forwarded.
+ * Until then, the same line is peeked again
+ *
+ * PARAMS
+ * - int event    | Event to cancel the read, -1 to not be cancelable
+ * - long timeout | Max milliseconds to wait, -1 to wait forever
+ *
+ * RETURN (ssize_t size)
+ * - >0 | Success! The length of the line
+ * -  0 | The spool has ended and is empty, End of File
+ * - -1 | The event was signaled (ECANCELED), timed out (ETIMEDOUT),
+ *        or the line does not fit (EMSGSIZE)
+ */
+ssize_t spool_peek(struct spool* spool, char* buffer, size_t size, int event, long timeout)
+{
+  struct timespec deadline;
+
+  if(timeout != -1) deadline_set(&deadline, timeout);
+
+  pthread_mutex_lock(&spool->lock);
+
+  char* record;
+
+  while(!(record = spool_next(spool)))
+  {
+    if(spool->ended)
+    {
+      pthread_mutex_unlock(&spool->lock);
+
+      return 0;
+    }
+
+    int status = event_cond_wait(&spool->cond, &spool->lock, event, timeout, &deadline);
+
+    if(status != 0)
+    {
+      pthread_mutex_unlock(&spool->lock);
+
+      errno = (status == 1) ? ECANCELED : ETIMEDOUT;
+
+      return -1;
+    }
+  }
+
+  uint32_t record_size;
+
+  memcpy(&record_size, record, SPOOL_RECORD_HEADER);
+
+  spool->peeking      = true;
+  spool->peek_segment = spool->cursor->segment;
+  spool->peek_offset  = spool->cursor->offset;
+  spool->peek_end     = spool->cursor->offset + SPOOL_RECORD_HEADER + record_size;
+
+  if(record_size > size)
+  {
+    pthread_mutex_unlock(&spool->lock);
+
+    errno = EMSGSIZE;
+
+    return -1;
+  }
+
+  memcpy(buffer, record + SPOOL_RECORD_HEADER, record_size);
+
+  pthread_mutex_unlock(&spool->lock);
+
+  return record_size;
+}
+
+/*
+ * Remove the peeked line from the spool, as it has been forwarded
+ *
+ * If the line has been dropped in the meantime, nothing is done
+ */
+void spool_commit(struct spool* spool)
+{
+  pthread_mutex_lock(&spool->lock);
+
+  if(spool->peeking && spool->cursor->segment == spool->peek_segment && spool->cursor->offset == spool->peek_offset)
+  {
+    spool->cursor->offset = spool->peek_end;
+  }
+
+  spool->peeking = false;
+
+  pthread_mutex_unlock(&spool->lock);
+}
@@ -0,0 +1,100 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include "debug.h"
+#include "event.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * Size of a segment file
+ */
+#define SPOOL_SEGMENT_SIZE (4 * 1024 * 1024)
+
+#define SPOOL_SEGMENTS_MAX 256
+
+#define DEFAULT_SPOOL_SIZE (64 * 1024 * 1024)
+
+/*
+ * A memory mapped segment file of records
+ */
+struct spool_segment
+{
+  uint64_t number;
+  int      fd;
+  char*    data;
+};
+
+/*
+ * Position of the next record to forward, kept in the cursor file
+ */
+struct spool_cursor
+{
+  char     magic[8];
+  uint64_t segment;
+  uint64_t offset;
+};
+
+/*
+ * Durable queue of lines, in segment files of a directory
+ *
+ * Lines are appended to the last segment, and forwarded from the
+ * first segment. Forwarded segments are removed, and if the spool
+ * is full, the oldest segment is dropped, so appending never blocks
+ */
+struct spool
+{
+  bool                 open;
+  char*                path;
+  size_t               max_segments;
+  struct spool_segment segments[SPOOL_SEGMENTS_MAX];
+  size_t               count;
+  int                  cursor_fd;
+  struct spool_cursor* cursor;
+  bool                 peeking;  // A record has been peeked, but not committed
+  uint64_t             peek_segment;
+  uint64_t             peek_offset;
+  uint64_t             peek_end;
+  bool                 ended;    // Nothing more will be appended
+  size_t               dropped;  // Bytes dropped because the spool was full
+  pthread_mutex_t      lock;
+  pthread_cond_t       cond;
+};
+
+extern int     spool_open(struct spool* spool, const char* path, size_t size, bool debug);
+
+extern void    spool_close(struct spool* spool, bool debug);
+
+extern int     spool_append(struct spool* spool, const char* buffer, size_t size, bool debug);
+
+extern void    spool_end(struct spool* spool);
+
+extern void    spool_wake(struct spool* spool);
+
+extern bool    spool_pending(struct spool* spool);
+
+
+extern ssize_t spool_peek(struct spool* spool, char* buffer, size_t size, int event, long timeout);
+
+extern void    spool_commit(struct spool* spool);
+
+#endif // SPOOL_H
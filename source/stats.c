@@ -0,0 +1,147 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "stats.h"
+
+/*
+ * Print a single kernel buffer size, or "default" if it has not been queried
+ */
+static void buffer_size_print(const char* name, int size)
+{
+  if(size > 0)
+  {
+    debug_print(stderr, "STATS", "%s: %d bytes", name, size);
+  }
+  else debug_print(stderr, "STATS", "%s: default", name);
+}
+
+/*
+ * Print statistics of the relay to stderr
+ *
+ * The counters are written by the stdin and stdout threads,
+ * so this should be called after both threads have been joined
+ */
+void stats_print(const struct stats* stats)
+{
+  if(!stats) return;
+
+  debug_print(stderr, "STATS", "stdin:  %ld bytes, %ld lines", (long) stats->stdin_bytes,  (long) stats->stdin_lines);
+
+  debug_print(stderr, "STATS", "stdout: %ld bytes, %ld lines", (long) stats->stdout_bytes, (long) stats->stdout_lines);
+
+  if(stats->socket_sent > 0 || stats->socket_received > 0)
+  {
+    debug_print(stderr, "STATS", "socket: %ld bytes sent, %ld bytes received (compressed)", (long) stats->socket_sent, (long) stats->socket_received);
+  }
+
+  if(stats->delta_sent > 0)
+  {
+    debug_print(stderr, "STATS", "delta: %ld bytes sent", (long) stats->delta_sent);
+  }
+
+  if(stats->stdin_transfer > 0)
+  {
+    double throughput = (double) stats->stdin_bytes * 1000 / stats->stdin_transfer / (1024 * 1024);
+
+    debug_print(stderr, "STATS", "stdin transfer: %ld ms (%f MiB/s)", stats->stdin_transfer, throughput);
+  }
+
+  if(stats->stdout_transfer > 0)
+  {
+    double throughput = (double) stats->stdout_bytes * 1000 / stats->stdout_transfer / (1024 * 1024);
+
+    debug_print(stderr, "STATS", "stdout transfer: %ld ms (%f MiB/s)", stats->stdout_transfer, throughput);
+  }
+
+  if(stats->crc_errors > 0)
+  {
+    debug_print(stderr, "STATS", "checksum: %ld lines dropped", (long) stats->crc_errors);
+  }
+
+  if(stats->grants_sent > 0 || stats->grants_received > 0)
+  {
+    debug_print(stderr, "STATS", "credit: %ld grants sent, %ld grants received", (long) stats->grants_sent, (long) stats->grants_received);
+  }
+
+  if(stats->credit_waits > 0)
+  {
+    debug_print(stderr, "STATS", "credit: waited %ld times, %ld ms (backpressure)", (long) stats->credit_waits, stats->credit_waited);
+  }
+
+  if(stats->lent_lines > 0)
+  {
+    debug_print(stderr, "STATS", "lend: %ld lines lent, %ld bytes copied", (long) stats->lent_lines, (long) stats->lend_copied);
+  }
+
+  if(stats->spool_lines > 0)
+  {
+    debug_print(stderr, "STATS", "spool: %ld lines forwarded", (long) stats->spool_lines);
+  }
+
+  if(stats->spool_dropped > 0)
+  {
+    debug_print(stderr, "STATS", "spool: %ld bytes dropped", (long) stats->spool_dropped);
+  }
+
+  if(stats->reconnects > 0)
+  {
+    debug_print(stderr, "STATS", "spool: %ld reconnects", (long) stats->reconnects);
+  }
+
+  if(stats->failovers > 0)
+  {
+    debug_print(stderr, "STATS", "spool: %ld failovers to the standby", (long) stats->failovers);
+  }
+
+  if(stats->replayed > 0)
+  {
+    debug_print(stderr, "STATS", "spool: %ld lines sent again", (long) stats->replayed);
+  }
+
+  if(stats->hub_clients > 0)
+  {
+    debug_print(stderr, "STATS", "hub: %ld clients, %ld lines published", (long) stats->hub_clients, (long) stats->hub_published);
+
+    debug_print(stderr, "STATS", "hub: %ld lines delivered, %ld dropped", (long) stats->hub_delivered, (long) stats->hub_dropped);
+  }
+
+  if(stats->stripes > 1)
+  {
+    debug_print(stderr, "STATS", "stripe: %d connections, %ld chunks sent, %ld reordered", stats->stripes, (long) stats->stripe_chunks, (long) stats->reordered);
+  }
+
+  if(stats->fanout_count > 0)
+  {
+    debug_print(stderr, "STATS", "fanout: %d consumers, %ld to %ld lines each, %ld skipped", stats->fanout_count, (long) stats->fanout_least, (long) stats->fanout_most, (long) stats->fanout_skipped);
+  }
+
+  if(stats->rpc_clients > 0)
+  {
+    debug_print(stderr, "STATS", "rpc: %ld clients, %ld requests, %ld replies", (long) stats->rpc_clients, (long) stats->rpc_sent, (long) stats->rpc_replied);
+
+    debug_print(stderr, "STATS", "rpc: %ld timed out, %ld unmatched, %ld undelivered", (long) stats->rpc_timeouts, (long) stats->rpc_unmatched, (long) stats->rpc_undelivered);
+
+    debug_print(stderr, "STATS", "rpc latency: p50 %ld us, p90 %ld us, p99 %ld us, max %ld us", stats->rpc_p50, stats->rpc_p90, stats->rpc_p99, stats->rpc_max);
+  }
+
+  if(stats->stdin_delay > 0)
+  {
+    debug_print(stderr, "STATS", "stdin shaping delay:  %ld ms", stats->stdin_delay);
+  }
+
+  if(stats->stdout_delay > 0)
+  {
+    debug_print(stderr, "STATS", "stdout shaping delay: %ld ms", stats->stdout_delay);
+  }
+
+  buffer_size_print("stdin pipe size",  stats->stdin_pipe_size);
+
+  buffer_size_print("stdout pipe size", stats->stdout_pipe_size);
+
+  buffer_size_print("socket send buffer",    stats->sndbuf_size);
+
+  buffer_size_print("socket receive buffer", stats->rcvbuf_size);
+}
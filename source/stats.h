@@ -0,0 +1,68 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "debug.h"
+
+#include <stddef.h>
+
+struct stats
+{
+  size_t stdin_bytes;
+  size_t stdin_lines;
+  size_t stdout_bytes;
+  size_t stdout_lines;
+  int    stdin_pipe_size;
+  int    stdout_pipe_size;
+  int    sndbuf_size;
+  int    rcvbuf_size;
+  long   stdin_delay;  // Milliseconds waited by the stdin rate limit
+  long   stdout_delay; // Milliseconds waited by the stdout rate limit
+  size_t socket_sent;     // Compressed bytes sent
+  size_t socket_received; // Compressed bytes received
+  size_t delta_sent;      // Delta encoded bytes sent
+  size_t crc_errors;      // Received lines with a bad checksum
+  size_t credit_waits;    // Times the sender waited for a grant of the peer
+  long   credit_waited;   // Milliseconds the sender waited for grants
+  size_t grants_sent;     // Grants of credits sent to the peer
+  size_t grants_received; // Grants of credits received from the peer
+  size_t lent_lines;      // Lines lent to the application
+  size_t lend_copied;     // Bytes copied to the buffers of the lent lines
+  long   stdin_transfer;  // Milliseconds of the stdin file transfer
+  long   stdout_transfer; // Milliseconds of the stdout file transfer
+  size_t spool_lines;     // Spooled lines forwarded to the peer
+  size_t reconnects;      // Lost connections in spool mode
+  size_t failovers;       // Lost connections replaced by the standby
+  size_t replayed;        // Lines sent again after a lost connection
+  size_t spool_dropped;   // Bytes dropped because the spool was full
+  size_t hub_clients;     // Clients accepted by the hub
+  size_t hub_published;   // Lines published to the hub
+  size_t hub_delivered;   // Lines sent to subscribers
+  size_t hub_dropped;     // Lines dropped for slow subscribers
+  int    stripes;         // Connections of a striped connection
+  size_t stripe_chunks;   // Chunks sent over the stripes
+  size_t reordered;       // Striped chunks received ahead of an earlier chunk
+  int    fanout_count;    // Consumers of the fan-out
+  size_t fanout_least;    // Lines of the consumer with the fewest lines
+  size_t fanout_most;     // Lines of the consumer with the most lines
+  size_t fanout_skipped;  // Lines that skipped a full consumer
+  size_t rpc_clients;     // Clients accepted by the RPC server
+  size_t rpc_sent;        // Requests sent to the worker
+  size_t rpc_replied;     // Replies matched to their request
+  size_t rpc_timeouts;    // Requests that timed out
+  size_t rpc_unmatched;   // Replies without an outstanding request
+  size_t rpc_undelivered; // Replies whose client or fifo has gone away
+  long   rpc_p50;         // Latency percentiles of the requests, in microseconds
+  long   rpc_p90;
+  long   rpc_p99;
+  long   rpc_max;
+};
+
+extern void stats_print(const struct stats* stats);
+
+#endif // STATS_H
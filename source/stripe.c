@@ -0,0 +1,546 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "stripe.h"
+
+/*
+ * Close the connections and the socket pair of a stripe, and free the frames
+ */
+static void stripe_free(struct stripe* stripe)
+{
+  for(int index = 0; index < STRIPES_MAX; index++)
+  {
+    struct stripe_link* link = &stripe->links[index];
+
+    socket_close(&link->sockfd, stripe->debug);
+
+    free(link->frames);
+
+    link->frames = NULL;
+  }
+
+  socket_close(&stripe->localfd, stripe->debug);
+
+  stripe->count = 0;
+
+  stripe->open = false;
+}
+
+/*
+ * Close an open stripe
+ */
+void stripe_close(struct stripe* stripe)
+{
+  if(stripe->open) stripe_free(stripe);
+}
+
+/*
+ * Add the connections of a stripe to the first connection,
+ * and put a local socket pair in place of the first connection
+ *
+ * The peer that connected the first connection connects the others,
+ * and the peer with the server socket accepts them. Both peers
+ * have to be given the same count
+ *
+ * PARAMS
+ * - int* sockfd | The first connection, and then the end of the socket pair
+ * - int servfd  | The server socket, or -1 if the first connection was connected
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to add the connections, sockfd is left as it is
+ */
+int stripe_open(struct stripe* stripe, int* sockfd, int servfd, const char* address, int port, int count, int sock_buffer, bool debug)
+{
+  memset(stripe, 0, sizeof(struct stripe));
+
+  for(int index = 0; index < STRIPES_MAX; index++)
+  {
+    stripe->links[index].sockfd = -1;
+  }
+
+  stripe->localfd = -1;
+  stripe->debug   = debug;
+
+  stripe->links[0].sockfd = *sockfd;
+
+  for(stripe->count = 1; stripe->count < count; stripe->count++)
+  {
+    int features = SOCKET_FEATURE_STRIPE;
+
+    int linkfd = -1;
+
+    // 1. If the first connection was connected, connect another one
+    if(servfd == -1)
+    {
+      client_socket_open(&linkfd, address, port, &features, debug);
+    }
+    // 2. If the first connection was accepted, accept another one
+    else linkfd = server_socket_join(servfd, &features, SOCKET_HELLO_TIMEOUT, debug);
+
+    if(linkfd != -1 && !(features & SOCKET_FEATURE_STRIPE)) socket_close(&linkfd, debug);
+
+    if(linkfd == -1)
+    {
+      if(debug) error_print("Failed to add connection %d of %d to stripe", stripe->count + 1, count);
+
+      break;
+    }
+
+    if(sock_buffer != 0)
+    {
+      socket_buffer_size_set(linkfd, SO_SNDBUF, sock_buffer, debug);
+
+      socket_buffer_size_set(linkfd, SO_RCVBUF, sock_buffer, debug);
+    }
+
+    stripe->links[stripe->count].sockfd = linkfd;
+  }
+
+  int pair[2] = { -1, -1 };
+
+  bool failed = (stripe->count < count);
+
+  for(int index = 0; !failed && index < stripe->count; index++)
+  {
+    if(!(stripe->links[index].frames = malloc(STRIPE_WINDOW * STRIPE_FRAME_SIZE))) failed = true;
+  }
+
+  if(!failed && socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) == -1)
+  {
+    if(debug) error_print("Failed to create stripe socket pair: %s", strerror(errno));
+
+    failed = true;
+  }
+
+  if(failed)
+  {
+    // The first connection is still owned by the caller
+    stripe->links[0].sockfd = -1;
+
+    stripe_free(stripe);
+
+    return -1;
+  }
+
+  stripe->localfd = pair[1];
+
+  *sockfd = pair[0];
+
+  stripe->open = true;
+
+  if(debug) info_print("Striped the connection over %d connections", stripe->count);
+
+  return 0;
+}
+
+/*
+ * Poll file descriptors, until the relay is stopped,
+ * and after that until the drain deadline
+ *
+ * PARAMS
+ * - struct pollfd* pollfds | count file descriptors, with room for the event after them
+ * - int* event             | The event, set to -1 when it has been signaled
+ *
+ * RETURN (int status)
+ * -  0 | A file descriptor is ready
+ * - -1 | The drain deadline has passed (ETIMEDOUT), or failed to poll
+ */
+static int stripe_poll(struct pollfd* pollfds, nfds_t count, int* event, struct timespec* deadline, long drain_timeout)
+{
+  while(true)
+  {
+    pollfds[count] = (struct pollfd) { .fd = *event, .events = POLLIN };
+
+    long timeout = (*event == -1) ? deadline_timeout(deadline) : -1;
+
+    int status = poll(pollfds, count + 1, timeout);
+
+    if(status == -1)
+    {
+      if(errno == EINTR) continue;
+
+      return -1;
+    }
+
+    if(status == 0)
+    {
+      errno = ETIMEDOUT;
+
+      return -1;
+    }
+
+    // The rest is sent within drain_timeout milliseconds
+    if(pollfds[count].revents)
+    {
+      *event = -1;
+
+      deadline_set(deadline, drain_timeout);
+
+      if(status == 1) continue;
+    }
+
+    return 0;
+  }
+}
+
+/*
+ * Write a frame to the next connection with room for it
+ *
+ * The connections are tried in turn, so that the chunks are spread
+ * evenly while all connections keep up
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The drain deadline has passed (ETIMEDOUT), or failed to write
+ */
+static int stripe_frame_write(struct stripe* stripe, const char* frame, size_t size, int* event, struct timespec* deadline, long drain_timeout)
+{
+  struct pollfd pollfds[STRIPES_MAX + 1];
+
+  for(int index = 0; index < stripe->count; index++)
+  {
+    pollfds[index] = (struct pollfd) { .fd = stripe->links[index].sockfd, .events = POLLOUT };
+  }
+
+  if(stripe_poll(pollfds, stripe->count, event, deadline, drain_timeout) == -1) return -1;
+
+  int index = stripe->next;
+
+  for(int tried = 0; tried < stripe->count && !pollfds[index].revents; tried++)
+  {
+    index = (index + 1) % stripe->count;
+  }
+
+  stripe->next = (index + 1) % stripe->count;
+
+  int sockfd = stripe->links[index].sockfd;
+
+  // The whole frame goes to the same connection
+  size_t written = 0;
+
+  while(written < size)
+  {
+    ssize_t status = send(sockfd, frame + written, size - written, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+    if(status > 0)
+    {
+      written += status;
+
+      continue;
+    }
+
+    if(status == -1 && errno != EAGAIN && errno != EINTR) return -1;
+
+    pollfds[0] = (struct pollfd) { .fd = sockfd, .events = POLLOUT };
+
+    if(stripe_poll(pollfds, 1, event, deadline, drain_timeout) == -1) return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Send what the relay writes to its end of the socket pair, striped
+ *
+ * When the relay is stopped, what it has written is still sent,
+ * until it closes its end or drain_timeout milliseconds have passed.
+ * Then every connection is shut down, for the peer to read End of File
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | The drain deadline has passed (ETIMEDOUT), or failed to send
+ */
+int stripe_send(struct stripe* stripe, int event, long drain_timeout)
+{
+  char* frame = malloc(STRIPE_FRAME_SIZE);
+
+  if(!frame) return -1;
+
+  struct timespec deadline;
+
+  struct pollfd pollfds[2];
+
+  int status = 0;
+
+  while(true)
+  {
+    ssize_t size = recv(stripe->localfd, frame + STRIPE_HEADER_SIZE, STRIPE_CHUNK, MSG_DONTWAIT);
+
+    // The relay has written everything
+    if(size == 0) break;
+
+    if(size == -1)
+    {
+      if(errno == EINTR) continue;
+
+      pollfds[0] = (struct pollfd) { .fd = stripe->localfd, .events = POLLIN };
+
+      if((errno != EAGAIN && errno != EWOULDBLOCK) || stripe_poll(pollfds, 1, &event, &deadline, drain_timeout) == -1)
+      {
+        status = -1;
+
+        break;
+      }
+
+      continue;
+    }
+
+    uint32_t header[2] = { htonl(stripe->send_seq), htonl(size) };
+
+    memcpy(frame, header, STRIPE_HEADER_SIZE);
+
+    if(stripe_frame_write(stripe, frame, STRIPE_HEADER_SIZE + size, &event, &deadline, drain_timeout) == -1)
+    {
+      status = -1;
+
+      break;
+    }
+
+    stripe->send_seq++;
+
+    stripe->chunks++;
+  }
+
+  int error = errno;
+
+  for(int index = 0; index < stripe->count; index++)
+  {
+    shutdown(stripe->links[index].sockfd, SHUT_WR);
+  }
+
+  free(frame);
+
+  errno = error;
+
+  return status;
+}
+
+/*
+ * Get the frame at a position in the ring of a connection
+ */
+static char* stripe_link_frame(struct stripe_link* link, size_t position)
+{
+  return link->frames + ((link->head + position) % STRIPE_WINDOW) * STRIPE_FRAME_SIZE;
+}
+
+/*
+ * Parse the header of a frame
+ */
+static void stripe_header_parse(const char* frame, uint32_t* seq, uint32_t* size)
+{
+  uint32_t header[2];
+
+  memcpy(header, frame, STRIPE_HEADER_SIZE);
+
+  *seq  = ntohl(header[0]);
+  *size = ntohl(header[1]);
+}
+
+/*
+ * Read what has arrived on a connection, into the ring of the connection
+ *
+ * RETURN (int status)
+ * -  0 | Success, nothing more has arrived, or the ring is full
+ * - -1 | The connection was lost, or a frame was corrupt (EPROTO)
+ */
+static int stripe_link_read(struct stripe* stripe, struct stripe_link* link)
+{
+  while(link->count < STRIPE_WINDOW && !link->ended)
+  {
+    char* frame = stripe_link_frame(link, link->count);
+
+    uint32_t seq = 0, size = 0;
+
+    if(link->filled >= STRIPE_HEADER_SIZE) stripe_header_parse(frame, &seq, &size);
+
+    size_t length = STRIPE_HEADER_SIZE + size;
+
+    if(size > STRIPE_CHUNK)
+    {
+      errno = EPROTO;
+
+      return -1;
+    }
+
+    if(link->filled == length && size > 0)
+    {
+      if(seq != stripe->recv_seq) stripe->reordered++;
+
+      link->count++;
+
+      link->filled = 0;
+
+      continue;
+    }
+
+    ssize_t status = recv(link->sockfd, frame + link->filled, length - link->filled, MSG_DONTWAIT);
+
+    if(status > 0)
+    {
+      link->filled += status;
+
+      continue;
+    }
+
+    if(status == 0)
+    {
+      // The connection ended within a frame
+      if(link->filled > 0)
+      {
+        errno = EPROTO;
+
+        return -1;
+      }
+
+      link->ended = true;
+
+      return 0;
+    }
+
+    if(errno == EINTR) continue;
+
+    return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Write the chunks that are next in order to the end of the relay
+ *
+ * The next chunk is always first in the ring of a connection,
+ * since every connection keeps the order of its chunks
+ *
+ * RETURN (int status)
+ * -  0 | Success, the next chunk has not arrived yet
+ * - -1 | The relay was stopped (ECANCELED), or failed to write
+ */
+static int stripe_deliver(struct stripe* stripe, int event)
+{
+  bool delivered = true;
+
+  while(delivered)
+  {
+    delivered = false;
+
+    for(int index = 0; index < stripe->count; index++)
+    {
+      struct stripe_link* link = &stripe->links[index];
+
+      if(link->count == 0) continue;
+
+      char* frame = stripe_link_frame(link, 0);
+
+      uint32_t seq, size;
+
+      stripe_header_parse(frame, &seq, &size);
+
+      if(seq != stripe->recv_seq) continue;
+
+      if(socket_write(stripe->localfd, frame + STRIPE_HEADER_SIZE, size, event, -1) != (ssize_t) size) return -1;
+
+      link->head = (link->head + 1) % STRIPE_WINDOW;
+
+      link->count--;
+
+      stripe->recv_seq++;
+
+      delivered = true;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Receive the chunks of all connections, and write them in order
+ * to the end of the relay, until every connection has ended
+ *
+ * A connection is only read while its ring has room, which bounds
+ * the chunks held back to STRIPE_WINDOW per connection
+ *
+ * When every connection has ended, the end of the relay is shut down,
+ * for the relay to read End of File
+ *
+ * RETURN (int status)
+ * -  0 | Success, or the relay was stopped
+ * - -1 | A connection was lost or corrupt, or failed to write
+ */
+int stripe_receive(struct stripe* stripe, int event)
+{
+  struct pollfd pollfds[STRIPES_MAX + 1];
+
+  int status = 0;
+
+  while(status == 0)
+  {
+    if(stripe_deliver(stripe, event) == -1)
+    {
+      if(errno != ECANCELED) status = -1;
+
+      break;
+    }
+
+    pollfds[0] = (struct pollfd) { .fd = event, .events = POLLIN };
+
+    bool ended = true, polled = false;
+
+    for(int index = 0; index < stripe->count; index++)
+    {
+      struct stripe_link* link = &stripe->links[index];
+
+      bool readable = (!link->ended && link->count < STRIPE_WINDOW);
+
+      pollfds[index + 1] = (struct pollfd) { .fd = readable ? link->sockfd : -1, .events = POLLIN };
+
+      if(!link->ended) ended = false;
+
+      if(readable) polled = true;
+    }
+
+    if(ended) break;
+
+    // The next chunk can not arrive anymore
+    if(!polled)
+    {
+      errno = EPROTO;
+
+      status = -1;
+
+      break;
+    }
+
+    if(poll(pollfds, stripe->count + 1, -1) == -1)
+    {
+      if(errno == EINTR) continue;
+
+      status = -1;
+
+      break;
+    }
+
+    if(pollfds[0].revents) break;
+
+    for(int index = 0; status == 0 && index < stripe->count; index++)
+    {
+      if(pollfds[index + 1].revents) status = stripe_link_read(stripe, &stripe->links[index]);
+    }
+  }
+
+  int error = errno;
+
+  for(int index = 0; index < stripe->count; index++)
+  {
+    if(stripe->links[index].count > 0 && stripe->debug) error_print("Dropped %ld chunks out of order", (long) stripe->links[index].count);
+  }
+
+  shutdown(stripe->localfd, SHUT_WR);
+
+  errno = error;
+
+  return status;
+}
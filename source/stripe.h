@@ -0,0 +1,91 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include "debug.h"
+#include "event.h"
+#include "socket.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define STRIPES_MAX 16
+
+/*
+ * Max bytes of a single chunk
+ */
+#define STRIPE_CHUNK (64 * 1024)
+
+/*
+ * A chunk is preceded by its sequence number and its size (network byte order)
+ */
+#define STRIPE_HEADER_SIZE 8
+
+#define STRIPE_FRAME_SIZE (STRIPE_HEADER_SIZE + STRIPE_CHUNK)
+
+/*
+ * Max received chunks held back per connection, waiting for an earlier chunk
+ */
+#define STRIPE_WINDOW 8
+
+/*
+ * One of the connections of a stripe
+ *
+ * The received chunks are kept in a ring, in the order of the connection,
+ * which is also the order of their sequence numbers
+ */
+struct stripe_link
+{
+  int      sockfd;
+  bool     ended;   // The peer has sent everything on the connection
+  char*    frames;  // STRIPE_WINDOW frames of STRIPE_FRAME_SIZE bytes
+  size_t   head;
+  size_t   count;   // Complete frames in the ring
+  size_t   filled;  // Bytes of the frame being received
+};
+
+/*
+ * A stream striped over many connections
+ *
+ * The relay reads and writes its end of a local socket pair, as if it
+ * were [socket]. The sending routine cuts the stream into sequenced chunks
+ * and writes every chunk to the next connection that has room for it.
+ * The receiving routine puts the chunks back in order
+ */
+struct stripe
+{
+  bool               open;
+  struct stripe_link links[STRIPES_MAX];
+  int                count;
+  int                localfd;   // The end of the socket pair of the routines
+  uint32_t           send_seq;  // Sequence number of the next sent chunk
+  uint32_t           recv_seq;  // Sequence number of the next chunk to deliver
+  int                next;      // Connection to try first, for the next chunk
+  size_t             chunks;    // Chunks sent
+  size_t             reordered; // Chunks received ahead of an earlier chunk
+  bool               debug;
+};
+
+extern int  stripe_open(struct stripe* stripe, int* sockfd, int servfd, const char* address, int port, int count, int sock_buffer, bool debug);
+
+extern void stripe_close(struct stripe* stripe);
+
+extern int  stripe_send(struct stripe* stripe, int event, long drain_timeout);
+
+extern int  stripe_receive(struct stripe* stripe, int event);
+
+#endif // STRIPE_H
@@ -1,7 +1,7 @@
 /*
  * Written by Hampus Fridholm
  *
- * Last updated: 2024-09-07
+ * Last updated: 2026-10-18
  */
 
 #include "thread.h"
@@ -9,27 +9,27 @@
 /*
  * Create stdin and stdout threads
  *
+ * PARAMS
+ * - void* arg | Argument passed to both routines
+ *
  * RETURN (int status)
  * - 0 | Success
  * - 1 | Failed to create stdin thread
- * - 2 | Failed to create stdout thread
+ * - 2 | Failed to create stdout thread (the stdin thread is running)
  */
-static int stdin_stdout_thread_create(pthread_t* stdin_thread, void *(*stdin_routine) (void *), pthread_t* stdout_thread, void *(*stdout_routine) (void *), bool debug)
+int stdin_stdout_thread_create(pthread_t* stdin_thread, void *(*stdin_routine) (void *), pthread_t* stdout_thread, void *(*stdout_routine) (void *), void* arg, bool debug)
 {
-  if(pthread_create(stdin_thread, NULL, stdin_routine, NULL) != 0)
+  if(pthread_create(stdin_thread, NULL, stdin_routine, arg) != 0)
   {
     if(debug) error_print("Failed to create stdin thread");
 
     return 1;
   }
 
-  if(pthread_create(stdout_thread, NULL, stdout_routine, NULL) != 0)
+  if(pthread_create(stdout_thread, NULL, stdout_routine, arg) != 0)
   {
     if(debug) error_print("Failed to create stdout thread");
 
-    // Interrupt stdin thread
-    pthread_kill(*stdin_thread, SIGUSR1);
-
     return 2;
   }
 
@@ -39,7 +39,7 @@ static int stdin_stdout_thread_create(pthread_t* stdin_thread, void *(*stdin_rou
 /*
  * Join stdin and stdout threads
  */
-static void stdin_stdout_thread_join(pthread_t stdin_thread, pthread_t stdout_thread, bool debug)
+void stdin_stdout_thread_join(pthread_t stdin_thread, pthread_t stdout_thread, bool debug)
 {
   if(pthread_join(stdin_thread, NULL) != 0)
   {
@@ -53,17 +53,53 @@ static void stdin_stdout_thread_join(pthread_t stdin_thread, pthread_t stdout_th
 }
 
 /*
- * Start stdin and stdout thread
+ * Pin the calling thread to a CPU, and run it under SCHED_FIFO
+ *
+ * PARAMS
+ * - int cpu      | CPU to run on, -1 to not pin the thread
+ * - int priority | SCHED_FIFO priority, 0 to keep the normal policy
  *
  * RETURN (int status)
- * - 0 | Success
- * - 1 | Failed to create stdin and stdout threads
+ * -  0 | Success
+ * - -1 | Failed to pin the thread, or to change its policy
  */
-int stdin_stdout_thread_start(pthread_t* stdin_thread, void *(*stdin_routine) (void *), pthread_t* stdout_thread, void *(*stdout_routine) (void *), bool debug)
+int thread_tune(int cpu, int priority, bool debug)
 {
-  if(stdin_stdout_thread_create(stdin_thread, stdin_routine, stdout_thread, stdout_routine, debug) != 0) return 1;
-  
-  stdin_stdout_thread_join(*stdin_thread, *stdout_thread, debug);
+  int status = 0;
 
-  return 0;
+  if(cpu != -1)
+  {
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+
+    CPU_SET(cpu, &cpus);
+
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    if(error != 0)
+    {
+      if(debug) error_print("Failed to pin thread to CPU %d: %s", cpu, strerror(error));
+
+      status = -1;
+    }
+    else if(debug) info_print("Pinned thread to CPU %d", cpu);
+  }
+
+  if(priority > 0)
+  {
+    struct sched_param param = { .sched_priority = priority };
+
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+    if(error != 0)
+    {
+      if(debug) error_print("Failed to run thread under SCHED_FIFO: %s", strerror(error));
+
+      status = -1;
+    }
+    else if(debug) info_print("Running thread under SCHED_FIFO (%d)", priority);
+  }
+
+  return status;
 }
@@ -1,7 +1,7 @@
 /*
  * Written by Hampus Fridholm
  *
- * Last updated: 2024-09-07
+ * Last updated: 2026-10-18
  */
 
 #ifndef THREAD_H
@@ -10,9 +10,14 @@
 #include "debug.h"
 
 #include <pthread.h>
+#include <sched.h>
+#include <string.h>
 #include <stdbool.h>
-#include <signal.h>
 
-extern int  stdin_stdout_thread_start(pthread_t* stdin_thread, void *(*stdin_routine) (void *), pthread_t* stdout_thread, void *(*stdout_routine) (void *), bool debug);
+extern int  stdin_stdout_thread_create(pthread_t* stdin_thread, void *(*stdin_routine) (void *), pthread_t* stdout_thread, void *(*stdout_routine) (void *), void* arg, bool debug);
+
+extern int  thread_tune(int cpu, int priority, bool debug);
+
+extern void stdin_stdout_thread_join(pthread_t stdin_thread, pthread_t stdout_thread, bool debug);
 
 #endif // THREAD_H
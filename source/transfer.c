@@ -0,0 +1,323 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "transfer.h"
+
+/*
+ * Check if a file descriptor is a regular file
+ */
+static bool file_regular(int fd, struct stat* status)
+{
+  return fstat(fd, status) == 0 && S_ISREG(status->st_mode);
+}
+
+/*
+ * Prepare a transfer as a whole, if either end is a regular file
+ *
+ * PARAMS
+ * - size_t* counter | Counter that the bytes are added to as they move, or NULL
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * -  1 | Neither end is a regular file, relay line by line
+ * - -1 | Failed to prepare the transfer
+ */
+int transfer_open(struct transfer* transfer, const char* name, int infd, int outfd, size_t* counter, bool progress, bool debug)
+{
+  memset(transfer, 0, sizeof(struct transfer));
+
+  transfer->pipe[0] = transfer->pipe[1] = -1;
+
+  struct stat in_status, out_status;
+
+  bool in_regular  = file_regular(infd, &in_status);
+  bool out_regular = file_regular(outfd, &out_status);
+
+  // 1. If both ends are regular files, copy within the kernel
+  if(in_regular && out_regular)
+  {
+    transfer->mode = TRANSFER_COPY;
+  }
+  // 2. If only the input is a regular file, send it to the socket or pipe
+  else if(in_regular)
+  {
+    transfer->mode = TRANSFER_SENDFILE;
+  }
+  // 3. If only the output is a regular file, splice the input to it
+  else if(out_regular)
+  {
+    transfer->mode = TRANSFER_SPLICE;
+
+    if(pipe2(transfer->pipe, O_CLOEXEC) == -1)
+    {
+      if(debug) error_print("Failed to create transfer pipe: %s", strerror(errno));
+
+      return -1;
+    }
+
+    // A larger pipe moves more bytes per splice
+    fcntl(transfer->pipe[1], F_SETPIPE_SZ, TRANSFER_PIPE_SIZE);
+  }
+  // 4. If neither end is a regular file, there is nothing to gain
+  else return 1;
+
+  transfer->name     = name;
+  transfer->total    = in_regular ? (size_t) in_status.st_size : 0;
+  transfer->counter  = counter;
+  transfer->progress = progress;
+  transfer->debug    = debug;
+
+  clock_gettime(CLOCK_MONOTONIC, &transfer->start);
+
+  deadline_set(&transfer->report, TRANSFER_REPORT);
+
+  if(debug) info_print("Transferring %s as a whole (mode %d)", name, transfer->mode);
+
+  return 0;
+}
+
+/*
+ * Close the pipe and free the buffer of a transfer
+ */
+void transfer_close(struct transfer* transfer)
+{
+  if(transfer->pipe[0] != -1) close(transfer->pipe[0]);
+
+  if(transfer->pipe[1] != -1) close(transfer->pipe[1]);
+
+  transfer->pipe[0] = transfer->pipe[1] = -1;
+
+  free(transfer->buffer);
+
+  transfer->buffer = NULL;
+}
+
+/*
+ * Milliseconds since the start of a transfer
+ */
+long transfer_elapsed(const struct transfer* transfer)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - transfer->start.tv_sec) * 1000 + (now.tv_nsec - transfer->start.tv_nsec) / 1000000;
+}
+
+/*
+ * Count moved bytes, also in the counter of the caller,
+ * so that the bytes are seen while the transfer is running
+ */
+static void transfer_count(struct transfer* transfer, size_t size)
+{
+  transfer->done += size;
+
+  if(transfer->counter) *transfer->counter += size;
+}
+
+/*
+ * Report the progress and the throughput of a transfer, once in a while
+ */
+static void transfer_report(struct transfer* transfer, bool last)
+{
+  if(!transfer->progress) return;
+
+  if(!last && deadline_timeout(&transfer->report) > 0) return;
+
+  deadline_set(&transfer->report, TRANSFER_REPORT);
+
+  long elapsed = transfer_elapsed(transfer);
+
+  double throughput = (elapsed > 0) ? (double) transfer->done * 1000 / elapsed / (1024 * 1024) : 0;
+
+  char text[128];
+
+  if(transfer->total > 0)
+  {
+    snprintf(text, sizeof(text), "%zu of %zu MiB (%d%%), %.1f MiB/s", transfer->done >> 20, transfer->total >> 20, (int) (transfer->done * 100 / transfer->total), throughput);
+  }
+  else snprintf(text, sizeof(text), "%zu MiB, %.1f MiB/s", transfer->done >> 20, throughput);
+
+  debug_print(stderr, "PROGRESS", "%s: %s", transfer->name, text);
+}
+
+/*
+ * Wait until a file descriptor is ready, or the event is signaled
+ *
+ * RETURN (int status)
+ * -  0 | Ready
+ * - -1 | The event was signaled (ECANCELED), or failed to wait
+ */
+static int transfer_wait(int fd, short events, int event)
+{
+  int status = event_wait(fd, events, event, -1);
+
+  if(status == 1) errno = ECANCELED;
+
+  return (status == 0) ? 0 : -1;
+}
+
+/*
+ * Move the bytes in the pipe of a splice transfer to the output
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to write
+ */
+static int transfer_pipe_drain(struct transfer* transfer, int outfd, size_t size)
+{
+  while(size > 0)
+  {
+    ssize_t moved = splice(transfer->pipe[0], NULL, outfd, NULL, size, SPLICE_F_MOVE);
+
+    if(moved == -1)
+    {
+      if(errno == EINTR) continue;
+
+      return -1;
+    }
+
+    size -= moved;
+
+    transfer_count(transfer, moved);
+  }
+
+  return 0;
+}
+
+/*
+ * Move one chunk of bytes with the system call of the transfer mode
+ *
+ * RETURN (ssize_t size)
+ * - >0 | The number of moved bytes
+ * -  0 | End of File
+ * - -1 | Failed to move bytes, or the call would block (EAGAIN)
+ */
+static ssize_t transfer_chunk(struct transfer* transfer, int infd, int outfd)
+{
+  ssize_t size;
+
+  switch(transfer->mode)
+  {
+    case TRANSFER_COPY:
+      return copy_file_range(infd, NULL, outfd, NULL, TRANSFER_CHUNK, 0);
+
+    case TRANSFER_SENDFILE:
+      return sendfile(outfd, infd, NULL, TRANSFER_CHUNK);
+
+    case TRANSFER_SPLICE:
+      size = splice(infd, NULL, transfer->pipe[1], NULL, TRANSFER_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+      if(size > 0 && transfer_pipe_drain(transfer, outfd, size) == -1) return -1;
+
+      return size;
+
+    default:
+      size = read(infd, transfer->buffer, TRANSFER_CHUNK);
+
+      if(size > 0 && buffer_write(outfd, transfer->buffer, size, -1, -1) != size) return -1;
+
+      return size;
+  }
+}
+
+/*
+ * Fall back to a simpler transfer mode, if the system call is not supported
+ *
+ * RETURN (bool fallback)
+ * - true  | Try again, with the simpler mode
+ * - false | There is nothing to fall back to
+ */
+static bool transfer_fallback(struct transfer* transfer, int outfd)
+{
+  if(errno != EINVAL && errno != ENOSYS && errno != EXDEV && errno != EOPNOTSUPP) return false;
+
+  // copy_file_range between file systems, or splice of an unsupported file
+  if(transfer->mode == TRANSFER_COPY)
+  {
+    transfer->mode = TRANSFER_SENDFILE;
+  }
+  else if(transfer->mode == TRANSFER_SPLICE && (transfer->buffer = malloc(TRANSFER_CHUNK)))
+  {
+    transfer->mode = TRANSFER_BUFFER;
+  }
+  else return false;
+
+  // The bytes already spliced to the pipe are written first
+  int pending = 0;
+
+  if(transfer->mode == TRANSFER_BUFFER && ioctl(transfer->pipe[0], FIONREAD, &pending) == 0 && pending > 0)
+  {
+    ssize_t size = read(transfer->pipe[0], transfer->buffer, pending);
+
+    if(size <= 0 || buffer_write(outfd, transfer->buffer, size, -1, -1) != size) return false;
+
+    transfer_count(transfer, size);
+  }
+
+  if(transfer->debug) info_print("Transfer of %s falls back to mode %d", transfer->name, transfer->mode);
+
+  return true;
+}
+
+/*
+ * Transfer the input to the output as a whole, until End of File
+ *
+ * The moved bytes are counted in done and the counter, also if the transfer fails
+ *
+ * RETURN (int status)
+ * -  0 | Success, End of File
+ * - -1 | The event was signaled (ECANCELED), or failed to transfer
+ */
+int transfer_run(struct transfer* transfer, int infd, int outfd, int event)
+{
+  // The input of a splice may not be nonblocking, so it is waited on first
+  bool input = (transfer->mode == TRANSFER_SPLICE);
+
+  while(true)
+  {
+    if(event_signaled(event))
+    {
+      errno = ECANCELED;
+
+      return -1;
+    }
+
+    if(input && transfer_wait(infd, POLLIN, event) == -1) return -1;
+
+    ssize_t size = transfer_chunk(transfer, infd, outfd);
+
+    if(size > 0)
+    {
+      // A splice counts the bytes as they leave the pipe
+      if(transfer->mode != TRANSFER_SPLICE) transfer_count(transfer, size);
+
+      transfer_report(transfer, false);
+
+      continue;
+    }
+
+    if(size == 0) break;
+
+    if(errno == EINTR) continue;
+
+    if(transfer_fallback(transfer, outfd))
+    {
+      input = (transfer->mode == TRANSFER_SPLICE || transfer->mode == TRANSFER_BUFFER);
+
+      continue;
+    }
+
+    if(errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+    // The output of a sendfile or a copy is full, the input is waited on above
+    if(!input && transfer_wait(outfd, POLLOUT, event) == -1) return -1;
+  }
+
+  transfer_report(transfer, true);
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "debug.h"
+#include "event.h"
+#include "fifo.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+
+/*
+ * Max bytes moved by a single system call
+ */
+#define TRANSFER_CHUNK (4 * 1024 * 1024)
+
+/*
+ * Size of the pipe of a splice, if the system allows it
+ */
+#define TRANSFER_PIPE_SIZE (1024 * 1024)
+
+/*
+ * Milliseconds between the progress reports
+ */
+#define TRANSFER_REPORT 1000
+
+#define TRANSFER_COPY     0 // copy_file_range, from a file to a file
+#define TRANSFER_SENDFILE 1 // sendfile, from a file to a socket or a pipe
+#define TRANSFER_SPLICE   2 // splice through a pipe, to a file
+#define TRANSFER_BUFFER   3 // read and write, if splice is not supported
+
+/*
+ * A transfer of bytes as a whole, instead of line by line,
+ * from or to a regular file
+ */
+struct transfer
+{
+  int             mode;
+  const char*     name;
+  size_t          total;    // Bytes to transfer, 0 if unknown
+  size_t          done;     // Bytes transferred
+  size_t*         counter;  // Counter of the caller, that the bytes are added to
+  struct timespec start;
+  struct timespec report;   // Time of the next progress report
+  bool            progress; // Report the progress every TRANSFER_REPORT ms
+  int             pipe[2];  // Pipe of TRANSFER_SPLICE
+  char*           buffer;   // Buffer of TRANSFER_BUFFER
+  bool            debug;
+};
+
+extern int     transfer_open(struct transfer* transfer, const char* name, int infd, int outfd, size_t* counter, bool progress, bool debug);
+
+extern void    transfer_close(struct transfer* transfer);
+
+extern int     transfer_run(struct transfer* transfer, int infd, int outfd, int event);
+
+extern long    transfer_elapsed(const struct transfer* transfer);
+
+#endif // TRANSFER_H
@@ -0,0 +1,302 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include "trie.h"
+
+#define TRIE_CAPACITY 64
+
+/*
+ * Make room for one more item at the end of an array
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to allocate memory
+ */
+static int array_reserve(void** array, size_t* capacity, size_t count, size_t item_size)
+{
+  if(count < *capacity) return 0;
+
+  size_t new_capacity = *capacity ? *capacity * 2 : 4;
+
+  void* new_array = realloc(*array, new_capacity * item_size);
+
+  if(!new_array) return -1;
+
+  *array = new_array;
+
+  *capacity = new_capacity;
+
+  return 0;
+}
+
+/*
+ * Initialize an empty trie, with only the root node
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to allocate memory
+ */
+int trie_init(struct trie* trie)
+{
+  memset(trie, 0, sizeof(struct trie));
+
+  if(!(trie->nodes = calloc(TRIE_CAPACITY, sizeof(struct trie_node)))) return -1;
+
+  trie->capacity = TRIE_CAPACITY;
+
+  trie->count = 1;
+
+  return 0;
+}
+
+/*
+ * Free the nodes of a trie
+ */
+void trie_free(struct trie* trie)
+{
+  for(size_t index = 0; index < trie->count; index++)
+  {
+    struct trie_node* node = &trie->nodes[index];
+
+    free(node->keys);
+
+    free(node->children);
+
+    free(node->subscribers);
+  }
+
+  free(trie->nodes);
+
+  memset(trie, 0, sizeof(struct trie));
+}
+
+/*
+ * Search the children of a node for a byte
+ *
+ * RETURN (size_t position)
+ * - The position of the child, or where it would be inserted
+ */
+static size_t node_child_search(const struct trie_node* node, uint8_t key)
+{
+  size_t low = 0, high = node->child_count;
+
+  while(low < high)
+  {
+    size_t middle = (low + high) / 2;
+
+    if(node->keys[middle] < key)
+    {
+      low = middle + 1;
+    }
+    else high = middle;
+  }
+
+  return low;
+}
+
+/*
+ * Get the child of a node for a byte
+ *
+ * RETURN (int index)
+ * - >=0 | The index of the child node
+ * -  -1 | The node has no child for the byte
+ */
+static int node_child(const struct trie_node* node, uint8_t key)
+{
+  size_t position = node_child_search(node, key);
+
+  if(position < node->child_count && node->keys[position] == key)
+  {
+    return node->children[position];
+  }
+
+  return -1;
+}
+
+/*
+ * Add a child node to a node, for a byte
+ *
+ * RETURN (int index)
+ * - >=0 | The index of the child node
+ * -  -1 | Failed to allocate memory
+ */
+static int trie_child_add(struct trie* trie, size_t parent, uint8_t key)
+{
+  if(array_reserve((void**) &trie->nodes, &trie->capacity, trie->count, sizeof(struct trie_node)) == -1) return -1;
+
+  struct trie_node* node = &trie->nodes[parent];
+
+  size_t capacity = node->child_capacity;
+
+  if(array_reserve((void**) &node->keys, &capacity, node->child_count, sizeof(uint8_t)) == -1) return -1;
+
+  capacity = node->child_capacity;
+
+  if(array_reserve((void**) &node->children, &capacity, node->child_count, sizeof(int)) == -1) return -1;
+
+  node->child_capacity = capacity;
+
+  int child = trie->count++;
+
+  memset(&trie->nodes[child], 0, sizeof(struct trie_node));
+
+  size_t position = node_child_search(node, key);
+
+  size_t after = node->child_count - position;
+
+  memmove(node->keys + position + 1, node->keys + position, after * sizeof(uint8_t));
+
+  memmove(node->children + position + 1, node->children + position, after * sizeof(int));
+
+  node->keys[position] = key;
+
+  node->children[position] = child;
+
+  node->child_count++;
+
+  return child;
+}
+
+/*
+ * Find the node of a prefix
+ *
+ * RETURN (int index)
+ * - >=0 | The index of the node
+ * -  -1 | The prefix is not in the trie
+ */
+static int trie_find(const struct trie* trie, const char* prefix, size_t size)
+{
+  int index = 0;
+
+  for(size_t depth = 0; depth < size && index != -1; depth++)
+  {
+    index = node_child(&trie->nodes[index], prefix[depth]);
+  }
+
+  return index;
+}
+
+/*
+ * Subscribe to a prefix
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * -  1 | The subscriber was already subscribed to the prefix
+ * - -1 | Failed to allocate memory
+ */
+int trie_insert(struct trie* trie, const char* prefix, size_t size, int subscriber)
+{
+  int index = 0;
+
+  for(size_t depth = 0; depth < size; depth++)
+  {
+    int child = node_child(&trie->nodes[index], prefix[depth]);
+
+    if(child == -1 && (child = trie_child_add(trie, index, prefix[depth])) == -1) return -1;
+
+    index = child;
+  }
+
+  struct trie_node* node = &trie->nodes[index];
+
+  for(size_t position = 0; position < node->subscriber_count; position++)
+  {
+    if(node->subscribers[position] == subscriber) return 1;
+  }
+
+  if(array_reserve((void**) &node->subscribers, &node->subscriber_capacity, node->subscriber_count, sizeof(int)) == -1) return -1;
+
+  node->subscribers[node->subscriber_count++] = subscriber;
+
+  return 0;
+}
+
+/*
+ * Remove a subscriber from a node
+ *
+ * RETURN (int status)
+ * - 0 | Success
+ * - 1 | The subscriber was not subscribed
+ */
+static int node_subscriber_remove(struct trie_node* node, int subscriber)
+{
+  for(size_t position = 0; position < node->subscriber_count; position++)
+  {
+    if(node->subscribers[position] == subscriber)
+    {
+      node->subscribers[position] = node->subscribers[--node->subscriber_count];
+
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * Unsubscribe from a prefix
+ *
+ * The nodes are kept, to be reused by later subscriptions
+ *
+ * RETURN (int status)
+ * - 0 | Success
+ * - 1 | The subscriber was not subscribed to the prefix
+ */
+int trie_remove(struct trie* trie, const char* prefix, size_t size, int subscriber)
+{
+  int index = trie_find(trie, prefix, size);
+
+  if(index == -1) return 1;
+
+  return node_subscriber_remove(&trie->nodes[index], subscriber);
+}
+
+/*
+ * Unsubscribe from every prefix, when the subscriber leaves
+ */
+void trie_remove_all(struct trie* trie, int subscriber)
+{
+  for(size_t index = 0; index < trie->count; index++)
+  {
+    node_subscriber_remove(&trie->nodes[index], subscriber);
+  }
+}
+
+/*
+ * Find the subscribers of every prefix of a topic
+ *
+ * A subscriber of several of the prefixes is matched once per prefix
+ *
+ * PARAMS
+ * - void (*match) (int, void*) | Called with every matched subscriber and arg
+ *
+ * RETURN (size_t count)
+ * - The number of matches
+ */
+size_t trie_match(const struct trie* trie, const char* topic, size_t size, void (*match) (int, void*), void* arg)
+{
+  size_t count = 0;
+
+  int index = 0;
+
+  for(size_t depth = 0; index != -1; depth++)
+  {
+    const struct trie_node* node = &trie->nodes[index];
+
+    for(size_t position = 0; position < node->subscriber_count; position++)
+    {
+      match(node->subscribers[position], arg);
+    }
+
+    count += node->subscriber_count;
+
+    if(depth == size) break;
+
+    index = node_child(node, topic[depth]);
+  }
+
+  return count;
+}
@@ -0,0 +1,57 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#ifndef TRIE_H
+#define TRIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A node of the trie, for one byte of a prefix
+ *
+ * The children are sorted by their byte, and searched in halves
+ */
+struct trie_node
+{
+  uint8_t* keys;        // Byte of each child
+  int*     children;    // Index of each child node
+  size_t   child_count;
+  size_t   child_capacity;
+  int*     subscribers; // Subscribers of the prefix that ends here
+  size_t   subscriber_count;
+  size_t   subscriber_capacity;
+};
+
+/*
+ * Prefix trie of subscriptions
+ *
+ * Matching a topic only visits the nodes of the topic itself,
+ * so the cost does not grow with the number of subscriptions
+ */
+struct trie
+{
+  struct trie_node* nodes; // The first node is the root, the empty prefix
+  size_t            count;
+  size_t            capacity;
+};
+
+extern int    trie_init(struct trie* trie);
+
+extern void   trie_free(struct trie* trie);
+
+extern int    trie_insert(struct trie* trie, const char* prefix, size_t size, int subscriber);
+
+extern int    trie_remove(struct trie* trie, const char* prefix, size_t size, int subscriber);
+
+extern void   trie_remove_all(struct trie* trie, int subscriber);
+
+extern size_t trie_match(const struct trie* trie, const char* topic, size_t size, void (*match) (int, void*), void* arg);
+
+#endif // TRIE_H
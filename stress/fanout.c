@@ -0,0 +1,650 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
+#include <argp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+#include "debug.h"
+
+/*
+ * The fan-out check runs one procom, that shares a stream of numbered
+ * lines from its stdin among a pool of consumer fifos:
+ *
+ *   harness -> [stdin pipe] -> procom -> [consumer fifos] -> harness
+ *
+ * One consumer is closed in the middle of the stream, as if its reader
+ * was killed. The relay has to drop it from the pool and relay the rest
+ * of the lines to the other consumers, instead of stopping.
+ * Only the lines left unread in the fifo of the closed consumer may be lost
+ */
+
+#define FANOUT_CONSUMERS_MAX 8
+
+/*
+ * Bytes of every line, with its sequence number and newline
+ */
+#define FANOUT_LINE_SIZE 64
+
+/*
+ * Lines written to the stdin pipe in a row
+ */
+#define FANOUT_WRITE_BATCH 64
+
+/*
+ * Max milliseconds without progress, before the relay is counted as stalled
+ */
+#define FANOUT_STALL_TIMEOUT 10000
+
+struct consumer
+{
+  char   path[PATH_MAX];
+  int    fd;
+  char   buffer[FANOUT_LINE_SIZE * 64];
+  size_t end;
+  size_t lines;
+  size_t capacity; // Fifo capacity, when it was closed
+  bool   closed;   // Closed on purpose
+  bool   ended;    // End of File
+};
+
+struct config
+{
+  const char* binary;
+  long        lines;
+  int         consumers;
+  long        kill_at;  // Lines read by the killed consumer, before it is closed
+  const char* policy;
+  bool        keep;
+  bool        debug;
+};
+
+struct check
+{
+  struct config   config;
+  char            dir[64];
+  char            log[PATH_MAX];
+  struct consumer consumers[FANOUT_CONSUMERS_MAX];
+  uint8_t*        seen;       // Times every line was read
+  size_t          corrupt;    // Lines with a bad sequence number
+  size_t          duplicated; // Lines that came more than once
+  size_t          after_kill; // Lines read after the consumer was closed
+};
+
+static struct check check =
+{
+  .config =
+  {
+    .binary    = NULL,
+    .lines     = 200000,
+    .consumers = 3,
+    .kill_at   = 1000,
+    .policy    = "round-robin",
+    .keep      = false,
+    .debug     = false
+  }
+};
+
+static char doc[] = "procom-fanout - close a fan-out consumer mid-stream, and check that the relay goes on";
+
+static char args_doc[] = "";
+
+static struct argp_option options[] =
+{
+  { "binary",    'b', "PATH",   0, "The procom binary, by default next to this binary" },
+  { "lines",     'l', "COUNT",  0, "Lines to relay" },
+  { "consumers", 'n', "COUNT",  0, "Consumer fifos of the fan-out" },
+  { "kill-at",   'k', "COUNT",  0, "Lines read by the first consumer, before it is closed" },
+  { "policy",    'm', "POLICY", 0, "Fan-out policy of procom" },
+  { "keep",      'K', 0,        0, "Keep the fifos and log, even if every check passes" },
+  { "debug",     'd', 0,        0, "Print debug messages" },
+  { 0 }
+};
+
+/*
+ * Parse a positive number, or end with an error
+ */
+static long number_parse(struct argp_state* state, const char* name, const char* arg)
+{
+  char* end = NULL;
+
+  long number = strtol(arg, &end, 10);
+
+  if(end == arg || *end != '\0' || number <= 0) argp_error(state, "Invalid %s: %s", name, arg);
+
+  return number;
+}
+
+/*
+ * Parse the command line options
+ */
+static error_t opt_parse(int key, char* arg, struct argp_state* state)
+{
+  struct config* config = state->input;
+
+  switch(key)
+  {
+    case 'b':
+      config->binary = arg;
+      break;
+
+    case 'l':
+      config->lines = number_parse(state, "line count", arg);
+      break;
+
+    case 'n':
+      config->consumers = number_parse(state, "consumer count", arg);
+
+      if(config->consumers < 2 || config->consumers > FANOUT_CONSUMERS_MAX)
+      {
+        argp_error(state, "Invalid consumer count (2 to %d): %s", FANOUT_CONSUMERS_MAX, arg);
+      }
+      break;
+
+    case 'k':
+      config->kill_at = number_parse(state, "kill point", arg);
+      break;
+
+    case 'm':
+      config->policy = arg;
+      break;
+
+    case 'K':
+      config->keep = true;
+      break;
+
+    case 'd':
+      config->debug = true;
+      break;
+
+    case ARGP_KEY_END:
+      if(config->kill_at >= config->lines / config->consumers)
+      {
+        argp_error(state, "The consumer has to be closed before the end of the stream");
+      }
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+
+  return 0;
+}
+
+/*
+ * Get monotonic milliseconds
+ */
+static long now_ms(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * Find the procom binary next to this binary
+ */
+static const char* binary_find(void)
+{
+  static char path[PATH_MAX];
+
+  ssize_t size = readlink("/proc/self/exe", path, sizeof(path) - sizeof("procom"));
+
+  if(size <= 0) return "procom";
+
+  path[size] = '\0';
+
+  char* slash = strrchr(path, '/');
+
+  strcpy(slash ? slash + 1 : path, "procom");
+
+  return path;
+}
+
+/*
+ * Start procom, with the read end of the stdin pipe and its stderr in the log
+ *
+ * RETURN (pid_t pid)
+ * - >0 | The process ID
+ * - -1 | Failed to fork
+ */
+static pid_t procom_spawn(int stdinfd)
+{
+  char* argv[4 + 2 * FANOUT_CONSUMERS_MAX + 2];
+
+  int count = 0;
+
+  argv[count++] = (char*) check.config.binary;
+  argv[count++] = "-m";
+  argv[count++] = (char*) check.config.policy;
+
+  for(int index = 0; index < check.config.consumers; index++)
+  {
+    argv[count++] = "-o";
+    argv[count++] = check.consumers[index].path;
+  }
+
+  if(check.config.debug) argv[count++] = "-d";
+
+  argv[count] = NULL;
+
+  pid_t pid = fork();
+
+  if(pid != 0) return pid;
+
+  // procom dies with the harness
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+  int logfd = open(check.log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+  int nullfd = open("/dev/null", O_WRONLY);
+
+  dup2(stdinfd, 0);
+
+  if(nullfd != -1) dup2(nullfd, 1);
+
+  if(logfd != -1) dup2(logfd, 2);
+
+  execv(argv[0], argv);
+
+  _exit(127);
+}
+
+/*
+ * Check a line read by a consumer
+ */
+static void line_check(struct consumer* consumer, const char* line, size_t length)
+{
+  char* end = NULL;
+
+  long seq = strtol(line, &end, 10);
+
+  if(length != FANOUT_LINE_SIZE || end == line || *end != ' ' || seq < 0 || seq >= check.config.lines)
+  {
+    check.corrupt++;
+
+    return;
+  }
+
+  if(check.seen[seq]++ > 0) check.duplicated++;
+
+  consumer->lines++;
+
+  if(check.consumers[0].closed) check.after_kill++;
+}
+
+/*
+ * Read the lines that have arrived at a consumer
+ *
+ * RETURN (ssize_t size)
+ * - >0 | The number of read bytes
+ * -  0 | End of File, or nothing to read
+ */
+static ssize_t consumer_read(struct consumer* consumer)
+{
+  ssize_t size = read(consumer->fd, consumer->buffer + consumer->end, sizeof(consumer->buffer) - consumer->end);
+
+  if(size == 0)
+  {
+    consumer->ended = true;
+
+    return 0;
+  }
+
+  if(size == -1) return 0;
+
+  consumer->end += size;
+
+  char* start = consumer->buffer;
+
+  char* newline;
+
+  while((newline = memchr(start, '\n', consumer->buffer + consumer->end - start)))
+  {
+    line_check(consumer, start, newline - start + 1);
+
+    start = newline + 1;
+  }
+
+  consumer->end -= start - consumer->buffer;
+
+  memmove(consumer->buffer, start, consumer->end);
+
+  return size;
+}
+
+/*
+ * Close the first consumer, as if its reader was killed
+ *
+ * The lines left in its fifo are lost, so the capacity of the fifo is kept
+ */
+static void consumer_kill(struct consumer* consumer)
+{
+  int capacity = fcntl(consumer->fd, F_GETPIPE_SZ);
+
+  consumer->capacity = (capacity > 0) ? capacity : 0;
+
+  close(consumer->fd);
+
+  consumer->fd     = -1;
+  consumer->closed = true;
+
+  info_print("Closed consumer %s after %ld lines", consumer->path, (long) consumer->lines);
+}
+
+/*
+ * Format the next batch of lines to be written
+ *
+ * RETURN (size_t size)
+ * - The number of bytes of the batch
+ */
+static size_t batch_format(char* buffer, long* next)
+{
+  size_t size = 0;
+
+  for(int count = 0; count < FANOUT_WRITE_BATCH && *next < check.config.lines; count++, (*next)++)
+  {
+    snprintf(buffer + size, FANOUT_LINE_SIZE + 1, "%-*ld", FANOUT_LINE_SIZE - 1, *next);
+
+    buffer[size + FANOUT_LINE_SIZE - 1] = '\n';
+
+    // The number is followed by a space, and padded with dots
+    char* space = memchr(buffer + size, ' ', FANOUT_LINE_SIZE);
+
+    if(space) memset(space + 1, '.', buffer + size + FANOUT_LINE_SIZE - 1 - (space + 1));
+
+    size += FANOUT_LINE_SIZE;
+  }
+
+  return size;
+}
+
+/*
+ * Write lines to procom and read them from the consumers, until every
+ * consumer has ended, and close the first consumer on the way
+ *
+ * RETURN (int status)
+ * -  0 | Every consumer has ended
+ * - -1 | The relay stalled
+ */
+static int stream_run(int writefd)
+{
+  char batch[FANOUT_LINE_SIZE * FANOUT_WRITE_BATCH];
+
+  size_t batch_size = 0, batch_done = 0;
+
+  long next = 0, progress = now_ms();
+
+  struct pollfd pollfds[FANOUT_CONSUMERS_MAX + 1];
+
+  while(true)
+  {
+    bool done = true;
+
+    for(int index = 0; index < check.config.consumers; index++)
+    {
+      struct consumer* consumer = &check.consumers[index];
+
+      pollfds[index] = (struct pollfd) { .fd = (consumer->closed || consumer->ended) ? -1 : consumer->fd, .events = POLLIN };
+
+      if(pollfds[index].fd != -1) done = false;
+    }
+
+    if(done) return 0;
+
+    pollfds[check.config.consumers] = (struct pollfd) { .fd = writefd, .events = POLLOUT };
+
+    if(poll(pollfds, check.config.consumers + 1, 100) == -1 && errno != EINTR) return -1;
+
+    bool moved = false;
+
+    for(int index = 0; index < check.config.consumers; index++)
+    {
+      if(pollfds[index].revents && consumer_read(&check.consumers[index]) > 0) moved = true;
+    }
+
+    struct consumer* killed = &check.consumers[0];
+
+    if(!killed->closed && (long) killed->lines >= check.config.kill_at) consumer_kill(killed);
+
+    // The stdin of procom is written to, until every line has been written
+    if(writefd != -1 && (pollfds[check.config.consumers].revents & (POLLOUT | POLLERR)))
+    {
+      if(batch_done == batch_size)
+      {
+        batch_size = batch_format(batch, &next);
+        batch_done = 0;
+      }
+
+      ssize_t size = write(writefd, batch + batch_done, batch_size - batch_done);
+
+      if(size > 0)
+      {
+        batch_done += size;
+
+        moved = true;
+      }
+      else if(size == -1 && errno != EAGAIN)
+      {
+        error_print("Failed to write to procom: %s", strerror(errno));
+
+        close(writefd);
+
+        writefd = -1;
+      }
+
+      if(writefd != -1 && batch_done == batch_size && next == check.config.lines)
+      {
+        close(writefd);
+
+        writefd = -1;
+      }
+    }
+
+    if(moved) progress = now_ms();
+
+    else if(now_ms() - progress > FANOUT_STALL_TIMEOUT)
+    {
+      error_print("No progress for %d ms", FANOUT_STALL_TIMEOUT);
+
+      if(writefd != -1) close(writefd);
+
+      return -1;
+    }
+  }
+}
+
+/*
+ * Check the lines, after the stream has ended
+ *
+ * RETURN (bool passed)
+ */
+static bool lines_check(void)
+{
+  size_t lost = 0;
+
+  for(long seq = 0; seq < check.config.lines; seq++)
+  {
+    if(check.seen[seq] == 0) lost++;
+  }
+
+  struct consumer* killed = &check.consumers[0];
+
+  // The lines in the fifo of the closed consumer, and a line being written to it
+  size_t lost_max = killed->capacity / FANOUT_LINE_SIZE + 1;
+
+  info_print("%ld lines, %ld read after the close, %ld lost (max %ld), %ld duplicated, %ld corrupt", check.config.lines, (long) check.after_kill, (long) lost, (long) lost_max, (long) check.duplicated, (long) check.corrupt);
+
+  for(int index = 0; index < check.config.consumers; index++)
+  {
+    info_print("Consumer %s: %ld lines", check.consumers[index].path, (long) check.consumers[index].lines);
+  }
+
+  bool passed = true;
+
+  if(!killed->closed)
+  {
+    error_print("The consumer was never closed");
+
+    passed = false;
+  }
+
+  if(lost > lost_max)
+  {
+    error_print("More lines were lost than the closed consumer could hold");
+
+    passed = false;
+  }
+
+  if(check.config.lines > 0 && check.seen[check.config.lines - 1] == 0)
+  {
+    error_print("The last line never came, the relay stopped");
+
+    passed = false;
+  }
+
+  if(check.duplicated > 0 || check.corrupt > 0) passed = false;
+
+  return passed;
+}
+
+/*
+ * Create the consumer fifos in a temporary directory, and open them
+ *
+ * The fifos are opened without waiting for procom, which opens them later
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to create or open a fifo
+ */
+static int consumers_init(void)
+{
+  for(int index = 0; index < check.config.consumers; index++)
+  {
+    struct consumer* consumer = &check.consumers[index];
+
+    snprintf(consumer->path, sizeof(consumer->path), "%s/%d.out", check.dir, index);
+
+    if(mkfifo(consumer->path, 0600) == -1 || (consumer->fd = open(consumer->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) == -1)
+    {
+      error_print("Failed to create fifo: %s", strerror(errno));
+
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Remove the fifos and log, and their directory
+ */
+static void consumers_remove(void)
+{
+  for(int index = 0; index < check.config.consumers; index++)
+  {
+    struct consumer* consumer = &check.consumers[index];
+
+    if(consumer->fd != -1) close(consumer->fd);
+
+    unlink(consumer->path);
+  }
+
+  unlink(check.log);
+
+  rmdir(check.dir);
+}
+
+static struct argp argp = { options, opt_parse, args_doc, doc };
+
+/*
+ * This is the main function
+ *
+ * RETURN (int status)
+ * - 0 | Every check passed
+ * - 1 | A check failed, or the check could not be started
+ */
+int main(int argc, char* argv[])
+{
+  argp_parse(&argp, argc, argv, 0, 0, &check.config);
+
+  if(!check.config.binary) check.config.binary = binary_find();
+
+  signal(SIGPIPE, SIG_IGN);
+
+  if(!(check.seen = calloc(check.config.lines, sizeof(uint8_t))))
+  {
+    error_print("Failed to allocate memory");
+
+    return 1;
+  }
+
+  snprintf(check.dir, sizeof(check.dir), "/tmp/procom-fanout-XXXXXX");
+
+  if(!mkdtemp(check.dir) || consumers_init() != 0) return 1;
+
+  snprintf(check.log, sizeof(check.log), "%s/procom.log", check.dir);
+
+  int pipefds[2];
+
+  if(pipe2(pipefds, O_CLOEXEC) == -1)
+  {
+    error_print("Failed to create pipe: %s", strerror(errno));
+
+    return 1;
+  }
+
+  info_print("Relaying %ld lines to %d consumers of %s, in %s", check.config.lines, check.config.consumers, check.config.binary, check.dir);
+
+  pid_t pid = procom_spawn(pipefds[0]);
+
+  close(pipefds[0]);
+
+  if(pid == -1)
+  {
+    error_print("Failed to start procom: %s", strerror(errno));
+
+    return 1;
+  }
+
+  fcntl(pipefds[1], F_SETFL, O_NONBLOCK);
+
+  int status = stream_run(pipefds[1]);
+
+  if(status != 0) kill(pid, SIGKILL);
+
+  int wstatus = 0;
+
+  waitpid(pid, &wstatus, 0);
+
+  bool passed = (status == 0 && lines_check());
+
+  if(passed && !check.config.keep)
+  {
+    consumers_remove();
+  }
+  else info_print("The fifos and log are kept in %s", check.dir);
+
+  info_print("%s", passed ? "Passed" : "Failed");
+
+  free(check.seen);
+
+  return passed ? 0 : 1;
+}
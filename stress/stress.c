@@ -0,0 +1,1333 @@
+/*
+ * Written by Hampus Fridholm
+ *
+ * Last updated: 2026-10-18
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
+#include <argp.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+#include "debug.h"
+
+/*
+ * The stress harness runs pairs of procom, each pair relaying a stream
+ * of numbered lines from a stdin fifo, over a socket, to a stdout fifo:
+ *
+ *   harness -> [in fifo] -> procom A -> socket -> procom B -> [out fifo] -> harness
+ *
+ * Every line is "PAIR EPOCH SEQ NSEC SIZE PADDING", where NSEC is the time
+ * it was written, so that its latency is known when it is read back.
+ * The lines are checked for loss, duplicates, reordering and corruption.
+ *
+ * A pair is restarted after one of its peers is killed, and every run of
+ * a pair is an epoch, with its own sequence of lines
+ */
+
+#define STRESS_PAIRS_MAX 64
+
+#define STRESS_EXTRA_MAX 16
+
+#define STRESS_LINE_MAX  (64 * 1024)
+
+#define STRESS_READ_SIZE (64 * 1024)
+
+/*
+ * Lines sent in a row before the stdout fifo is read again
+ */
+#define STRESS_WRITE_BATCH 64
+
+/*
+ * The lines behind the next expected line, that are remembered as missing.
+ * A line that comes later than this is counted as a duplicate
+ */
+#define STRESS_WINDOW (1 << 16)
+
+/*
+ * Max milliseconds for procom A to listen, and for a pair to end
+ */
+#define STRESS_LISTEN_TIMEOUT 5000
+#define STRESS_DRAIN_TIMEOUT  10000
+
+/*
+ * Ports of the pairs from the first port. Every epoch of a pair has a new
+ * port, that is not in use by an old connection that waits to time out
+ */
+#define STRESS_PORTS 10000
+
+/*
+ * Milliseconds between merges of the counters of a pair
+ */
+#define STRESS_MERGE_INTERVAL 100
+
+/*
+ * Buckets of the latency histogram, with 8 buckets for every power of two
+ * microseconds, so that a percentile is within an eighth of the latency
+ */
+#define STRESS_LATENCY_SUBBUCKETS 8
+#define STRESS_LATENCY_BUCKETS    (40 * STRESS_LATENCY_SUBBUCKETS)
+
+struct counters
+{
+  size_t lines;
+  size_t bytes;
+  size_t lost;        // Lines that never came
+  size_t duplicated;  // Lines that came more than once
+  size_t reordered;   // Lines that came after a later line
+  size_t corrupt;     // Lines with a bad header or padding
+  size_t stalls;      // Times no line came for the stall limit
+  size_t hangs;       // Times a pair did not end in time
+  size_t exits;       // Times a peer ended by itself, or failed to start
+  size_t kills;       // Peers killed on purpose
+  size_t killed_lost; // Lines in flight when a peer was killed
+  long   latency_max; // Microseconds
+  size_t latency[STRESS_LATENCY_BUCKETS];
+};
+
+struct config
+{
+  const char* binary;
+  int         pairs;
+  long        duration;    // Seconds
+  int         max_size;    // Max bytes of padding of a line
+  long        rate;        // Lines per second of a pair, 0 for as fast as possible
+  long        slow;        // Max microseconds to wait between reads
+  long        stall;       // Milliseconds to stop reading, now and then
+  long        kill;        // Mean milliseconds between kills of a peer
+  long        stall_limit; // Milliseconds without a line to report a stall
+  long        interval;    // Milliseconds between reports
+  int         port;
+  const char* pipe_size;
+  char*       extra[STRESS_EXTRA_MAX];
+  int         extra_count;
+  unsigned    seed;
+  bool        keep;
+  bool        debug;
+};
+
+struct pair
+{
+  int             index;
+  pthread_t       thread;
+  uint64_t        random;
+  char            in_path[PATH_MAX];
+  char            out_path[PATH_MAX];
+  char            a_log[PATH_MAX];
+  char            b_log[PATH_MAX];
+  int             epoch;
+  int             port_turn; // The turn of the next port to try
+  struct counters counters; // Not yet merged
+  struct timespec merged;
+  uint8_t         missing[STRESS_WINDOW / 8];
+};
+
+struct stress
+{
+  struct config    config;
+  char             dir[64];
+  int              holdfd;   // Read end of a pipe, that is the stdin of every procom
+  int              nullfd;
+  struct timespec  start;
+  struct timespec  end;
+  volatile bool    stop;
+  pthread_mutex_t  lock;
+  struct counters  total;    // Guarded by lock
+  struct counters  interval; // Guarded by lock
+  struct pair      pairs[STRESS_PAIRS_MAX];
+};
+
+static struct stress stress =
+{
+  .config =
+  {
+    .binary      = NULL,
+    .pairs       = 4,
+    .duration    = 10,
+    .max_size    = 256,
+    .rate        = 0,
+    .slow        = 0,
+    .stall       = 0,
+    .kill        = 0,
+    .stall_limit = 5000,
+    .interval    = 1000,
+    .port        = 20000,
+    .pipe_size   = NULL,
+    .extra_count = 0,
+    .seed        = 1,
+    .keep        = false,
+    .debug       = false
+  },
+  .holdfd = -1,
+  .nullfd = -1,
+  .stop   = false,
+  .lock   = PTHREAD_MUTEX_INITIALIZER
+};
+
+static char doc[] = "procom-stress - run pairs of procom under load, and check every line";
+
+static char args_doc[] = "";
+
+static struct argp_option options[] =
+{
+  { "binary",      'b', "PATH",    0, "The procom binary, by default next to this binary" },
+  { "pairs",       'n', "COUNT",   0, "Pairs of procom to run at once" },
+  { "duration",    't', "SECONDS", 0, "Seconds to run, for a soak test run for hours" },
+  { "max-size",    'm', "BYTES",   0, "Max bytes of random padding of a line" },
+  { "rate",        'r', "LINES",   0, "Lines per second of every pair, as fast as possible if left out" },
+  { "slow",        'w', "USEC",    0, "Wait at random up to USEC microseconds between reads" },
+  { "stall",       'S', "MS",      0, "Stop reading for MS milliseconds, at random now and then" },
+  { "kill",        'k', "MS",      0, "Kill a peer of a pair, at random every MS milliseconds" },
+  { "stall-limit", 'l', "MS",      0, "Report a stall after MS milliseconds without a line" },
+  { "interval",    'i', "MS",      0, "Milliseconds between reports" },
+  { "port",        'p', "PORT",    0, "First network port of the pairs" },
+  { "pipe-size",   'P', "SIZE",    0, "Fifo capacity of procom, small to saturate the fifos" },
+  { "extra",       'e', "ARG",     0, "Extra argument of procom, repeatable" },
+  { "seed",        'x', "SEED",    0, "Seed of the random sizes and timings" },
+  { "keep",        'K', 0,         0, "Keep the fifos and logs, even if every check passes" },
+  { "debug",       'd', 0,         0, "Print debug messages" },
+  { 0 }
+};
+
+/*
+ * Parse a positive number option, or end with an error
+ */
+static long number_parse(struct argp_state* state, const char* name, const char* arg)
+{
+  char* end = NULL;
+
+  long number = strtol(arg, &end, 10);
+
+  if(*end != '\0' || number <= 0) argp_error(state, "Invalid %s: %s", name, arg);
+
+  return number;
+}
+
+static error_t opt_parse(int key, char* arg, struct argp_state* state)
+{
+  struct config* config = state->input;
+
+  switch(key)
+  {
+    case 'b':
+      config->binary = arg;
+      break;
+
+    case 'n':
+      config->pairs = number_parse(state, "pair count", arg);
+
+      if(config->pairs > STRESS_PAIRS_MAX) argp_error(state, "Too many pairs: %s", arg);
+      break;
+
+    case 't':
+      config->duration = number_parse(state, "duration", arg);
+      break;
+
+    case 'm':
+      config->max_size = number_parse(state, "max size", arg);
+
+      if(config->max_size > STRESS_LINE_MAX / 2) argp_error(state, "Too large max size: %s", arg);
+      break;
+
+    case 'r':
+      config->rate = number_parse(state, "rate", arg);
+      break;
+
+    case 'w':
+      config->slow = number_parse(state, "slow wait", arg);
+      break;
+
+    case 'S':
+      config->stall = number_parse(state, "stall", arg);
+      break;
+
+    case 'k':
+      config->kill = number_parse(state, "kill interval", arg);
+      break;
+
+    case 'l':
+      config->stall_limit = number_parse(state, "stall limit", arg);
+      break;
+
+    case 'i':
+      config->interval = number_parse(state, "interval", arg);
+      break;
+
+    case 'p':
+      config->port = number_parse(state, "port", arg);
+
+      if(config->port > 65536 - STRESS_PORTS) argp_error(state, "Invalid port: %s", arg);
+      break;
+
+    case 'P':
+      config->pipe_size = arg;
+      break;
+
+    case 'e':
+      if(config->extra_count >= STRESS_EXTRA_MAX) argp_error(state, "Too many extra arguments");
+
+      config->extra[config->extra_count++] = arg;
+      break;
+
+    case 'x':
+      config->seed = number_parse(state, "seed", arg);
+      break;
+
+    case 'K':
+      config->keep = true;
+      break;
+
+    case 'd':
+      config->debug = true;
+      break;
+
+    case ARGP_KEY_ARG:
+      break;
+
+    case ARGP_KEY_END:
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+
+  return 0;
+}
+
+/*
+ * Get the time of the monotonic clock, in nanoseconds
+ */
+static long now_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/*
+ * Get a pseudo random number of a pair (xorshift64)
+ */
+static uint64_t pair_random(struct pair* pair)
+{
+  pair->random ^= pair->random << 13;
+  pair->random ^= pair->random >> 7;
+  pair->random ^= pair->random << 17;
+
+  return pair->random;
+}
+
+/*
+ * Get a pseudo random number from 0 up to, but not including, a limit
+ */
+static long pair_random_below(struct pair* pair, long limit)
+{
+  return (limit > 0) ? (long) (pair_random(pair) % (uint64_t) limit) : 0;
+}
+
+/*
+ * Get the latency bucket of a number of microseconds
+ */
+static int latency_bucket(long usec)
+{
+  if(usec < STRESS_LATENCY_SUBBUCKETS) return (usec > 0) ? usec : 0;
+
+  int msb = 63 - __builtin_clzl(usec);
+
+  int bucket = (msb - 2) * STRESS_LATENCY_SUBBUCKETS + ((usec >> (msb - 3)) & (STRESS_LATENCY_SUBBUCKETS - 1));
+
+  return (bucket < STRESS_LATENCY_BUCKETS) ? bucket : STRESS_LATENCY_BUCKETS - 1;
+}
+
+/*
+ * Get the highest number of microseconds of a latency bucket
+ */
+static long latency_bound(int bucket)
+{
+  if(bucket < STRESS_LATENCY_SUBBUCKETS) return bucket;
+
+  int shift = bucket / STRESS_LATENCY_SUBBUCKETS - 1;
+
+  long lower = (long) (STRESS_LATENCY_SUBBUCKETS + bucket % STRESS_LATENCY_SUBBUCKETS) << shift;
+
+  return lower + (1L << shift) - 1;
+}
+
+/*
+ * Get a percentile of the latency of the counted lines
+ *
+ * PARAMS
+ * - double percentile | The percentile, from 0 to 100
+ *
+ * RETURN (long usec)
+ * - The latency in microseconds, rounded up to its bucket
+ *   (but not above the max), or 0 if no line has been counted
+ */
+static long latency_percentile(const struct counters* counters, double percentile)
+{
+  if(counters->lines == 0) return 0;
+
+  size_t rank = (size_t) (counters->lines * percentile / 100);
+
+  if(rank < 1) rank = 1;
+
+  size_t count = 0;
+
+  for(int bucket = 0; bucket < STRESS_LATENCY_BUCKETS; bucket++)
+  {
+    if((count += counters->latency[bucket]) >= rank) return MIN(latency_bound(bucket), counters->latency_max);
+  }
+
+  return counters->latency_max;
+}
+
+/*
+ * Add the counters of a pair to other counters
+ */
+static void counters_add(struct counters* sum, const struct counters* counters)
+{
+  sum->lines       += counters->lines;
+  sum->bytes       += counters->bytes;
+  sum->lost        += counters->lost;
+  sum->duplicated  += counters->duplicated;
+  sum->reordered   += counters->reordered;
+  sum->corrupt     += counters->corrupt;
+  sum->stalls      += counters->stalls;
+  sum->hangs       += counters->hangs;
+  sum->exits       += counters->exits;
+  sum->kills       += counters->kills;
+  sum->killed_lost += counters->killed_lost;
+
+  if(counters->latency_max > sum->latency_max) sum->latency_max = counters->latency_max;
+
+  for(int bucket = 0; bucket < STRESS_LATENCY_BUCKETS; bucket++)
+  {
+    sum->latency[bucket] += counters->latency[bucket];
+  }
+}
+
+/*
+ * Get the number of failed checks
+ */
+static size_t counters_failures(const struct counters* counters)
+{
+  return counters->lost + counters->duplicated + counters->reordered + counters->corrupt + counters->stalls + counters->hangs + counters->exits;
+}
+
+/*
+ * Merge the counters of a pair into the total and interval counters
+ *
+ * PARAMS
+ * - bool force | Merge now, instead of every STRESS_MERGE_INTERVAL
+ */
+static void pair_counters_merge(struct pair* pair, bool force)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  long elapsed = (now.tv_sec - pair->merged.tv_sec) * 1000 + (now.tv_nsec - pair->merged.tv_nsec) / 1000000;
+
+  if(!force && elapsed < STRESS_MERGE_INTERVAL) return;
+
+  pthread_mutex_lock(&stress.lock);
+
+  counters_add(&stress.total,    &pair->counters);
+  counters_add(&stress.interval, &pair->counters);
+
+  pthread_mutex_unlock(&stress.lock);
+
+  memset(&pair->counters, 0, sizeof(struct counters));
+
+  pair->merged = now;
+}
+
+/*
+ * Start procom, with the hold pipe as stdin and its stderr in a log
+ *
+ * The fifos of the harness are close-on-exec, so that a peer never holds
+ * the fifo of another pair open
+ *
+ * RETURN (pid_t pid)
+ * - >0 | The process ID
+ * - -1 | Failed to fork
+ */
+static pid_t procom_spawn(char** argv, const char* log)
+{
+  pid_t pid = fork();
+
+  if(pid != 0) return pid;
+
+  // The peers die with the harness
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+  int logfd = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+  dup2(stress.holdfd, 0);
+  dup2(stress.nullfd, 1);
+
+  if(logfd != -1) dup2(logfd, 2);
+
+  execv(argv[0], argv);
+
+  _exit(127);
+}
+
+/*
+ * Build the arguments of procom
+ *
+ * PARAMS
+ * - const char* fifo_option | "-i" or "-o"
+ */
+static void procom_args(char** argv, char* port_arg, const char* fifo_option, const char* fifo)
+{
+  int count = 0;
+
+  argv[count++] = (char*) stress.config.binary;
+  argv[count++] = (char*) fifo_option;
+  argv[count++] = (char*) fifo;
+  argv[count++] = "-p";
+  argv[count++] = port_arg;
+
+  if(stress.config.debug) argv[count++] = "-d";
+
+  if(stress.config.pipe_size)
+  {
+    argv[count++] = "-P";
+    argv[count++] = (char*) stress.config.pipe_size;
+  }
+
+  for(int index = 0; index < stress.config.extra_count; index++)
+  {
+    argv[count++] = stress.config.extra[index];
+  }
+
+  argv[count] = NULL;
+}
+
+/*
+ * Check if a port is in use, or listened on, without connecting to it
+ *
+ * PARAMS
+ * - bool listening | Only count a socket that listens
+ */
+static bool port_used(int port, bool listening)
+{
+  const char* paths[] = { "/proc/net/tcp", "/proc/net/tcp6" };
+
+  for(size_t index = 0; index < sizeof(paths) / sizeof(*paths); index++)
+  {
+    FILE* file = fopen(paths[index], "r");
+
+    if(!file) continue;
+
+    char line[512];
+
+    bool used = false;
+
+    while(!used && fgets(line, sizeof(line), file))
+    {
+      char local[128];
+      char remote[128];
+      unsigned state;
+
+      if(sscanf(line, " %*d: %127s %127s %x", local, remote, &state) != 3) continue;
+
+      const char* colon = strrchr(local, ':');
+
+      used = (colon && strtol(colon + 1, NULL, 16) == port && (!listening || state == 0x0A));
+    }
+
+    fclose(file);
+
+    if(used) return true;
+  }
+
+  return false;
+}
+
+/*
+ * Wait until a port is listened on
+ *
+ * RETURN (bool listening)
+ * - true  | The port is listened on
+ * - false | Timed out, or the process ended
+ */
+static bool port_listening_wait(int port, pid_t pid)
+{
+  for(long waited = 0; waited < STRESS_LISTEN_TIMEOUT; waited += 10)
+  {
+    if(port_used(port, true)) return true;
+
+    if(waitpid(pid, NULL, WNOHANG) == pid) return false;
+
+    usleep(10000);
+  }
+
+  return false;
+}
+
+/*
+ * Find a port of a pair that is not in use, such as by an old connection
+ * that waits to time out
+ *
+ * The ports of a pair are every pairs-th port from the first port plus its index
+ */
+static int pair_port_find(struct pair* pair)
+{
+  const struct config* config = &stress.config;
+
+  int port = config->port;
+
+  for(int tried = 0; tried < STRESS_PORTS / config->pairs; tried++)
+  {
+    port = config->port + (pair->index + pair->port_turn++ * config->pairs) % STRESS_PORTS;
+
+    if(!port_used(port, false)) break;
+  }
+
+  return port;
+}
+
+/*
+ * The state of an epoch of a pair
+ */
+struct epoch
+{
+  pid_t  a;
+  pid_t  b;
+  int    infd;
+  int    outfd;
+  long   sent;     // Lines written in whole to the stdin fifo
+  long   expected; // The next line in order
+  long   missing;  // Lines skipped, that may still come
+  char   write_buffer[STRESS_LINE_MAX];
+  size_t write_size;
+  size_t write_done;
+  char   read_buffer[STRESS_LINE_MAX + STRESS_READ_SIZE];
+  size_t read_size;
+};
+
+/*
+ * Format the next line of an epoch into the write buffer
+ */
+static void epoch_line_format(struct pair* pair, struct epoch* epoch)
+{
+  int size = pair_random_below(pair, stress.config.max_size + 1);
+
+  char* buffer = epoch->write_buffer;
+
+  int length = snprintf(buffer, STRESS_LINE_MAX, "%d %d %ld %ld %d ", pair->index, pair->epoch, epoch->sent, now_ns(), size);
+
+  for(int index = 0; index < size; index++)
+  {
+    buffer[length + index] = 'a' + (epoch->sent + index) % 26;
+  }
+
+  buffer[length + size] = '\n';
+
+  epoch->write_size = length + size + 1;
+  epoch->write_done = 0;
+}
+
+/*
+ * Check if a line is missing, in the window behind the next expected line
+ */
+static bool missing_get(const struct pair* pair, long seq)
+{
+  return pair->missing[(seq % STRESS_WINDOW) / 8] & (1 << (seq % 8));
+}
+
+static void missing_set(struct pair* pair, long seq, bool missing)
+{
+  if(missing)
+  {
+    pair->missing[(seq % STRESS_WINDOW) / 8] |= (1 << (seq % 8));
+  }
+  else pair->missing[(seq % STRESS_WINDOW) / 8] &= ~(1 << (seq % 8));
+}
+
+/*
+ * Check a line read back from the stdout fifo
+ *
+ * A line ahead of the expected line marks the lines in between as missing.
+ * A missing line that comes later is reordered, and any other
+ * line behind the expected line is a duplicate
+ */
+static void epoch_line_check(struct pair* pair, struct epoch* epoch, const char* line, size_t length)
+{
+  struct counters* counters = &pair->counters;
+
+  char* end = NULL;
+
+  long fields[5];
+
+  const char* field = line;
+
+  for(int index = 0; index < 5; index++)
+  {
+    fields[index] = strtol(field, &end, 10);
+
+    if(end == field || *end != ' ')
+    {
+      counters->corrupt++;
+
+      return;
+    }
+
+    field = end + 1;
+  }
+
+  long seq  = fields[2];
+  long size = fields[4];
+
+  bool valid = (fields[0] == pair->index && fields[1] == pair->epoch && seq >= 0 && seq < epoch->sent);
+
+  valid = valid && (size == (long) (line + length - field));
+
+  for(long index = 0; valid && index < size; index++)
+  {
+    valid = (field[index] == 'a' + (seq + index) % 26);
+  }
+
+  if(!valid)
+  {
+    counters->corrupt++;
+
+    return;
+  }
+
+  long latency = (now_ns() - fields[3]) / 1000;
+
+  counters->lines++;
+  counters->bytes += length + 1;
+  counters->latency[latency_bucket(latency)]++;
+
+  if(latency > counters->latency_max) counters->latency_max = latency;
+
+  if(seq == epoch->expected)
+  {
+    epoch->expected++;
+  }
+  else if(seq > epoch->expected)
+  {
+    long first = (seq - epoch->expected > STRESS_WINDOW) ? seq - STRESS_WINDOW : epoch->expected;
+
+    for(long skipped = first; skipped < seq; skipped++) missing_set(pair, skipped, true);
+
+    epoch->missing += seq - epoch->expected;
+
+    // Lines too far behind to be remembered are lost for good
+    counters->lost += first - epoch->expected;
+    epoch->missing -= first - epoch->expected;
+
+    epoch->expected = seq + 1;
+
+    missing_set(pair, seq, false);
+  }
+  else if(epoch->expected - seq <= STRESS_WINDOW && missing_get(pair, seq))
+  {
+    missing_set(pair, seq, false);
+
+    epoch->missing--;
+
+    counters->reordered++;
+  }
+  else counters->duplicated++;
+}
+
+/*
+ * Read from the stdout fifo of an epoch, and check the whole lines
+ *
+ * RETURN (ssize_t size)
+ * - >0 | The number of read bytes
+ * -  0 | Nothing to read
+ * - -1 | Failed to read
+ */
+static ssize_t epoch_read(struct pair* pair, struct epoch* epoch, size_t max)
+{
+  ssize_t size = read(epoch->outfd, epoch->read_buffer + epoch->read_size, max);
+
+  if(size == -1) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+  epoch->read_size += size;
+
+  char* start = epoch->read_buffer;
+  char* end   = epoch->read_buffer + epoch->read_size;
+
+  char* newline;
+
+  while((newline = memchr(start, '\n', end - start)))
+  {
+    epoch_line_check(pair, epoch, start, newline - start);
+
+    start = newline + 1;
+  }
+
+  // A line longer than any sent line is corrupt
+  if(end - start >= STRESS_LINE_MAX)
+  {
+    pair->counters.corrupt++;
+
+    start = end;
+  }
+
+  epoch->read_size = end - start;
+
+  memmove(epoch->read_buffer, start, epoch->read_size);
+
+  return size;
+}
+
+/*
+ * Write lines to the stdin fifo of an epoch, until it is full
+ *
+ * PARAMS
+ * - long max | Max lines to start
+ *
+ * RETURN (long started)
+ * - The number of started lines
+ */
+static long epoch_write(struct pair* pair, struct epoch* epoch, long max)
+{
+  long started = 0;
+
+  while(true)
+  {
+    if(epoch->write_done == epoch->write_size)
+    {
+      if(started >= max) break;
+
+      epoch_line_format(pair, epoch);
+
+      started++;
+    }
+
+    ssize_t size = write(epoch->infd, epoch->write_buffer + epoch->write_done, epoch->write_size - epoch->write_done);
+
+    if(size <= 0) break;
+
+    epoch->write_done += size;
+
+    if(epoch->write_done == epoch->write_size) epoch->sent++;
+  }
+
+  return started;
+}
+
+/*
+ * Reap a peer that has ended
+ *
+ * RETURN (bool ended)
+ */
+static bool peer_reap(pid_t* pid)
+{
+  if(*pid == -1) return true;
+
+  if(waitpid(*pid, NULL, WNOHANG) != *pid) return false;
+
+  *pid = -1;
+
+  return true;
+}
+
+/*
+ * Run an epoch of a pair, until the run ends or a peer is killed
+ *
+ * RETURN (int status)
+ * -  0 | The epoch ended
+ * - -1 | The pair could not be started
+ */
+static int pair_epoch_run(struct pair* pair, struct epoch* epoch)
+{
+  const struct config* config = &stress.config;
+
+  struct counters* counters = &pair->counters;
+
+  char port_arg[16];
+
+  snprintf(port_arg, sizeof(port_arg), "%d", pair_port_find(pair));
+
+  char* argv[STRESS_EXTRA_MAX + 9];
+
+  procom_args(argv, port_arg, "-i", pair->in_path);
+
+  if((epoch->a = procom_spawn(argv, pair->a_log)) == -1) return -1;
+
+  if(!port_listening_wait(atoi(port_arg), epoch->a))
+  {
+    error_print("Pair %d: procom A did not listen on port %s, see %s", pair->index, port_arg, pair->a_log);
+
+    kill(epoch->a, SIGKILL);
+    waitpid(epoch->a, NULL, 0);
+
+    counters->exits++;
+
+    return -1;
+  }
+
+  procom_args(argv, port_arg, "-o", pair->out_path);
+
+  if((epoch->b = procom_spawn(argv, pair->b_log)) == -1)
+  {
+    kill(epoch->a, SIGKILL);
+    waitpid(epoch->a, NULL, 0);
+
+    return -1;
+  }
+
+  long now = now_ns();
+
+  long next_send  = now;
+  long next_read  = now;
+  long progressed = now; // The last time a line came, or a pause of the reads ended
+  long stall_at   = config->stall ? now + pair_random_below(pair, 20 * config->stall) * 1000000 : 0;
+  long kill_at    = config->kill  ? now + (config->kill / 2 + pair_random_below(pair, config->kill)) * 1000000 : 0;
+  long deadline   = 0; // The end of the draining of the epoch
+  long end        = stress.end.tv_sec * 1000000000L + stress.end.tv_nsec;
+
+  bool draining = false;
+  bool killed   = false;
+  bool stalled  = false;
+
+  while(true)
+  {
+    now = now_ns();
+
+    // 1. If the run is over, the rest of the lines are drained
+    if(!draining && (stress.stop || now >= end))
+    {
+      draining = true;
+      deadline = now + STRESS_DRAIN_TIMEOUT * 1000000L;
+    }
+
+    // 2. If it is time, a peer is killed in the middle of the stream
+    if(!draining && kill_at && now >= kill_at)
+    {
+      pid_t victim = (pair_random(pair) & 1) ? epoch->a : epoch->b;
+
+      if(config->debug) info_print("Pair %d: killing procom %s", pair->index, (victim == epoch->a) ? "A" : "B");
+
+      kill(victim, SIGKILL);
+
+      counters->kills++;
+
+      draining = true;
+      killed   = true;
+      deadline = now + STRESS_DRAIN_TIMEOUT * 1000000L;
+    }
+
+    // 3. If a peer has ended by itself, the rest of the lines are drained
+    bool a_ended = peer_reap(&epoch->a);
+    bool b_ended = peer_reap(&epoch->b);
+
+    if(!draining && (a_ended || b_ended))
+    {
+      error_print("Pair %d: procom %s ended in epoch %d, see %s", pair->index, a_ended ? "A" : "B", pair->epoch, a_ended ? pair->a_log : pair->b_log);
+
+      counters->exits++;
+
+      draining = true;
+      deadline = now + STRESS_DRAIN_TIMEOUT * 1000000L;
+    }
+
+    // The stdin fifo is closed after the last whole line, which ends procom A
+    if(draining && epoch->infd != -1 && (killed || epoch->write_done == epoch->write_size))
+    {
+      close(epoch->infd);
+
+      epoch->infd = -1;
+    }
+
+    if(a_ended && b_ended)
+    {
+      while(epoch_read(pair, epoch, STRESS_READ_SIZE) > 0);
+
+      break;
+    }
+
+    if(draining && now >= deadline)
+    {
+      error_print("Pair %d: epoch %d did not end in time (%ld of %ld lines)", pair->index, pair->epoch, epoch->expected, epoch->sent);
+
+      counters->hangs++;
+
+      if(epoch->a != -1) kill(epoch->a, SIGKILL);
+      if(epoch->b != -1) kill(epoch->b, SIGKILL);
+
+      deadline = LONG_MAX;
+
+      continue;
+    }
+
+    // 4. Now and then, the reads stop for a while
+    if(!draining && stall_at && now >= stall_at)
+    {
+      next_read = now + config->stall * 1000000L;
+      stall_at  = next_read + pair_random_below(pair, 20 * config->stall) * 1000000L;
+    }
+
+    if(draining) next_read = now;
+
+    if(next_read > progressed && next_read <= now) progressed = next_read;
+
+    // 5. If no line has come for too long, the pair has stalled
+    if(!stalled && epoch->expected < epoch->sent && next_read <= now && now - progressed > config->stall_limit * 1000000L)
+    {
+      error_print("Pair %d: no line for %ld ms in epoch %d (%ld of %ld lines)", pair->index, (now - progressed) / 1000000, pair->epoch, epoch->expected, epoch->sent);
+
+      counters->stalls++;
+
+      stalled = true;
+    }
+
+    bool sending = (epoch->infd != -1 && !draining && now >= next_send) || (epoch->infd != -1 && epoch->write_done < epoch->write_size);
+    bool reading = (now >= next_read);
+
+    struct pollfd pollfds[2] =
+    {
+      { .fd = sending ? epoch->infd  : -1, .events = POLLOUT },
+      { .fd = reading ? epoch->outfd : -1, .events = POLLIN  }
+    };
+
+    long wait = 100;
+
+    if(!draining && config->rate && next_send > now) wait = MIN(wait, (next_send - now) / 1000000 + 1);
+
+    if(next_read > now) wait = MIN(wait, (next_read - now) / 1000000 + 1);
+
+    if(poll(pollfds, 2, wait) == -1 && errno != EINTR) return -1;
+
+    if(pollfds[0].revents & POLLOUT)
+    {
+      long max = config->rate ? 1 : STRESS_WRITE_BATCH;
+
+      if(draining) max = 0;
+
+      long started = epoch_write(pair, epoch, max);
+
+      if(config->rate) next_send += started * (1000000000L / config->rate);
+    }
+
+    if(pollfds[1].revents & POLLIN)
+    {
+      size_t max = (config->slow && !draining) ? PIPE_BUF : STRESS_READ_SIZE;
+
+      long expected = epoch->expected;
+
+      if(epoch_read(pair, epoch, max) > 0 && epoch->expected != expected)
+      {
+        progressed = now_ns();
+        stalled    = false;
+      }
+
+      if(config->slow && !draining) next_read = now_ns() + pair_random_below(pair, config->slow) * 1000;
+    }
+
+    pair_counters_merge(pair, false);
+  }
+
+  // The lines that never came were lost, unless they were in flight when a peer was killed
+  counters->lost += epoch->missing;
+
+  if(killed)
+  {
+    counters->killed_lost += epoch->sent - epoch->expected;
+  }
+  else counters->lost += epoch->sent - epoch->expected;
+
+  if(!killed && epoch->sent != epoch->expected) error_print("Pair %d: %ld of %ld lines lost in epoch %d", pair->index, epoch->sent - epoch->expected, epoch->sent, pair->epoch);
+
+  return 0;
+}
+
+/*
+ * Run epochs of a pair, until the run ends
+ */
+static void* pair_routine(void* arg)
+{
+  struct pair* pair = arg;
+
+  struct epoch* epoch = malloc(sizeof(struct epoch));
+
+  if(!epoch) return NULL;
+
+  clock_gettime(CLOCK_MONOTONIC, &pair->merged);
+
+  while(!stress.stop)
+  {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(now.tv_sec > stress.end.tv_sec || (now.tv_sec == stress.end.tv_sec && now.tv_nsec >= stress.end.tv_nsec)) break;
+
+    memset(epoch, 0, sizeof(struct epoch));
+    memset(pair->missing, 0, sizeof(pair->missing));
+
+    // Both ends of the fifos are held by the harness, and closing them drops the lines of a killed epoch
+    epoch->infd  = open(pair->in_path,  O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    epoch->outfd = open(pair->out_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+    int status = -1;
+
+    if(epoch->infd != -1 && epoch->outfd != -1)
+    {
+      status = pair_epoch_run(pair, epoch);
+    }
+    else error_print("Pair %d: Failed to open fifos", pair->index);
+
+    if(epoch->infd  != -1) close(epoch->infd);
+    if(epoch->outfd != -1) close(epoch->outfd);
+
+    pair_counters_merge(pair, true);
+
+    if(status != 0) break;
+
+    pair->epoch++;
+  }
+
+  free(epoch);
+
+  return NULL;
+}
+
+/*
+ * Print the counters of an interval, or of the whole run
+ */
+static void counters_print(const struct counters* counters, const char* name, long elapsed)
+{
+  double seconds = (elapsed > 0) ? elapsed / 1000.0 : 1;
+
+  debug_print(stderr, "STRESS", "%s: %ld lines (%f lines/s, %f MiB/s)", name, (long) counters->lines, counters->lines / seconds, counters->bytes / seconds / (1024 * 1024));
+
+  debug_print(stderr, "STRESS", "%s: latency p50 %ld us, p99 %ld us, p99.9 %ld us, max %ld us", name,
+    latency_percentile(counters, 50), latency_percentile(counters, 99), latency_percentile(counters, 99.9), counters->latency_max);
+}
+
+/*
+ * Print every failed check of the run, and the kills
+ */
+static void failures_print(const struct counters* counters)
+{
+  debug_print(stderr, "STRESS", "lost %ld, duplicated %ld, reordered %ld, corrupt %ld",
+    (long) counters->lost, (long) counters->duplicated, (long) counters->reordered, (long) counters->corrupt);
+
+  debug_print(stderr, "STRESS", "stalls %ld, hangs %ld, exits %ld", (long) counters->stalls, (long) counters->hangs, (long) counters->exits);
+
+  if(counters->kills > 0)
+  {
+    debug_print(stderr, "STRESS", "kills %ld, with %ld lines in flight", (long) counters->kills, (long) counters->killed_lost);
+  }
+}
+
+/*
+ * Get the milliseconds since the start of the run
+ */
+static long elapsed_ms(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - stress.start.tv_sec) * 1000 + (now.tv_nsec - stress.start.tv_nsec) / 1000000;
+}
+
+/*
+ * Keyboard interrupt - end the run, and check the lines in flight
+ */
+static void sigint_handler(int signum)
+{
+  stress.stop = true;
+}
+
+/*
+ * Find the procom binary next to this binary
+ */
+static const char* binary_find(void)
+{
+  static char path[PATH_MAX];
+
+  ssize_t size = readlink("/proc/self/exe", path, sizeof(path) - sizeof("procom"));
+
+  if(size <= 0) return "procom";
+
+  path[size] = '\0';
+
+  char* slash = strrchr(path, '/');
+
+  strcpy(slash ? slash + 1 : path, "procom");
+
+  return path;
+}
+
+/*
+ * Create the fifos of the pairs in a temporary directory
+ *
+ * RETURN (int status)
+ * -  0 | Success
+ * - -1 | Failed to create a fifo
+ */
+static int pairs_init(void)
+{
+  for(int index = 0; index < stress.config.pairs; index++)
+  {
+    struct pair* pair = &stress.pairs[index];
+
+    pair->index  = index;
+    pair->random = (uint64_t) stress.config.seed * 0x9e3779b97f4a7c15ULL + index + 1;
+
+    snprintf(pair->in_path,  sizeof(pair->in_path),  "%s/%d.in",    stress.dir, index);
+    snprintf(pair->out_path, sizeof(pair->out_path), "%s/%d.out",   stress.dir, index);
+    snprintf(pair->a_log,    sizeof(pair->a_log),    "%s/%d.a.log", stress.dir, index);
+    snprintf(pair->b_log,    sizeof(pair->b_log),    "%s/%d.b.log", stress.dir, index);
+
+    if(mkfifo(pair->in_path, 0600) == -1 || mkfifo(pair->out_path, 0600) == -1)
+    {
+      error_print("Failed to create fifo: %s", strerror(errno));
+
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Remove the fifos and logs of the pairs, and their directory
+ */
+static void pairs_remove(void)
+{
+  for(int index = 0; index < stress.config.pairs; index++)
+  {
+    struct pair* pair = &stress.pairs[index];
+
+    unlink(pair->in_path);
+    unlink(pair->out_path);
+    unlink(pair->a_log);
+    unlink(pair->b_log);
+  }
+
+  rmdir(stress.dir);
+}
+
+static struct argp argp = { options, opt_parse, args_doc, doc };
+
+/*
+ * This is the main function
+ *
+ * RETURN (int status)
+ * - 0 | Every check passed
+ * - 1 | A check failed, or the run could not be started
+ */
+int main(int argc, char* argv[])
+{
+  argp_parse(&argp, argc, argv, 0, 0, &stress.config);
+
+  if(!stress.config.binary) stress.config.binary = binary_find();
+
+  signal(SIGPIPE, SIG_IGN);
+
+  struct sigaction sig_action = { .sa_handler = sigint_handler };
+
+  sigaction(SIGINT, &sig_action, NULL);
+
+  int holdfds[2];
+
+  if(pipe2(holdfds, O_CLOEXEC) == -1 || (stress.nullfd = open("/dev/null", O_WRONLY | O_CLOEXEC)) == -1)
+  {
+    error_print("Failed to create pipe: %s", strerror(errno));
+
+    return 1;
+  }
+
+  // The write end is never written to, so that the stdin of procom never ends
+  stress.holdfd = holdfds[0];
+
+  snprintf(stress.dir, sizeof(stress.dir), "/tmp/procom-stress-XXXXXX");
+
+  if(!mkdtemp(stress.dir) || pairs_init() != 0) return 1;
+
+  info_print("Running %d pairs of %s for %ld s, in %s", stress.config.pairs, stress.config.binary, stress.config.duration, stress.dir);
+
+  clock_gettime(CLOCK_MONOTONIC, &stress.start);
+
+  stress.end = stress.start;
+  stress.end.tv_sec += stress.config.duration;
+
+  int started = 0;
+
+  for(; started < stress.config.pairs; started++)
+  {
+    struct pair* pair = &stress.pairs[started];
+
+    if(pthread_create(&pair->thread, NULL, pair_routine, pair) != 0) break;
+  }
+
+  // The counters of every interval are reported, until the run has ended
+  long reported = 0;
+
+  while(!stress.stop && elapsed_ms() < stress.config.duration * 1000)
+  {
+    usleep(MIN(stress.config.interval, stress.config.duration * 1000 - elapsed_ms() + 1) * 1000);
+
+    long elapsed = elapsed_ms();
+
+    if(elapsed - reported < stress.config.interval && !stress.stop && elapsed < stress.config.duration * 1000) continue;
+
+    pthread_mutex_lock(&stress.lock);
+
+    struct counters interval = stress.interval;
+
+    memset(&stress.interval, 0, sizeof(struct counters));
+
+    size_t failures = counters_failures(&stress.total);
+
+    pthread_mutex_unlock(&stress.lock);
+
+    char name[32];
+
+    snprintf(name, sizeof(name), "%ld s", elapsed / 1000);
+
+    counters_print(&interval, name, elapsed - reported);
+
+    if(failures > 0) debug_print(stderr, "STRESS", "%s: %ld failed checks", name, (long) failures);
+
+    reported = elapsed;
+  }
+
+  for(int index = 0; index < started; index++)
+  {
+    pthread_join(stress.pairs[index].thread, NULL);
+  }
+
+  counters_print(&stress.total, "total", elapsed_ms());
+
+  failures_print(&stress.total);
+
+  bool passed = (started == stress.config.pairs && counters_failures(&stress.total) == 0 && stress.total.lines > 0);
+
+  if(passed && !stress.config.keep)
+  {
+    pairs_remove();
+  }
+  else info_print("The fifos and logs are kept in %s", stress.dir);
+
+  info_print("%s", passed ? "Passed" : "Failed");
+
+  return passed ? 0 : 1;
+}